@@ -7,16 +7,35 @@
 
 #include "CPURadiosity.h"
 
+#include <cfloat>
+#include <unordered_map>
+
 namespace DTFramework
 {
 
+//split vertices de una misma superficie tienen la misma normal; los de una arista dura difieren mucho más
+const float CPURadiosity::WELD_NORMAL_COSINE = 0.999f;
+
 CPURadiosity::CPURadiosity(const D3DDevicesManager &d3d, const bool exportHemicubes, const bool enableProfiling, 
-                           const UINT verticesBakedPerDispatch, const UINT numBounces)
+                           const UINT verticesBakedPerDispatch, const UINT numBounces, const UINT numThreads, const UINT hemicubeFaceSize, 
+                           const bool halfPrecisionHemicubes, const float irradianceCacheError, const bool weldVertices)
 : 
-Radiosity(d3d, exportHemicubes, enableProfiling, verticesBakedPerDispatch, numBounces),
-m_cpuGITempData(0), m_currentPassCpuGIData(0), m_lastPassBuffer(0), m_finalGIDataBuffer(0), m_integrationTimeMinusMemCpyTime(0)
+Radiosity(d3d, exportHemicubes, enableProfiling, verticesBakedPerDispatch, numBounces, hemicubeFaceSize, true),
+m_cpuGITempData(0), m_currentPassCpuGIData(0), m_lastPassBuffer(0), m_finalGIDataBuffer(0), m_numThreads(numThreads), 
+m_nextReadbackSlot(0), m_integrationTimeMinusMemCpyTime(0), m_readbackWaitTime(0), m_irradianceCacheError(irradianceCacheError), 
+m_irradianceCacheTime(0), m_weldVertices(weldVertices), m_weldTime(0)
 {
-	
+	for(UINT i=0; i<NUM_READBACK_SLOTS; ++i) {
+		m_readbackSlots[i].texture = NULL;
+		m_readbackSlots[i].copyDone = NULL;
+		m_readbackSlots[i].vertexId = 0;
+		m_readbackSlots[i].verticesBaked = 0;
+		m_readbackSlots[i].pass = 0;
+		m_readbackSlots[i].pending = false;
+	}
+
+	if(halfPrecisionHemicubes)
+		m_hemicubeFormat = DXGI_FORMAT_R16G16B16A16_FLOAT;
 }
 
 CPURadiosity::~CPURadiosity()
@@ -24,6 +43,11 @@ CPURadiosity::~CPURadiosity()
 	SAFE_DELETE(m_lastPassBuffer);
 	SAFE_DELETE(m_finalGIDataBuffer);
 
+	for(UINT i=0; i<NUM_READBACK_SLOTS; ++i) {
+		SAFE_DELETE(m_readbackSlots[i].texture);
+		SAFE_RELEASE(m_readbackSlots[i].copyDone);
+	}
+
 	if(m_cpuGITempData) _aligned_free(m_cpuGITempData);
 	if(m_currentPassCpuGIData) _aligned_free(m_currentPassCpuGIData);
 }
@@ -39,50 +63,147 @@ HRESULT CPURadiosity::Init()
 
 	HRESULT hr;
 
+	if(FAILED(hr = InitResources())) return hr;
+
+	m_ready = true;
+
+	return S_OK;
+}
+
+HRESULT CPURadiosity::InitResources()
+{
+	HRESULT hr;
+
 	//el hardware soporta la biblioteca DirectXMath?
 	if(!DirectX::XMVerifyCPUSupport()) {
 		MiscErrorWarning(NO_SSE_SUPPORT, NULL);
 		return E_FAIL;
 	}
 
-	if(FAILED(hr = Radiosity::Init())) return hr;
-	
-	m_ready = true;
+	if(FAILED(hr = m_threadPool.Init(m_numThreads))) return hr;
+
+	if(FAILED(hr = m_integrator.Init(HEMICUBE_FACE_SIZE))) return hr;
+
+	if(m_irradianceCacheError < 0.0f || m_irradianceCacheError >= 1.0f) {
+		MiscErrorWarning(INVALID_PARAMETER, L"CPURadiosity::InitResources");
+		return E_INVALIDARG;
+	}
+
+	//Radiosity::Init no modifica m_ready
+	return Radiosity::Init();
+}
+
+HRESULT CPURadiosity::CreateHemicubeTargets()
+{
+	HRESULT hr;
+
+	if(FAILED(hr = Radiosity::CreateHemicubeTargets())) return hr;
+
+	D3D11_QUERY_DESC queryDesc;
+	queryDesc.Query = D3D11_QUERY_EVENT;
+	queryDesc.MiscFlags = 0;
+
+	for(UINT i=0; i<NUM_READBACK_SLOTS; ++i) 
+	{
+		if((m_readbackSlots[i].texture = new (std::nothrow) StagingTexture(m_d3dManager, PARENT_HEMICUBES_TEXTURE_WIDTH, FACES_PER_COLUMN * HEMICUBE_FACE_SIZE, 
+		                                                                   m_hemicubeFormat)) == NULL) 
+		{
+			MiscErrorWarning(BAD_ALLOC);
+			return E_FAIL;
+		}
+		if(FAILED(hr = m_readbackSlots[i].texture->Init())) return hr;
+
+		if(FAILED(hr = m_d3dManager.CreateQuery(&queryDesc, &m_readbackSlots[i].copyDone))) return hr;
+	}
 
 	return S_OK;
 }
 
-HRESULT CPURadiosity::ComputeGIDataForScene(Renderer &renderer, Scene &scene, Light &light)
+HRESULT CPURadiosity::BakeGIData(Renderer &renderer, Scene &scene, Light &light)
 {
 	_ASSERT(m_ready);
 
 	if(!m_ready) {
-		MiscErrorWarning(INVALID_FUNCTION_CALL, L"CPURadiosity::ComputeGIDataForScene");
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"CPURadiosity::BakeGIData");
 		return E_FAIL;
 	}
 
-	if(!scene.GetSceneMesh() || scene.GetSceneMesh()->GetTotalVertices() <= 0) {
-		MiscErrorWarning(INVALID_PARAMETER, L"CPURadiosity::ComputeGIDataForScene");
+	if(scene.GetTotalGIVertices() <= 0) {
+		MiscErrorWarning(INVALID_PARAMETER, L"CPURadiosity::BakeGIData");
 		return E_INVALIDARG;
 	}
 
 	HRESULT hr;
 
+	//las draw calls de los hemicubos no deben buscar techniques por nombre (ver CommonMaterialShader::ResolveTechniques)
+	const UINT techniqueLookups = scene.GetTechniqueLookups();
+	const UINT materialDraws = scene.GetMaterialDraws();
+	const UINT skyRequests = renderer.GetSkyTextureRequests();
+	const UINT skyRenders = renderer.GetSkyTextureRenders();
+
 	if(m_profiling) {
 		m_hemicubeRenderingTime = 0;
 		m_totalIntegrationTime = 0;
 		m_totalAlgorithmTime = 0;
 		m_integrationTimeMinusMemCpyTime = 0;
+		m_readbackWaitTime = 0;
+		m_irradianceCacheTime = 0;
+		m_weldTime = 0;
+		m_integrationStatistics.assign(m_threadPool.GetNumThreads(), ThreadPool::ThreadStatistics());
 
 		m_timer2.UpdateForGPU();
 	}
 
-	ComputeCPUAlgorithmConstants();
+	//un cálculo anterior con el mismo objeto (por ejemplo la referencia de GIBaker con -lodreport) no debe iluminar
+	//la primera pasada de éste, y su buffer final se reemplaza
+	SAFE_DELETE(m_lastPassBuffer);
+	SAFE_DELETE(m_finalGIDataBuffer);
+	m_lastPassGIDataSRV = NULL;
+	m_finalGIDataSRV = NULL;
+
+	if(FAILED(hr = PrepareCPUAlgorithmBuffers(scene.GetTotalGIVertices()))) return hr;
 
-	if(FAILED(hr = PrepareCPUAlgorithmBuffers(*(scene.GetSceneMesh())))) return hr;
+	//preparar vector de vértices GI creados en base a los vértices del vertex buffer de cada objeto
+	if(FAILED(hr = PrepareGIVerticesVector(scene))) return hr;
 
-	//preparar vector de vértices GI creados en base a los vértices del vertex buffer
-	if(FAILED(hr = PrepareGIVerticesVector(*(scene.GetSceneMesh())))) return hr;
+	//con caché de irradiancia sólo se renderizan los hemicubos de las muestras, y sin él uno por grupo de vértices soldados
+	m_bakedVertices.clear();
+	m_weldCluster.clear();
+
+	if(UsesIrradianceCache()) 
+	{
+		if(m_profiling)
+			m_timer.Update();
+
+		if(FAILED(hr = m_irradianceCache.SelectSamples(m_vertices, m_irradianceCacheError))) return hr;
+
+		try 
+		{
+			m_bakedVertices = m_irradianceCache.GetSamples();
+		}
+		catch (std::bad_alloc &) 
+		{
+			MiscErrorWarning(BAD_ALLOC);
+			return E_FAIL;
+		}
+
+		if(m_profiling) {
+			m_timer.Update();
+			m_irradianceCacheTime += m_timer.GetTimeElapsed();
+		}
+	}
+	else if(m_weldVertices) 
+	{
+		if(m_profiling)
+			m_timer.Update();
+
+		if(FAILED(hr = WeldVertices())) return hr;
+
+		if(m_profiling) {
+			m_timer.Update();
+			m_weldTime += m_timer.GetTimeElapsed();
+		}
+	}
 
 	//las pasadas, o iteraciones, representan el numero de veces que calculamos el rebote de la luz. Desde que sale de su origen.
 	const bool showSky =  scene.ShowSky();
@@ -93,15 +214,18 @@ HRESULT CPURadiosity::ComputeGIDataForScene(Renderer &renderer, Scene &scene, Li
 		if(!showSky && pass == 0) continue;	//no consideramos a la luz del skybox para el GI si no hay cielo en la escena
 
 		if(FAILED(hr = ProcessScene(renderer, scene, light, pass))) return hr;
+
+		//la próxima pasada necesita la irradiancia de todos los vértices de esta
+		if(FAILED(hr = IntegratePendingReadbacks())) return hr;
 		
 		if(pass < numPasses-1) 
 		{
 			// copiamos a un buffer en memoria de video los datos del último pass (porque los necesitamos para la próxima renderización de hemicubos)
-			const Mesh &mesh = *(scene.GetSceneMesh());
+			const UINT numGIVertices = scene.GetTotalGIVertices();
 
 			SAFE_DELETE(m_lastPassBuffer);
 				
-			if((m_lastPassBuffer = new (std::nothrow) ImmutableBuffer(m_d3dManager, mesh.GetTotalVertices() * 16, mesh.GetTotalVertices(), 
+			if((m_lastPassBuffer = new (std::nothrow) ImmutableBuffer(m_d3dManager, numGIVertices * 16, numGIVertices, 
 			                                                          (void *) m_currentPassCpuGIData, DXGI_FORMAT_R32G32B32A32_FLOAT)) == NULL) 
 			{
 				MiscErrorWarning(BAD_ALLOC);
@@ -114,9 +238,9 @@ HRESULT CPURadiosity::ComputeGIDataForScene(Renderer &renderer, Scene &scene, Li
 		else	
 		{
 			//en el ultimo pass guardar el finalsrv (que está en m_cpuGITempData)
-			const Mesh &mesh = *(scene.GetSceneMesh());
+			const UINT numGIVertices = scene.GetTotalGIVertices();
 
-			if((m_finalGIDataBuffer = new (std::nothrow) ImmutableBuffer(m_d3dManager, mesh.GetTotalVertices() * 16, mesh.GetTotalVertices(), 
+			if((m_finalGIDataBuffer = new (std::nothrow) ImmutableBuffer(m_d3dManager, numGIVertices * 16, numGIVertices, 
 			                                                             (void *) m_cpuGITempData, DXGI_FORMAT_R32G32B32A32_FLOAT)) == NULL)
 			{
 				MiscErrorWarning(BAD_ALLOC);
@@ -134,110 +258,431 @@ HRESULT CPURadiosity::ComputeGIDataForScene(Renderer &renderer, Scene &scene, Li
 
 		m_outputFile << "RESULTS:" << endl << endl;
 		m_outputFile << "Vertices in Scene:\t\t\t\t\t\t" << m_vertices.size() << endl;
+		m_outputFile << "Scene Objects:\t\t\t\t\t\t\t" << scene.GetNumObjects() << " (" << scene.GetNumMeshes() << " meshes)" << endl;
+
+		//una vez por mesh: los objetos que la comparten usan los mismos buffers
+		for(UINT i=0; i<scene.GetNumMeshes(); ++i) 
+		{
+			const Mesh &mesh = *(scene.GetMesh(i));
+
+			VertexCacheStatistics cacheBefore, cacheAfter;
+			mesh.GetVertexCacheStatistics(cacheBefore, cacheAfter);
+
+			m_outputFile << "Mesh Vertex Cache ACMR/ATVR:\t\t\t\t\t\t" << cacheBefore.acmr << " / " << cacheBefore.atvr << " (optimized: "
+			             << cacheAfter.acmr << " / " << cacheAfter.atvr << ")" << endl;
+			m_outputFile << "Mesh Vertex Format:\t\t\t\t\t\t\t" << (mesh.UsesCompactVertices() ? "compact, " : "float, ") << mesh.GetVertexStride()
+			             << " bytes per vertex (" << static_cast<double>(mesh.GetTotalVertices()) * mesh.GetVertexStride() / (1024.0 * 1024.0) << " MB)" << endl;
+
+			if(mesh.IsChunked()) {
+				MeshStreamingStatistics streaming;
+				mesh.GetStreamingStatistics(streaming);
+
+				m_outputFile << "Mesh Clusters Streamed:\t\t\t\t\t\t" << mesh.GetNumClusters() << " clusters, " << streaming.clustersStreamed << " uploads, "
+				             << streaming.evictions << " evictions, " << streaming.bytesStreamed / (1024.0 * 1024.0) << " MB streamed" << endl;
+				m_outputFile << "Mesh Resident Memory:\t\t\t\t\t" << streaming.residentBytes / (1024.0 * 1024.0) << " MB (peak "
+				             << streaming.peakResidentBytes / (1024.0 * 1024.0) << " MB)" << endl;
+			}
+		}
+		//el presupuesto es uno solo para todas las meshes por partes
+		if(scene.GetMeshResidency().GetNumCaches() > 0) {
+			const MeshResidencyBudget &residency = scene.GetMeshResidency();
+
+			m_outputFile << "Scene Resident Memory:\t\t\t\t\t" << residency.GetResidentBytes() / (1024.0 * 1024.0) << " MB (peak "
+			             << residency.GetPeakResidentBytes() / (1024.0 * 1024.0) << " MB, budget " << residency.GetBudgetBytes() / (1024.0 * 1024.0) 
+			             << " MB, " << residency.GetNumCaches() << " chunked meshes)" << endl;
+		}
+		if(scene.GetClustersDrawn() + scene.GetClustersCulled() > 0)
+			m_outputFile << "Clusters Drawn/Culled:\t\t\t\t\t" << scene.GetClustersDrawn() << " / " << scene.GetClustersCulled() << endl;
+		if(scene.GetLODFullDetailTriangles() > 0)
+			m_outputFile << "LOD Triangles Drawn:\t\t\t\t\t" << scene.GetLODTrianglesDrawn() << " of " << scene.GetLODFullDetailTriangles() << " ("
+			             << 100.0 * scene.GetLODTrianglesDrawn() / scene.GetLODFullDetailTriangles() << "%, max error " << GetLODTexelError() << " texels)" << endl;
+		m_outputFile << "Hemicube Format:\t\t\t\t\t\t" << (m_hemicubeFormat == DXGI_FORMAT_R16G16B16A16_FLOAT ? "float16" : "float32") << endl;
+		if(UsesIrradianceCache()) {
+			m_outputFile << "Irradiance Cache Samples:\t\t\t\t\t" << GetNumBakedVertices() << " (" << 100.0 * GetNumBakedVertices() / m_vertices.size() 
+			             << "% of the vertices, error " << m_irradianceCacheError << ", " << m_irradianceCache.GetRefinements() << " refinements)" << endl;
+			m_outputFile << "Irradiance Cache Time:\t\t\t\t\t\t" << m_irradianceCacheTime << " seconds." << endl;
+		}
+		if(UsesWelding()) {
+			m_outputFile << "Welded Vertices:\t\t\t\t\t\t" << GetNumBakedVertices() << " unique of " << m_vertices.size() << " (dedup ratio " 
+			             << m_vertices.size() / (double) max((UINT) 1, GetNumBakedVertices()) << ")" << endl;
+			m_outputFile << "Vertex Welding Time:\t\t\t\t\t\t" << m_weldTime << " seconds." << endl;
+		}
+		m_outputFile << "Hemicube Face Size:\t\t\t\t\t\t" << HEMICUBE_FACE_SIZE << " (" << VERTICES_BAKED_PER_DISPATCH << " vertices per dispatch)" << endl;
 		m_outputFile << "Hemicubes' Total Rendering Time:\t\t\t\t" << m_hemicubeRenderingTime << " seconds." << endl;
 		m_outputFile << "Hemicubes' Total Integration Time:\t\t\t\t" << m_totalIntegrationTime << " seconds." << endl;
 		m_outputFile << "Hemicubes' Total Integration Time Minus Memory Transfer:\t" << m_integrationTimeMinusMemCpyTime << " seconds." << endl;
+		m_outputFile << "Hemicubes' Readback Wait Time:\t\t\t\t\t" << m_readbackWaitTime << " seconds." << endl;
 		m_outputFile << "Radiosity Algorithm Total Time:\t\t\t\t\t" << m_totalAlgorithmTime << " seconds." << endl;
+		m_outputFile << "Technique Lookups While Baking:\t\t\t\t\t" << scene.GetTechniqueLookups() - techniqueLookups << " ("
+		             << scene.GetMaterialDraws() - materialDraws << " material draws)" << endl;
+		m_outputFile << "Sky Textures Generated:\t\t\t\t\t\t" << renderer.GetSkyTextureRenders() - skyRenders << " of " 
+		             << renderer.GetSkyTextureRequests() - skyRequests << " skyboxes rendered" << endl;
+
+		m_outputFile << endl << "Integration Kernel:\t\t\t\t\t\t" << HemicubeIntegrator::GetKernelName(m_integrator.GetKernel()) 
+		             << (m_integrator.IsKernelSpecialized() ? " (specialized)" : " (generic)") << endl;
+		m_outputFile << "Integration Threads:\t\t\t\t\t\t" << m_integrationStatistics.size() << endl;
+		for(UINT i=0; i<m_integrationStatistics.size(); ++i) {
+			m_outputFile << "Integration Thread " << i << ":\t\t\t\t\t\t" << m_integrationStatistics[i].busyTime << " seconds, " 
+			             << m_integrationStatistics[i].tasks << " vertices, " << m_integrationStatistics[i].steals << " steals." << endl;
+		}
 	}
 
 	return S_OK;
 }
 
 
-HRESULT CPURadiosity::IntegrateHemicubeRadiance(const UINT vertexId, const UINT verticesBaked, const UINT pass)
+//------------------------------------------------------------------------------------------
+// Con caché de irradiancia, al terminar las pasadas del cielo y de la luz directa (las de
+// cambios más bruscos: sombras y oclusión) se agregan muestras donde la irradiancia varía más
+// de lo tolerado y se renderizan sólo esas, hasta que no haya más. Las pasadas siguientes
+// usan las mismas muestras. Luego se interpolan los vértices restantes (o, con vértices
+// soldados, se copia la irradiancia de cada grupo a todos sus vértices).
+//------------------------------------------------------------------------------------------
+HRESULT CPURadiosity::ProcessScene(Renderer &renderer, Scene &scene, Light &light, const UINT pass)
 {
 	HRESULT hr;
 
+	if(FAILED(hr = Radiosity::ProcessScene(renderer, scene, light, pass))) return hr;
+
+	if(!UsesIrradianceCache() && !UsesWelding())
+		return S_OK;
+
+	//la interpolación necesita la irradiancia de todas las muestras de esta pasada
+	if(FAILED(hr = IntegratePendingReadbacks())) return hr;
+
+	while(UsesIrradianceCache() && pass <= 1) 
+	{
+		const UINT firstNewSample = GetNumBakedVertices();
+		UINT newSamples;
+
+		if(m_profiling)
+			m_timer.Update();
+
+		if(FAILED(hr = m_irradianceCache.Refine(m_vertices, m_currentPassCpuGIData, newSamples))) return hr;
+
+		if(m_profiling) {
+			m_timer.Update();
+			m_irradianceCacheTime += m_timer.GetTimeElapsed();
+		}
+
+		if(newSamples == 0) break;
+
+		try 
+		{
+			m_bakedVertices.insert(m_bakedVertices.end(), m_irradianceCache.GetSamples().begin() + firstNewSample, m_irradianceCache.GetSamples().end());
+		}
+		catch (std::bad_alloc &) 
+		{
+			MiscErrorWarning(BAD_ALLOC);
+			return E_FAIL;
+		}
+
+		for(UINT i=firstNewSample; i<GetNumBakedVertices(); i += VERTICES_BAKED_PER_DISPATCH) {
+			if(FAILED(hr = ProcessVertex(renderer, scene, light, pass, i))) return hr;
+		}
+
+		if(FAILED(hr = IntegratePendingReadbacks())) return hr;
+	}
+
+	CompleteUnbakedVertices();
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// El cargador de OBJ separa una posición en varios vértices cuando cambian las coordenadas de
+// textura o la normal. Los que comparten posición y tienen casi la misma normal ven la misma
+// escena desde el mismo punto: se renderiza el hemicubo del primero de cada grupo y el 
+// resultado se copia a los demás. Las posiciones se cuantizan con 2^20 pasos por la diagonal
+// de la caja que contiene a la escena y se buscan con una tabla hash de celdas.
+//------------------------------------------------------------------------------------------
+HRESULT CPURadiosity::WeldVertices()
+{
+	const UINT numVertices = static_cast<UINT>(m_vertices.size());
+
+	D3DXVECTOR3 minimum(FLT_MAX, FLT_MAX, FLT_MAX);
+	D3DXVECTOR3 maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(UINT i=0; i<numVertices; ++i) {
+		D3DXVec3Minimize(&minimum, &minimum, &m_vertices[i].position);
+		D3DXVec3Maximize(&maximum, &maximum, &m_vertices[i].position);
+	}
+
+	const D3DXVECTOR3 extent = maximum - minimum;
+	float diagonal = numVertices > 0 ? D3DXVec3Length(&extent) : 0.0f;
+	if(diagonal <= 0.0f) diagonal = 1.0f;
+
+	const float quantum = diagonal / (1 << WELD_POSITION_BITS);
+
+	try 
+	{
+		//primer grupo de cada celda y siguiente grupo en la misma celda
+		std::unordered_map<UINT64, UINT> cells;
+		vector<UINT> nextInCell;
+
+		cells.reserve(numVertices);
+		m_weldCluster.resize(numVertices);
+
+		for(UINT v=0; v<numVertices; ++v) 
+		{
+			const GIVertex &vertex = m_vertices[v];
+
+			const UINT64 mask = (1ULL << (WELD_POSITION_BITS + 1)) - 1;
+			const UINT64 x = static_cast<UINT64>((vertex.position.x - minimum.x) / quantum + 0.5f) & mask;
+			const UINT64 y = static_cast<UINT64>((vertex.position.y - minimum.y) / quantum + 0.5f) & mask;
+			const UINT64 z = static_cast<UINT64>((vertex.position.z - minimum.z) / quantum + 0.5f) & mask;
+			const UINT64 key = x | (y << (WELD_POSITION_BITS + 1)) | (z << (2 * (WELD_POSITION_BITS + 1)));
+
+			const std::unordered_map<UINT64, UINT>::iterator cell = cells.find(key);
+
+			UINT cluster = NOT_WELDED;
+			for(UINT c=(cell == cells.end() ? NOT_WELDED : cell->second); c!=NOT_WELDED && cluster==NOT_WELDED; c=nextInCell[c]) {
+				if(D3DXVec3Dot(&vertex.normal, &m_vertices[m_bakedVertices[c]].normal) >= WELD_NORMAL_COSINE)
+					cluster = c;
+			}
+
+			if(cluster == NOT_WELDED) {
+				cluster = static_cast<UINT>(m_bakedVertices.size());
+				m_bakedVertices.push_back(v);
+				nextInCell.push_back(cell == cells.end() ? NOT_WELDED : cell->second);
+				cells[key] = cluster;
+			}
+
+			m_weldCluster[v] = cluster;
+		}
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+void CPURadiosity::CompleteUnbakedVertices()
+{
+	if(!UsesIrradianceCache() && !UsesWelding())
+		return;
+
 	if(m_profiling)
 		m_timer.Update();
 
-	DirectX::XMVECTOR vertexIrradiance;
+	CompleteUnbakedVertices(m_currentPassCpuGIData, m_cpuGITempData);
 
-	//copiar el radiance map a un staging buffer para poder leerlo desde la CPU
-	StagingTexture stagingTex(m_d3dManager, PARENT_HEMICUBES_TEXTURE_WIDTH, FACES_PER_COLUMN * HEMICUBE_FACE_SIZE, DXGI_FORMAT_R32G32B32A32_FLOAT);
-	if(FAILED(hr = stagingTex.Init())) return hr;
+	if(m_profiling) {
+		m_timer.Update();
+		if(UsesIrradianceCache())
+			m_irradianceCacheTime += m_timer.GetTimeElapsed();
+		else
+			m_weldTime += m_timer.GetTimeElapsed();
+	}
+}
 
+void CPURadiosity::CompleteUnbakedVertices(DirectX::XMVECTOR * const irradiance, DirectX::XMVECTOR * const total) const
+{
+	if(UsesIrradianceCache()) {
+		m_irradianceCache.Interpolate(irradiance, total);
+		return;
+	}
+
+	if(!UsesWelding())
+		return;
+
+	const UINT numVertices = static_cast<UINT>(m_weldCluster.size());
+
+	for(UINT v=0; v<numVertices; ++v) 
+	{
+		const UINT representative = m_bakedVertices[m_weldCluster[v]];
+		if(representative == v) continue;
+
+		irradiance[v] = irradiance[representative];
+		total[v] = DirectX::XMVectorAdd(total[v], irradiance[v]);
+	}
+}
+
+HRESULT CPURadiosity::IntegrateHemicubeRadiance(const UINT vertexId, const UINT verticesBaked, const UINT pass)
+{
+	ReadbackSlot &slot = m_readbackSlots[m_nextReadbackSlot];
+
+	//el slot se integra antes de avanzar al siguiente, así que siempre está libre
+	_ASSERT(!slot.pending);
+
+	//copiar el radiance map a un staging texture para poder leerlo desde la CPU. La copia y el evento quedan
+	//encolados detrás de la renderización del lote; no esperamos a que terminen
 	ID3D11Resource *pRes = NULL;
 	m_hemiCubes->GetColorTexture()->GetResource(&pRes);
 
-	m_d3dManager.CopyResource( stagingTex.GetTexture(), pRes );
+	m_d3dManager.CopyResource(slot.texture->GetTexture(), pRes);
+	m_d3dManager.End(slot.copyDone);
 
-	//map
-	D3D11_MAPPED_SUBRESOURCE mapped;
-	if(FAILED(hr = m_d3dManager.Map(stagingTex.GetTexture(), 0, D3D11_MAP_READ, 0, &mapped))) {
-		SAFE_RELEASE(pRes);
-		return hr;
+	SAFE_RELEASE(pRes);
+
+	slot.vertexId = vertexId;
+	slot.verticesBaked = verticesBaked;
+	slot.pass = pass;
+	slot.pending = true;
+
+	m_nextReadbackSlot = (m_nextReadbackSlot + 1) % NUM_READBACK_SLOTS;
+
+	//integrar el lote más viejo mientras la GPU procesa este
+	ReadbackSlot &oldest = m_readbackSlots[m_nextReadbackSlot];
+	if(oldest.pending)
+		return IntegrateReadbackSlot(oldest);
+
+	return S_OK;
+}
+
+HRESULT CPURadiosity::IntegratePendingReadbacks()
+{
+	HRESULT hr;
+
+	for(UINT i=0; i<NUM_READBACK_SLOTS; ++i) 
+	{
+		ReadbackSlot &slot = m_readbackSlots[(m_nextReadbackSlot + i) % NUM_READBACK_SLOTS];
+
+		if(slot.pending)
+			if(FAILED(hr = IntegrateReadbackSlot(slot))) return hr;
 	}
 
-	const float *rawMapData = reinterpret_cast<float *>(mapped.pData);
+	return S_OK;
+}
+
+HRESULT CPURadiosity::IntegrateReadbackSlot(ReadbackSlot &slot)
+{
+	HRESULT hr;
+
+	if(m_profiling)
+		m_timer.Update();
+
+	//esperar a que la GPU termine la copia. GetData sin D3D11_ASYNC_GETDATA_DONOTFLUSH además envía a la GPU los
+	//comandos encolados (la renderización del lote siguiente), que se ejecutan mientras integramos este
+	while((hr = m_d3dManager.GetData(slot.copyDone, NULL, 0, 0)) == S_FALSE)
+		SwitchToThread();
+
+	if(FAILED(hr)) {
+		DXGI_D3D_ErrorWarning(hr, L"CPURadiosity::IntegrateReadbackSlot --> GetData");
+		return hr;
+	}
 
 	if(m_profiling) {
 		m_timer.Update();
+		m_readbackWaitTime += m_timer.GetTimeElapsed();
 		m_totalIntegrationTime += m_timer.GetTimeElapsed();
 	}
 
+	//map (la copia ya terminó: no bloquea)
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if(FAILED(hr = m_d3dManager.Map(slot.texture->GetTexture(), 0, D3D11_MAP_READ, 0, &mapped))) return hr;
 
-	if(m_exportHemicubes)
-		ExportHemicubeFaces(rawMapData, vertexId, pass);
+	const BYTE *rawMapData = reinterpret_cast<BYTE *>(mapped.pData);
 
-	//calcular irradiancia para los vertices a partir de sus radiancias sacadas del staging texture
-	for(UINT i=0; i<verticesBaked; ++i)
-	{
-		vertexIrradiance = DirectX::XMVectorReplicate(0.0f);
-		for(UINT j=0; j<NUM_HEMICUBE_FACES; ++j) 
-		{
-			for(UINT k=0; k<HEMICUBE_FACE_SIZE; ++k)	//coordenada v
-			{
-				if(j == 3 && k < HEMICUBE_FACE_SIZE / 2) continue;	//+y
-				if(j == 4 && k >= HEMICUBE_FACE_SIZE / 2) break;	//-y
-
-				for(UINT f=0; f<HEMICUBE_FACE_SIZE; ++f)	//coordenada u
-				{
-					if(j == 1 && f >= HEMICUBE_FACE_SIZE / 2) break;	//+x
-					if(j == 2 && f < HEMICUBE_FACE_SIZE / 2) continue;	//-x
+	if(m_profiling) {
+		m_timer.Update();
+		m_totalIntegrationTime += m_timer.GetTimeElapsed();
+	}
 
-					const UINT faceNumber = i * NUM_HEMICUBE_FACES + j;
-					const UINT faceRow = faceNumber / FACES_PER_ROW;
-					const UINT faceCol = faceNumber % FACES_PER_ROW;
+	if(m_exportHemicubes) {
+		if(m_hemicubeFormat == DXGI_FORMAT_R16G16B16A16_FLOAT)
+			ExportHalfHemicubeFaces(rawMapData, mapped.RowPitch, slot.vertexId, slot.pass);
+		else
+			ExportHemicubeFaces(reinterpret_cast<const float *>(rawMapData), slot.vertexId, slot.pass);
+	}
 
-					const UINT index = ((faceCol * HEMICUBE_FACE_SIZE + f)  +  k * PARENT_HEMICUBES_TEXTURE_WIDTH + faceRow * HEMICUBE_FACE_SIZE * PARENT_HEMICUBES_TEXTURE_WIDTH) * 4;
+	IntegrateHemicubes(rawMapData, mapped.RowPitch, slot.vertexId, slot.verticesBaked);
 
-					DirectX::XMVECTOR pixelRadiance = DirectX::XMVectorSet(rawMapData[index], rawMapData[index+1], rawMapData[index+2], 0.0f);
+	m_d3dManager.Unmap(slot.texture->GetTexture(), 0);
 
-					const DirectX::XMVECTOR weight = DirectX::XMVectorReplicate(m_weights[j == 0 ? 0 : 1][j <= 2 ? k : f][j <= 2 ? f : k]);
+	slot.pending = false;
 
-					//al multiplicarlo por el delta form factor la radiancia se convierte en irradiancia
-					pixelRadiance = DirectX::XMVectorMultiply(pixelRadiance, weight);
-						
-					vertexIrradiance = DirectX::XMVectorAdd(vertexIrradiance, pixelRadiance);
-				}
-			}
-		}
-		
-		vertexIrradiance = DirectX::XMVectorMultiply(vertexIrradiance, DirectX::XMVectorReplicate(m_giCalcConstants.vertexWeight));
+	return S_OK;
+}
 
-		//guardamos la vertexIrradiance en un bufer de cpu indexado por el vertexId y el object id
-		m_currentPassCpuGIData[vertexId + i] = vertexIrradiance;
+void CPURadiosity::IntegrateHemicubes(const void * const hemicubeData, const UINT rowPitch, const UINT vertexId, const UINT verticesBaked)
+{
+	if(m_profiling)
+		m_timer.Update();
 
-		//suma parcial (al final quedará la total aquí de manera que no necesitamos un método AddPassesCPU)
-		m_cpuGITempData[vertexId + i] = DirectX::XMVectorAdd(m_cpuGITempData[vertexId + i], vertexIrradiance);
-	}
+	//los vértices son independientes. Cada hilo escribe en un rango contiguo de m_currentPassCpuGIData y m_cpuGITempData (salvo con caché de irradiancia)
+	m_threadPool.ParallelFor(verticesBaked, [&](const UINT i, const UINT thread) {
+		IntegrateVertex(reinterpret_cast<const BYTE *>(hemicubeData), rowPitch, i, GetBakedVertex(vertexId + i));
+	}, INTEGRATION_GRAIN_SIZE);
 	
 	if(m_profiling) {
 		m_timer.Update();
 
 		m_integrationTimeMinusMemCpyTime += m_timer.GetTimeElapsed();
 		m_totalIntegrationTime += m_timer.GetTimeElapsed();
+
+		for(UINT i=0; i<m_integrationStatistics.size(); ++i) {
+			const ThreadPool::ThreadStatistics &statistics = m_threadPool.GetLastRunStatistics(i);
+
+			m_integrationStatistics[i].tasks += statistics.tasks;
+			m_integrationStatistics[i].steals += statistics.steals;
+			m_integrationStatistics[i].busyTime += statistics.busyTime;
+		}
 	}
+}
 
-	m_d3dManager.Unmap(stagingTex.GetTexture(), 0);
+//calcular irradiancia para el vertice a partir de sus radiancias
+void CPURadiosity::IntegrateVertex(const BYTE * const hemicubeData, const UINT rowPitch, const UINT slot, const UINT vertex)
+{
+	const bool halfPrecision = m_hemicubeFormat == DXGI_FORMAT_R16G16B16A16_FLOAT;
+	const UINT texelSize = halfPrecision ? 4 * sizeof(UINT16) : 4 * sizeof(float);
 
-	SAFE_RELEASE(pRes);
+	const BYTE *faces[NUM_HEMICUBE_FACES];
 
-	return S_OK;
+	for(UINT j=0; j<NUM_HEMICUBE_FACES; ++j) 
+	{
+		const UINT faceNumber = GetFaceTile(slot, j);
+		const UINT faceRow = faceNumber / FACES_PER_ROW;
+		const UINT faceCol = faceNumber % FACES_PER_ROW;
+
+		faces[j] = hemicubeData + faceRow * HEMICUBE_FACE_SIZE * rowPitch + faceCol * HEMICUBE_FACE_SIZE * texelSize;
+	}
+
+	DirectX::XMFLOAT4A irradiance;
+	if(halfPrecision)
+		m_integrator.IntegrateHalf(reinterpret_cast<const UINT16 * const *>(faces), rowPitch / sizeof(UINT16), &irradiance.x);
+	else
+		m_integrator.Integrate(reinterpret_cast<const float * const *>(faces), rowPitch / sizeof(float), &irradiance.x);
+
+	DirectX::XMVECTOR vertexIrradiance = DirectX::XMLoadFloat4A(&irradiance);
+	
+	vertexIrradiance = DirectX::XMVectorMultiply(vertexIrradiance, DirectX::XMVectorReplicate(m_giCalcConstants.vertexWeight));
+
+	//guardamos la vertexIrradiance en un bufer de cpu indexado por el vertexId y el object id
+	m_currentPassCpuGIData[vertex] = vertexIrradiance;
+
+	//suma parcial (al final quedará la total aquí de manera que no necesitamos un método AddPassesCPU)
+	m_cpuGITempData[vertex] = DirectX::XMVectorAdd(m_cpuGITempData[vertex], vertexIrradiance);
+}
+
+void CPURadiosity::ExportHalfHemicubeFaces(const BYTE * const hemicubeData, const UINT rowPitch, const UINT vertexId, const UINT pass) const
+{
+	_ASSERT(hemicubeData);
+
+	//ExportHemicubeFaces espera float4 sin relleno al final de cada fila
+	const UINT rowTexels = PARENT_HEMICUBES_TEXTURE_WIDTH;
+	const UINT numRows = FACES_PER_COLUMN * HEMICUBE_FACE_SIZE;
+
+	vector<float> floatData;
+	try 
+	{
+		floatData.resize(rowTexels * numRows * 4);
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return;
+	}
+
+	for(UINT y=0; y<numRows; ++y)
+		HemicubeIntegrator::HalfToFloat(reinterpret_cast<const UINT16 *>(hemicubeData + y * rowPitch), &floatData[y * rowTexels * 4], rowTexels * 4);
+
+	ExportHemicubeFaces(&floatData[0], vertexId, pass);
 }
 
-HRESULT CPURadiosity::PrepareCPUAlgorithmBuffers(const Mesh &sceneMesh)
+HRESULT CPURadiosity::PrepareCPUAlgorithmBuffers(const UINT numGIVertices)
 {
 	//borrar buffers anteriores
 	if(m_cpuGITempData) _aligned_free(m_cpuGITempData);
@@ -247,44 +692,17 @@ HRESULT CPURadiosity::PrepareCPUAlgorithmBuffers(const Mesh &sceneMesh)
 	m_currentPassCpuGIData = NULL;
 
 	//reservar memoria con alineación de 16 bytes según lo requerido por la biblioteca DirectXMath
-	m_cpuGITempData = (DirectX::XMVECTOR *) _aligned_malloc(sizeof(DirectX::XMVECTOR) * sceneMesh.GetTotalVertices(), 16);
-	m_currentPassCpuGIData = (DirectX::XMVECTOR *) _aligned_malloc(sizeof(DirectX::XMVECTOR) * sceneMesh.GetTotalVertices(), 16);
+	m_cpuGITempData = (DirectX::XMVECTOR *) _aligned_malloc(sizeof(DirectX::XMVECTOR) * numGIVertices, 16);
+	m_currentPassCpuGIData = (DirectX::XMVECTOR *) _aligned_malloc(sizeof(DirectX::XMVECTOR) * numGIVertices, 16);
 
 	if(!m_cpuGITempData || !m_currentPassCpuGIData) {
 		MiscErrorWarning(BAD_ALIGNED_ALLOC);
 		return E_FAIL;
 	}
 
-	ZeroMemory(m_cpuGITempData, 16 * sceneMesh.GetTotalVertices());
+	ZeroMemory(m_cpuGITempData, 16 * numGIVertices);
 
 	return S_OK;
 }
 
-void CPURadiosity::ComputeCPUAlgorithmConstants()
-{
-	if(m_profiling)
-		m_timer.Update();
-
-	//calcular datos que se usan repetidamente en el algoritmo
-
-	//coordenadas u,v
-	for(UINT i=0; i<HEMICUBE_FACE_SIZE; ++i)
-		m_uvFunction[i] = (static_cast<float>(i) / static_cast<float>(HEMICUBE_FACE_SIZE-1)) * 2.0f - 1.0f;
-	
-	//delta form factors
-	for(UINT i=0; i<HEMICUBE_FACE_SIZE; ++i) {  //coordenada v
-		for(UINT j=0; j<HEMICUBE_FACE_SIZE; ++j) { //coordenada u
-			float tmp = 1.0f + m_uvFunction[i] * m_uvFunction[i] + m_uvFunction[j] * m_uvFunction[j];
-			tmp = tmp * tmp * (float) D3DX_PI;
-			m_weights[0][i][j] = 1.0f / tmp;	//+z
-			m_weights[1][i][j] = abs(m_uvFunction[j]) / tmp;	//las otras 4 caras
-		}
-	}
-
-	if(m_profiling) {
-		m_timer.Update();
-		m_totalIntegrationTime += m_timer.GetTimeElapsed();
-	}
-}
-
 }
\ No newline at end of file
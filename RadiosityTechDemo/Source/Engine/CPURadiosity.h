@@ -4,7 +4,13 @@
 // Esta clase implementa el algoritmo de radiosidad para su ejecución en una CPU.
 // Computa el término de iluminación global para el cálculo del color
 // final de cada pixel de la escena. Los datos tienen una densidad por vértice.
-// Los cálculos aritméticos utilizan la biblioteca DirectXMath.
+// Los cálculos aritméticos utilizan la biblioteca DirectXMath. La integración de los
+// hemicubos se reparte entre todos los núcleos del procesador y se solapa con la
+// renderización: mientras la GPU renderiza el lote N la CPU integra el lote N-1.
+// Con irradianceCacheError > 0 sólo se renderizan los hemicubos de las muestras de un
+// IrradianceCache; los demás vértices se interpolan al terminar cada pasada. Sin caché, los
+// vértices que el cargador de OBJ separa por coordenadas de textura o normales distintas pero
+// que comparten posición y normal se integran una sola vez (weldVertices).
 // 
 // Author: Gabriel Clavero
 //------------------------------------------------------------------------------------------
@@ -13,6 +19,9 @@
 #define CPU_RADIOSITY_H
 
 #include "Radiosity.h"
+#include "ThreadPool.h"
+#include "HemicubeIntegrator.h"
+#include "IrradianceCache.h"
 #include <DirectXMath.h>
 
 namespace DTFramework
@@ -21,21 +30,92 @@ namespace DTFramework
 class CPURadiosity : public Radiosity
 {
 public:
-	CPURadiosity(const D3DDevicesManager &d3d, const bool exportHemicubes=false, const bool enableProfiling=false, const UINT verticesBakedPerDispatch=256, const UINT numBounces=2);
+	//numThreads == 0 => un hilo por núcleo lógico. Usa el atlas de hemicubos compacto. halfPrecisionHemicubes: renderizar
+	//los hemicubos en DXGI_FORMAT_R16G16B16A16_FLOAT (la mitad de memoria y de lectura, con algo de error en la irradiancia).
+	//irradianceCacheError en (0, 1): renderizar sólo las muestras del caché de irradiancia con ese error máximo (a de Ward). 0 => todos los vértices.
+	//weldVertices: renderizar un solo hemicubo por grupo de vértices con la misma posición y normal (el caché de irradiancia ya los agrupa)
+	CPURadiosity(const D3DDevicesManager &d3d, const bool exportHemicubes=false, const bool enableProfiling=false, const UINT verticesBakedPerDispatch=256, 
+	             const UINT numBounces=2, const UINT numThreads=0, const UINT hemicubeFaceSize=DEFAULT_HEMICUBE_FACE_SIZE, 
+	             const bool halfPrecisionHemicubes=false, const float irradianceCacheError=0.0f, const bool weldVertices=true);
 	virtual ~CPURadiosity();
 
-	//sólo debe llamarse a lo sumo una vez por objeto
+	//sólo debe llamarse a lo sumo una vez por objeto. Las clases derivadas agregan su inicialización en InitResources
 	virtual HRESULT Init();
-	
-	//calcula datos de iluminación indirecta dado un renderizador, una escena y una luz
-	virtual HRESULT ComputeGIDataForScene(Renderer &renderer, Scene &scene, Light &light);
 
 protected:
-	void ComputeCPUAlgorithmConstants();
-	HRESULT PrepareCPUAlgorithmBuffers(const Mesh &sceneMesh);
+	virtual HRESULT BakeGIData(Renderer &renderer, Scene &scene, Light &light);
+
+	//crea todo lo que necesita el algoritmo sin modificar m_ready (lo asigna sólo Init). Las clases derivadas deben llamar
+	//primero a la de la clase base, igual que con CreateHemicubeTargets
+	virtual HRESULT InitResources();
+
+	HRESULT PrepareCPUAlgorithmBuffers(const UINT numGIVertices);
+
+	virtual float GetIrradianceCacheError() const;
+	virtual bool WeldsVertices() const;
+
+	virtual HRESULT CreateHemicubeTargets();
+
+	//con caché de irradiancia, refina las muestras en las pasadas del cielo y de la luz directa. Luego completa los vértices no renderizados
+	virtual HRESULT ProcessScene(Renderer &renderer, Scene &scene, Light &light, const UINT pass);
 
+	//agrupa los vértices con la misma posición cuantizada y casi la misma normal. m_bakedVertices queda con el primero de cada grupo
+	HRESULT WeldVertices();
+
+	//completa m_currentPassCpuGIData (y suma a m_cpuGITempData) en los vértices no renderizados: los interpola del caché de
+	//irradiancia o copia el de su grupo
+	void CompleteUnbakedVertices();
+	void CompleteUnbakedVertices(DirectX::XMVECTOR * const irradiance, DirectX::XMVECTOR * const total) const;
+
+	//posición en m_bakedVertices del vértice renderizado que representa a vertex (sólo para vértices renderizados o soldados)
+	UINT GetBakedPosition(const UINT vertex) const;
+
+	bool UsesIrradianceCache() const;
+	bool UsesWelding() const;
+
+	//encola la copia del lote recién renderizado e integra el lote anterior
 	virtual HRESULT IntegrateHemicubeRadiance(const UINT vertexId, const UINT verticesBaked, const UINT pass);
 
+	//integra, en orden, los lotes cuya copia todavía no fue integrada. Debe llamarse al terminar cada pasada
+	HRESULT IntegratePendingReadbacks();
+
+	//integra los hemicubos que ya están en memoria de sistema, en el formato m_hemicubeFormat. rowPitch: bytes por fila de la textura de hemicubos
+	void IntegrateHemicubes(const void * const hemicubeData, const UINT rowPitch, const UINT vertexId, const UINT verticesBaked);
+
+	//integra el hemicubo de la posición slot de la textura de hemicubos, que corresponde al vértice vertex
+	void IntegrateVertex(const BYTE * const hemicubeData, const UINT rowPitch, const UINT slot, const UINT vertex);
+
+	//exporta hemicubos en half float convirtiéndolos antes a float
+	void ExportHalfHemicubeFaces(const BYTE * const hemicubeData, const UINT rowPitch, const UINT vertexId, const UINT pass) const;
+
+private:
+	//staging texture persistente donde se copia la textura de hemicubos de un lote
+	struct ReadbackSlot
+	{
+		StagingTexture *texture;
+		ID3D11Query *copyDone;   //evento insertado detrás de la copia
+
+		UINT vertexId;
+		UINT verticesBaked;
+		UINT pass;
+		bool pending;           //la copia fue encolada y el lote todavía no fue integrado
+	};
+
+	HRESULT IntegrateReadbackSlot(ReadbackSlot &slot);
+
+protected:
+	//vértices que toma cada hilo por vez. Cuatro float4 ocupan una línea de caché de m_currentPassCpuGIData y m_cpuGITempData
+	static const UINT INTEGRATION_GRAIN_SIZE = 4;
+
+	//vértices soldados: bits por eje de la posición cuantizada y coseno mínimo entre normales del mismo grupo
+	static const UINT WELD_POSITION_BITS = 20;
+	static const float WELD_NORMAL_COSINE;
+
+	static const UINT NOT_WELDED = 0xFFFFFFFF;
+
+	//con dos slots la GPU renderiza un lote mientras la CPU integra el anterior. Cada slot ocupa lo mismo que m_hemiCubes
+	static const UINT NUM_READBACK_SLOTS = 2;
+
 protected:
 	DirectX::XMVECTOR *m_cpuGITempData;          //suma parcial (y total al finalizar)
 	DirectX::XMVECTOR *m_currentPassCpuGIData;  //pasada actual
@@ -43,13 +123,60 @@ protected:
 	ImmutableBuffer *m_lastPassBuffer;
 	ImmutableBuffer *m_finalGIDataBuffer;
 
-	//datos para el cálculo del algoritmo en CPU
-	float m_uvFunction[HEMICUBE_FACE_SIZE];
-	float m_weights[2][HEMICUBE_FACE_SIZE][HEMICUBE_FACE_SIZE];
+	//delta form factors y kernel de integración (SSE2 o AVX2 según el procesador)
+	HemicubeIntegrator m_integrator;
+
+	const UINT m_numThreads;
+	ThreadPool m_threadPool;
+
+	ReadbackSlot m_readbackSlots[NUM_READBACK_SLOTS];
+	UINT m_nextReadbackSlot;
+
+	//profiling: suma de los datos de cada hilo en todas las integraciones
+	vector<ThreadPool::ThreadStatistics> m_integrationStatistics;
 
 	double m_integrationTimeMinusMemCpyTime;    //tiempo de integración en segundos (precisión en microsegundos) sin contar el tiempo de copiado de datos.
+	double m_readbackWaitTime;                  //tiempo en segundos que la CPU esperó a que terminara la copia de un lote
+
+	//submuestreo de vértices. m_bakedVertices son las muestras de m_irradianceCache en el mismo orden
+	const float m_irradianceCacheError;
+	IrradianceCache m_irradianceCache;
+	double m_irradianceCacheTime;               //tiempo en segundos de selección, refinamiento e interpolación
+
+	//vértices soldados (sin caché de irradiancia). m_weldCluster: posición en m_bakedVertices del grupo de cada vértice
+	const bool m_weldVertices;
+	vector<UINT> m_weldCluster;
+	double m_weldTime;                          //tiempo en segundos de agrupamiento y copia a los vértices del grupo
 };
 
+inline float CPURadiosity::GetIrradianceCacheError() const
+{
+	return m_irradianceCacheError;
+}
+
+inline bool CPURadiosity::WeldsVertices() const
+{
+	return m_weldVertices && !UsesIrradianceCache();
+}
+
+inline bool CPURadiosity::UsesIrradianceCache() const
+{
+	return m_irradianceCacheError > 0.0f;
+}
+
+inline bool CPURadiosity::UsesWelding() const
+{
+	return !m_weldCluster.empty();
+}
+
+inline UINT CPURadiosity::GetBakedPosition(const UINT vertex) const
+{
+	if(UsesIrradianceCache())
+		return m_irradianceCache.GetSampleIndex(vertex);
+	
+	return UsesWelding() ? m_weldCluster[vertex] : vertex;
+}
+
 }
 
 #endif
\ No newline at end of file
@@ -14,8 +14,9 @@ CommonMaterialShader::CommonMaterialShader(const D3DDevicesManager &d3d)
  m_diffuseTexVariable(0), m_normalTexVariable(0), 
   m_GIBuffer(0),
  m_ambient(0), m_diffuse(0), m_specular(0), m_opacity(0), m_specularPower(0),
- m_WVPMatrixVariable(0), m_cameraPosition(0), m_shaderLight(0), m_activeLightsVariable(0), 
- m_shadowDepthMapVariable(0), m_lightWVPVariable(0), m_omniShadowDepthMapVariable(0), m_ready(false)
+ m_worldMatrixVariable(0), m_WVPMatrixVariable(0), m_cameraPosition(0), m_shaderLight(0), m_activeLightsVariable(0), 
+ m_shadowDepthMapVariable(0), m_lightWVPVariable(0), m_omniShadowDepthMapVariable(0), 
+ m_techniqueLookups(0), m_techniqueBinds(0), m_ready(false)
 {
 	
 }
@@ -41,6 +42,7 @@ HRESULT CommonMaterialShader::Init()
 		ID3DX11Effect *tmp = m_shader.GetEffect();
 
 		//matrices
+		m_worldMatrixVariable = tmp->GetVariableByName( "gWorld" )->AsMatrix();
 		m_WVPMatrixVariable = tmp->GetVariableByName( "gWVP" )->AsMatrix();
 
 		//texturas
@@ -75,6 +77,41 @@ HRESULT CommonMaterialShader::Init()
 	return hr;
 }
 
+HRESULT CommonMaterialShader::ResolveTechniques(Material &material)
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"CommonMaterialShader::ResolveTechniques");
+		return E_FAIL;
+	}
+
+	ID3DX11EffectTechnique *technique = NULL;
+	ID3DX11EffectTechnique *techniqueGI = NULL;
+
+	try
+	{
+		technique = m_shader.GetEffect()->GetTechniqueByName(material.GetTechniqueName().c_str());
+		techniqueGI = m_shader.GetEffect()->GetTechniqueByName( (material.GetTechniqueName() + "GI").c_str() );
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	m_techniqueLookups += 2;
+
+	if(!technique->IsValid() || !techniqueGI->IsValid()) {
+		DXGI_D3D_ErrorWarning(E_FAIL, L"CommonMaterialShader::ResolveTechniques --> GetTechniqueByName");
+		return E_FAIL;
+	}
+
+	material.SetTechniques(technique, techniqueGI);
+
+	return S_OK;
+}
+
 HRESULT CommonMaterialShader::SetTechnique(const Material &material, const bool useGI)
 {
 	_ASSERT(m_ready);
@@ -86,20 +123,20 @@ HRESULT CommonMaterialShader::SetTechnique(const Material &material, const bool
 
 	//setear la technique que usaremos en la siguiente draw call. 
 	//useGI es true => usamos iluminación indirecta
-	if(!useGI)
-		m_technique = m_shader.GetEffect()->GetTechniqueByName(material.GetTechniqueName().c_str());
-	else
-		m_technique = m_shader.GetEffect()->GetTechniqueByName( (material.GetTechniqueName() + "GI").c_str() );
+	m_technique = material.GetTechnique(useGI);
 
-	if(!m_technique->IsValid()) {
-		DXGI_D3D_ErrorWarning(E_FAIL, L"CommonMaterialShader::SetTechnique --> GetTechniqueByName");
+	if(!m_technique) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"CommonMaterialShader::SetTechnique");
 		return E_FAIL;
 	}
 
+	++m_techniqueBinds;
+
 	return S_OK;
 }
 
-HRESULT CommonMaterialShader::SetShaderVariablesPerObject(const D3DMATRIX &wvp, const D3DMATRIX * const lightWVP, ID3D11ShaderResourceView * const GIMeshData)
+HRESULT CommonMaterialShader::SetShaderVariablesPerObject(const D3DMATRIX &world, const D3DMATRIX &wvp, const D3DMATRIX * const lightWVP, 
+                                                          ID3D11ShaderResourceView * const GIMeshData)
 {
 	_ASSERT(m_ready);
 
@@ -110,7 +147,21 @@ HRESULT CommonMaterialShader::SetShaderVariablesPerObject(const D3DMATRIX &wvp,
 
 	HRESULT hr;
 
-	//Por simplicidad y porque las escenas siempre tienen un sólo objeto, World siempre es la identidad
+	//world matrix. Un .fxo anterior a gWorld calcularía posición, normales y tangentes en el espacio del objeto: sólo sirve con la identidad
+	if(m_worldMatrixVariable->IsValid())
+	{
+		if(FAILED( hr = m_worldMatrixVariable->SetMatrix((float *) &world))) 
+		{
+			DXGI_D3D_ErrorWarning(hr, L"MaterialShader::SetShaderVariablesPerObject --> SetMatrix");
+			return hr;
+		}
+	}
+	else if(!D3DXMatrixIsIdentity(static_cast<const D3DXMATRIX *>(&world)))
+	{
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"CommonMaterialShader::SetShaderVariablesPerObject --> gWorld");
+		return E_FAIL;
+	}
+
 	//world view projection matrix
 	if(FAILED( hr = m_WVPMatrixVariable->SetMatrix((float *) &wvp))) 
 	{
@@ -138,6 +189,23 @@ HRESULT CommonMaterialShader::SetShaderVariablesPerObject(const D3DMATRIX &wvp,
 	return hr;
 }
 
+HRESULT CommonMaterialShader::SetGIMeshData(ID3D11ShaderResourceView * const GIMeshData)
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"CommonMaterialShader::SetGIMeshData");
+		return E_FAIL;
+	}
+
+	HRESULT hr;
+
+	if(FAILED(hr = m_GIBuffer->SetResource( GIMeshData )))
+		DXGI_D3D_ErrorWarning(hr, L"CommonMaterialShader::SetGIMeshData --> SetResource");
+
+	return hr;
+}
+
 HRESULT CommonMaterialShader::SetShaderVariablesPerMaterial(const Material &material)
 {
 	_ASSERT(m_ready);
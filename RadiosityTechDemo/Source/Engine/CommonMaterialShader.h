@@ -36,12 +36,29 @@ public:
 
 	HRESULT SetShaderVariablesPerFrame(const D3DXVECTOR3 &camPos, const LightProperties * const light, ID3D11ShaderResourceView *shadowMap, const UINT activeLights);
 
-	HRESULT SetShaderVariablesPerObject(const D3DMATRIX &wvp, const D3DMATRIX * const lightWVP = NULL, ID3D11ShaderResourceView * const GIMeshData=NULL);
+	//world: matriz del objeto (Scene::SceneObject). wvp y lightWVP ya incluyen world. Falla si world no es la identidad y el .fxo
+	//no tiene gWorld (ver SupportsWorldMatrix)
+	HRESULT SetShaderVariablesPerObject(const D3DMATRIX &world, const D3DMATRIX &wvp, const D3DMATRIX * const lightWVP = NULL, 
+	                                    ID3D11ShaderResourceView * const GIMeshData=NULL);
+
+	//cambia sólo la GI por vértice del objeto (cada cluster de una mesh por partes tiene su propia vista)
+	HRESULT SetGIMeshData(ID3D11ShaderResourceView * const GIMeshData);
 
 	HRESULT SetShaderVariablesPerMaterial(const Material &Material);
 
+	//busca en el effect las techniques (con y sin GI) de material y las guarda en el mismo. Una vez por material, al cargar la escena
+	HRESULT ResolveTechniques(Material &material);
+
+	//sin búsquedas por nombre ni reservas de memoria: usa las techniques de ResolveTechniques
 	HRESULT SetTechnique(const Material &material, const bool useGI=true);
 
+	//contadores para profiling: búsquedas de techniques por nombre y llamadas a SetTechnique desde Init
+	UINT GetTechniqueLookups() const;
+	UINT GetTechniqueBinds() const;
+
+	//false si el .fxo se compiló antes de gWorld: sólo se pueden dibujar objetos sin rotación ni traslación. Válido después de Init
+	bool SupportsWorldMatrix() const;
+
 private:
 	const D3DDevicesManager &m_d3dManager;
 
@@ -64,6 +81,7 @@ private:
 	ID3DX11EffectScalarVariable *m_specularPower;
 
 	//matrices
+	ID3DX11EffectMatrixVariable *m_worldMatrixVariable;     //inválida si el .fxo se compiló sin gWorld (world identidad)
 	ID3DX11EffectMatrixVariable *m_WVPMatrixVariable;
 
 	//camera
@@ -78,6 +96,9 @@ private:
 	ID3DX11EffectMatrixVariable			*m_lightWVPVariable;			//view projection matrix de la luz para el depth test con el shadow depth map
 	ID3DX11EffectShaderResourceVariable	*m_omniShadowDepthMapVariable;	
 
+	UINT m_techniqueLookups;
+	UINT m_techniqueBinds;
+
 	bool m_ready;
 };
 
@@ -86,6 +107,21 @@ inline ID3DX11EffectTechnique *CommonMaterialShader::GetTechnique() const
 	return m_technique;
 }
 
+inline UINT CommonMaterialShader::GetTechniqueLookups() const
+{
+	return m_techniqueLookups;
+}
+
+inline UINT CommonMaterialShader::GetTechniqueBinds() const
+{
+	return m_techniqueBinds;
+}
+
+inline bool CommonMaterialShader::SupportsWorldMatrix() const
+{
+	return m_worldMatrixVariable && m_worldMatrixVariable->IsValid();
+}
+
 }
 
 #endif
@@ -0,0 +1,107 @@
+﻿//------------------------------------------------------------------------------------------
+// File: CompactVertexCodec.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "CompactVertexCodec.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace DTFramework
+{
+
+//SNORM de 8 bits: x en [-1, 1] se guarda como round(x * 127). -128 se decodifica como -1 (regla de D3D)
+DWORD CompactVertexCodec::EncodeSNorm8(const float x, const float y, const float z, const float w)
+{
+	const float components[4] = { x, y, z, w };
+	DWORD packed = 0;
+
+	for(UINT i=0; i<4; ++i) {
+		const float c = components[i] < -1.0f ? -1.0f : (components[i] > 1.0f ? 1.0f : components[i]);
+		const int value = static_cast<int>(floor(c * 127.0f + 0.5f));
+
+		packed |= static_cast<DWORD>(value & 0xFF) << (i * 8);
+	}
+
+	return packed;
+}
+
+D3DXVECTOR4 CompactVertexCodec::DecodeSNorm8(const DWORD packed)
+{
+	float components[4];
+
+	for(UINT i=0; i<4; ++i) {
+		const signed char value = static_cast<signed char>((packed >> (i * 8)) & 0xFF);
+		components[i] = value == -128 ? -1.0f : value / 127.0f;
+	}
+
+	return D3DXVECTOR4(components[0], components[1], components[2], components[3]);
+}
+
+void CompactVertexCodec::Encode(const Vertex &vertex, CompactVertex &compact)
+{
+	compact.position = vertex.position;
+	compact.normal = EncodeSNorm8(vertex.normal.x, vertex.normal.y, vertex.normal.z, 0.0f);
+	compact.tangent = EncodeSNorm8(vertex.tangent.x, vertex.tangent.y, vertex.tangent.z, vertex.tangent.w);
+
+	D3DXFloat32To16Array(compact.texcoord, &(vertex.texcoord.x), 2);
+}
+
+void CompactVertexCodec::Decode(const CompactVertex &compact, Vertex &vertex)
+{
+	const D3DXVECTOR4 normal = DecodeSNorm8(compact.normal);
+
+	vertex.position = compact.position;
+	vertex.normal = D3DXVECTOR3(normal.x, normal.y, normal.z);
+	vertex.tangent = DecodeSNorm8(compact.tangent);
+
+	D3DXFloat16To32Array(&(vertex.texcoord.x), compact.texcoord, 2);
+}
+
+void CompactVertexCodec::Encode(const Vertex * const vertices, const UINT numVertices, CompactVertex * const compact)
+{
+	for(UINT i=0; i<numVertices; ++i)
+		Encode(vertices[i], compact[i]);
+}
+
+//ángulo en grados entre a y la dirección de b. Las normales de la mesh ya están normalizadas (Mesh::CalculateTangents)
+static float AngleBetween(const D3DXVECTOR3 &a, const D3DXVECTOR3 &b)
+{
+	D3DXVECTOR3 normalizedA, normalizedB;
+	D3DXVec3Normalize(&normalizedA, &a);
+	D3DXVec3Normalize(&normalizedB, &b);
+
+	const float cosine = D3DXVec3Dot(&normalizedA, &normalizedB);
+
+	return D3DXToDegree(acos(cosine > 1.0f ? 1.0f : (cosine < -1.0f ? -1.0f : cosine)));
+}
+
+CompactVertexError CompactVertexCodec::MeasureError(const Vertex * const vertices, const UINT numVertices)
+{
+	CompactVertexError error = { 0.0f, 0.0f, 0.0f, 0 };
+
+	for(UINT i=0; i<numVertices; ++i)
+	{
+		const Vertex &vertex = vertices[i];
+
+		CompactVertex compact;
+		Vertex decoded;
+		Encode(vertex, compact);
+		Decode(compact, decoded);
+
+		const D3DXVECTOR3 tangent(vertex.tangent.x, vertex.tangent.y, vertex.tangent.z);
+		const D3DXVECTOR3 decodedTangent(decoded.tangent.x, decoded.tangent.y, decoded.tangent.z);
+
+		error.normalAngle = std::max<float>(error.normalAngle, AngleBetween(vertex.normal, decoded.normal));
+		error.tangentAngle = std::max<float>(error.tangentAngle, AngleBetween(tangent, decodedTangent));
+		error.texCoord = std::max<float>(error.texCoord, std::max<float>(fabs(vertex.texcoord.x - decoded.texcoord.x), fabs(vertex.texcoord.y - decoded.texcoord.y)));
+
+		if((vertex.tangent.w < 0.0f) != (decoded.tangent.w < 0.0f)) ++error.handednessErrors;
+	}
+
+	return error;
+}
+
+}
@@ -0,0 +1,49 @@
+﻿//------------------------------------------------------------------------------------------
+// File: CompactVertexCodec.h
+//
+// Conversión entre Vertex (48 bytes de float) y CompactVertex (24 bytes), el formato
+// opcional del vertex buffer de la mesh de la escena. La posición queda en float: los
+// shaders compilados usan la posición del vertex buffer directamente como posición de
+// mundo. La normal y la tangente van en R8G8B8A8_SNORM y las coordenadas de textura en
+// R16G16_FLOAT, formatos que el input assembler convierte a float sin cambiar los shaders.
+// MeasureError decodifica lo codificado y devuelve el error máximo de cada atributo.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef COMPACT_VERTEX_CODEC_H
+#define COMPACT_VERTEX_CODEC_H
+
+#include "Utility.h"
+
+namespace DTFramework
+{
+
+//error máximo de la codificación de un conjunto de vértices
+struct CompactVertexError
+{
+	float normalAngle;          //ángulo en grados entre la normal y la decodificada (normalizada)
+	float tangentAngle;         //ídem tangente
+	float texCoord;             //diferencia absoluta máxima de u o v
+	UINT handednessErrors;      //vértices cuyo signo de bitangente cambió
+};
+
+class CompactVertexCodec
+{
+public:
+	static void Encode(const Vertex &vertex, CompactVertex &compact);
+	static void Decode(const CompactVertex &compact, Vertex &vertex);
+
+	//codifica numVertices vértices
+	static void Encode(const Vertex * const vertices, const UINT numVertices, CompactVertex * const compact);
+
+	static CompactVertexError MeasureError(const Vertex * const vertices, const UINT numVertices);
+
+private:
+	static DWORD EncodeSNorm8(const float x, const float y, const float z, const float w);
+	static D3DXVECTOR4 DecodeSNorm8(const DWORD packed);
+};
+
+}
+
+#endif
@@ -75,14 +75,20 @@ HRESULT D3DDevicesManager::Init(const DXGI_MODE_DESC &mode, const bool windowed,
 	//la llamada a GetBuffer incrementa en 1 las referencias al back buffer.
 	SAFE_RELEASE(backBuffer);
 
+	DXGI_SWAP_CHAIN_DESC sd;
+	if(FAILED( hr = m_swapChain->GetDesc(&sd) )) {
+		DXGI_D3D_ErrorWarning(hr, L"D3DDevicesManager::Init --> IDXGISwapChain::GetDesc");
+		return hr;
+	}
+
 	//depth stencil buffer
-	if(FAILED( hr = PrepareDepthStencilBuffer() )) return hr;
+	if(FAILED( hr = PrepareDepthStencilBuffer(sd.BufferDesc.Width, sd.BufferDesc.Height) )) return hr;
 	
 	//bindear las views al Output Merger Stage del pipeline
 	m_deviceContext->OMSetRenderTargets(1, &m_renderTargetView, m_depthStencilView);
 
 	//view port
-	if(FAILED( hr = PrepareViewPort() )) return hr;
+	PrepareViewPort(sd.BufferDesc.Width, sd.BufferDesc.Height);
 
 	//font
 	IFW1Factory *FW1factory;
@@ -98,6 +104,90 @@ HRESULT D3DDevicesManager::Init(const DXGI_MODE_DESC &mode, const bool windowed,
 	return hr;
 }
 
+//------------------------------------------------------------------------------------------
+// Inicialización sin ventana ni swap chain para los procesos en lote (ej. el baker de GI).
+// Se utiliza el rasterizador por software WARP de manera que no se requiere una GPU.
+// El "back buffer" es una textura de width x height que nunca se presenta.
+//------------------------------------------------------------------------------------------
+HRESULT D3DDevicesManager::InitHeadless(const UINT width, const UINT height)
+{
+	_ASSERT(!m_ready);
+
+	if(m_ready || width == 0 || height == 0) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"D3DDevicesManager::InitHeadless");
+		return E_FAIL;
+	}
+
+	HRESULT hr;
+
+	m_vsync = false;
+
+	D3D_FEATURE_LEVEL featureLevel[1] = {D3D_FEATURE_LEVEL_11_0};
+
+	UINT createDeviceFlags = D3D11_CREATE_DEVICE_SINGLETHREADED;
+	#if defined(DEBUG)
+		createDeviceFlags |= D3D11_CREATE_DEVICE_DEBUG;
+	#endif
+
+	hr = D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_WARP, NULL, createDeviceFlags, featureLevel, 1, D3D11_SDK_VERSION, &m_device11, NULL, &m_deviceContext);
+
+	if(FAILED(hr)) {
+		DXGI_D3D_ErrorWarning(hr, L"D3DDevicesManager::InitHeadless-->D3D11CreateDevice");
+		return hr;
+	}
+
+	//el ID3D10Device sólo se usa para las operaciones de ID3DX10Mesh. Si WARP no está disponible para d3d10 
+	//alcanza con un device sin capacidad de renderización
+	createDeviceFlags = D3D10_CREATE_DEVICE_SINGLETHREADED;
+	#if defined(DEBUG)
+		createDeviceFlags |= D3D10_CREATE_DEVICE_DEBUG;
+	#endif
+	if(FAILED( hr = D3D10CreateDevice(NULL, D3D10_DRIVER_TYPE_WARP, NULL, createDeviceFlags, D3D10_SDK_VERSION, &m_device10) )) {
+		if(FAILED( hr = D3D10CreateDevice(NULL, D3D10_DRIVER_TYPE_NULL, NULL, createDeviceFlags, D3D10_SDK_VERSION, &m_device10) )) {
+			DXGI_D3D_ErrorWarning(hr, L"D3DDevicesManager::InitHeadless-->D3D10CreateDevice");
+			return hr;
+		}
+	}
+
+	//render target fuera de pantalla que reemplaza al back buffer
+	D3D11_TEXTURE2D_DESC desc;
+	desc.Width = width;
+	desc.Height = height;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	desc.SampleDesc.Count = 1;
+	desc.SampleDesc.Quality = 0;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+	desc.CPUAccessFlags = 0;
+	desc.MiscFlags = 0;
+
+	ID3D11Texture2D *backBuffer = NULL;
+	if(FAILED(hr = m_device11->CreateTexture2D(&desc, NULL, &backBuffer))) {
+		DXGI_D3D_ErrorWarning(hr, L"D3DDevicesManager::InitHeadless-->CreateTexture2D");
+		return hr;
+	}
+	if(FAILED(hr = m_device11->CreateRenderTargetView(backBuffer, NULL, &m_renderTargetView))) {
+		SAFE_RELEASE(backBuffer);
+		DXGI_D3D_ErrorWarning(hr, L"D3DDevicesManager::InitHeadless-->CreateRenderTargetView");
+		return hr;
+	}
+	SAFE_RELEASE(backBuffer);
+
+	if(FAILED( hr = PrepareDepthStencilBuffer(width, height) )) return hr;
+
+	m_deviceContext->OMSetRenderTargets(1, &m_renderTargetView, m_depthStencilView);
+
+	PrepareViewPort(width, height);
+
+	//sin font. DrawString no hace nada en este modo
+
+	m_ready = true;
+
+	return S_OK;
+}
+
 //creamos el ID3D10Device, ID3D11Device, ID3D11DeviceContext, y IDXGISwapChain. Utilizamos las opciones que escogió el usuario en el SettingsDialog y en el EngineConfig
 HRESULT D3DDevicesManager::PrepareDevicesAndSwapChain(const DXGI_MODE_DESC &mode, const bool windowed, const bool aa, const HWND window, const UINT totalBackBuffers)
 {
@@ -195,20 +285,14 @@ HRESULT D3DDevicesManager::PrepareDevicesAndSwapChain(const DXGI_MODE_DESC &mode
 	return hr;
 }
 
-HRESULT D3DDevicesManager::PrepareDepthStencilBuffer()
+HRESULT D3DDevicesManager::PrepareDepthStencilBuffer(const UINT width, const UINT height)
 {
 	//crear el depth stencil buffer usando un texture resource
 	HRESULT hr;
-	DXGI_SWAP_CHAIN_DESC sd;
-
-	if(FAILED( hr = m_swapChain->GetDesc(&sd) )) {
-		DXGI_D3D_ErrorWarning(hr, L"PrepareDepthStencilBufferAndView --> IDXGISwapChain::GetDesc");
-		return hr;
-	}
 
 	D3D11_TEXTURE2D_DESC descDepth;
-	descDepth.Width = sd.BufferDesc.Width;
-	descDepth.Height = sd.BufferDesc.Height;
+	descDepth.Width = width;
+	descDepth.Height = height;
 	descDepth.MipLevels = 1;                    //para el depth buffer con un mip map level nos basta
 	descDepth.ArraySize = 1;
 	descDepth.Format = DXGI_FORMAT_D32_FLOAT;   //no stencil buffer
@@ -239,25 +323,15 @@ HRESULT D3DDevicesManager::PrepareDepthStencilBuffer()
 	return hr;
 }
 
-HRESULT D3DDevicesManager::PrepareViewPort()
+void D3DDevicesManager::PrepareViewPort(const UINT width, const UINT height)
 {
-	HRESULT hr;
-
-	DXGI_SWAP_CHAIN_DESC sd;
-	if(FAILED( hr = m_swapChain->GetDesc(&sd) )) {
-		DXGI_D3D_ErrorWarning(hr, L"PrepareViewPort --> IDXGISwapChain::GetDesc");
-		return hr;
-	}
-
 	m_vp.TopLeftX = 0;
 	m_vp.TopLeftY = 0;
-	m_vp.Width = static_cast<float>(sd.BufferDesc.Width);
-	m_vp.Height = static_cast<float>(sd.BufferDesc.Height);
+	m_vp.Width = static_cast<float>(width);
+	m_vp.Height = static_cast<float>(height);
 	m_vp.MinDepth = 0.0f;
 	m_vp.MaxDepth = 1.0f;
 	m_deviceContext->RSSetViewports(1, &m_vp);
-
-	return hr;
 }
 
 }
\ No newline at end of file
@@ -31,6 +31,11 @@ public:
 	HRESULT Init(const DXGI_MODE_DESC &mode, const bool windowed, const bool vsync, const bool aa, 
 	             const HWND window, const UINT totalBackBuffers);
 
+	//alternativa a Init sin ventana, swap chain ni GPU (WARP). Sólo debe llamarse una de las dos
+	HRESULT InitHeadless(const UINT width, const UINT height);
+
+	bool IsHeadless() const;
+
 	HRESULT Present() const;
 	
 	void ResetRenderingToBackBuffer() const;
@@ -103,6 +108,8 @@ public:
 	                                   ID3D11Resource **ppTexture,  HRESULT *pHResult) const;
 
 	void CopyResource(ID3D11Resource *pDstResource, ID3D11Resource *pSrcResource) const;
+	void CopySubresourceRegion(ID3D11Resource *pDstResource, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, 
+	                           ID3D11Resource *pSrcResource, UINT SrcSubresource, const D3D11_BOX *pSrcBox) const;
 	HRESULT Map(ID3D11Resource *pResource, UINT Subresource, D3D11_MAP MapType, UINT MapFlags, D3D11_MAPPED_SUBRESOURCE *pMappedResource) const;
 	void Unmap(ID3D11Resource *pResource, UINT Subresource) const;
 	
@@ -139,8 +146,8 @@ public:
 
 private:
 	HRESULT PrepareDevicesAndSwapChain(const DXGI_MODE_DESC &mode, const bool windowed, const bool aa, const HWND window, const UINT totalBackBuffers);
-	HRESULT PrepareDepthStencilBuffer();
-	HRESULT PrepareViewPort();
+	HRESULT PrepareDepthStencilBuffer(const UINT width, const UINT height);
+	void PrepareViewPort(const UINT width, const UINT height);
 
 private:
 	static const UINT SAMPLE_COUNT = 8;
@@ -167,6 +174,11 @@ private:
 };
 
 
+inline bool D3DDevicesManager::IsHeadless() const
+{
+	return m_swapChain == NULL;
+}
+
 inline D3D11_VIEWPORT const &D3DDevicesManager::GetViewPort() const
 {
 	return m_vp;
@@ -178,7 +190,8 @@ inline void D3DDevicesManager::PrepareForExit()
 	_ASSERT(m_ready);
 	if(!m_ready) { MiscErrorWarning(INVALID_FUNCTION_CALL, L"D3DDevicesManager::PrepareForExit"); return; }
 
-	m_swapChain->SetFullscreenState(false, NULL);
+	if(m_swapChain)
+		m_swapChain->SetFullscreenState(false, NULL);
 }
 
 inline void D3DDevicesManager::DrawString(const WCHAR *text, FLOAT FontSize, FLOAT X, FLOAT Y, UINT32 Color, UINT Flags) const
@@ -186,7 +199,8 @@ inline void D3DDevicesManager::DrawString(const WCHAR *text, FLOAT FontSize, FLO
 	_ASSERT(m_ready);
 	if(!m_ready) { MiscErrorWarning(INVALID_FUNCTION_CALL, L"D3DDevicesManager::DrawString"); return; }
 
-	m_font->DrawString(m_deviceContext, text, FontSize, X, Y, Color, Flags);
+	if(m_font)
+		m_font->DrawString(m_deviceContext, text, FontSize, X, Y, Color, Flags);
 }
 
 inline HRESULT D3DDevicesManager::ApplyEffectPass(ID3DX11EffectPass *effectPass, const UINT flags) const
@@ -259,6 +273,9 @@ inline HRESULT D3DDevicesManager::Present() const
 	_ASSERT(m_ready);
 	if(!m_ready) { MiscErrorWarning(INVALID_FUNCTION_CALL, L"D3DDevicesManager::Present"); return E_FAIL; }
 
+	//sin swap chain no hay nada que presentar
+	if(!m_swapChain) return S_OK;
+
 	HRESULT hr;
 
 	const UINT interval = m_vsync ? 1 : 0;
@@ -677,6 +694,15 @@ inline void D3DDevicesManager::CopyResource(ID3D11Resource *pDstResource, ID3D11
 	m_deviceContext->CopyResource(pDstResource, pSrcResource);
 }
 
+inline void D3DDevicesManager::CopySubresourceRegion(ID3D11Resource *pDstResource, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, 
+                                                     ID3D11Resource *pSrcResource, UINT SrcSubresource, const D3D11_BOX *pSrcBox) const
+{
+	_ASSERT(m_ready);
+	if(!m_ready) { MiscErrorWarning(INVALID_FUNCTION_CALL, L"D3DDevicesManager::CopySubresourceRegion"); return; }
+
+	m_deviceContext->CopySubresourceRegion(pDstResource, DstSubresource, DstX, DstY, DstZ, pSrcResource, SrcSubresource, pSrcBox);
+}
+
 inline HRESULT D3DDevicesManager::Map(ID3D11Resource *pResource, UINT Subresource, D3D11_MAP MapType, UINT MapFlags, D3D11_MAPPED_SUBRESOURCE *pMappedResource) const
 {
 	_ASSERT(m_ready);
@@ -65,20 +65,12 @@ HRESULT DirectionalShadowMap::ComputeShadowMap(const Scene &scene, const Light &
 
 	m_d3dManager.RSSetState( m_deviceStates->GetRasterizerState( DEVICE_STATE_RASTER_SOLID_CULLBACK ) );
 	
-	//obtener la matriz WVP desde el punto de vista de la luz
+	//obtener la matriz VP desde el punto de vista de la luz. La WVP de cada objeto la asigna Scene::DrawSceneMesh antes de aplicar la technique
 	const D3DXMATRIX &viewProj = light.GetViewProjectionMatrix();
 
-	if(FAILED(hr = m_lightWVP->SetMatrix( (float *) &viewProj ))) {
-		DXGI_D3D_ErrorWarning(hr, L"DirectionalShadowMap::ComputeShadowMap-->SetMatrix");
-		return hr;
-	}
-
-	//aplicar la technique luego de actualizar variables del shader
-	if(FAILED( hr = m_d3dManager.ApplyEffectPass(m_technique->GetPassByIndex(0), 0) ) ) return hr;
-
 	//vamos a dibujar toda la escena desde el punto de vista de la luz para obtener el depth map 
 	//(no renderizamos al backbuffer solo nos interesa el depth buffer)
-	hr = Render(scene);
+	hr = Render(scene, m_lightWVP, viewProj, m_technique->GetPassByIndex(0));
 
 	return hr;
 }
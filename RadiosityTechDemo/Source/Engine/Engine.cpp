@@ -125,9 +125,12 @@ HRESULT Engine::Init(const EngineConfig * const config)
 		{
 			
 			if(m_settingsDialog.IsCpuGIEnabled()) {
+				const UINT faceSize = m_scene->GetHemicubeFaceSize() != 0 ? m_scene->GetHemicubeFaceSize() : Radiosity::DEFAULT_HEMICUBE_FACE_SIZE;
+
 				m_gi = new CPURadiosity(m_d3dManager, m_settingsDialog.IsExportHemicubesEnabled(), m_settingsDialog.IsProfilingEnabled(),
-				                        m_settingsDialog.GetVerticesBakedPerDispatch(), m_settingsDialog.GetNumBounces() );
+				                        m_settingsDialog.GetVerticesBakedPerDispatch(), m_settingsDialog.GetNumBounces(), 0, faceSize );
 			} else {
+				//los compute shaders sólo soportan el tamaño de cara por defecto
 				m_gi = new GPURadiosity(m_d3dManager, m_settingsDialog.IsExportHemicubesEnabled(), m_settingsDialog.IsProfilingEnabled(),
 				                        m_settingsDialog.GetVerticesBakedPerDispatch(), m_settingsDialog.GetVerticesBakedPerDispatch2(), m_settingsDialog.GetNumBounces() );
 			}
@@ -0,0 +1,216 @@
+﻿//------------------------------------------------------------------------------------------
+// File: GIBaker.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "GIBaker.h"
+
+#include <cmath>
+
+namespace DTFramework
+{
+
+const float GIBaker::LOD_REPORT_THRESHOLD = 0.01f;
+
+GIBaker::GIBaker()
+: m_scene(0), m_renderer(0), m_gi(0), m_bakeTime(0), m_comInitialized(false), m_ready(false)
+{
+	ZeroMemory(&m_lodReport, sizeof(LODReport));
+}
+
+GIBaker::~GIBaker()
+{
+	SAFE_DELETE(m_scene);
+	SAFE_DELETE(m_gi);
+	SAFE_DELETE(m_renderer);
+
+	if(m_comInitialized)
+		CoUninitialize();
+}
+
+HRESULT GIBaker::Init(const BakerConfig &config)
+{
+	_ASSERT(!m_ready);
+
+	if(m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"GIBaker::Init");
+		return E_FAIL;
+	}
+
+	if(config.sceneFile.length() == 0 || config.outputFile.length() == 0 || config.width == 0 || config.height == 0 || config.lodTexelError < 0.0f ||
+	   (config.lodReport && config.lodTexelError == 0.0f)) {
+		MiscErrorWarning(INVALID_PARAMETER, L"GIBaker::Init");
+		return E_INVALIDARG;
+	}
+
+	HRESULT hr;
+
+	try 
+	{
+		m_config = config;
+
+		//la carga de texturas de D3DX necesita COM
+		if(FAILED(hr = CoInitializeEx(NULL, COINIT_MULTITHREADED | COINIT_SPEED_OVER_MEMORY))) {
+			COMErrorWarning(hr, L"CoInitializeEx");
+			return E_FAIL;
+		}
+		m_comInitialized = true;
+
+		//direct3d sin ventana
+		if(FAILED( hr = m_d3dManager.InitHeadless(m_config.width, m_config.height) )) return hr;
+
+		//escena
+		if((m_scene = new (std::nothrow) Scene(m_d3dManager)) == NULL) {
+			MiscErrorWarning(BAD_ALLOC);
+			return E_FAIL;
+		}
+		if(FAILED( hr = m_scene->Init(m_config.sceneFile, &m_camera, &m_light) )) return hr;
+
+		//renderer para los hemicubos y radiosidad en CPU (con hemicubos renderizados por Direct3D o por software, o con rayos)
+		if((m_renderer = new (std::nothrow) Renderer(m_d3dManager)) == NULL) {
+			MiscErrorWarning(BAD_ALLOC);
+			return E_FAIL;
+		}
+
+		//la línea de comandos tiene prioridad sobre la escena
+		UINT faceSize = m_config.hemicubeFaceSize;
+		if(faceSize == 0) faceSize = m_scene->GetHemicubeFaceSize();
+		if(faceSize == 0) faceSize = Radiosity::DEFAULT_HEMICUBE_FACE_SIZE;
+
+		//el solver progresivo parte de la primera pasada iluminada, que sólo se calcula con al menos dos pasadas
+		const UINT numBounces = m_config.solver == RADIOSITY_SOLVER_PROGRESSIVE ? max(m_config.numBounces, (UINT) 2) : m_config.numBounces;
+
+		if(m_config.raysPerVertex > 0)
+			m_gi = new (std::nothrow) RayTracedRadiosity(m_d3dManager, m_config.profiling, m_config.verticesBakedPerDispatch, numBounces, 
+			                                             m_config.numThreads, m_config.raysPerVertex, m_config.reuseFormFactors, m_config.solver, 
+			                                             m_config.convergenceTolerance, m_config.irradianceCacheError, m_config.weldVertices);
+		else if(m_config.softwareRasterizer)
+			m_gi = new (std::nothrow) SoftwareRadiosity(m_d3dManager, false, m_config.profiling, m_config.verticesBakedPerDispatch, numBounces, 
+			                                            m_config.numThreads, faceSize, m_config.reuseFormFactors, m_config.solver, m_config.convergenceTolerance, 
+			                                            m_config.irradianceCacheError, m_config.weldVertices);
+		else
+			m_gi = new (std::nothrow) CPURadiosity(m_d3dManager, false, m_config.profiling, m_config.verticesBakedPerDispatch, m_config.numBounces, 
+			                                       m_config.numThreads, faceSize, m_config.halfPrecisionHemicubes, m_config.irradianceCacheError, 
+			                                       m_config.weldVertices);
+
+		if(m_gi == NULL) {
+			MiscErrorWarning(BAD_ALLOC);
+			return E_FAIL;
+		}
+
+		if(FAILED( hr = m_renderer->Init(m_light.GetType(), m_scene->GetShadowMapsSize(), m_gi->GetHemicubeFaceSize()) )) return hr;
+
+		if(FAILED( hr = m_gi->Init() )) return hr;
+
+		m_gi->SetLODTexelError(m_config.lodTexelError);
+
+		//la comparación necesita los dos resultados calculados
+		if(!m_config.useGICache || m_config.lodReport)
+			m_gi->SetGICacheEnabled(false);
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	m_ready = true;
+
+	return S_OK;
+}
+
+HRESULT GIBaker::Bake()
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"GIBaker::Bake");
+		return E_FAIL;
+	}
+
+	HRESULT hr;
+
+	Timer timer(m_d3dManager);
+	timer.Start();
+	timer.UpdateForGPU();
+
+	if(FAILED( hr = m_gi->ComputeGIDataForScene(*m_renderer, *m_scene, m_light) )) return hr;
+
+	timer.UpdateForGPU();
+	m_bakeTime = timer.GetTimeElapsed();
+
+	if(FAILED( hr = m_gi->ExportGIData(m_config.outputFile) )) return hr;
+
+	if(!m_config.lodReport) return S_OK;
+
+	//------------------------------------------------------------------------------------------
+	// Comparación con la geometría completa. Los contadores de triángulos de la escena sólo
+	// avanzan con un punto de vista de LOD, así que quedan los del cálculo anterior.
+	//------------------------------------------------------------------------------------------
+	vector<float> lodGIData, fullDetailGIData;
+
+	if(FAILED( hr = m_gi->ReadFinalGIData(lodGIData) )) return hr;
+
+	m_gi->SetLODTexelError(0.0f);
+
+	timer.UpdateForGPU();
+
+	if(FAILED( hr = m_gi->ComputeGIDataForScene(*m_renderer, *m_scene, m_light) )) return hr;
+
+	timer.UpdateForGPU();
+
+	m_gi->SetLODTexelError(m_config.lodTexelError);
+
+	if(FAILED( hr = m_gi->ReadFinalGIData(fullDetailGIData) )) return hr;
+
+	const UINT numVertices = static_cast<UINT> (fullDetailGIData.size() / 4);
+
+	double squaredError = 0.0, irradiance = 0.0;
+	float maxError = 0.0f;
+	UINT verticesOverThreshold = 0;
+
+	for(UINT v=0; v<numVertices; ++v) 
+	{
+		bool overThreshold = false;
+
+		for(UINT c=0; c<3; ++c) {
+			const float reference = fullDetailGIData[v * 4 + c];
+			const float error = fabs(lodGIData[v * 4 + c] - reference);
+
+			maxError = max(maxError, error);
+			squaredError += static_cast<double> (error) * error;
+			irradiance += fabs(reference);
+
+			if(error > LOD_REPORT_THRESHOLD * fabs(reference)) overThreshold = true;
+		}
+
+		if(overThreshold) verticesOverThreshold++;
+	}
+
+	const double numChannels = max(numVertices * 3.0, 1.0);
+
+	m_lodReport.fullDetailBakeTime = timer.GetTimeElapsed();
+	m_lodReport.trianglesDrawn = m_scene->GetLODTrianglesDrawn();
+	m_lodReport.fullDetailTriangles = m_scene->GetLODFullDetailTriangles();
+	m_lodReport.maxError = maxError;
+	m_lodReport.rmsError = static_cast<float> (sqrt(squaredError / numChannels));
+	m_lodReport.relativeRMSError = irradiance > 0.0 ? static_cast<float> (m_lodReport.rmsError / (irradiance / numChannels)) : 0.0f;
+	m_lodReport.verticesOverThreshold = verticesOverThreshold;
+
+	return S_OK;
+}
+
+UINT GIBaker::GetNumVertices() const
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"GIBaker::GetNumVertices");
+		return 0;
+	}
+
+	return m_scene->GetTotalGIVertices();
+}
+
+}
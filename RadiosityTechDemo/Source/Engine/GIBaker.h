@@ -0,0 +1,169 @@
+﻿//------------------------------------------------------------------------------------------
+// File: GIBaker.h
+//
+// Cálculo de la iluminación global de una escena sin ventana, sin SettingsDialog y sin GPU.
+// Inicializa Direct3D con el rasterizador por software WARP, carga la escena, ejecuta
+// todas las pasadas del algoritmo de radiosidad en CPU y escribe la irradiancia por vértice
+// a disco. Pensado para procesos en lote desde la línea de comandos.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef GI_BAKER_H
+#define GI_BAKER_H
+
+#include <objbase.h>
+
+#include "Utility.h"
+#include "D3DDevicesManager.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Camera.h"
+#include "Light.h"
+#include "CPURadiosity.h"
+#include "SoftwareRadiosity.h"
+#include "RayTracedRadiosity.h"
+#include "Timer.h"
+
+using std::wstring;
+
+namespace DTFramework
+{
+
+//opciones del baker. Los valores por defecto coinciden con los del SettingsDialog
+struct BakerConfig
+{
+	wstring sceneFile;                   //archivo de escena (relativo a SCENES_DIRECTORY)
+	wstring outputFile;                  //archivo de salida con los datos de GI
+
+	UINT numBounces;
+	UINT verticesBakedPerDispatch;
+
+	bool profiling;
+
+	//renderizar los hemicubos con SoftwareRasterizer en lugar de Direct3D
+	bool softwareRasterizer;
+	UINT numThreads;                     //hilos de la integración (y del rasterizador por software). 0 => un hilo por núcleo lógico
+
+	//lanzar raysPerVertex rayos por vértice contra una BVH en lugar de renderizar hemicubos (RayTracedRadiosity). 0 => hemicubos.
+	//Usa los materiales, la matriz de form factors y el solver de softwareRasterizer
+	UINT raysPerVertex;
+
+	//tamaño de las caras de los hemicubos. 0 => el de la escena (hemicubefacesize) o Radiosity::DEFAULT_HEMICUBE_FACE_SIZE
+	UINT hemicubeFaceSize;
+
+	//renderizar los hemicubos en half float (sólo con Direct3D; el rasterizador por software siempre usa float)
+	bool halfPrecisionHemicubes;
+
+	//con softwareRasterizer: calcular los rebotes desde el segundo con la matriz de form factors del primero
+	bool reuseFormFactors;
+
+	//con softwareRasterizer: cómo se calculan los rebotes posteriores al primero. Con RADIOSITY_SOLVER_PROGRESSIVE numBounces no
+	//limita los rebotes: se dispara energía hasta que la sin distribuir sea menor que convergenceTolerance por la inicial
+	RadiositySolver solver;
+	float convergenceTolerance;
+
+	//error máximo del caché de irradiancia (a de Ward, en (0, 1)): sólo se renderizan los hemicubos de las muestras y el resto
+	//de los vértices se interpola. 0 => todos los vértices
+	float irradianceCacheError;
+
+	//renderizar un solo hemicubo por grupo de vértices con la misma posición y normal (los que el cargador de OBJ separa por
+	//coordenadas de textura). Sin efecto con el caché de irradiancia, que ya los agrupa
+	bool weldVertices;
+
+	//reutilizar un resultado del caché de GI (GI_CACHE_DIRECTORY) si la escena no cambió
+	bool useGICache;
+
+	//sólo con hemicubos de Direct3D: error máximo en texels de los niveles de detalle de los objetos con lod N. 0 => geometría completa
+	float lodTexelError;
+
+	//con lodTexelError: calcular también la GI con la geometría completa y comparar (ver GIBaker::GetLODReport). No usa el caché de GI
+	bool lodReport;
+
+	//tamaño del render target fuera de pantalla. Sólo afecta a la cámara y a la textura del cielo
+	UINT width;
+	UINT height;
+
+	static const UINT DEFAULT_BOUNCES = 2;
+	static const UINT DEFAULT_VERTICES_BAKED_PER_DISPATCH = 256;
+	static const UINT DEFAULT_WIDTH = 1280;
+	static const UINT DEFAULT_HEIGHT = 720;
+
+	BakerConfig()
+	: outputFile(L"gi.bin"), numBounces(DEFAULT_BOUNCES), verticesBakedPerDispatch(DEFAULT_VERTICES_BAKED_PER_DISPATCH), 
+	  profiling(false), softwareRasterizer(false), numThreads(0), raysPerVertex(0), hemicubeFaceSize(0), halfPrecisionHemicubes(false), reuseFormFactors(true), 
+	  solver(RADIOSITY_SOLVER_GATHERING), convergenceTolerance(SoftwareRadiosity::DEFAULT_CONVERGENCE_TOLERANCE), irradianceCacheError(0.0f), 
+	  weldVertices(true), useGICache(true), lodTexelError(0.0f), lodReport(false), width(DEFAULT_WIDTH), height(DEFAULT_HEIGHT)
+	{
+
+	}
+};
+
+//diferencia de la irradiancia calculada con niveles de detalle respecto de la calculada con la geometría completa
+struct LODReport
+{
+	double fullDetailBakeTime;          //segundos (el de los niveles de detalle es GIBaker::GetBakeTime)
+	UINT64 trianglesDrawn;              //triángulos de los clusters dibujados en los hemicubos con niveles de detalle
+	UINT64 fullDetailTriangles;         //los mismos clusters con la geometría completa
+	float maxError;                     //máxima diferencia absoluta de un canal (r, g, b)
+	float rmsError;                     //raíz del error cuadrático medio de los canales
+	float relativeRMSError;             //rmsError / irradiancia media de los canales
+	UINT verticesOverThreshold;         //vértices con algún canal con diferencia mayor que LOD_REPORT_THRESHOLD de su irradiancia
+};
+
+class GIBaker
+{
+public:
+	GIBaker();
+	~GIBaker();
+
+	//sólo debe llamarse a lo sumo una vez por objeto
+	HRESULT Init(const BakerConfig &config);
+
+	//ejecuta todas las pasadas del algoritmo y escribe el resultado en config.outputFile. Con config.lodReport luego lo vuelve a
+	//ejecutar con la geometría completa y compara los resultados
+	HRESULT Bake();
+
+	//sólo luego de Bake con config.lodReport
+	const LODReport &GetLODReport() const;
+
+	//diferencia relativa a partir de la cual un vértice cuenta en LODReport::verticesOverThreshold
+	static const float LOD_REPORT_THRESHOLD;
+
+	//tiempo en segundos del último Bake
+	double GetBakeTime() const;
+
+	UINT GetNumVertices() const;
+
+private:
+	BakerConfig m_config;
+
+	D3DDevicesManager m_d3dManager;
+
+	Scene *m_scene;
+	Renderer *m_renderer;
+	Radiosity *m_gi;
+
+	Camera m_camera;
+	Light m_light;
+
+	double m_bakeTime;
+	LODReport m_lodReport;
+
+	bool m_comInitialized;
+	bool m_ready;
+};
+
+inline double GIBaker::GetBakeTime() const
+{
+	return m_bakeTime;
+}
+
+inline const LODReport &GIBaker::GetLODReport() const
+{
+	return m_lodReport;
+}
+
+}
+
+#endif
@@ -74,19 +74,19 @@ HRESULT GPURadiosity::Init()
 	return S_OK;
 }
 
-HRESULT GPURadiosity::ComputeGIDataForScene(Renderer &renderer, Scene &scene, Light &light)
+HRESULT GPURadiosity::BakeGIData(Renderer &renderer, Scene &scene, Light &light)
 {
 	_ASSERT(m_ready);
 
-	if(!m_ready || !scene.GetSceneMesh()) {
-		MiscErrorWarning(INVALID_FUNCTION_CALL, L"GPURadiosity::ComputeGIDataForScene");
+	if(!m_ready || scene.GetNumObjects() == 0) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"GPURadiosity::BakeGIData");
 		return E_FAIL;
 	}
 
-	m_totalVertices = scene.GetSceneMesh()->GetTotalVertices();
+	m_totalVertices = scene.GetTotalGIVertices();
 
 	if(m_totalVertices <= 0) {
-		MiscErrorWarning(INVALID_PARAMETER, L"GPURadiosity::ComputeGIDataForScene");
+		MiscErrorWarning(INVALID_PARAMETER, L"GPURadiosity::BakeGIData");
 		return E_INVALIDARG;
 	}
 
@@ -102,11 +102,15 @@ HRESULT GPURadiosity::ComputeGIDataForScene(Renderer &renderer, Scene &scene, Li
 		m_timer2.UpdateForGPU();
 	}
 
+	//las SRVs de un cálculo anterior con el mismo objeto no deben iluminar la primera pasada de éste
+	m_lastPassGIDataSRV = NULL;
+	m_finalGIDataSRV = NULL;
+
 	//preparar buffers en GPU
-	if(FAILED(hr = PrepareGPUAlgorithmBuffers(*(scene.GetSceneMesh())))) return hr;
+	if(FAILED(hr = PrepareGPUAlgorithmBuffers(m_totalVertices))) return hr;
 
-	//preparar vector de vértices GI creados en base a los vértices del vertex buffer
-	if(FAILED(hr = PrepareGIVerticesVector(*(scene.GetSceneMesh())))) return hr;
+	//preparar vector de vértices GI creados en base a los vértices del vertex buffer de cada objeto
+	if(FAILED(hr = PrepareGIVerticesVector(scene))) return hr;
 
 	//las pasadas, o iteraciones, representan el numero de veces que calculamos el rebote de la luz. Desde que sale de su origen.
 	const bool showSky =  scene.ShowSky();
@@ -161,6 +165,44 @@ HRESULT GPURadiosity::ComputeGIDataForScene(Renderer &renderer, Scene &scene, Li
 
 		m_outputFile << "RESULTS:" << endl << endl;
 		m_outputFile << "Vertices in Scene:\t\t\t" << m_vertices.size() << endl;
+		m_outputFile << "Scene Objects:\t\t\t\t" << scene.GetNumObjects() << " (" << scene.GetNumMeshes() << " meshes)" << endl;
+
+		//una vez por mesh: los objetos que la comparten usan los mismos buffers
+		for(UINT i=0; i<scene.GetNumMeshes(); ++i) 
+		{
+			const Mesh &mesh = *(scene.GetMesh(i));
+
+			VertexCacheStatistics cacheBefore, cacheAfter;
+			mesh.GetVertexCacheStatistics(cacheBefore, cacheAfter);
+
+			m_outputFile << "Mesh Vertex Cache ACMR/ATVR:\t\t" << cacheBefore.acmr << " / " << cacheBefore.atvr << " (optimized: "
+			             << cacheAfter.acmr << " / " << cacheAfter.atvr << ")" << endl;
+			m_outputFile << "Mesh Vertex Format:\t\t\t" << (mesh.UsesCompactVertices() ? "compact, " : "float, ") << mesh.GetVertexStride()
+			             << " bytes per vertex (" << static_cast<double>(mesh.GetTotalVertices()) * mesh.GetVertexStride() / (1024.0 * 1024.0) << " MB)" << endl;
+
+			if(mesh.IsChunked()) {
+				MeshStreamingStatistics streaming;
+				mesh.GetStreamingStatistics(streaming);
+
+				m_outputFile << "Mesh Clusters Streamed:\t\t" << mesh.GetNumClusters() << " clusters, " << streaming.clustersStreamed << " uploads, "
+				             << streaming.evictions << " evictions, " << streaming.bytesStreamed / (1024.0 * 1024.0) << " MB streamed" << endl;
+				m_outputFile << "Mesh Resident Memory:\t\t\t" << streaming.residentBytes / (1024.0 * 1024.0) << " MB (peak "
+				             << streaming.peakResidentBytes / (1024.0 * 1024.0) << " MB)" << endl;
+			}
+		}
+		//el presupuesto es uno solo para todas las meshes por partes
+		if(scene.GetMeshResidency().GetNumCaches() > 0) {
+			const MeshResidencyBudget &residency = scene.GetMeshResidency();
+
+			m_outputFile << "Scene Resident Memory:\t\t\t" << residency.GetResidentBytes() / (1024.0 * 1024.0) << " MB (peak "
+			             << residency.GetPeakResidentBytes() / (1024.0 * 1024.0) << " MB, budget " << residency.GetBudgetBytes() / (1024.0 * 1024.0) 
+			             << " MB, " << residency.GetNumCaches() << " chunked meshes)" << endl;
+		}
+		if(scene.GetClustersDrawn() + scene.GetClustersCulled() > 0)
+			m_outputFile << "Clusters Drawn/Culled:\t\t\t" << scene.GetClustersDrawn() << " / " << scene.GetClustersCulled() << endl;
+		if(scene.GetLODFullDetailTriangles() > 0)
+			m_outputFile << "LOD Triangles Drawn:\t\t\t" << scene.GetLODTrianglesDrawn() << " of " << scene.GetLODFullDetailTriangles() << " ("
+			             << 100.0 * scene.GetLODTrianglesDrawn() / scene.GetLODFullDetailTriangles() << "%, max error " << GetLODTexelError() << " texels)" << endl;
 		m_outputFile << "Hemicubes' Total Rendering Time:\t" << m_hemicubeRenderingTime << " seconds." << endl;
 		m_outputFile << "Add Passes Total Time:\t\t\t" << m_addPassesTime << " seconds." << endl;
 		m_outputFile << "Radiosity Algorithm Total Time:\t\t" << m_totalAlgorithmTime << " seconds." << endl;
@@ -334,7 +376,7 @@ HRESULT GPURadiosity::AddPasses(const UINT pass)
 	return S_OK;
 }
 
-HRESULT GPURadiosity::PrepareGPUAlgorithmBuffers(const Mesh &sceneMesh)
+HRESULT GPURadiosity::PrepareGPUAlgorithmBuffers(const UINT numGIVertices)
 {
 	HRESULT hr;
 
@@ -357,14 +399,14 @@ HRESULT GPURadiosity::PrepareGPUAlgorithmBuffers(const Mesh &sceneMesh)
 	if(FAILED( hr = m_giCalcConstantsBuffer->Init() )) return hr;
 
 	//constant buffer 1. UV Function
-	float uvFunction[HEMICUBE_FACE_SIZE*4];
+	vector<float> uvFunction(HEMICUBE_FACE_SIZE*4);
 	for(UINT i=0; i<HEMICUBE_FACE_SIZE; ++i) {
 		uvFunction[i*4] = (static_cast<float>(i) / static_cast<float>(HEMICUBE_FACE_SIZE-1)) * 2.0f - 1.0f;
 		uvFunction[i*4+1] = 0.0f;
 		uvFunction[i*4+2] = 0.0f;
 		uvFunction[i*4+3] = 0.0f;
 	}
-	if((m_UVConstantsBuffer = new (std::nothrow) ConstantBuffer(m_d3dManager, HEMICUBE_FACE_SIZE*4*4, (void *) uvFunction, false )) == NULL) {
+	if((m_UVConstantsBuffer = new (std::nothrow) ConstantBuffer(m_d3dManager, HEMICUBE_FACE_SIZE*4*4, (void *) &uvFunction[0], false )) == NULL) {
 		MiscErrorWarning(BAD_ALLOC);
 		return E_FAIL;
 	}
@@ -385,29 +427,29 @@ HRESULT GPURadiosity::PrepareGPUAlgorithmBuffers(const Mesh &sceneMesh)
 	//crear los buffers requeridos en memoria de video
 	//por cada vértice guardaremos la irradiancia (un sólo valor en RGBA, 4 bytes por cada canal) que proviene de la radiancia de los objetos y el cielo circundante
 	if((m_currentAndLastPassGIData[0] = new (std::nothrow) 
-	                                        WritableBuffer(m_d3dManager, 16 * sceneMesh.GetTotalVertices(), 
-	                                                       DXGI_FORMAT_R32G32B32A32_FLOAT, sceneMesh.GetTotalVertices())) == NULL) 
+	                                        WritableBuffer(m_d3dManager, 16 * numGIVertices, 
+	                                                       DXGI_FORMAT_R32G32B32A32_FLOAT, numGIVertices)) == NULL) 
 	{
 		MiscErrorWarning(BAD_ALLOC);
 		return E_FAIL;
 	}
 	if((m_GITempData[0] = new (std::nothrow) 
-	                           WritableBuffer(m_d3dManager, 16 * sceneMesh.GetTotalVertices(), 
-	                                          DXGI_FORMAT_R32G32B32A32_FLOAT, sceneMesh.GetTotalVertices())) == NULL)
+	                           WritableBuffer(m_d3dManager, 16 * numGIVertices, 
+	                                          DXGI_FORMAT_R32G32B32A32_FLOAT, numGIVertices)) == NULL)
 	{
 		MiscErrorWarning(BAD_ALLOC);
 		return E_FAIL;
 	}
 	if((m_GITempData[1] = new (std::nothrow) 
-	                           WritableBuffer(m_d3dManager, 16 * sceneMesh.GetTotalVertices(), 
-	                                          DXGI_FORMAT_R32G32B32A32_FLOAT, sceneMesh.GetTotalVertices())) == NULL)
+	                           WritableBuffer(m_d3dManager, 16 * numGIVertices, 
+	                                          DXGI_FORMAT_R32G32B32A32_FLOAT, numGIVertices)) == NULL)
 	{
 		MiscErrorWarning(BAD_ALLOC);
 		return E_FAIL;
 	}
 	if((m_currentAndLastPassGIData[1] = new (std::nothrow) 
-	                                         WritableBuffer(m_d3dManager, 16 * sceneMesh.GetTotalVertices(), 
-	                                                        DXGI_FORMAT_R32G32B32A32_FLOAT, sceneMesh.GetTotalVertices())) == NULL)
+	                                         WritableBuffer(m_d3dManager, 16 * numGIVertices, 
+	                                                        DXGI_FORMAT_R32G32B32A32_FLOAT, numGIVertices)) == NULL)
 	{
 		MiscErrorWarning(BAD_ALLOC);
 		return E_FAIL;
@@ -5,7 +5,8 @@
 // Computa el término de iluminación global para el cálculo del color
 // final de cada pixel de la escena. Los datos tienen una densidad por vértice.
 // La integración se realiza en los compute shaders implementados en el archivo
-// Shaders/HemicubesIntegration.hlsl
+// Shaders/HemicubesIntegration.hlsl, que asumen caras de hemicubo de 64x64
+// (DEFAULT_HEMICUBE_FACE_SIZE).
 // 
 // Author: Gabriel Clavero
 //------------------------------------------------------------------------------------------
@@ -29,13 +30,12 @@ public:
 
 	//sólo debe llamarse a lo sumo una vez por objeto
 	virtual HRESULT Init();
-	
-	//calcula datos de iluminación indirecta dado un renderizador, una escena y una luz
-	virtual HRESULT ComputeGIDataForScene(Renderer &renderer, Scene &scene, Light &light);
 
 protected:
+	virtual HRESULT BakeGIData(Renderer &renderer, Scene &scene, Light &light);
+
 	HRESULT CompileComputeShaders();
-	HRESULT PrepareGPUAlgorithmBuffers(const Mesh &sceneMesh);
+	HRESULT PrepareGPUAlgorithmBuffers(const UINT numGIVertices);
 
 	virtual HRESULT IntegrateHemicubeRadiance(const UINT vertexId, const UINT verticesBaked, const UINT pass);
 	HRESULT AddPasses(const UINT pass);
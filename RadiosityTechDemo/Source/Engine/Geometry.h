@@ -15,14 +15,25 @@
 namespace DTFramework
 {
 
+//normal normalizada, tangente ortogonal a ella (normalizada) y en tangent.w el signo de la bitangente: cross(normal, tangent) * w
 typedef struct Vertex
 {
 	D3DXVECTOR3 position;
 	D3DXVECTOR3 normal;
-	D3DXVECTOR3 tangent;
+	D3DXVECTOR4 tangent;
 	D3DXVECTOR2 texcoord;
 } VERTEX, Vertex;
 
+//formato compacto del vertex buffer (24 bytes): normal y tangente en R8G8B8A8_SNORM (en la tangente, w es el signo de la bitangente)
+//y coordenadas de textura en half float. Ver CompactVertexCodec
+struct CompactVertex
+{
+	D3DXVECTOR3 position;
+	DWORD normal;
+	DWORD tangent;
+	D3DXFLOAT16 texcoord[2];
+};
+
 struct GIVertex
 {
 	D3DXVECTOR3 position;
@@ -0,0 +1,428 @@
+﻿//------------------------------------------------------------------------------------------
+// File: HemicubeIntegrator.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "HemicubeIntegrator.h"
+
+#include <intrin.h>
+#include <emmintrin.h>
+#include <cmath>
+
+namespace DTFramework
+{
+
+HemicubeIntegrator::HemicubeIntegrator()
+: m_weights(0), m_faceSize(0), m_kernel(INTEGRATION_KERNEL_SSE2), m_kernelFunction(IntegrateHemicubeSSE2), m_halfKernelFunction(IntegrateHemicubeHalfSSE2), m_kernelSpecialized(false), m_ready(false)
+{
+	ZeroMemory(m_ranges, sizeof(m_ranges));
+}
+
+HemicubeIntegrator::~HemicubeIntegrator()
+{
+	if(m_weights) _aligned_free(m_weights);
+}
+
+HRESULT HemicubeIntegrator::Init(const UINT faceSize)
+{
+	_ASSERT(!m_ready);
+
+	if(m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"HemicubeIntegrator::Init");
+		return E_FAIL;
+	}
+
+	if(faceSize < 2 || faceSize % 2 != 0) {
+		MiscErrorWarning(INVALID_PARAMETER, L"HemicubeIntegrator::Init");
+		return E_INVALIDARG;
+	}
+
+	m_faceSize = faceSize;
+
+	const UINT faceWeights = m_faceSize * m_faceSize;
+
+	if((m_weights = (float *) _aligned_malloc(sizeof(float) * NUM_FACES * faceWeights, 32)) == NULL) {
+		MiscErrorWarning(BAD_ALIGNED_ALLOC);
+		return E_FAIL;
+	}
+
+	ZeroMemory(m_weights, sizeof(float) * NUM_FACES * faceWeights);
+
+	//delta form factors. Las caras laterales usan el valor absoluto de la coordenada perpendicular a la normal (u para ±x, v para ±y)
+	for(UINT v=0; v<m_faceSize; ++v) 
+	{
+		const float y = (static_cast<float>(v) / static_cast<float>(m_faceSize-1)) * 2.0f - 1.0f;
+
+		for(UINT u=0; u<m_faceSize; ++u) 
+		{
+			const float x = (static_cast<float>(u) / static_cast<float>(m_faceSize-1)) * 2.0f - 1.0f;
+
+			float tmp = 1.0f + x * x + y * y;
+			tmp = tmp * tmp * (float) D3DX_PI;
+
+			const UINT texel = v * m_faceSize + u;
+
+			m_weights[0 * faceWeights + texel] = 1.0f / tmp;               //+z
+			m_weights[1 * faceWeights + texel] = fabs(x) / tmp;            //+x
+			m_weights[2 * faceWeights + texel] = fabs(x) / tmp;            //-x
+			m_weights[3 * faceWeights + texel] = fabs(y) / tmp;            //+y
+			m_weights[4 * faceWeights + texel] = fabs(y) / tmp;            //-y
+		}
+	}
+
+	//sólo la mitad de las caras laterales cae dentro del hemisferio
+	const UINT half = m_faceSize / 2;
+
+	const HemicubeFaceRange ranges[NUM_FACES] = {
+		{ 0, m_faceSize, 0, m_faceSize },        //+z
+		{ 0, m_faceSize, 0, half },              //+x
+		{ 0, m_faceSize, half, m_faceSize },     //-x
+		{ half, m_faceSize, 0, m_faceSize },     //+y
+		{ 0, half, 0, m_faceSize }               //-y
+	};
+
+	memcpy(m_ranges, ranges, sizeof(m_ranges));
+
+	SetKernel(GetBestSupportedKernel());
+
+	m_ready = true;
+
+	return S_OK;
+}
+
+void HemicubeIntegrator::Integrate(const float * const faces[NUM_FACES], const UINT rowPitch, float * const irradiance) const
+{
+	_ASSERT(m_ready);
+
+	HemicubeIntegrationData data;
+
+	for(UINT i=0; i<NUM_FACES; ++i)
+		data.faces[i] = faces[i];
+
+	data.rowPitch = rowPitch;
+	data.weights = m_weights;
+	data.ranges = m_ranges;
+	data.faceSize = m_faceSize;
+
+	m_kernelFunction(data, irradiance);
+}
+
+void HemicubeIntegrator::IntegrateHalf(const UINT16 * const faces[NUM_FACES], const UINT rowPitch, float * const irradiance) const
+{
+	_ASSERT(m_ready);
+
+	HemicubeIntegrationDataHalf data;
+
+	for(UINT i=0; i<NUM_FACES; ++i)
+		data.faces[i] = faces[i];
+
+	data.rowPitch = rowPitch;
+	data.weights = m_weights;
+	data.ranges = m_ranges;
+	data.faceSize = m_faceSize;
+
+	m_halfKernelFunction(data, irradiance);
+}
+
+HRESULT HemicubeIntegrator::SetKernel(const IntegrationKernel kernel)
+{
+	if(!IsKernelSupported(kernel)) {
+		MiscErrorWarning(INVALID_PARAMETER, L"HemicubeIntegrator::SetKernel");
+		return E_INVALIDARG;
+	}
+
+	m_kernel = kernel;
+
+	HemicubeKernelFunction specialized = NULL;
+
+	switch(kernel) 
+	{
+		case INTEGRATION_KERNEL_AVX2:
+			m_kernelFunction = IntegrateHemicubeAVX2;
+			m_halfKernelFunction = IntegrateHemicubeHalfAVX2;
+			specialized = GetSpecializedKernelAVX2(m_faceSize);
+			break;
+		default:
+			m_kernelFunction = IntegrateHemicubeSSE2;
+			m_halfKernelFunction = IntegrateHemicubeHalfSSE2;
+			specialized = GetSpecializedKernelSSE2(m_faceSize);
+			break;
+	}
+
+	//las versiones especializadas asumen los rangos de Init
+	m_kernelSpecialized = (specialized != NULL);
+	if(m_kernelSpecialized)
+		m_kernelFunction = specialized;
+
+	return S_OK;
+}
+
+UINT HemicubeIntegrator::GetTexelsPerHemicube() const
+{
+	UINT texels = 0;
+
+	for(UINT i=0; i<NUM_FACES; ++i)
+		texels += (m_ranges[i].rowEnd - m_ranges[i].rowBegin) * (m_ranges[i].columnEnd - m_ranges[i].columnBegin);
+
+	return texels;
+}
+
+//AVX2, FMA y F16C en el procesador y registros ymm habilitados por el sistema operativo
+static bool CPUSupportsAVX2()
+{
+	int info[4];
+
+	__cpuid(info, 0);
+	if(info[0] < 7) return false;
+
+	__cpuid(info, 1);
+
+	const bool fma = (info[2] & (1 << 12)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	const bool f16c = (info[2] & (1 << 29)) != 0;
+
+	if(!fma || !osxsave || !avx || !f16c) return false;
+
+	//el sistema operativo guarda los estados xmm e ymm en los cambios de contexto?
+	if((_xgetbv(0) & 6) != 6) return false;
+
+	__cpuidex(info, 7, 0);
+
+	return (info[1] & (1 << 5)) != 0;
+}
+
+bool HemicubeIntegrator::IsKernelSupported(const IntegrationKernel kernel)
+{
+	switch(kernel) 
+	{
+		case INTEGRATION_KERNEL_SSE2:
+			return true;	//requerido por el proyecto (/arch:SSE2)
+		case INTEGRATION_KERNEL_AVX2:
+			return CPUSupportsAVX2();
+		default:
+			return false;
+	}
+}
+
+IntegrationKernel HemicubeIntegrator::GetBestSupportedKernel()
+{
+	return IsKernelSupported(INTEGRATION_KERNEL_AVX2) ? INTEGRATION_KERNEL_AVX2 : INTEGRATION_KERNEL_SSE2;
+}
+
+const char *HemicubeIntegrator::GetKernelName(const IntegrationKernel kernel)
+{
+	switch(kernel) 
+	{
+		case INTEGRATION_KERNEL_SSE2:
+			return "SSE2";
+		case INTEGRATION_KERNEL_AVX2:
+			return "AVX2+FMA";
+		default:
+			return "?";
+	}
+}
+
+UINT16 HemicubeIntegrator::FloatToHalf(const float value)
+{
+	UINT bits;
+	memcpy(&bits, &value, sizeof(UINT));
+
+	const UINT sign = (bits >> 16) & 0x8000;
+	const UINT floatExponent = (bits >> 23) & 0xff;
+	const int exponent = static_cast<int>(floatExponent) - 127 + 15;
+	UINT mantissa = bits & 0x7fffff;
+
+	if(floatExponent == 0xff) return static_cast<UINT16>(sign | 0x7c00 | (mantissa ? 0x200 : 0));   //inf o NaN
+	if(exponent >= 31) return static_cast<UINT16>(sign | 0x7c00);                                   //fuera de rango => inf
+
+	//subnormales de half
+	if(exponent <= 0) {
+		if(exponent < -10) return static_cast<UINT16>(sign);
+
+		mantissa |= 0x800000;
+
+		const UINT shift = static_cast<UINT>(14 - exponent);
+		UINT half = mantissa >> shift;
+		if((mantissa >> (shift - 1)) & 1) ++half;
+
+		return static_cast<UINT16>(sign | half);
+	}
+
+	//el acarreo del redondeo puede pasar al exponente, lo que da el resultado correcto
+	UINT half = sign | (static_cast<UINT>(exponent) << 10) | (mantissa >> 13);
+	if(mantissa & 0x1000) ++half;
+
+	return static_cast<UINT16>(half);
+}
+
+void HemicubeIntegrator::HalfToFloat(const UINT16 * const halfs, float * const floats, const UINT count)
+{
+	for(UINT i=0; i<count; ++i) 
+	{
+		const UINT sign = (halfs[i] & 0x8000) << 16;
+		const UINT exponent = (halfs[i] >> 10) & 0x1f;
+		const UINT mantissa = halfs[i] & 0x3ff;
+
+		UINT bits;
+
+		if(exponent == 0) {
+			const float value = mantissa * (1.0f / 16777216.0f);	//2^-24
+			memcpy(&bits, &value, sizeof(UINT));
+			bits |= sign;
+		}
+		else if(exponent == 31)
+			bits = sign | 0x7f800000 | (mantissa << 13);
+		else
+			bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+
+		memcpy(&floats[i], &bits, sizeof(UINT));
+	}
+}
+
+//------------------------------------------------------------------------------------------
+// Kernel SSE2: un texel por instrucción, con dos acumuladores para no depender de la latencia
+// de la suma.
+//------------------------------------------------------------------------------------------
+void IntegrateHemicubeSSE2(const HemicubeIntegrationData &data, float * const irradiance)
+{
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+
+	for(UINT face=0; face<HemicubeIntegrator::NUM_FACES; ++face) 
+	{
+		const HemicubeFaceRange &range = data.ranges[face];
+		const UINT count = range.columnEnd - range.columnBegin;
+
+		for(UINT row=range.rowBegin; row<range.rowEnd; ++row) 
+		{
+			const float * const texels = data.faces[face] + row * data.rowPitch + range.columnBegin * 4;
+			const float * const weights = data.weights + (face * data.faceSize + row) * data.faceSize + range.columnBegin;
+
+			UINT i = 0;
+			for(; i+2 <= count; i += 2) {
+				sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(texels + i*4), _mm_set1_ps(weights[i])));
+				sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(texels + i*4 + 4), _mm_set1_ps(weights[i+1])));
+			}
+			if(i < count)
+				sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(texels + i*4), _mm_set1_ps(weights[i])));
+		}
+	}
+
+	_mm_storeu_ps(irradiance, _mm_add_ps(sum0, sum1));
+	irradiance[3] = 0.0f;
+}
+
+//------------------------------------------------------------------------------------------
+// Conversión de 4 halfs (en los 16 bits bajos de cada canal) a float sin F16C: exponente y
+// mantisa se mueven a su lugar en un float y el producto por 2^112 corrige el sesgo del
+// exponente (también normaliza los subnormales). Inf y NaN de half quedan como números
+// finitos grandes; no deberían aparecer en un render target de radiancias.
+//------------------------------------------------------------------------------------------
+static __forceinline __m128 HalfBitsToFloatSSE2(const __m128i halfs)
+{
+	const __m128i magnitude = _mm_slli_epi32(_mm_and_si128(halfs, _mm_set1_epi32(0x7fff)), 13);
+	const __m128i sign = _mm_slli_epi32(_mm_and_si128(halfs, _mm_set1_epi32(0x8000)), 16);
+
+	const __m128 value = _mm_mul_ps(_mm_castsi128_ps(magnitude), _mm_castsi128_ps(_mm_set1_epi32(0x77800000)));
+
+	return _mm_or_ps(value, _mm_castsi128_ps(sign));
+}
+
+//------------------------------------------------------------------------------------------
+// Kernel SSE2 para texels half: dos texels (128 bits) por lectura, convertidos a float y
+// acumulados igual que en IntegrateHemicubeSSE2.
+//------------------------------------------------------------------------------------------
+void IntegrateHemicubeHalfSSE2(const HemicubeIntegrationDataHalf &data, float * const irradiance)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+
+	for(UINT face=0; face<HemicubeIntegrator::NUM_FACES; ++face) 
+	{
+		const HemicubeFaceRange &range = data.ranges[face];
+		const UINT count = range.columnEnd - range.columnBegin;
+
+		for(UINT row=range.rowBegin; row<range.rowEnd; ++row) 
+		{
+			const UINT16 * const texels = data.faces[face] + row * data.rowPitch + range.columnBegin * 4;
+			const float * const weights = data.weights + (face * data.faceSize + row) * data.faceSize + range.columnBegin;
+
+			UINT i = 0;
+			for(; i+2 <= count; i += 2) 
+			{
+				const __m128i pair = _mm_loadu_si128(reinterpret_cast<const __m128i *>(texels + i*4));
+
+				sum0 = _mm_add_ps(sum0, _mm_mul_ps(HalfBitsToFloatSSE2(_mm_unpacklo_epi16(pair, zero)), _mm_set1_ps(weights[i])));
+				sum1 = _mm_add_ps(sum1, _mm_mul_ps(HalfBitsToFloatSSE2(_mm_unpackhi_epi16(pair, zero)), _mm_set1_ps(weights[i+1])));
+			}
+			if(i < count) {
+				const __m128i single = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(texels + i*4));
+				sum0 = _mm_add_ps(sum0, _mm_mul_ps(HalfBitsToFloatSSE2(_mm_unpacklo_epi16(single, zero)), _mm_set1_ps(weights[i])));
+			}
+		}
+	}
+
+	_mm_storeu_ps(irradiance, _mm_add_ps(sum0, sum1));
+	irradiance[3] = 0.0f;
+}
+
+//------------------------------------------------------------------------------------------
+// Versión del kernel SSE2 para un tamaño de cara fijo. Las medias caras laterales se recorren
+// con los mismos rangos que calcula Init, pero como constantes: +x las columnas [0, HALF),
+// -x las columnas [HALF, FACE_SIZE), +y las filas [HALF, FACE_SIZE) y -y las filas [0, HALF).
+//------------------------------------------------------------------------------------------
+template<UINT FACE_SIZE, UINT COLUMNS, UINT ROWS>
+static __forceinline void AccumulateRowsSSE2(const float *texels, const UINT rowPitch, const float *weights, __m128 &sum0, __m128 &sum1)
+{
+	for(UINT row=0; row<ROWS; ++row, texels += rowPitch, weights += FACE_SIZE) 
+	{
+		for(UINT i=0; i<COLUMNS; i += 2) {
+			sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(texels + i*4), _mm_set1_ps(weights[i])));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(texels + i*4 + 4), _mm_set1_ps(weights[i+1])));
+		}
+	}
+}
+
+template<UINT FACE_SIZE>
+static void IntegrateHemicubeSSE2Fixed(const HemicubeIntegrationData &data, float * const irradiance)
+{
+	static_assert(FACE_SIZE % 4 == 0, "las medias caras deben tener un número par de columnas");
+
+	static const UINT HALF = FACE_SIZE / 2;
+	static const UINT FACE_WEIGHTS = FACE_SIZE * FACE_SIZE;
+
+	_ASSERT(data.faceSize == FACE_SIZE);
+
+	const UINT pitch = data.rowPitch;
+	const float * const weights = data.weights;
+
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+
+	AccumulateRowsSSE2<FACE_SIZE, FACE_SIZE, FACE_SIZE>(data.faces[0], pitch, weights, sum0, sum1);
+	AccumulateRowsSSE2<FACE_SIZE, HALF, FACE_SIZE>(data.faces[1], pitch, weights + FACE_WEIGHTS, sum0, sum1);
+	AccumulateRowsSSE2<FACE_SIZE, HALF, FACE_SIZE>(data.faces[2] + HALF*4, pitch, weights + 2*FACE_WEIGHTS + HALF, sum0, sum1);
+	AccumulateRowsSSE2<FACE_SIZE, FACE_SIZE, HALF>(data.faces[3] + HALF*pitch, pitch, weights + 3*FACE_WEIGHTS + HALF*FACE_SIZE, sum0, sum1);
+	AccumulateRowsSSE2<FACE_SIZE, FACE_SIZE, HALF>(data.faces[4], pitch, weights + 4*FACE_WEIGHTS, sum0, sum1);
+
+	_mm_storeu_ps(irradiance, _mm_add_ps(sum0, sum1));
+	irradiance[3] = 0.0f;
+}
+
+HemicubeKernelFunction GetSpecializedKernelSSE2(const UINT faceSize)
+{
+	switch(faceSize) 
+	{
+		case 32:  return IntegrateHemicubeSSE2Fixed<32>;
+		case 64:  return IntegrateHemicubeSSE2Fixed<64>;
+		case 128: return IntegrateHemicubeSSE2Fixed<128>;
+		case 256: return IntegrateHemicubeSSE2Fixed<256>;
+		default:  return NULL;
+	}
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,155 @@
+﻿//------------------------------------------------------------------------------------------
+// File: HemicubeIntegrator.h
+//
+// Integración de un hemicubo en la CPU: suma la radiancia de los texels de las cinco caras
+// ponderada por su delta form factor. Los pesos se guardan por cara, fila por fila, y las
+// medias caras laterales se recorren con rangos calculados de antemano, así los kernels
+// procesan filas contiguas sin saltos ni índices dependientes de la cara. El kernel se elige
+// en tiempo de ejecución según las extensiones del procesador (CPUID): AVX2+FMA o SSE2.
+// Cada kernel tiene además versiones instanciadas con el tamaño de cara como parámetro de
+// template (32, 64, 128 y 256): los límites de los bucles son constantes y no hay colas.
+// Los hemicubos también pueden estar en half float (8 bytes por texel, la mitad de lectura);
+// se convierten a float con F16C en el kernel AVX2 y con operaciones enteras en el SSE2, y se
+// acumulan en float.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef HEMICUBE_INTEGRATOR_H
+#define HEMICUBE_INTEGRATOR_H
+
+#include <malloc.h>
+
+#include "Utility.h"
+
+namespace DTFramework
+{
+
+enum IntegrationKernel { INTEGRATION_KERNEL_SSE2 = 0, INTEGRATION_KERNEL_AVX2, NUM_INTEGRATION_KERNELS };
+
+//parte de una cara del hemicubo que se integra
+struct HemicubeFaceRange
+{
+	UINT rowBegin, rowEnd;
+	UINT columnBegin, columnEnd;
+};
+
+//datos de entrada de los kernels. Los texels son float4 (rgba). El canal alfa no se usa
+struct HemicubeIntegrationData
+{
+	const float *faces[5];                //primer texel de cada cara
+	UINT rowPitch;                        //floats por fila de la textura de hemicubos
+	const float *weights;                 //5 * faceSize * faceSize pesos. Cara, fila, columna
+	const HemicubeFaceRange *ranges;      //uno por cara
+	UINT faceSize;
+};
+
+//igual que HemicubeIntegrationData pero con texels half float (4 x 16 bits). rowPitch en halfs
+struct HemicubeIntegrationDataHalf
+{
+	const UINT16 *faces[5];
+	UINT rowPitch;
+	const float *weights;
+	const HemicubeFaceRange *ranges;
+	UINT faceSize;
+};
+
+typedef void (*HemicubeKernelFunction)(const HemicubeIntegrationData &data, float * const irradiance);
+typedef void (*HemicubeHalfKernelFunction)(const HemicubeIntegrationDataHalf &data, float * const irradiance);
+
+//kernels para cualquier tamaño de cara par
+void IntegrateHemicubeSSE2(const HemicubeIntegrationData &data, float * const irradiance);
+void IntegrateHemicubeAVX2(const HemicubeIntegrationData &data, float * const irradiance);
+
+void IntegrateHemicubeHalfSSE2(const HemicubeIntegrationDataHalf &data, float * const irradiance);
+void IntegrateHemicubeHalfAVX2(const HemicubeIntegrationDataHalf &data, float * const irradiance);
+
+//kernels especializados para faceSize. NULL si no hay una versión para ese tamaño
+HemicubeKernelFunction GetSpecializedKernelSSE2(const UINT faceSize);
+HemicubeKernelFunction GetSpecializedKernelAVX2(const UINT faceSize);
+
+class HemicubeIntegrator
+{
+public:
+	static const UINT NUM_FACES = 5;
+
+	HemicubeIntegrator();
+	~HemicubeIntegrator();
+
+	//sólo debe llamarse a lo sumo una vez por objeto. Usa el mejor kernel que soporte el procesador
+	HRESULT Init(const UINT faceSize);
+
+	//faces: primer texel de cada cara (+z, +x, -x, +y, -y). irradiance: 4 floats (rgb y 0)
+	void Integrate(const float * const faces[NUM_FACES], const UINT rowPitch, float * const irradiance) const;
+
+	//igual que Integrate con texels half float. rowPitch: halfs por fila
+	void IntegrateHalf(const UINT16 * const faces[NUM_FACES], const UINT rowPitch, float * const irradiance) const;
+
+	//permite forzar un kernel, por ejemplo para compararlos. Falla si el procesador no lo soporta
+	HRESULT SetKernel(const IntegrationKernel kernel);
+	IntegrationKernel GetKernel() const;
+
+	//true si el kernel actual es la versión especializada para el tamaño de cara
+	bool IsKernelSpecialized() const;
+
+	//texels que suma Integrate por cada hemicubo
+	UINT GetTexelsPerHemicube() const;
+
+	//parte de la cara face que se integra y delta form factor de uno de sus texels
+	const HemicubeFaceRange &GetFaceRange(const UINT face) const;
+	float GetWeight(const UINT face, const UINT row, const UINT column) const;
+
+	static bool IsKernelSupported(const IntegrationKernel kernel);
+	static IntegrationKernel GetBestSupportedKernel();
+	static const char *GetKernelName(const IntegrationKernel kernel);
+
+	//conversiones escalares (redondeo al más cercano). Los texels de la GPU ya vienen convertidos por el render target
+	static UINT16 FloatToHalf(const float value);
+	static void HalfToFloat(const UINT16 * const halfs, float * const floats, const UINT count);
+
+private:
+	//no copiable
+	HemicubeIntegrator(const HemicubeIntegrator &);
+	HemicubeIntegrator &operator=(const HemicubeIntegrator &);
+
+private:
+	float *m_weights;
+	HemicubeFaceRange m_ranges[NUM_FACES];
+
+	UINT m_faceSize;
+
+	IntegrationKernel m_kernel;
+	HemicubeKernelFunction m_kernelFunction;
+	HemicubeHalfKernelFunction m_halfKernelFunction;
+	bool m_kernelSpecialized;
+
+	bool m_ready;
+};
+
+inline IntegrationKernel HemicubeIntegrator::GetKernel() const
+{
+	return m_kernel;
+}
+
+inline bool HemicubeIntegrator::IsKernelSpecialized() const
+{
+	return m_kernelSpecialized;
+}
+
+inline const HemicubeFaceRange &HemicubeIntegrator::GetFaceRange(const UINT face) const
+{
+	_ASSERT(face < NUM_FACES);
+
+	return m_ranges[face];
+}
+
+inline float HemicubeIntegrator::GetWeight(const UINT face, const UINT row, const UINT column) const
+{
+	_ASSERT(m_ready && face < NUM_FACES && row < m_faceSize && column < m_faceSize);
+
+	return m_weights[(face * m_faceSize + row) * m_faceSize + column];
+}
+
+}
+
+#endif
@@ -0,0 +1,201 @@
+﻿//------------------------------------------------------------------------------------------
+// File: HemicubeIntegratorAVX2.cpp
+//
+// Kernels AVX2+FMA (y F16C para texels half) de HemicubeIntegrator. Este archivo se compila con /arch:AVX y sólo se
+// ejecuta si el procesador lo soporta, así que no debe usar funciones inline de otros
+// headers: el linker podría quedarse con esta versión para todo el programa.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "HemicubeIntegrator.h"
+
+#include <immintrin.h>
+
+namespace DTFramework
+{
+
+//------------------------------------------------------------------------------------------
+// Dos texels (8 floats) por instrucción y cuatro acumuladores: cada iteración procesa 8
+// texels contiguos de una fila. Los 8 pesos se cargan juntos y se reparten con un permute,
+// cada peso en los cuatro canales de su texel.
+//------------------------------------------------------------------------------------------
+void IntegrateHemicubeAVX2(const HemicubeIntegrationData &data, float * const irradiance)
+{
+	const __m256i weightPair0 = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+	const __m256i weightPair1 = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+	const __m256i weightPair2 = _mm256_setr_epi32(4, 4, 4, 4, 5, 5, 5, 5);
+	const __m256i weightPair3 = _mm256_setr_epi32(6, 6, 6, 6, 7, 7, 7, 7);
+
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	__m256 sum2 = _mm256_setzero_ps();
+	__m256 sum3 = _mm256_setzero_ps();
+
+	__m128 tail = _mm_setzero_ps();
+
+	for(UINT face=0; face<5; ++face) 
+	{
+		const HemicubeFaceRange &range = data.ranges[face];
+		const UINT count = range.columnEnd - range.columnBegin;
+
+		for(UINT row=range.rowBegin; row<range.rowEnd; ++row) 
+		{
+			const float * const texels = data.faces[face] + row * data.rowPitch + range.columnBegin * 4;
+			const float * const weights = data.weights + (face * data.faceSize + row) * data.faceSize + range.columnBegin;
+
+			UINT i = 0;
+			for(; i+8 <= count; i += 8) 
+			{
+				const __m256 w = _mm256_loadu_ps(weights + i);
+				const float * const t = texels + i*4;
+
+				sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(t), _mm256_permutevar8x32_ps(w, weightPair0), sum0);
+				sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(t + 8), _mm256_permutevar8x32_ps(w, weightPair1), sum1);
+				sum2 = _mm256_fmadd_ps(_mm256_loadu_ps(t + 16), _mm256_permutevar8x32_ps(w, weightPair2), sum2);
+				sum3 = _mm256_fmadd_ps(_mm256_loadu_ps(t + 24), _mm256_permutevar8x32_ps(w, weightPair3), sum3);
+			}
+
+			//filas cuyo ancho no es múltiplo de 8
+			for(; i < count; ++i)
+				tail = _mm_fmadd_ps(_mm_loadu_ps(texels + i*4), _mm_set1_ps(weights[i]), tail);
+		}
+	}
+
+	const __m256 sum = _mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3));
+
+	tail = _mm_add_ps(tail, _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1)));
+
+	_mm_storeu_ps(irradiance, tail);
+	irradiance[3] = 0.0f;
+
+	//evitar la penalidad de transición al volver a código SSE
+	_mm256_zeroupper();
+}
+
+//------------------------------------------------------------------------------------------
+// Kernel para texels half. Cada lectura de 128 bits son dos texels, que _mm256_cvtph_ps (F16C)
+// convierte a los 8 floats que usa IntegrateHemicubeAVX2.
+//------------------------------------------------------------------------------------------
+void IntegrateHemicubeHalfAVX2(const HemicubeIntegrationDataHalf &data, float * const irradiance)
+{
+	const __m256i weightPair0 = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+	const __m256i weightPair1 = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+	const __m256i weightPair2 = _mm256_setr_epi32(4, 4, 4, 4, 5, 5, 5, 5);
+	const __m256i weightPair3 = _mm256_setr_epi32(6, 6, 6, 6, 7, 7, 7, 7);
+
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	__m256 sum2 = _mm256_setzero_ps();
+	__m256 sum3 = _mm256_setzero_ps();
+
+	__m128 tail = _mm_setzero_ps();
+
+	for(UINT face=0; face<5; ++face) 
+	{
+		const HemicubeFaceRange &range = data.ranges[face];
+		const UINT count = range.columnEnd - range.columnBegin;
+
+		for(UINT row=range.rowBegin; row<range.rowEnd; ++row) 
+		{
+			const UINT16 * const texels = data.faces[face] + row * data.rowPitch + range.columnBegin * 4;
+			const float * const weights = data.weights + (face * data.faceSize + row) * data.faceSize + range.columnBegin;
+
+			UINT i = 0;
+			for(; i+8 <= count; i += 8) 
+			{
+				const __m256 w = _mm256_loadu_ps(weights + i);
+				const __m128i * const t = reinterpret_cast<const __m128i *>(texels + i*4);
+
+				sum0 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128(t)), _mm256_permutevar8x32_ps(w, weightPair0), sum0);
+				sum1 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128(t + 1)), _mm256_permutevar8x32_ps(w, weightPair1), sum1);
+				sum2 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128(t + 2)), _mm256_permutevar8x32_ps(w, weightPair2), sum2);
+				sum3 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128(t + 3)), _mm256_permutevar8x32_ps(w, weightPair3), sum3);
+			}
+
+			for(; i < count; ++i)
+				tail = _mm_fmadd_ps(_mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(texels + i*4))), _mm_set1_ps(weights[i]), tail);
+		}
+	}
+
+	const __m256 sum = _mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3));
+
+	tail = _mm_add_ps(tail, _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1)));
+
+	_mm_storeu_ps(irradiance, tail);
+	irradiance[3] = 0.0f;
+
+	_mm256_zeroupper();
+}
+
+//------------------------------------------------------------------------------------------
+// Versión para un tamaño de cara fijo. Mismo recorrido que IntegrateHemicubeSSE2Fixed: las
+// medias caras tienen un múltiplo de 8 texels por fila, así que no hay cola.
+//------------------------------------------------------------------------------------------
+template<UINT FACE_SIZE, UINT COLUMNS, UINT ROWS>
+static __forceinline void AccumulateRowsAVX2(const float *texels, const UINT rowPitch, const float *weights, 
+                                             __m256 &sum0, __m256 &sum1, __m256 &sum2, __m256 &sum3)
+{
+	const __m256i weightPair0 = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+	const __m256i weightPair1 = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+	const __m256i weightPair2 = _mm256_setr_epi32(4, 4, 4, 4, 5, 5, 5, 5);
+	const __m256i weightPair3 = _mm256_setr_epi32(6, 6, 6, 6, 7, 7, 7, 7);
+
+	for(UINT row=0; row<ROWS; ++row, texels += rowPitch, weights += FACE_SIZE) 
+	{
+		for(UINT i=0; i<COLUMNS; i += 8) 
+		{
+			const __m256 w = _mm256_loadu_ps(weights + i);
+			const float * const t = texels + i*4;
+
+			sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(t), _mm256_permutevar8x32_ps(w, weightPair0), sum0);
+			sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(t + 8), _mm256_permutevar8x32_ps(w, weightPair1), sum1);
+			sum2 = _mm256_fmadd_ps(_mm256_loadu_ps(t + 16), _mm256_permutevar8x32_ps(w, weightPair2), sum2);
+			sum3 = _mm256_fmadd_ps(_mm256_loadu_ps(t + 24), _mm256_permutevar8x32_ps(w, weightPair3), sum3);
+		}
+	}
+}
+
+template<UINT FACE_SIZE>
+static void IntegrateHemicubeAVX2Fixed(const HemicubeIntegrationData &data, float * const irradiance)
+{
+	static_assert(FACE_SIZE % 16 == 0, "las medias caras deben tener un múltiplo de 8 columnas");
+
+	static const UINT HALF = FACE_SIZE / 2;
+	static const UINT FACE_WEIGHTS = FACE_SIZE * FACE_SIZE;
+
+	const UINT pitch = data.rowPitch;
+	const float * const weights = data.weights;
+
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	__m256 sum2 = _mm256_setzero_ps();
+	__m256 sum3 = _mm256_setzero_ps();
+
+	AccumulateRowsAVX2<FACE_SIZE, FACE_SIZE, FACE_SIZE>(data.faces[0], pitch, weights, sum0, sum1, sum2, sum3);
+	AccumulateRowsAVX2<FACE_SIZE, HALF, FACE_SIZE>(data.faces[1], pitch, weights + FACE_WEIGHTS, sum0, sum1, sum2, sum3);
+	AccumulateRowsAVX2<FACE_SIZE, HALF, FACE_SIZE>(data.faces[2] + HALF*4, pitch, weights + 2*FACE_WEIGHTS + HALF, sum0, sum1, sum2, sum3);
+	AccumulateRowsAVX2<FACE_SIZE, FACE_SIZE, HALF>(data.faces[3] + HALF*pitch, pitch, weights + 3*FACE_WEIGHTS + HALF*FACE_SIZE, sum0, sum1, sum2, sum3);
+	AccumulateRowsAVX2<FACE_SIZE, FACE_SIZE, HALF>(data.faces[4], pitch, weights + 4*FACE_WEIGHTS, sum0, sum1, sum2, sum3);
+
+	const __m256 sum = _mm256_add_ps(_mm256_add_ps(sum0, sum1), _mm256_add_ps(sum2, sum3));
+
+	_mm_storeu_ps(irradiance, _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1)));
+	irradiance[3] = 0.0f;
+
+	_mm256_zeroupper();
+}
+
+HemicubeKernelFunction GetSpecializedKernelAVX2(const UINT faceSize)
+{
+	switch(faceSize) 
+	{
+		case 32:  return IntegrateHemicubeAVX2Fixed<32>;
+		case 64:  return IntegrateHemicubeAVX2Fixed<64>;
+		case 128: return IntegrateHemicubeAVX2Fixed<128>;
+		case 256: return IntegrateHemicubeAVX2Fixed<256>;
+		default:  return NULL;
+	}
+}
+
+}
\ No newline at end of file
@@ -14,10 +14,19 @@ D3D11_INPUT_ELEMENT_DESC InputLayouts::m_standardLayoutDesc[4] =
 {
 	{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 	{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-	{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0},
-	{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 36, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	{ "TANGENT", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0},
+	{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 40, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 };
 UINT InputLayouts::m_standardLayoutNumElements = 4;
+//mismos elementos que el standard layout: el input assembler convierte SNORM y half a float (ver CompactVertex)
+D3D11_INPUT_ELEMENT_DESC InputLayouts::m_compactLayoutDesc[4] = 
+{
+	{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	{ "NORMAL", 0, DXGI_FORMAT_R8G8B8A8_SNORM, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	{ "TANGENT", 0, DXGI_FORMAT_R8G8B8A8_SNORM, 0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0},
+	{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 20, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+};
+UINT InputLayouts::m_compactLayoutNumElements = 4;
 D3D11_INPUT_ELEMENT_DESC InputLayouts::m_positionOnlyLayoutDesc[1] = 
 {
 	{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
@@ -33,8 +42,8 @@ D3D10_INPUT_ELEMENT_DESC InputLayouts::m_standardLayoutDesc10[4] =
 {
 	{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D10_INPUT_PER_VERTEX_DATA, 0 },
 	{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D10_INPUT_PER_VERTEX_DATA, 0 },
-	{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 24, D3D10_INPUT_PER_VERTEX_DATA, 0},
-	{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 36, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+	{ "TANGENT", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 24, D3D10_INPUT_PER_VERTEX_DATA, 0},
+	{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 40, D3D10_INPUT_PER_VERTEX_DATA, 0 },
 };
 
 HRESULT InputLayouts::Init(const UINT flags)
@@ -48,9 +57,9 @@ HRESULT InputLayouts::Init(const UINT flags)
 
 	HRESULT hr = S_OK;
 	
-	//STANDARD LAYOUT
+	//STANDARD LAYOUT Y COMPACT LAYOUT (misma firma de entrada)
 	//Crear input (vertex) layout
-	if(flags & INPUT_LAYOUT_STANDARD)
+	if(flags & (INPUT_LAYOUT_STANDARD | INPUT_LAYOUT_COMPACT))
 	{
 		CompiledShader shader(m_d3dManager);
 		D3DX11_PASS_DESC passDesc;
@@ -68,9 +77,15 @@ HRESULT InputLayouts::Init(const UINT flags)
 			return hr;
 		}
 
-		if(FAILED( hr = m_d3dManager.CreateInputLayout(m_standardLayoutDesc, m_standardLayoutNumElements, passDesc.pIAInputSignature,
+		if((flags & INPUT_LAYOUT_STANDARD) &&
+		   FAILED( hr = m_d3dManager.CreateInputLayout(m_standardLayoutDesc, m_standardLayoutNumElements, passDesc.pIAInputSignature,
 		                                               passDesc.IAInputSignatureSize, &m_standardLayout) )) 
 			return hr;
+
+		if((flags & INPUT_LAYOUT_COMPACT) &&
+		   FAILED( hr = m_d3dManager.CreateInputLayout(m_compactLayoutDesc, m_compactLayoutNumElements, passDesc.pIAInputSignature,
+		                                               passDesc.IAInputSignatureSize, &m_compactLayout) )) 
+			return hr;
 	}
 
 	//POSITION ONLY LAYOUT (Para la sombra, renderizaciones auxiliares y el skybox)
@@ -131,6 +146,11 @@ ID3D11InputLayout *InputLayouts::GetStandardInputLayout() const
 	return m_standardLayout;
 }
 
+ID3D11InputLayout *InputLayouts::GetCompactInputLayout() const
+{
+	return m_compactLayout;
+}
+
 ID3D11InputLayout *InputLayouts::GetPositionOnlyInputLayout() const
 {
 	return m_positionOnlyLayout;
@@ -23,6 +23,7 @@ namespace
 	const UINT INPUT_LAYOUT_STANDARD = 1;
 	const UINT INPUT_LAYOUT_POSITION_ONLY = 2;
 	const UINT INPUT_LAYOUT_POSITION_TEX = 4;
+	const UINT INPUT_LAYOUT_COMPACT = 8;
 }
 
 class InputLayouts
@@ -35,6 +36,7 @@ public:
 	HRESULT Init(const UINT flags);
 
 	ID3D11InputLayout *GetStandardInputLayout() const;
+	ID3D11InputLayout *GetCompactInputLayout() const;
 	ID3D11InputLayout *GetPositionOnlyInputLayout() const;
 	ID3D11InputLayout *GetPositionTexInputLayout() const;
 
@@ -49,6 +51,7 @@ private:
 	const D3DDevicesManager &m_d3dManager;
 
 	ID3D11InputLayout *m_standardLayout;        //input layout con posicion, normal, tangente y tex coord
+	ID3D11InputLayout *m_compactLayout;         //ídem con los vértices en formato CompactVertex
 	ID3D11InputLayout *m_positionOnlyLayout;    //input layout con posicion
 	ID3D11InputLayout *m_positionTexLayout;     //input layout con posicion y tex coords
 
@@ -58,6 +61,10 @@ private:
 	static D3D11_INPUT_ELEMENT_DESC m_standardLayoutDesc[4];
 	static UINT m_standardLayoutNumElements;
 
+	//COMPACT LAYOUT
+	static D3D11_INPUT_ELEMENT_DESC m_compactLayoutDesc[4];
+	static UINT m_compactLayoutNumElements;
+
 	//POSITION LAYOUT
 	static D3D11_INPUT_ELEMENT_DESC m_positionOnlyLayoutDesc[1];
 	static UINT m_positionOnlyLayoutNumElements;
@@ -71,7 +78,7 @@ private:
 };
 
 inline InputLayouts::InputLayouts(const D3DDevicesManager &d3d)
-: m_d3dManager(d3d), m_standardLayout(0), m_positionOnlyLayout(0), m_positionTexLayout(0), m_ready(false)
+: m_d3dManager(d3d), m_standardLayout(0), m_compactLayout(0), m_positionOnlyLayout(0), m_positionTexLayout(0), m_ready(false)
 {
 
 }
@@ -79,6 +86,7 @@ inline InputLayouts::InputLayouts(const D3DDevicesManager &d3d)
 inline InputLayouts::~InputLayouts()
 {
 	SAFE_RELEASE(m_standardLayout);
+	SAFE_RELEASE(m_compactLayout);
 	SAFE_RELEASE(m_positionOnlyLayout);
 	SAFE_RELEASE(m_positionTexLayout);
 }
@@ -0,0 +1,319 @@
+﻿//------------------------------------------------------------------------------------------
+// File: IrradianceCache.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "IrradianceCache.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+namespace DTFramework
+{
+
+const float IrradianceCache::DEFAULT_MAX_ERROR = 0.2f;
+
+const float IrradianceCache::MIN_DISTANCE = 1.0e-3f;
+const float IrradianceCache::INITIAL_RADIUS_FRACTION = 0.25f;
+const float IrradianceCache::LUMINANCE_FLOOR_FRACTION = 0.05f;
+
+//bits por eje de la clave de una celda de la grilla
+static const UINT CELL_KEY_BITS = 21;
+
+static inline float Luminance(DirectX::FXMVECTOR irradiance)
+{
+	static const DirectX::XMVECTORF32 LUMINANCE_WEIGHTS = { 0.2126f, 0.7152f, 0.0722f, 0.0f };
+
+	return DirectX::XMVectorGetX(DirectX::XMVector3Dot(irradiance, LUMINANCE_WEIGHTS));
+}
+
+IrradianceCache::IrradianceCache()
+: m_maxError(DEFAULT_MAX_ERROR), m_minRadius(0), m_refinements(0), m_gridOrigin(0.0f, 0.0f, 0.0f), m_cellSize(1.0f)
+{
+
+}
+
+HRESULT IrradianceCache::SelectSamples(const vector<GIVertex> &vertices, const float maxError)
+{
+	if(maxError <= 0.0f || maxError >= 1.0f) {
+		MiscErrorWarning(INVALID_PARAMETER, L"IrradianceCache::SelectSamples");
+		return E_INVALIDARG;
+	}
+
+	const UINT numVertices = static_cast<UINT>(vertices.size());
+
+	//caja que contiene a la escena: da la escala de los radios y el origen de la grilla
+	D3DXVECTOR3 minimum(FLT_MAX, FLT_MAX, FLT_MAX);
+	D3DXVECTOR3 maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(UINT i=0; i<numVertices; ++i) {
+		D3DXVec3Minimize(&minimum, &minimum, &vertices[i].position);
+		D3DXVec3Maximize(&maximum, &maximum, &vertices[i].position);
+	}
+
+	const D3DXVECTOR3 extent = maximum - minimum;
+	float diagonal = numVertices > 0 ? D3DXVec3Length(&extent) : 0.0f;
+	if(diagonal <= 0.0f) diagonal = 1.0f;
+
+	const float initialRadius = diagonal * INITIAL_RADIUS_FRACTION;
+
+	m_maxError = maxError;
+	m_minRadius = initialRadius / (1 << MAX_REFINEMENTS) * 0.999f;
+	m_refinements = 0;
+
+	//una muestra sólo es válida hasta maxError * radio: con celdas de ese tamaño alcanza con las 27 vecinas
+	m_gridOrigin = minimum;
+	m_cellSize = maxError * initialRadius;
+
+	try
+	{
+		m_samples.clear();
+		m_radius.clear();
+		m_nextInCell.clear();
+		m_cells.clear();
+		m_sampleIndex.assign(numVertices, NOT_A_SAMPLE);
+
+		vector<UINT> nearby;
+
+		for(UINT v=0; v<numVertices; ++v)
+		{
+			GatherNearbySamples(vertices[v].position, nearby);
+
+			bool covered = false;
+			for(UINT i=0; i<nearby.size() && !covered; ++i)
+				covered = ComputeWeight(vertices, v, nearby[i]) > 0.0f;
+
+			if(!covered)
+				AddSample(vertices, v, initialRadius);
+		}
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	return BuildWeights(vertices);
+}
+
+//------------------------------------------------------------------------------------------
+// Criterio de gradiente: la irradiancia interpolada de un vértice es un promedio de la de sus
+// muestras, así que la mayor diferencia entre una muestra y el promedio acota el error de la
+// interpolación por el cambio de irradiancia entre las muestras. Si supera maxError relativo
+// (con un piso para las zonas oscuras) el vértice se vuelve muestra, salvo que ya lo cubra una
+// muestra nueva de este refinamiento. Las muestras nuevas tienen la mitad del menor radio de
+// las que reemplazan, así que cada vértice se refina a lo sumo MAX_REFINEMENTS veces.
+//------------------------------------------------------------------------------------------
+HRESULT IrradianceCache::Refine(const vector<GIVertex> &vertices, const DirectX::XMVECTOR * const irradiance, UINT &newSamples)
+{
+	_ASSERT(m_sampleIndex.size() == vertices.size());
+
+	newSamples = 0;
+
+	if(m_samples.empty())
+		return S_OK;
+
+	const UINT numVertices = static_cast<UINT>(vertices.size());
+	const UINT firstNewSample = static_cast<UINT>(m_samples.size());
+
+	double meanLuminance = 0;
+	for(UINT i=0; i<m_samples.size(); ++i)
+		meanLuminance += max(Luminance(irradiance[m_samples[i]]), 0.0f);
+	meanLuminance /= m_samples.size();
+
+	const float luminanceFloor = static_cast<float>(meanLuminance) * LUMINANCE_FLOOR_FRACTION;
+
+	try
+	{
+		vector<UINT> nearby;
+
+		for(UINT v=0; v<numVertices; ++v)
+		{
+			if(m_sampleIndex[v] != NOT_A_SAMPLE) continue;
+
+			UINT count;
+			const IrradianceCacheWeight * const weights = GetWeights(v, count);
+
+			float interpolated = 0.0f;
+			for(UINT i=0; i<count; ++i)
+				interpolated += weights[i].weight * Luminance(irradiance[weights[i].sample]);
+
+			float deviation = 0.0f;
+			float radius = FLT_MAX;
+			for(UINT i=0; i<count; ++i) {
+				deviation = max(deviation, fabsf(Luminance(irradiance[weights[i].sample]) - interpolated));
+				radius = min(radius, m_radius[m_sampleIndex[weights[i].sample]]);
+			}
+
+			if(count == 0 || deviation <= m_maxError * max(interpolated, luminanceFloor)) continue;
+
+			radius *= 0.5f;
+			if(radius < m_minRadius) continue;
+
+			GatherNearbySamples(vertices[v].position, nearby);
+
+			bool covered = false;
+			for(UINT i=0; i<nearby.size() && !covered; ++i)
+				covered = nearby[i] >= firstNewSample && ComputeWeight(vertices, v, nearby[i]) > 0.0f;
+
+			if(!covered) {
+				AddSample(vertices, v, radius);
+				++newSamples;
+			}
+		}
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	if(newSamples == 0)
+		return S_OK;
+
+	++m_refinements;
+
+	return BuildWeights(vertices);
+}
+
+void IrradianceCache::Interpolate(DirectX::XMVECTOR * const irradiance, DirectX::XMVECTOR * const total) const
+{
+	const UINT numVertices = static_cast<UINT>(m_sampleIndex.size());
+
+	for(UINT v=0; v<numVertices; ++v)
+	{
+		if(m_sampleIndex[v] != NOT_A_SAMPLE) continue;
+
+		DirectX::XMVECTOR value = DirectX::XMVectorZero();
+
+		const UINT end = m_weightOffsets[v + 1];
+		for(UINT i=m_weightOffsets[v]; i<end; ++i)
+			value = DirectX::XMVectorMultiplyAdd(DirectX::XMVectorReplicate(m_weights[i].weight), irradiance[m_weights[i].sample], value);
+
+		irradiance[v] = value;
+		total[v] = DirectX::XMVectorAdd(total[v], value);
+	}
+}
+
+//------------------------------------------------------------------------------------------
+// Peso de Ward. La muestra no es válida si su normal apunta a otro lado, si está delante del
+// vértice (el vértice está detrás del plano promedio de la muestra) o si el error estimado
+// |p - p_i| / R_i + sqrt(1 - n · n_i) no es menor que maxError.
+//------------------------------------------------------------------------------------------
+float IrradianceCache::ComputeWeight(const vector<GIVertex> &vertices, const UINT vertex, const UINT sample) const
+{
+	const GIVertex &p = vertices[vertex];
+	const GIVertex &q = vertices[m_samples[sample]];
+	const float radius = m_radius[sample];
+
+	const float cosine = D3DXVec3Dot(&p.normal, &q.normal);
+	if(cosine <= 0.0f) return 0.0f;
+
+	const D3DXVECTOR3 offset = p.position - q.position;
+	const D3DXVECTOR3 normal = (p.normal + q.normal) * 0.5f;
+
+	if(D3DXVec3Dot(&offset, &normal) < -0.05f * m_maxError * radius) return 0.0f;
+
+	const float error = max(D3DXVec3Length(&offset) / radius, MIN_DISTANCE) + sqrtf(max(1.0f - cosine, 0.0f));
+	if(error >= m_maxError) return 0.0f;
+
+	return 1.0f / error;
+}
+
+UINT64 IrradianceCache::GetCellKey(const D3DXVECTOR3 &position, const int dx, const int dy, const int dz) const
+{
+	//+1: las celdas vecinas de la primera no tienen índice negativo
+	const UINT64 mask = (1ULL << CELL_KEY_BITS) - 1;
+	const UINT64 x = static_cast<UINT64>(static_cast<int>(floorf((position.x - m_gridOrigin.x) / m_cellSize)) + 1 + dx) & mask;
+	const UINT64 y = static_cast<UINT64>(static_cast<int>(floorf((position.y - m_gridOrigin.y) / m_cellSize)) + 1 + dy) & mask;
+	const UINT64 z = static_cast<UINT64>(static_cast<int>(floorf((position.z - m_gridOrigin.z) / m_cellSize)) + 1 + dz) & mask;
+
+	return x | (y << CELL_KEY_BITS) | (z << (2 * CELL_KEY_BITS));
+}
+
+void IrradianceCache::GatherNearbySamples(const D3DXVECTOR3 &position, vector<UINT> &samples) const
+{
+	samples.clear();
+
+	for(int dz=-1; dz<=1; ++dz) {
+		for(int dy=-1; dy<=1; ++dy) {
+			for(int dx=-1; dx<=1; ++dx)
+			{
+				const std::unordered_map<UINT64, UINT>::const_iterator cell = m_cells.find(GetCellKey(position, dx, dy, dz));
+				if(cell == m_cells.end()) continue;
+
+				for(UINT s=cell->second; s!=NOT_A_SAMPLE; s=m_nextInCell[s])
+					samples.push_back(s);
+			}
+		}
+	}
+}
+
+void IrradianceCache::AddSample(const vector<GIVertex> &vertices, const UINT vertex, const float radius)
+{
+	const UINT sample = static_cast<UINT>(m_samples.size());
+	const UINT64 key = GetCellKey(vertices[vertex].position, 0, 0, 0);
+
+	m_samples.push_back(vertex);
+	m_radius.push_back(radius);
+
+	const std::unordered_map<UINT64, UINT>::iterator cell = m_cells.find(key);
+	m_nextInCell.push_back(cell == m_cells.end() ? NOT_A_SAMPLE : cell->second);
+	m_cells[key] = sample;
+
+	m_sampleIndex[vertex] = sample;
+}
+
+HRESULT IrradianceCache::BuildWeights(const vector<GIVertex> &vertices)
+{
+	const UINT numVertices = static_cast<UINT>(vertices.size());
+
+	try
+	{
+		m_weightOffsets.assign(numVertices + 1, 0);
+		m_weights.clear();
+
+		vector<UINT> nearby;
+
+		for(UINT v=0; v<numVertices; ++v)
+		{
+			const UINT begin = static_cast<UINT>(m_weights.size());
+
+			if(m_sampleIndex[v] == NOT_A_SAMPLE)
+			{
+				GatherNearbySamples(vertices[v].position, nearby);
+
+				float sum = 0.0f;
+				for(UINT i=0; i<nearby.size(); ++i) {
+					const float weight = ComputeWeight(vertices, v, nearby[i]);
+					if(weight <= 0.0f) continue;
+
+					const IrradianceCacheWeight entry = { m_samples[nearby[i]], weight };
+					m_weights.push_back(entry);
+					sum += weight;
+				}
+
+				//la selección garantiza al menos una muestra válida por vértice
+				_ASSERT(sum > 0.0f);
+
+				for(UINT i=begin; i<m_weights.size(); ++i)
+					m_weights[i].weight /= sum;
+			}
+
+			m_weightOffsets[v + 1] = static_cast<UINT>(m_weights.size());
+		}
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+}
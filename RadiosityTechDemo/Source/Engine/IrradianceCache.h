@@ -0,0 +1,142 @@
+﻿//------------------------------------------------------------------------------------------
+// File: IrradianceCache.h
+//
+// Submuestreo adaptativo de los vértices de la escena al estilo del caché de irradiancia de
+// Ward. Sólo se renderiza el hemicubo de algunos vértices (las muestras); la irradiancia de
+// los demás se interpola de las muestras cercanas con el peso de Ward
+//     w = 1 / (|p - p_i| / R_i + sqrt(1 - n · n_i))
+// donde R_i es el radio de validez de la muestra i. Una muestra sirve para un vértice si
+// w > 1 / maxError y no está delante de él. La selección inicial es geométrica: se recorren los
+// vértices y se agrega como muestra todo vértice sin ninguna muestra válida, con un radio
+// proporcional al tamaño de la escena (Ward usa la distancia media a las superficies visibles,
+// que no se conoce antes de renderizar). Luego de integrar una pasada se refina donde la
+// irradiancia cambia rápido: si las muestras de un vértice interpolado difieren de su
+// irradiancia interpolada en más de maxError (relativo), el vértice se vuelve muestra con la
+// mitad del radio. Las muestras se buscan con una grilla uniforme.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include <unordered_map>
+#include <DirectXMath.h>
+
+#include "Utility.h"
+
+using std::vector;
+
+namespace DTFramework
+{
+
+//peso de una muestra en la interpolación de un vértice
+struct IrradianceCacheWeight
+{
+	UINT sample;        //índice del vértice muestra
+	float weight;       //normalizado: los pesos de un vértice suman uno
+};
+
+class IrradianceCache
+{
+public:
+	static const UINT NOT_A_SAMPLE = 0xFFFFFFFF;
+
+	//a de Ward: error relativo tolerado. 0.1 - 0.3 es lo usual
+	static const float DEFAULT_MAX_ERROR;
+
+	//el radio de las muestras nuevas es la mitad del de las que reemplazan, y a lo sumo 2^MAX_REFINEMENTS veces menor que el inicial
+	static const UINT MAX_REFINEMENTS = 3;
+
+	IrradianceCache();
+
+	//elige las muestras iniciales de vertices y calcula los pesos de los demás. maxError en (0, 1)
+	HRESULT SelectSamples(const vector<GIVertex> &vertices, const float maxError);
+
+	//agrega como muestras los vértices interpolados donde la irradiancia de las muestras varía más de lo tolerado y
+	//recalcula los pesos. Las muestras nuevas quedan al final de GetSamples. irradiance: un valor por vértice
+	HRESULT Refine(const vector<GIVertex> &vertices, const DirectX::XMVECTOR * const irradiance, UINT &newSamples);
+
+	//escribe en irradiance la interpolación de los vértices que no son muestras y la suma a total
+	void Interpolate(DirectX::XMVECTOR * const irradiance, DirectX::XMVECTOR * const total) const;
+
+	//vértices cuyo hemicubo se renderiza, en orden de selección
+	const vector<UINT> &GetSamples() const;
+
+	//posición de vertex en GetSamples o NOT_A_SAMPLE
+	UINT GetSampleIndex(const UINT vertex) const;
+
+	//pesos de un vértice interpolado. count == 0 para las muestras
+	const IrradianceCacheWeight *GetWeights(const UINT vertex, UINT &count) const;
+
+	//cantidad de llamadas a Refine que agregaron muestras
+	UINT GetRefinements() const;
+
+private:
+	//peso de Ward de la muestra sample para el vértice vertex, o 0 si no es válida
+	float ComputeWeight(const vector<GIVertex> &vertices, const UINT vertex, const UINT sample) const;
+
+	//clave de la celda de position desplazada (dx, dy, dz) celdas
+	UINT64 GetCellKey(const D3DXVECTOR3 &position, const int dx, const int dy, const int dz) const;
+
+	//muestras de la celda de position y de sus 26 vecinas
+	void GatherNearbySamples(const D3DXVECTOR3 &position, vector<UINT> &samples) const;
+
+	void AddSample(const vector<GIVertex> &vertices, const UINT vertex, const float radius);
+
+	HRESULT BuildWeights(const vector<GIVertex> &vertices);
+
+private:
+	//distancia relativa mínima: los vértices en la misma posición que una muestra (costuras de UV) no tienen peso infinito
+	static const float MIN_DISTANCE;
+
+	//radio de las muestras iniciales respecto de la diagonal de la caja que contiene a la escena
+	static const float INITIAL_RADIUS_FRACTION;
+
+	//las diferencias de irradiancia por debajo de esta fracción de la media de las muestras no refinan
+	static const float LUMINANCE_FLOOR_FRACTION;
+
+	float m_maxError;
+	float m_minRadius;
+	UINT m_refinements;
+
+	vector<UINT> m_samples;
+	vector<UINT> m_sampleIndex;         //uno por vértice
+	vector<float> m_radius;             //uno por muestra
+
+	//grilla uniforme de celdas de m_cellSize: primera muestra de cada celda y siguiente muestra en la misma celda
+	D3DXVECTOR3 m_gridOrigin;
+	float m_cellSize;
+	std::unordered_map<UINT64, UINT> m_cells;
+	vector<UINT> m_nextInCell;          //uno por muestra
+
+	//pesos en formato CSR: los del vértice v son [m_weightOffsets[v], m_weightOffsets[v+1])
+	vector<UINT> m_weightOffsets;
+	vector<IrradianceCacheWeight> m_weights;
+};
+
+inline const vector<UINT> &IrradianceCache::GetSamples() const
+{
+	return m_samples;
+}
+
+inline UINT IrradianceCache::GetSampleIndex(const UINT vertex) const
+{
+	return m_sampleIndex[vertex];
+}
+
+inline const IrradianceCacheWeight *IrradianceCache::GetWeights(const UINT vertex, UINT &count) const
+{
+	count = m_weightOffsets[vertex + 1] - m_weightOffsets[vertex];
+
+	return count > 0 ? &m_weights[m_weightOffsets[vertex]] : NULL;
+}
+
+inline UINT IrradianceCache::GetRefinements() const
+{
+	return m_refinements;
+}
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+﻿//------------------------------------------------------------------------------------------
+// File: MappedFile.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "MappedFile.h"
+
+namespace DTFramework
+{
+
+MappedFile::MappedFile()
+: m_file(INVALID_HANDLE_VALUE), m_mapping(NULL), m_data(NULL), m_size(0)
+{
+
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+HRESULT MappedFile::Open(const wstring &file)
+{
+	Close();
+
+	if( (m_file = CreateFile(file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL)) == INVALID_HANDLE_VALUE ) 
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(m_file, &size)) {
+		const HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		Close();
+		return hr;
+	}
+
+	m_size = static_cast<UINT64> (size.QuadPart);
+
+	//no se puede proyectar un archivo vacío
+	if(m_size == 0) return S_OK;
+
+	//la vista tiene que entrar en el espacio de direcciones del proceso
+	if(m_size > static_cast<UINT64> (static_cast<SIZE_T> (-1))) {
+		Close();
+		return E_OUTOFMEMORY;
+	}
+
+	if( (m_mapping = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL ) {
+		const HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		Close();
+		return hr;
+	}
+
+	if( (m_data = static_cast<const BYTE *> (MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0))) == NULL ) {
+		const HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+		Close();
+		return hr;
+	}
+
+	return S_OK;
+}
+
+void MappedFile::Close()
+{
+	if(m_data) {
+		UnmapViewOfFile(m_data);
+		m_data = NULL;
+	}
+
+	if(m_mapping) {
+		CloseHandle(m_mapping);
+		m_mapping = NULL;
+	}
+
+	if(m_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+
+	m_size = 0;
+}
+
+}
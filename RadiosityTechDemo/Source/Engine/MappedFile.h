@@ -0,0 +1,60 @@
+﻿//------------------------------------------------------------------------------------------
+// File: MappedFile.h
+//
+// Archivo de sólo lectura proyectado en memoria (CreateFileMapping/MapViewOfFile). Evita
+// copiar el contenido a un buffer intermedio: el sistema operativo carga las páginas a
+// medida que se leen.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "Utility.h"
+
+using std::wstring;
+
+namespace DTFramework
+{
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	//no muestra mensajes de error: devuelve el código de error de windows y el que llama decide si es un error
+	HRESULT Open(const wstring &file);
+	void Close();
+
+	//NULL si el archivo está vacío
+	const BYTE *GetData() const;
+	UINT64 GetSize() const;
+
+private:
+	//no copiable
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+private:
+	HANDLE m_file;
+	HANDLE m_mapping;
+
+	const BYTE *m_data;
+	UINT64 m_size;
+};
+
+inline const BYTE *MappedFile::GetData() const
+{
+	return m_data;
+}
+
+inline UINT64 MappedFile::GetSize() const
+{
+	return m_size;
+}
+
+}
+
+#endif
@@ -3,7 +3,8 @@
 //
 // La clase Material contiene la descripción de las propiedades lumínicas de un material, ruta
 // de las texturas difusa, normal, sus shader resource views asociados,
-// y nombre de las techniques con las que debe renderizarse.
+// y nombre de las techniques con las que debe renderizarse (y las techniques ya resueltas
+// en el effect, para no buscarlas por nombre en cada draw call).
 //
 // Author: Gabriel Clavero
 //------------------------------------------------------------------------------------------
@@ -12,6 +13,7 @@
 #define MATERIAL_H
 
 #include "Utility.h"
+#include "d3dx11effect.h"
 
 using std::wstring;
 using std::string;
@@ -55,7 +57,11 @@ public:
 
 	const string &GetTechniqueName() const;
 
+	//technique del effect de CommonMaterialShader sin o con iluminación global. NULL hasta CommonMaterialShader::ResolveTechniques
+	ID3DX11EffectTechnique *GetTechnique(const bool useGI) const;
+
 	//lighting properties
+	void SetLightProperties(const MaterialLightProperties &p);
 	void SetSpecular(const D3DXVECTOR3 &v);
 	void SetAmbient(const D3DXVECTOR3 &v);
 	void SetDiffuse(const D3DXVECTOR3 &v);
@@ -72,7 +78,7 @@ public:
 	void SetNormalTextureSRV(ID3D11ShaderResourceView * const srv);
 	
 	void SetTechniqueName(const string &t);
-
+	void SetTechniques(ID3DX11EffectTechnique * const technique, ID3DX11EffectTechnique * const techniqueGI);
 
 private:
 	MaterialLightProperties m_lightProperties;
@@ -84,6 +90,9 @@ private:
 
 	string m_technique;
 
+	//[0] => m_technique, [1] => m_technique + "GI". Punteros al effect: no se liberan
+	ID3DX11EffectTechnique *m_techniques[2];
+
 
 	ID3D11ShaderResourceView *m_textureRV11;
 	ID3D11ShaderResourceView *m_normalTextureRV11;
@@ -93,6 +102,7 @@ inline Material::Material()
 : m_textureRV11(0), m_normalTextureRV11(0)
 {
 	ZeroMemory(&m_lightProperties, sizeof(MaterialLightProperties));
+	m_techniques[0] = m_techniques[1] = NULL;
 }
 
 inline HRESULT Material::SetName(const WCHAR * const name_material)
@@ -140,6 +150,10 @@ inline float Material::GetAlpha() const
 { 
 	return m_lightProperties.alpha;
 }
+inline void Material::SetLightProperties(const MaterialLightProperties &p)
+{
+	m_lightProperties = p;
+}
 inline void Material::SetSpecular(const D3DXVECTOR3 &v)
 {
 	m_lightProperties.specular = v;
@@ -184,6 +198,11 @@ inline void Material::SetTechniqueName(const string &t)
 {
 	m_technique = t;
 }
+inline void Material::SetTechniques(ID3DX11EffectTechnique * const technique, ID3DX11EffectTechnique * const techniqueGI)
+{
+	m_techniques[0] = technique;
+	m_techniques[1] = techniqueGI;
+}
 inline ID3D11ShaderResourceView *Material::GetDiffuseTextureSRV() const
 {
 	return m_textureRV11;
@@ -196,6 +215,10 @@ inline const string &Material::GetTechniqueName() const
 {
 	return m_technique;
 }
+inline ID3DX11EffectTechnique *Material::GetTechnique(const bool useGI) const
+{
+	return m_techniques[useGI ? 1 : 0];
+}
 
 }
 
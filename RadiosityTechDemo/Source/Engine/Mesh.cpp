@@ -5,15 +5,39 @@
 //------------------------------------------------------------------------------------------
 
 #include "Mesh.h"
+#include "ThreadPool.h"
+
+#include <emmintrin.h>
+#include <cmath>
 
 namespace DTFramework
 {
 
+//ACMR máximo de los clusters de MeshOptimizer respecto del de la secuencia optimizada para la caché
+static const float MESH_OVERDRAW_THRESHOLD = 1.05f;
+
+//CalculateTangents: caras mínimas por hilo, tamaño total máximo de los acumuladores por hilo (en vértices de la mesh) y vértices por tarea
+static const UINT MIN_TANGENT_BLOCK_FACES = 16384;
+static const UINT MAX_TANGENT_ACCUMULATOR_FACTOR = 4;
+static const UINT TANGENT_VERTEX_GRAIN = 4096;
+
+//error máximo de las coordenadas de textura en half float para usar CompactVertex: medio texel de una textura de 1024
+static const float MAX_COMPACT_TEXCOORD_ERROR = 1.0f / 2048.0f;
+
+//caras máximas de un cluster de una mesh por partes. Con 3 vértices por cara como máximo sus índices entran en 16 bits
+static const UINT MESH_CLUSTER_FACES = 8192;
+static_assert(MESH_CLUSTER_FACES * 3 <= MeshClusterCache::MAX_CLUSTER_VERTICES, "los vértices de un cluster deben entrar en índices de 16 bits");
+
+//caras mínimas de un nivel de detalle de un cluster: con menos no vale la pena otro draw
+static const UINT MIN_LOD_FACES = 16;
+
 Mesh::Mesh(const D3DDevicesManager &d3d)
-: m_d3dManager(d3d), m_numAttribTableEntries(0), m_pAttribTable(0), m_mesh(0), m_vertexBuffer(0), m_indexBuffer(0),
-  m_totalVertices(0), m_totalFaces(0), m_ready(false)
+: m_d3dManager(d3d), m_numAttribTableEntries(0), m_pAttribTable(0), m_vertexBuffer(0), m_indexBuffer(0),
+  m_totalVertices(0), m_totalFaces(0), m_compactVertices(false), m_chunked(false), m_residencyBudget(NULL), m_clusterCache(NULL), m_lodLevels(0), 
+  m_cachedVertices(NULL), m_cachedIndices(NULL), m_ready(false)
 {
-	
+	ZeroMemory(&m_cacheStatisticsBefore, sizeof(VertexCacheStatistics));
+	ZeroMemory(&m_cacheStatisticsAfter, sizeof(VertexCacheStatistics));
 }
 
 
@@ -26,14 +50,15 @@ Mesh::~Mesh()
 	m_attributes.clear();
 
 	SAFE_DELETE_ARRAY(m_pAttribTable);
-	SAFE_RELEASE(m_mesh);
 
 	SAFE_DELETE(m_indexBuffer);
 	SAFE_DELETE(m_vertexBuffer);
+	SAFE_DELETE(m_clusterCache);
 }
 
 //meshFile es el nombre del archivo solamente. No la ruta completa
-HRESULT Mesh::Init(const wstring &meshFile,  const UINT numVertices, const UINT numNormals, const UINT numCoords)
+HRESULT Mesh::Init(const wstring &meshFile, const bool compactVertices, const bool chunked, MeshResidencyBudget * const residencyBudget, 
+                   const UINT lodLevels)
 {
 	_ASSERT(!m_ready);
 
@@ -42,20 +67,88 @@ HRESULT Mesh::Init(const wstring &meshFile,  const UINT numVertices, const UINT
 		return E_FAIL;
 	}
 
+	if(lodLevels > MAX_LOD_LEVELS || (lodLevels > 0 && !chunked) || (chunked && !residencyBudget)) {
+		MiscErrorWarning(INVALID_PARAMETER, L"Mesh::Init");
+		return E_INVALIDARG;
+	}
+
 	m_meshFile = meshFile;
+	m_compactVertices = compactVertices;
+	m_chunked = chunked;
+	m_residencyBudget = residencyBudget;
+	m_lodLevels = lodLevels;
 
 	HRESULT hr;
 
-	//cargar el vertex buffer, index buffer e información de subsets de un archivo .obj
-	if(FAILED( hr = LoadGeometryFromOBJ( MESHES_DIRECTORY + meshFile, numVertices, numNormals, numCoords ) ))
-		return hr;
+	//con un caché válido no se leen el .obj y el .mtl ni se optimiza la mesh: los buffers se crean directamente desde el archivo proyectado
+	if(FAILED(hr = LoadFromMeshCache())) return hr;
+
+	if(hr != S_OK) 
+	{
+		if(FAILED(hr = BuildOptimizedMesh())) return hr;
+
+		//si no se puede escribir el caché se muestra el error pero la mesh igual se carga
+		if(SUCCEEDED(StoreInMeshCache(&m_vertices[0], &m_indices[0])) && m_chunked)
+			MapStoredGeometry();
+	}
+
+	const Vertex * const vertices = m_cachedVertices != NULL ? m_cachedVertices : &m_vertices[0];
+	const DWORD * const indices = m_cachedIndices != NULL ? m_cachedIndices : &m_indices[0];
 
-	//crear la ID3DX10Mesh
-	InputLayouts inputLayout(m_d3dManager);
-	const D3D10_INPUT_ELEMENT_DESC *ieDesc = inputLayout.GetMeshLayoutDesc();
+	if(m_chunked && m_lodLevels > 0 && FAILED(hr = BuildClusterLODs(vertices, indices))) return hr;
 
-	if( FAILED (hr = m_d3dManager.CreateMesh(ieDesc, inputLayout.GetMeshLayoutNumElements(), ieDesc[0].SemanticName,
-	                                         static_cast<UINT> ( m_vertices.size() ), static_cast<UINT> ( m_indices.size() / 3 ), D3DX10_MESH_32_BIT, &m_mesh ) ) ) return hr;
+	if(m_chunked)
+		hr = CreateClusterCache(vertices, indices);
+	else
+		hr = CreateBuffers(vertices, indices);
+
+	if(FAILED(hr)) return hr;
+
+	//cargar texturas del material
+	wstring rutaTextura;
+	for(UINT i = 0; i < m_materials.size(); ++i) {
+		Material *pMaterial = &(m_materials[i]);
+		if(pMaterial->GetDiffuseTextureName().size() > 0 ) {
+			rutaTextura = TEXTURES_DIRECTORY + pMaterial->GetDiffuseTextureName();
+
+			//creamos una shader resource desde la imagen 2d almacenada en un archivo en disco para poder leerla desde un shader
+			ID3D11ShaderResourceView *srv = (ID3D11ShaderResourceView *) ERROR_RESOURCE_VALUE;
+			if(FAILED( hr = m_d3dManager.CreateShaderResourceViewFromFileD3D11(rutaTextura.c_str(), NULL, NULL, &(srv), NULL) )) {
+				ErrorMessage(pMaterial->GetDiffuseTextureName().c_str(), L"Texture Error");
+				return hr;
+			}
+			pMaterial->SetDiffuseTextureSRV(srv);		//las copias no aumentan las reference count
+		}
+
+		if(pMaterial->GetNormalTextureName().size() > 0 ) {
+			rutaTextura = TEXTURES_DIRECTORY + pMaterial->GetNormalTextureName();
+
+			//lo mismo para la normal texture
+			ID3D11ShaderResourceView *srv = (ID3D11ShaderResourceView*)ERROR_RESOURCE_VALUE;
+			if(FAILED( hr = m_d3dManager.CreateShaderResourceViewFromFileD3D11(rutaTextura.c_str(), NULL, NULL, &(srv), NULL) )) {
+				ErrorMessage(pMaterial->GetNormalTextureName().c_str(), L"Texture Error");
+				return hr;
+			}
+			pMaterial->SetNormalTextureSRV(srv);
+		}
+	}
+
+	this->SetTechniquesForMaterials();
+
+	m_ready = true;
+
+	return S_OK;
+}
+
+
+//carga el .obj y el .mtl y optimiza la mesh con MeshOptimizer. Deja la geometría final en m_vertices y m_indices
+HRESULT Mesh::BuildOptimizedMesh()
+{
+	HRESULT hr;
+
+	//cargar el vertex buffer, index buffer e información de subsets de un archivo .obj
+	if(FAILED( hr = LoadGeometryFromOBJ( MESHES_DIRECTORY + m_meshFile ) ))
+		return hr;
 
 	m_totalVertices = static_cast<UINT> ( m_vertices.size() );
 	m_totalFaces = static_cast<UINT> ( m_indices.size()  / 3 );
@@ -67,45 +160,102 @@ HRESULT Mesh::Init(const wstring &meshFile,  const UINT numVertices, const UINT
 
 	if(FAILED(hr = CalculateTangents())) return hr;
 
-	// setear vertex data
-	if(FAILED( hr = m_mesh->SetVertexData( 0, (void *) ( &m_vertices[0] ) ) )) {
-		DXGI_D3D_ErrorWarning(hr, L"Mesh::Init --> ID3DX10Mesh::SetVertexData");
-		return hr;
-	}
-	m_vertices.clear();
+	//MeshOptimizer trabaja con unsigned int: los índices y atributos se reordenan en el lugar
+	static_assert(sizeof(DWORD) == sizeof(unsigned int), "DWORD y unsigned int deben tener el mismo tamaño");
+	unsigned int * const indices = reinterpret_cast<unsigned int *>(&m_indices[0]);
+	unsigned int * const attributes = reinterpret_cast<unsigned int *>(&m_attributes[0]);
 
-	// setear index data
-	if(FAILED( hr = m_mesh->SetIndexData( (void *) (&m_indices[0]), static_cast<UINT> ( m_indices.size() ) ))) {
-		DXGI_D3D_ErrorWarning(hr, L"Mesh::Init --> ID3DX10Mesh::SetIndexData");
-		return hr;
-	}
-	m_indices.clear();
+	//reorganizar los triángulos de acuerdo al subset y optimizarlos para la cache de vertices de la tarjeta de video y para el overdraw.
+	//Cuando se renderiza la lista de triangulos de la mesh los vertices van a hacer cache hit mas a menudo asi que nos evitamos volver a ejecutar el vertex shader
+	vector<MeshSubset> subsets;
+	vector<UINT> clusterAttributes;
 
-	// setear attribute data
-	if(FAILED( hr = m_mesh->SetAttributeData( (UINT *)&m_attributes[0] ))) {
-		DXGI_D3D_ErrorWarning(hr, L"Mesh::Init --> ID3DX10Mesh::SetAttributeData");
-		return hr;
+	try
+	{
+		m_cacheStatisticsBefore = MeshOptimizer::AnalyzeVertexCache(indices, m_totalFaces, m_totalVertices);
+
+		//mesh por partes: los atributos pasan a ser los clusters, así que cada subset de Optimize es un cluster
+		if(m_chunked)
+			SplitIntoClusters(indices, attributes, clusterAttributes);
+
+		vector<UINT> remap;
+		const UINT usedVertices = MeshOptimizer::Optimize(indices, attributes, m_totalFaces, m_totalVertices, &(m_vertices[0].position.x),
+		                                                  sizeof(Vertex), MESH_OVERDRAW_THRESHOLD, remap, subsets);
+
+		//vértices en el orden nuevo (los que no usa ningún triángulo se descartan)
+		vector<VERTEX> optimizedVertices(usedVertices);
+		for(UINT i=0; i<m_totalVertices; ++i) {
+			if(remap[i] != MeshOptimizer::NO_VERTEX)
+				optimizedVertices[remap[i]] = m_vertices[i];
+		}
+
+		m_vertices.swap(optimizedVertices);
+		m_totalVertices = usedVertices;
+
+		m_cacheStatisticsAfter = MeshOptimizer::AnalyzeVertexCache(indices, m_totalFaces, m_totalVertices);
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
 	}
-	m_attributes.clear();	//Borramos esto porque no nos sirve luego de aplicar Optimize. En su lugar usamos la tabla de atributos
 
-	//reorganizar los vertices de acuerdo al subset y optimizar la mesh para la cache de vertices de la tarjeta de video
-	//Cuando se renderiza la lista de triangulos de la mesh los vertices van a hacer cache hit mas a menudo asi que nos evitamos volver a ejecutar el vertex shader
-	if(FAILED( hr = m_mesh->GenerateAdjacencyAndPointReps( 1e-6f ) )) {
-		DXGI_D3D_ErrorWarning(hr, L"Mesh::Init --> ID3DX10Mesh::GenerateAdjacencyAndPointReps");
-		return hr;
-	}	
-	const UINT a = m_mesh->GetVertexCount();
-	if(FAILED( hr = m_d3dManager.OptimizeMesh(m_mesh, D3DX10_MESHOPT_ATTR_SORT | D3DX10_MESHOPT_VERTEX_CACHE, NULL, NULL, a ) )) 
-		return hr;
-	m_totalVertices = m_mesh->GetVertexCount();
+	m_attributes.clear();	//Borramos esto porque no nos sirve luego de optimizar. En su lugar usamos la tabla de atributos
 
+	//los clusters de un mismo material son consecutivos (ClusterSpatially los numera por atributo): cada entrada de la tabla de
+	//atributos es la unión de los clusters de un material
+	if(m_chunked)
+	{
+		try
+		{
+			m_clusters.resize(subsets.size());
+		}
+		catch (std::bad_alloc &)
+		{
+			MiscErrorWarning(BAD_ALLOC);
+			return E_FAIL;
+		}
 
-	//cargar tabla de atributos
-	if(FAILED(hr = m_mesh->GetAttributeTable( NULL, &m_numAttribTableEntries ))) {
-		DXGI_D3D_ErrorWarning(hr, L"Mesh::Init --> ID3DX10Mesh::GetAttributeTable");
-		return hr;
+		UINT numMerged = 0;
+
+		for(UINT c=0; c<subsets.size(); ++c)
+		{
+			const MeshSubset cluster = subsets[c];
+			const UINT material = clusterAttributes[cluster.attribute];
+
+			if(numMerged == 0 || subsets[numMerged - 1].attribute != material) {
+				subsets[numMerged] = cluster;
+				subsets[numMerged].attribute = material;
+				++numMerged;
+			} else {
+				MeshSubset &merged = subsets[numMerged - 1];
+				merged.faceCount = cluster.faceStart + cluster.faceCount - merged.faceStart;
+				merged.vertexCount = cluster.vertexStart + cluster.vertexCount - merged.vertexStart;
+			}
+
+			MeshCluster &meshCluster = m_clusters[c];
+
+			meshCluster.faceStart = cluster.faceStart;
+			meshCluster.faceCount = cluster.faceCount;
+			meshCluster.vertexStart = cluster.vertexStart;
+			meshCluster.vertexCount = cluster.vertexCount;
+			meshCluster.subset = numMerged - 1;
+
+			_ASSERT(cluster.vertexCount <= MeshClusterCache::MAX_CLUSTER_VERTICES);
+
+			meshCluster.boundsMin = meshCluster.boundsMax = m_vertices[cluster.vertexStart].position;
+			for(UINT v=cluster.vertexStart + 1; v<cluster.vertexStart + cluster.vertexCount; ++v) {
+				D3DXVec3Minimize(&meshCluster.boundsMin, &meshCluster.boundsMin, &m_vertices[v].position);
+				D3DXVec3Maximize(&meshCluster.boundsMax, &meshCluster.boundsMax, &m_vertices[v].position);
+			}
+		}
+
+		subsets.resize(numMerged);
 	}
 
+	//cargar tabla de atributos
+	m_numAttribTableEntries = static_cast<UINT> ( subsets.size() );
+
 	if(m_numAttribTableEntries == 0) { 
 		MiscErrorWarning(MESHFILE_ERROR, L"Mesh::Init");
 		return E_INVALIDARG;
@@ -115,132 +265,578 @@ HRESULT Mesh::Init(const wstring &meshFile,  const UINT numVertices, const UINT
 		MiscErrorWarning(BAD_ALLOC); 
 		return E_FAIL;
 	}
-	if(FAILED(hr = m_mesh->GetAttributeTable( m_pAttribTable, &m_numAttribTableEntries ))) {
-		DXGI_D3D_ErrorWarning(hr, L"Mesh::Init --> ID3DX10Mesh::GetAttributeTable");
-		return hr;
+
+	for(UINT i=0; i<m_numAttribTableEntries; ++i) {
+		m_pAttribTable[i].AttribId = subsets[i].attribute;
+		m_pAttribTable[i].FaceStart = subsets[i].faceStart;
+		m_pAttribTable[i].FaceCount = subsets[i].faceCount;
+		m_pAttribTable[i].VertexStart = subsets[i].vertexStart;
+		m_pAttribTable[i].VertexCount = subsets[i].vertexCount;
 	}
 
-	//crear vertex, index buffer de direct3d11 copiando los datos que están en el vertex e index buffer de la ID3DX10Mesh
-	//vertex buffer
-	ID3DX10MeshBuffer *meshVertexBuffer = NULL;
-	void *vertices = NULL;
-	SIZE_T size;
+	return S_OK;
+}
 
-	if(FAILED(hr = m_mesh->GetVertexBuffer(0, &meshVertexBuffer))) {
-		DXGI_D3D_ErrorWarning(hr, L"Mesh::Init --> ID3DX10Mesh::GetVertexBuffer");
-		return hr;
+//------------------------------------------------------------------------------------------
+// Cada cluster debe poder subirse solo a la GPU, así que no comparte vértices: un vértice
+// usado por caras de varios clusters queda en el primero y los demás usan una copia. Las
+// caras se recorren agrupadas por cluster, con lo que alcanza con recordar la última copia
+// de cada vértice. Las copias se agregan al final de m_vertices.
+//------------------------------------------------------------------------------------------
+void Mesh::SplitIntoClusters(const unsigned int * const indices, unsigned int * const attributes, vector<UINT> &clusterAttributes)
+{
+	//los índices se modifican a través de m_indices (indices apunta a sus datos)
+	vector<UINT> clusters;
+	const UINT numClusters = MeshOptimizer::ClusterSpatially(indices, attributes, m_totalFaces, &(m_vertices[0].position.x), sizeof(Vertex),
+	                                                         MESH_CLUSTER_FACES, clusters, clusterAttributes);
+
+	//caras ordenadas por cluster (counting sort)
+	vector<UINT> firstFace(numClusters + 1, 0);
+	for(UINT f=0; f<m_totalFaces; ++f)
+		firstFace[clusters[f] + 1]++;
+	for(UINT c=0; c<numClusters; ++c)
+		firstFace[c + 1] += firstFace[c];
+
+	vector<UINT> order(m_totalFaces);
+	for(UINT f=0; f<m_totalFaces; ++f)
+		order[firstFace[clusters[f]]++] = f;
+
+	static const UINT NO_CLUSTER = 0xFFFFFFFF;
+
+	vector<UINT> owner(m_totalVertices, NO_CLUSTER);        //cluster que usa el vértice original
+	vector<UINT> copyCluster(m_totalVertices, NO_CLUSTER);  //cluster de la última copia del vértice
+	vector<UINT> lastCopy(m_totalVertices);
+
+	for(UINT i=0; i<m_totalFaces; ++i)
+	{
+		const UINT f = order[i];
+		const UINT cluster = clusters[f];
+
+		for(UINT k=0; k<3; ++k)
+		{
+			DWORD &index = m_indices[f * 3 + k];
+			const UINT v = index;
+
+			if(owner[v] == NO_CLUSTER) owner[v] = cluster;
+			if(owner[v] == cluster) continue;
+
+			if(copyCluster[v] != cluster) {
+				const VERTEX copy = m_vertices[v];
+				m_vertices.push_back(copy);
+
+				copyCluster[v] = cluster;
+				lastCopy[v] = static_cast<UINT> (m_vertices.size() - 1);
+			}
+
+			index = lastCopy[v];
+		}
+
+		attributes[f] = cluster;
 	}
-	if(FAILED(hr = meshVertexBuffer->Map(&vertices, &size))) {  //size = sizeof(Vertex) * m_mesh->GetVertexCount();
-		DXGI_D3D_ErrorWarning(hr, L"Mesh::Init --> ID3DX10MeshBuffer::Map");
-		SAFE_RELEASE(meshVertexBuffer);
-		return hr;
+
+	m_totalVertices = static_cast<UINT> (m_vertices.size());
+}
+
+//vertices: m_totalVertices vértices. indices: m_totalFaces * 3 índices de 32 bits
+HRESULT Mesh::CreateBuffers(const void * const vertices, const void * const indices)
+{
+	HRESULT hr;
+
+	//formato compacto: sólo si las coordenadas de textura de todos los vértices entran en half float (normales y tangentes siempre entran)
+	vector<CompactVertex> compactVertices;
+	const Vertex * const meshVertices = reinterpret_cast<const Vertex *>(vertices);
+
+	if(m_compactVertices) 
+	{
+		m_compactVertices = CompactVertexCodec::MeasureError(meshVertices, m_totalVertices).texCoord <= MAX_COMPACT_TEXCOORD_ERROR;
+
+		if(m_compactVertices) 
+		{
+			try
+			{
+				compactVertices.resize(m_totalVertices);
+			}
+			catch (bad_alloc &) 
+			{
+				MiscErrorWarning(BAD_ALLOC);
+				return E_FAIL;
+			}
+
+			CompactVertexCodec::Encode(meshVertices, m_totalVertices, &compactVertices[0]);
+		}
 	}
-	if((m_vertexBuffer = new (std::nothrow) VertexBuffer(m_d3dManager, size, vertices)) == NULL) {
+
+	const void * const vertexData = m_compactVertices ? static_cast<const void *>(&compactVertices[0]) : vertices;
+
+	if((m_vertexBuffer = new (std::nothrow) VertexBuffer(m_d3dManager, m_totalVertices * GetVertexStride(), vertexData)) == NULL) {
 		MiscErrorWarning(BAD_ALLOC);
-		meshVertexBuffer->Unmap();
-		SAFE_RELEASE(meshVertexBuffer);
 		return E_FAIL;
 	}
-	if(FAILED( hr = m_vertexBuffer->Init() )) { 
-		meshVertexBuffer->Unmap();
-		SAFE_RELEASE(meshVertexBuffer);
-		return hr;
+	if(FAILED( hr = m_vertexBuffer->Init() )) return hr;
+
+	if((m_indexBuffer = new (std::nothrow) IndexBuffer(m_d3dManager, m_totalFaces * 3 * sizeof(DWORD), indices)) == NULL) {
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
 	}
-	meshVertexBuffer->Unmap();
-	SAFE_RELEASE(meshVertexBuffer);
+	if(FAILED( hr = m_indexBuffer->Init() )) return hr;
+
+	return S_OK;
+}
 
-	//index buffer
-	ID3DX10MeshBuffer *meshIndexBuffer = NULL;
-	void *indices = NULL;
-	SIZE_T sizeI = 0;
+//vertices e indices deben existir mientras exista la mesh (el archivo proyectado o m_vertices y m_indices)
+HRESULT Mesh::CreateClusterCache(const Vertex * const vertices, const DWORD * const indices)
+{
+	//el formato se decide para toda la mesh, igual que en CreateBuffers
+	if(m_compactVertices)
+		m_compactVertices = CompactVertexCodec::MeasureError(vertices, m_totalVertices).texCoord <= MAX_COMPACT_TEXCOORD_ERROR;
 
-	if(FAILED(hr = m_mesh->GetIndexBuffer(&meshIndexBuffer))) {
-		DXGI_D3D_ErrorWarning(hr, L"Mesh::Init --> ID3DX10Mesh::GetIndexBuffer");
-		return  hr;
+	if((m_clusterCache = new (std::nothrow) MeshClusterCache(m_d3dManager, *m_residencyBudget)) == NULL) {
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
 	}
-	if(FAILED(hr = meshIndexBuffer->Map(&indices, &sizeI))) {
-		DXGI_D3D_ErrorWarning(hr, L"Mesh::Init --> ID3DX10MeshBuffer::Map");
-		SAFE_RELEASE(meshIndexBuffer);
-		return hr;
+
+	return m_clusterCache->Init(&m_clusters[0], GetNumClusters(), vertices, indices, m_compactVertices,
+	                            m_lodIndices.empty() ? NULL : &m_lodIndices[0], m_lodIndexBases.empty() ? NULL : &m_lodIndexBases[0]);
+}
+
+//------------------------------------------------------------------------------------------
+// Cada cluster se simplifica por separado con sus índices locales. MeshSimplifier no mueve
+// los vértices de los bordes, que son los vértices duplicados entre clusters vecinos, así
+// que dos clusters dibujados con distintos niveles no dejan grietas entre ellos.
+//------------------------------------------------------------------------------------------
+HRESULT Mesh::BuildClusterLODs(const Vertex * const vertices, const DWORD * const indices)
+{
+	HRESULT hr;
+
+	const UINT numClusters = GetNumClusters();
+
+	vector< vector<unsigned int> > clusterIndices;
+	vector< vector<SimplifiedLevel> > clusterLevels;
+	vector<char> failed;
+
+	try
+	{
+		clusterIndices.resize(numClusters);
+		clusterLevels.resize(numClusters);
+		failed.assign(numClusters, 0);
 	}
-	if((m_indexBuffer = new (std::nothrow) IndexBuffer(m_d3dManager, sizeI, indices)) == NULL) {
+	catch (bad_alloc &) 
+	{
 		MiscErrorWarning(BAD_ALLOC);
-		meshIndexBuffer->Unmap();
-		SAFE_RELEASE(meshIndexBuffer);
 		return E_FAIL;
 	}
-	if(FAILED( hr = m_indexBuffer->Init() )) {
-		meshIndexBuffer->Unmap();
-		SAFE_RELEASE(meshIndexBuffer);
-		return hr;
+
+	ThreadPool threadPool;
+	if(FAILED(hr = threadPool.Init())) return hr;
+
+	threadPool.ParallelFor(numClusters, [&](const UINT c, const UINT) {
+		const MeshCluster &cluster = m_clusters[c];
+
+		try
+		{
+			vector<unsigned int> local(cluster.faceCount * 3);
+			const DWORD * const source = indices + cluster.faceStart * static_cast<size_t> (3);
+
+			for(UINT i=0; i<cluster.faceCount * 3; ++i)
+				local[i] = source[i] - cluster.vertexStart;
+
+			MeshSimplifier::BuildLODChain(&local[0], cluster.faceCount, &vertices[cluster.vertexStart].position.x, sizeof(Vertex),
+			                              cluster.vertexCount, m_lodLevels, MIN_LOD_FACES, clusterIndices[c], clusterLevels[c]);
+		}
+		catch (bad_alloc &)
+		{
+			failed[c] = 1;
+		}
+	});
+
+	UINT totalIndices = 0, totalLevels = 0;
+	for(UINT c=0; c<numClusters; ++c) {
+		if(failed[c]) {
+			MiscErrorWarning(BAD_ALLOC);
+			return E_FAIL;
+		}
+
+		totalIndices += static_cast<UINT> (clusterIndices[c].size());
+		totalLevels += static_cast<UINT> (clusterLevels[c].size());
 	}
-	meshIndexBuffer->Unmap();
-	SAFE_RELEASE(meshIndexBuffer);
-						
 
-	//cargar texturas del material
-	wstring rutaTextura;
-	for(UINT i = 0; i < m_materials.size(); ++i) {
-		Material *pMaterial = &(m_materials[i]);
-		if(pMaterial->GetDiffuseTextureName().size() > 0 ) {
-			rutaTextura = TEXTURES_DIRECTORY + pMaterial->GetDiffuseTextureName();
+	try
+	{
+		m_lodIndices.resize(totalIndices);
+		m_lodIndexBases.resize(numClusters + 1);
+		m_clusterLODs.resize(totalLevels);
+		m_clusterLODBases.resize(numClusters + 1);
+	}
+	catch (bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
 
-			//creamos una shader resource desde la imagen 2d almacenada en un archivo en disco para poder leerla desde un shader
-			ID3D11ShaderResourceView *srv = (ID3D11ShaderResourceView *) ERROR_RESOURCE_VALUE;
-			if(FAILED( hr = m_d3dManager.CreateShaderResourceViewFromFileD3D11(rutaTextura.c_str(), NULL, NULL, &(srv), NULL) )) {
-				MessageBox(NULL, pMaterial->GetDiffuseTextureName().c_str(), L"Texture Error", MB_OK);
-				return hr;
-			}
-			pMaterial->SetDiffuseTextureSRV(srv);		//las copias no aumentan las reference count
+	//los índices de los niveles van después de los de la geometría completa en el index buffer del cluster
+	UINT indexBase = 0, levelBase = 0;
+	for(UINT c=0; c<numClusters; ++c) 
+	{
+		m_lodIndexBases[c] = indexBase;
+		m_clusterLODBases[c] = levelBase;
+
+		for(UINT i=0; i<clusterIndices[c].size(); ++i)
+			m_lodIndices[indexBase + i] = static_cast<WORD> (clusterIndices[c][i]);
+
+		for(UINT l=0; l<clusterLevels[c].size(); ++l) {
+			MeshClusterLOD &lod = m_clusterLODs[levelBase + l];
+			lod.indexStart = m_clusters[c].faceCount * 3 + clusterLevels[c][l].indexStart;
+			lod.indexCount = clusterLevels[c][l].indexCount;
+			lod.error = clusterLevels[c][l].error;
 		}
 
-		if(pMaterial->GetNormalTextureName().size() > 0 ) {
-			rutaTextura = TEXTURES_DIRECTORY + pMaterial->GetNormalTextureName();
+		indexBase += static_cast<UINT> (clusterIndices[c].size());
+		levelBase += static_cast<UINT> (clusterLevels[c].size());
+	}
 
-			//lo mismo para la normal texture
-			ID3D11ShaderResourceView *srv = (ID3D11ShaderResourceView*)ERROR_RESOURCE_VALUE;
-			if(FAILED( hr = m_d3dManager.CreateShaderResourceViewFromFileD3D11(rutaTextura.c_str(), NULL, NULL, &(srv), NULL) )) {
-				MessageBox(NULL, pMaterial->GetNormalTextureName().c_str(), L"Texture Error", MB_OK);
-				return hr;
+	m_lodIndexBases[numClusters] = indexBase;
+	m_clusterLODBases[numClusters] = levelBase;
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// Caché de la mesh optimizada. Un archivo por .obj en MESH_CACHE_DIRECTORY, válido mientras
+// no cambien el tamaño ni la fecha de modificación del .obj y del .mtl. Formato del archivo:
+// MeshCacheHeader, vértices, índices de 32 bits, tabla de atributos, clusters (numClusters
+// MeshCluster, sólo en meshes por partes), nombre del .mtl (materialFileLength WCHARs) y por
+// cada material MaterialLightProperties seguido del nombre, la textura difusa y la normal
+// (cada una un UINT con la cantidad de WCHARs y los caracteres). Los vértices y los índices
+// se usan directamente desde el archivo proyectado en memoria. Una mesh por partes usa otro
+// archivo que la misma mesh sin partes, así las dos pueden estar en el caché a la vez.
+//------------------------------------------------------------------------------------------
+
+const char Mesh::MESH_CACHE_FILE_MAGIC[4] = { 'M', 'S', 'H', 'C' };
+
+static bool GetFileStamp(const wstring &file, UINT64 &size, UINT64 &writeTime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if(!GetFileAttributesEx(file.c_str(), GetFileExInfoStandard, &data)) return false;
+
+	size = (static_cast<UINT64> (data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+	writeTime = (static_cast<UINT64> (data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+
+	return true;
+}
+
+static bool ReadCacheData(const BYTE *&p, const BYTE * const end, void * const dest, const UINT64 size)
+{
+	if(size > static_cast<UINT64> (end - p)) return false;
+
+	memcpy(dest, p, static_cast<size_t> (size));
+	p += size;
+
+	return true;
+}
+
+static bool ReadCacheString(const BYTE *&p, const BYTE * const end, wstring &s)
+{
+	UINT length;
+	if(!ReadCacheData(p, end, &length, sizeof(UINT))) return false;
+	if(length > static_cast<UINT64> (end - p) / sizeof(WCHAR)) return false;
+
+	s.assign(reinterpret_cast<const WCHAR *>(p), length);
+	p += length * sizeof(WCHAR);
+
+	return true;
+}
+
+static void WriteCacheString(ofstream &output, const wstring &s)
+{
+	const UINT length = static_cast<UINT> (s.length());
+
+	output.write((const char *) &length, sizeof(UINT));
+	output.write((const char *) s.c_str(), length * sizeof(WCHAR));
+}
+
+wstring Mesh::GetMeshCacheFileName(const wstring &meshFile, const bool chunked)
+{
+	return MESH_CACHE_DIRECTORY + meshFile + (chunked ? L".chunked.mshc" : L".mshc");
+}
+
+//devuelve S_FALSE si no hay un archivo válido. Sólo falla si no hay memoria para los materiales o la tabla de atributos
+HRESULT Mesh::LoadFromMeshCache()
+{
+	if(FAILED(m_cacheFile.Open(GetMeshCacheFileName(m_meshFile, m_chunked)))) return S_FALSE;
+
+	const BYTE *p = m_cacheFile.GetData();
+	const BYTE * const end = p + m_cacheFile.GetSize();
+
+	MeshCacheHeader header;
+	if(!ReadCacheData(p, end, &header, sizeof(MeshCacheHeader)) || memcmp(header.magic, MESH_CACHE_FILE_MAGIC, 4) != 0 ||
+	   header.version != MESH_CACHE_FILE_VERSION || header.vertexSize != sizeof(Vertex) || header.numVertices == 0 || 
+	   header.numFaces == 0 || header.numAttribTableEntries == 0 || header.numMaterials == 0 || (header.numClusters > 0) != m_chunked) 
+	{
+		m_cacheFile.Close();
+		return S_FALSE;
+	}
+
+	const UINT64 verticesSize = static_cast<UINT64> (header.numVertices) * sizeof(Vertex);
+	const UINT64 indicesSize = static_cast<UINT64> (header.numFaces) * 3 * sizeof(DWORD);
+	const UINT64 attribTableSize = static_cast<UINT64> (header.numAttribTableEntries) * sizeof(D3DX10_ATTRIBUTE_RANGE);
+	const UINT64 clustersSize = static_cast<UINT64> (header.numClusters) * sizeof(MeshCluster);
+
+	if(verticesSize + indicesSize + attribTableSize + clustersSize > static_cast<UINT64> (end - p)) {
+		m_cacheFile.Close();
+		return S_FALSE;
+	}
+
+	const BYTE * const vertices = p;
+	const BYTE * const indices = vertices + verticesSize;
+	const BYTE * const attribTable = indices + indicesSize;
+	const BYTE * const clusterTable = attribTable + attribTableSize;
+
+	p = clusterTable + clustersSize;
+
+	bool valid = true;
+
+	try
+	{
+		//el .obj y el .mtl no deben haber cambiado desde que se escribió el caché
+		UINT64 size, writeTime;
+
+		valid = GetFileStamp(MESHES_DIRECTORY + m_meshFile, size, writeTime) && size == header.objSize && writeTime == header.objWriteTime &&
+		        header.materialFileLength <= static_cast<UINT64> (end - p) / sizeof(WCHAR);
+
+		if(valid) {
+			m_materialFile.assign(reinterpret_cast<const WCHAR *>(p), header.materialFileLength);
+			p += header.materialFileLength * sizeof(WCHAR);
+
+			if(m_materialFile.length() > 0)
+				valid = GetFileStamp(MTLS_DIRECTORY + m_materialFile, size, writeTime) && size == header.mtlSize && writeTime == header.mtlWriteTime;
+		}
+
+		for(UINT i=0; valid && i<header.numMaterials; ++i)
+		{
+			MaterialLightProperties lightProperties;
+			wstring name, diffuseTexture, normalTexture;
+
+			valid = ReadCacheData(p, end, &lightProperties, sizeof(MaterialLightProperties)) && ReadCacheString(p, end, name) &&
+			        ReadCacheString(p, end, diffuseTexture) && ReadCacheString(p, end, normalTexture);
+
+			if(valid) {
+				m_materials.push_back(Material());
+				Material *pMaterial = &(m_materials[m_materials.size() - 1]);
+
+				pMaterial->SetName(name.c_str());
+				pMaterial->SetLightProperties(lightProperties);
+				pMaterial->SetDiffuseTextureName(diffuseTexture);
+				pMaterial->SetNormalTextureName(normalTexture);
 			}
-			pMaterial->SetNormalTextureSRV(srv);
 		}
 	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
 
-	this->SetTechniquesForMaterials();
+	//los índices y los subsets deben estar dentro de la mesh (un archivo truncado o corrupto no debe llegar a la GPU)
+	if(valid) {
+		const DWORD * const idx = reinterpret_cast<const DWORD *>(indices);
+		const UINT64 numIndices = static_cast<UINT64> (header.numFaces) * 3;
+		for(UINT64 i=0; valid && i<numIndices; ++i)
+			valid = idx[i] < header.numVertices;
+
+		const D3DX10_ATTRIBUTE_RANGE * const ranges = reinterpret_cast<const D3DX10_ATTRIBUTE_RANGE *>(attribTable);
+		for(UINT i=0; valid && i<header.numAttribTableEntries; ++i)
+			valid = ranges[i].AttribId < header.numMaterials && ranges[i].FaceStart <= header.numFaces &&
+			        ranges[i].FaceCount <= header.numFaces - ranges[i].FaceStart;
+
+		//cada cluster debe usar sólo sus vértices: sus índices se pasan a 16 bits restando vertexStart
+		const MeshCluster * const clusters = reinterpret_cast<const MeshCluster *>(clusterTable);
+		for(UINT c=0; valid && c<header.numClusters; ++c)
+		{
+			const MeshCluster &cluster = clusters[c];
 
-	m_ready = true;
+			valid = cluster.subset < header.numAttribTableEntries && cluster.faceStart <= header.numFaces && 
+			        cluster.faceCount <= header.numFaces - cluster.faceStart && cluster.vertexStart <= header.numVertices &&
+			        cluster.vertexCount <= header.numVertices - cluster.vertexStart && cluster.vertexCount <= MeshClusterCache::MAX_CLUSTER_VERTICES;
+
+			for(UINT64 i=cluster.faceStart * static_cast<UINT64> (3); valid && i<(cluster.faceStart + static_cast<UINT64> (cluster.faceCount)) * 3; ++i)
+				valid = idx[i] >= cluster.vertexStart && idx[i] - cluster.vertexStart < cluster.vertexCount;
+		}
+	}
+
+	if(valid && header.numClusters > 0)
+	{
+		try
+		{
+			const MeshCluster * const clusters = reinterpret_cast<const MeshCluster *>(clusterTable);
+			m_clusters.assign(clusters, clusters + header.numClusters);
+		}
+		catch (std::bad_alloc &)
+		{
+			MiscErrorWarning(BAD_ALLOC);
+			return E_FAIL;
+		}
+	}
+
+	if(!valid) {
+		m_materials.clear();
+		m_materialFile.clear();
+		m_cacheFile.Close();
+		return S_FALSE;
+	}
+
+	if((m_pAttribTable = new (std::nothrow) D3DX10_ATTRIBUTE_RANGE[header.numAttribTableEntries]) == NULL) {
+		MiscErrorWarning(BAD_ALLOC); 
+		return E_FAIL;
+	}
+	memcpy(m_pAttribTable, attribTable, header.numAttribTableEntries * sizeof(D3DX10_ATTRIBUTE_RANGE));
+
+	m_numAttribTableEntries = header.numAttribTableEntries;
+	m_totalVertices = header.numVertices;
+	m_totalFaces = header.numFaces;
+	m_cacheStatisticsBefore = header.cacheStatisticsBefore;
+	m_cacheStatisticsAfter = header.cacheStatisticsAfter;
+
+	m_cachedVertices = reinterpret_cast<const Vertex *>(vertices);
+	m_cachedIndices = reinterpret_cast<const DWORD *>(indices);
 
 	return S_OK;
 }
 
+HRESULT Mesh::StoreInMeshCache(const void * const vertices, const void * const indices) const
+{
+	MeshCacheHeader header;
+	ZeroMemory(&header, sizeof(MeshCacheHeader));
+
+	memcpy(header.magic, MESH_CACHE_FILE_MAGIC, 4);
+	header.version = MESH_CACHE_FILE_VERSION;
+	header.vertexSize = sizeof(Vertex);
+	header.numVertices = m_totalVertices;
+	header.numFaces = m_totalFaces;
+	header.numAttribTableEntries = m_numAttribTableEntries;
+	header.numClusters = GetNumClusters();
+	header.numMaterials = GetNumMaterials();
+	header.materialFileLength = static_cast<UINT> (m_materialFile.length());
+	header.cacheStatisticsBefore = m_cacheStatisticsBefore;
+	header.cacheStatisticsAfter = m_cacheStatisticsAfter;
+
+	if(!GetFileStamp(MESHES_DIRECTORY + m_meshFile, header.objSize, header.objWriteTime)) {
+		ErrorWarning(L"Mesh::StoreInMeshCache --> GetFileAttributesEx");
+		return E_FAIL;
+	}
+	if(m_materialFile.length() > 0 && !GetFileStamp(MTLS_DIRECTORY + m_materialFile, header.mtlSize, header.mtlWriteTime)) {
+		ErrorWarning(L"Mesh::StoreInMeshCache --> GetFileAttributesEx");
+		return E_FAIL;
+	}
+
+	if(!CreateDirectory(MESH_CACHE_DIRECTORY, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+		ErrorWarning(L"Mesh::StoreInMeshCache --> CreateDirectory");
+		return E_FAIL;
+	}
+
+	//se escribe a un archivo temporal y luego se reemplaza el definitivo para no dejar nunca un archivo a medio escribir
+	const wstring file = GetMeshCacheFileName(m_meshFile, m_chunked);
+	const wstring tmpFile = file + L".tmp";
 
-HRESULT Mesh::LoadGeometryFromOBJ( const wstring &strFileName, const UINT numVertices, const UINT numNormals, const UINT numCoords )
+	ofstream output;
+	output.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+	try 
+	{
+		output.open(tmpFile.c_str(), std::ios::binary);
+
+		output.write((const char *) &header, sizeof(MeshCacheHeader));
+		output.write((const char *) vertices, static_cast<std::streamsize> (m_totalVertices) * sizeof(Vertex));
+		output.write((const char *) indices, static_cast<std::streamsize> (m_totalFaces) * 3 * sizeof(DWORD));
+		output.write((const char *) m_pAttribTable, m_numAttribTableEntries * sizeof(D3DX10_ATTRIBUTE_RANGE));
+		if(!m_clusters.empty())
+			output.write((const char *) &m_clusters[0], m_clusters.size() * sizeof(MeshCluster));
+		output.write((const char *) m_materialFile.c_str(), m_materialFile.length() * sizeof(WCHAR));
+
+		for(UINT i=0; i<m_materials.size(); ++i) {
+			output.write((const char *) &(m_materials[i].GetLightProperties()), sizeof(MaterialLightProperties));
+			WriteCacheString(output, m_materials[i].GetName());
+			WriteCacheString(output, m_materials[i].GetDiffuseTextureName());
+			WriteCacheString(output, m_materials[i].GetNormalTextureName());
+		}
+
+		output.close();
+	}
+	catch (std::ofstream::failure &) 
+	{
+		MiscErrorWarning(IFSTREAM_ERROR, L"Mesh::StoreInMeshCache");
+		if(output.is_open()) output.close();
+		DeleteFile(tmpFile.c_str());
+		return E_FAIL;
+	}
+
+	if(!MoveFileEx(tmpFile.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+		ErrorWarning(L"Mesh::StoreInMeshCache --> MoveFileEx");
+		DeleteFile(tmpFile.c_str());
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// Mesh por partes recién construida: los vértices y los índices pasan a leerse del archivo
+// del caché recién escrito (proyectado en memoria) y se libera la copia en memoria, así la
+// mesh completa no queda residente. Si el archivo no coincide se sigue usando la copia.
+//------------------------------------------------------------------------------------------
+HRESULT Mesh::MapStoredGeometry()
 {
-	HRESULT hr = E_FAIL;
+	if(FAILED(m_cacheFile.Open(GetMeshCacheFileName(m_meshFile, m_chunked)))) return S_FALSE;
 
-	static const int BUFFERSIZE = 4096;
-	static const int MAX_LINE_LENGTH = 100;
+	const UINT64 verticesSize = static_cast<UINT64> (m_totalVertices) * sizeof(Vertex);
+	const UINT64 indicesSize = static_cast<UINT64> (m_totalFaces) * 3 * sizeof(DWORD);
+
+	MeshCacheHeader header;
+	if(m_cacheFile.GetSize() < sizeof(MeshCacheHeader) + verticesSize + indicesSize) {
+		m_cacheFile.Close();
+		return S_FALSE;
+	}
 
-	vector <D3DXVECTOR3> *positions = NULL;
-	vector <D3DXVECTOR2> *texCoords = NULL;
-	vector <D3DXVECTOR3> *normals = NULL;
+	memcpy(&header, m_cacheFile.GetData(), sizeof(MeshCacheHeader));
 
-	HANDLE hFile=INVALID_HANDLE_VALUE;
+	if(memcmp(header.magic, MESH_CACHE_FILE_MAGIC, 4) != 0 || header.version != MESH_CACHE_FILE_VERSION || 
+	   header.numVertices != m_totalVertices || header.numFaces != m_totalFaces || header.numClusters != GetNumClusters()) 
+	{
+		m_cacheFile.Close();
+		return S_FALSE;
+	}
+
+	m_cachedVertices = reinterpret_cast<const Vertex *>(m_cacheFile.GetData() + sizeof(MeshCacheHeader));
+	m_cachedIndices = reinterpret_cast<const DWORD *>(m_cacheFile.GetData() + sizeof(MeshCacheHeader) + verticesSize);
+
+	vector<VERTEX>().swap(m_vertices);
+	vector<DWORD>().swap(m_indices);
+
+	return S_OK;
+}
+
+HRESULT Mesh::LoadGeometryFromOBJ( const wstring &strFileName )
+{
+	HRESULT hr = E_FAIL;
+
+	//el archivo se lee completo (en paralelo) antes de armar los vértices
+	OBJParser parser;
+	if(FAILED( hr = parser.Parse(strFileName) )) return hr;
+
+	const vector<D3DXVECTOR3> &positions = parser.GetPositions();
+	const vector<D3DXVECTOR2> &texCoords = parser.GetTexCoords();
+	const vector<D3DXVECTOR3> &normals = parser.GetNormals();
+	const vector<OBJFace> &faces = parser.GetFaces();
+	const vector<OBJEvent> &events = parser.GetEvents();
 
 	WCHAR *wstrNameC = NULL;
 
 	try 
 	{	
-		//almacenamiento temporal para los datos de entrada
-		positions = new vector<D3DXVECTOR3>;
-		texCoords = new vector<D3DXVECTOR2>;
-		normals = new vector<D3DXVECTOR3>;
-
-		positions->reserve(numVertices+1);
-		normals->reserve(numNormals+1);
-		texCoords->reserve(numCoords+1);
-	
+		//ahora se conocen las cantidades exactas
+		m_vertices.reserve(positions.size());
+		m_indices.reserve(faces.size() * 3);
+		m_attributes.reserve(faces.size());
+		m_vertexTable.Reserve(static_cast<UINT>(positions.size()));
 
 		//material por defecto si el archivo no especifica ninguno para el primer subconjunto de triangulos
 		m_materials.push_back( Material() );
@@ -249,144 +845,33 @@ HRESULT Mesh::LoadGeometryFromOBJ( const wstring &strFileName, const UINT numVer
 		//indice que indica cual material esta activo para las faces que estemos cargando en ese momento
 		DWORD curSubset = 0;
 
-		//primer elemento en el vector de posiciones que corresponde al objeto 3ds max que estamos procesando 
-		//(hay muchos objetos 3D en la escena 3DS Max pero todos serán cargados en la misma Mesh)
-		UINT firstIndex = 0;
-
 		string strMaterialFilenameTmp;
-		wstring strMaterialFilename;
-
-		// File input
-		char readBuffer[BUFFERSIZE] = {0};	//leemos el archivo de a bloques grandes para mejor performance
-		DWORD bytesToRead;
-		
-		if((hFile = CreateFile(strFileName.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL)) == INVALID_HANDLE_VALUE) {
-			ErrorWarning(L"Mesh::LoadGeometryFromOBJ --> CreateFile");
-			throw 'e';
-		}
-
-		if(!ReadFile(hFile, readBuffer, BUFFERSIZE-1, &bytesToRead, NULL)) {
-			ErrorWarning(L"Mesh::LoadGeometryFromOBJ --> ReadFile");
-			throw 'e';
-		}
-
-		//pasamos el buffer leído a un stringstream para una cómoda extracción de datos con formato
-		stringstream inputFile(stringstream::in | stringstream::out);
-		inputFile.exceptions( stringstream::failbit | stringstream::badbit );
 
-		inputFile << readBuffer;
-		char c;
-		string strCommand;
-		while( (c = inputFile.peek()) != EOF && !inputFile.eof() ) 
+		//los vértices se agregan en el orden del archivo, aplicando g/usemtl/mtllib justo antes de la cara en la que aparecieron
+		UINT nextEvent = 0;
+		for( UINT iFace = 0; iFace <= faces.size(); iFace++ ) 
 		{
-			if(!isspace( c )) 
+			for( ; nextEvent < events.size() && events[nextEvent].face == iFace; nextEvent++ ) 
 			{
-				inputFile >> strCommand;
-			
-				if( strCommand == "#" ) 
-				{
-					// comentario
-				} 
-				else if( strCommand == "g" ) //las g indican que lo que sigue es la descripcion de las caras de un nuevo objeto
-				{	
-					//los vertices que forman parte de un objeto 3d en el archivo .obj no se comparten con los del siguiente objeto, asi que borremos la tabla hash
-					for(UINT i=0; i<HASH_TABLE_SIZE; i++)
-						m_hashTable[i].clear();
-
-					firstIndex = positions->size();
-				}
-				else if( strCommand == "v" ) 
-				{
-					// posicion
-					float x, y, z;
-					inputFile >> x >> y >> z;
-					(*positions).push_back( D3DXVECTOR3( x, y, z ) );
-				}
-				else if( strCommand == "vt" ) 
-				{
-					// texCoord
-					float u, v;
-					inputFile >> u >> v;
-					(*texCoords).push_back( D3DXVECTOR2( u, v ) );
-				}
-				else if( strCommand == "vn" ) 
-				{
-					// normal
-					float x, y, z;
-					inputFile >> x >> y >> z;
-					(*normals).push_back( D3DXVECTOR3( x, y, z ) );
-				}
-				else if( strCommand == "f" ) 
-				{
-					// face
-					UINT iPosition, iTexCoord, iNormal;
-					VERTEX vertex;
-
-					for( UINT iFace = 0; iFace < 3; iFace++ ) 
-					{
-						ZeroMemory( &vertex, sizeof( VERTEX ) );
-
-						// formato OBJ utiliza 1-based arrays
-						inputFile >> iPosition;
-						if(iPosition - 1 < 0 || iPosition - 1 >= positions->size() || inputFile.eof()) 
-							throw OBJFILE_ERROR;
-				
-						vertex.position = (*positions)[ iPosition - 1 ];
+				const OBJEvent &event = events[nextEvent];
 
-						if( '/' == inputFile.peek() ) 
-						{
-							inputFile.ignore();
-
-							if( '/' != inputFile.peek() ) 
-							{
-								// texture coordinate
-								inputFile >> iTexCoord;
-								if(iTexCoord - 1 < 0 || iTexCoord - 1 >= texCoords->size()|| inputFile.eof()) 
-									throw OBJFILE_ERROR;
-
-								vertex.texcoord = (*texCoords)[ iTexCoord - 1 ];
-							} 
-
-							if( '/' == inputFile.peek() ) 
-							{
-								inputFile.ignore();
-
-								// vertex normal
-								inputFile >> iNormal;
-								if(iNormal - 1 < 0 || iNormal - 1 >= normals->size()) 
-									throw OBJFILE_ERROR;
-
-								vertex.normal = (*normals)[ iNormal - 1 ];	
-							} 
-							else 
-								throw OBJFILE_ERROR;
-						} 
-						else 
-							throw OBJFILE_ERROR;
-	
-
-						//si el actual no es vertice duplicado lo sumamos a la lista de vertices. Y pasamos su indice al array de indices.
-						//El arreglo de indices y vertices se convertiran en el index buffer y vertex buffer de la mesh
-						DWORD index = AddVertex(iPosition, vertex);
-						m_indices.push_back(index);	
-					}
-					m_attributes.push_back(curSubset);			
+				if( event.type == OBJ_EVENT_GROUP ) //las g indican que lo que sigue es la descripcion de las caras de un nuevo objeto
+				{
+					//los vertices que forman parte de un objeto 3d en el archivo .obj no se comparten con los del siguiente objeto, asi que vaciamos la tabla
+					m_vertexTable.Clear();
 				}
-				else if( strCommand == "mtllib" ) 
+				else if( event.type == OBJ_EVENT_MTLLIB ) 
 				{
 					// biblioteca de material. Sólo una por archivo a lo sumo
-					inputFile >> strMaterialFilenameTmp;
+					strMaterialFilenameTmp = event.name;
 				}
-				else if( strCommand == "usemtl" ) 
+				else if( event.type == OBJ_EVENT_USEMTL ) 
 				{
 					// Material
-					string strNameTmp;
-					inputFile >> strNameTmp;
-
 					SAFE_DELETE_ARRAY(wstrNameC);
-					wstrNameC = new WCHAR[strNameTmp.size()+1];
+					wstrNameC = new WCHAR[event.name.size()+1];
 					
-					if(MultiByteToWideChar(CP_ACP, 0, strNameTmp.c_str(), -1, wstrNameC, strNameTmp.size()+1) == 0) {
+					if(MultiByteToWideChar(CP_ACP, 0, event.name.c_str(), -1, wstrNameC, event.name.size()+1) == 0) {
 						ErrorWarning(L"Mesh::LoadGeometryFromOBJ --> MultiByteToWideChar");
 						throw 'e';
 					}
@@ -416,37 +901,36 @@ HRESULT Mesh::LoadGeometryFromOBJ( const wstring &strFileName, const UINT numVer
 						curSubset = (DWORD) m_materials.size() - 1;
 					}
 				}
-				else 
-				{
-					//comando no implementado o no aceptado
-				}
 			}
-			if(inputFile.eof()) break;
-
-			inputFile.ignore(numeric_limits<streamsize>::max(), '\n');		//pasamos a la siguiente linea
 
-			if(inputFile.eof()) break;
+			if( iFace == faces.size() ) break;
 
-			//leemos mas datos del archivo .obj si es que lo que nos queda del bloque presente no alcanza para procesar una nueva línea
-			long remainingBytes = static_cast<long> (bytesToRead - inputFile.tellg());
+			VERTEX vertex;
 
-			if( (remainingBytes < MAX_LINE_LENGTH) && bytesToRead == BUFFERSIZE-1) 
+			for( UINT iVertex = 0; iVertex < 3; iVertex++ ) 
 			{
-				inputFile.read(readBuffer, remainingBytes);
+				// formato OBJ utiliza 1-based arrays. OBJParser ya verificó los índices
+				const OBJFaceVertex &faceVertex = faces[iFace].vertices[iVertex];
 
-				if(!ReadFile(hFile, &(readBuffer[remainingBytes]), BUFFERSIZE-remainingBytes-1, &bytesToRead, NULL)) {
-					ErrorWarning(L"Mesh::LoadGeometryFromOBJ --> ReadFile");
-					throw 'e';
-				}
-				//if(bytesToRead == 0) break;
-				readBuffer[bytesToRead+remainingBytes] = NULL;
-				inputFile.str(readBuffer);
-				inputFile.clear(stringstream::goodbit);
-				inputFile.seekg(0);
-				bytesToRead += remainingBytes;
+				ZeroMemory( &vertex, sizeof( VERTEX ) );
+
+				vertex.position = positions[ faceVertex.position - 1 ];
+				if( faceVertex.texCoord != 0 )
+					vertex.texcoord = texCoords[ faceVertex.texCoord - 1 ];
+				vertex.normal = normals[ faceVertex.normal - 1 ];
+
+				//si el actual no es vertice duplicado lo sumamos a la lista de vertices. Y pasamos su indice al array de indices.
+				//El arreglo de indices y vertices se convertiran en el index buffer y vertex buffer de la mesh
+				DWORD index = AddVertex(faceVertex, vertex);
+				m_indices.push_back(index);	
 			}
+			m_attributes.push_back(curSubset);			
 		}
 
+		//los datos del archivo y la tabla ya no se necesitan
+		parser.Clear();
+		m_vertexTable = VertexDedupTable();
+
 		// Si encontramos un archivo .mtl asociado lo leemos ahora. Notar que solo puede haber un .mtl asociado
 		if( strMaterialFilenameTmp.length() > 0 ) 
 		{
@@ -457,8 +941,10 @@ HRESULT Mesh::LoadGeometryFromOBJ( const wstring &strFileName, const UINT numVer
 				ErrorWarning(L"Mesh::LoadGeometryFromOBJ --> MultiByteToWideChar");
 				throw 'e';
 			}
-			if(FAILED( hr = LoadMaterialsFromMTL(MTLS_DIRECTORY + wstring(wstrNameC)) )) {
-				MessageBox(NULL, L"Error en la carga del material library", L"Error", MB_OK);
+			m_materialFile = wstrNameC;
+
+			if(FAILED( hr = LoadMaterialsFromMTL(MTLS_DIRECTORY + m_materialFile) )) {
+				ErrorMessage(L"Error en la carga del material library", L"Error");
 				throw 'e';
 			}
 		}
@@ -479,53 +965,25 @@ HRESULT Mesh::LoadGeometryFromOBJ( const wstring &strFileName, const UINT numVer
 	{
 		hr = E_FAIL;
 	}
-	catch (stringstream::failure &) 
-	{
-		MiscErrorWarning(SS_ERROR);
-		hr = E_FAIL;
-	}
-	catch (OBJMTLError &) 
-	{
-		MiscErrorWarning(MESHFILE_ERROR);
-		hr = E_FAIL;
-	}
-
 
 	// clean up
-	SAFE_DELETE(positions); 
-	SAFE_DELETE(texCoords);
-	SAFE_DELETE(normals);
-
 	SAFE_DELETE_ARRAY(wstrNameC);
 
-	if(hFile != INVALID_HANDLE_VALUE) {
-		if(CloseHandle(hFile) == 0) ErrorWarning(L"Mesh::LoadGeometryFromOBJ --> CloseHandle");	//hubo un error pero continuamos, porque no es fatal
-	}
-
 	return hr;
 }
 
 //Decidimos si agregar el vertice vertex al vector de vertices que se convertirá en el vertexbuffer. Pero debemos evitar agregar vertices duplicados
-//por eso se verifica si ya lo hicimos, inspeccionando la tabla hash de los vértices ya agregados.
-DWORD Mesh::AddVertex(const UINT a, const Vertex &vertex)
+//por eso se busca su terna de índices del .obj en la tabla de los vértices ya agregados.
+DWORD Mesh::AddVertex(const OBJFaceVertex &faceVertex, const Vertex &vertex)
 {
-	const UINT hash = a % HASH_TABLE_SIZE;
-
-	for(UINT i=0; i<m_hashTable[hash].size(); ++i) 
-	{
-		if(m_vertices[m_hashTable[hash][i]].position == vertex.position  &&
-		   m_vertices[m_hashTable[hash][i]].texcoord == vertex.texcoord &&
-		   m_vertices[m_hashTable[hash][i]].normal == vertex.normal) 
-				return m_hashTable[hash][i]; 
-	}
+	const DWORD s = static_cast<DWORD> ( m_vertices.size() );
 
-	const UINT s = static_cast<UINT> ( m_vertices.size() );
+	const DWORD index = m_vertexTable.FindOrInsert(faceVertex.position, faceVertex.texCoord, faceVertex.normal, s);
 
-	m_vertices.push_back(vertex);	//insertar el vértice en la lista de vertices global
+	if(index == s)
+		m_vertices.push_back(vertex);	//insertar el vértice en la lista de vertices global
 
-	m_hashTable[hash].push_back(s);	//insertar el índice en la tabla hash
-
-	return (DWORD) s;
+	return index;
 }
 
 HRESULT Mesh::LoadMaterialsFromMTL( const wstring &strFileName )
@@ -765,74 +1223,214 @@ void Mesh::SetTechniquesForMaterials()
 }
 
 
+//------------------------------------------------------------------------------------------
+// Tangentes (http://www.terathon.com/code/tangent.html). Las caras se reparten en bloques
+// contiguos, uno por hilo. Cada bloque acumula las direcciones s y t de sus triángulos en
+// su propio arreglo, que sólo cubre el rango de vértices que usan sus caras: los vértices
+// del .obj están en el orden en que los usan las caras, así que los rangos casi no se
+// superponen. Las direcciones se calculan de a 4 triángulos con SSE2. Luego cada vértice
+// suma lo de los bloques que lo incluyen y se escriben una sola vez la normal normalizada,
+// la tangente ortogonalizada (Gram-Schmidt) y en tangent.w el signo de la bitangente.
+//------------------------------------------------------------------------------------------
+
+//direcciones de u y v crecientes acumuladas en un vértice
+struct TangentAccumulator
+{
+	D3DXVECTOR3 s;
+	D3DXVECTOR3 t;
+};
+
+//caras [firstFace, endFace) de un hilo y los acumuladores de los vértices [firstVertex, endVertex) que usan
+struct TangentBlock
+{
+	UINT firstFace, endFace;
+	UINT firstVertex, endVertex;
+	vector<TangentAccumulator> accumulators;
+};
+
+static void AccumulateTangents(const Vertex * const vertices, const DWORD * const indices, TangentBlock &block)
+{
+	for(UINT f=block.firstFace; f<block.endFace; f+=4)
+	{
+		const UINT count = std::min(block.endFace - f, static_cast<UINT>(4));
+
+		//4 triángulos en formato SoA. Los lugares libres quedan en 0 (determinante 0: no aportan)
+		float x1[4] = { 0 }, y1[4] = { 0 }, z1[4] = { 0 }, x2[4] = { 0 }, y2[4] = { 0 }, z2[4] = { 0 };
+		float s1[4] = { 0 }, t1[4] = { 0 }, s2[4] = { 0 }, t2[4] = { 0 };
+
+		for(UINT k=0; k<count; ++k) {
+			const DWORD * const triangle = &indices[(f + k) * 3];
+			const Vertex &v1 = vertices[triangle[0]];
+			const Vertex &v2 = vertices[triangle[1]];
+			const Vertex &v3 = vertices[triangle[2]];
+
+			x1[k] = v2.position.x - v1.position.x;  x2[k] = v3.position.x - v1.position.x;
+			y1[k] = v2.position.y - v1.position.y;  y2[k] = v3.position.y - v1.position.y;
+			z1[k] = v2.position.z - v1.position.z;  z2[k] = v3.position.z - v1.position.z;
+
+			s1[k] = v2.texcoord.x - v1.texcoord.x;  s2[k] = v3.texcoord.x - v1.texcoord.x;
+			t1[k] = v2.texcoord.y - v1.texcoord.y;  t2[k] = v3.texcoord.y - v1.texcoord.y;
+		}
+
+		const __m128 S1 = _mm_loadu_ps(s1), S2 = _mm_loadu_ps(s2), T1 = _mm_loadu_ps(t1), T2 = _mm_loadu_ps(t2);
+		const __m128 X1 = _mm_loadu_ps(x1), Y1 = _mm_loadu_ps(y1), Z1 = _mm_loadu_ps(z1);
+		const __m128 X2 = _mm_loadu_ps(x2), Y2 = _mm_loadu_ps(y2), Z2 = _mm_loadu_ps(z2);
+
+		//r = 1 / (s1 t2 - s2 t1), 0 si las coordenadas de textura del triángulo son degeneradas
+		const __m128 det = _mm_sub_ps(_mm_mul_ps(S1, T2), _mm_mul_ps(S2, T1));
+		const __m128 r = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), det), _mm_cmpneq_ps(det, _mm_setzero_ps()));
+
+		float sdir[3][4], tdir[3][4];
+		_mm_storeu_ps(sdir[0], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(T2, X1), _mm_mul_ps(T1, X2)), r));
+		_mm_storeu_ps(sdir[1], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(T2, Y1), _mm_mul_ps(T1, Y2)), r));
+		_mm_storeu_ps(sdir[2], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(T2, Z1), _mm_mul_ps(T1, Z2)), r));
+		_mm_storeu_ps(tdir[0], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(S1, X2), _mm_mul_ps(S2, X1)), r));
+		_mm_storeu_ps(tdir[1], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(S1, Y2), _mm_mul_ps(S2, Y1)), r));
+		_mm_storeu_ps(tdir[2], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(S1, Z2), _mm_mul_ps(S2, Z1)), r));
+
+		for(UINT k=0; k<count; ++k) {
+			const D3DXVECTOR3 s(sdir[0][k], sdir[1][k], sdir[2][k]);
+			const D3DXVECTOR3 t(tdir[0][k], tdir[1][k], tdir[2][k]);
+
+			for(UINT i=0; i<3; ++i) {
+				TangentAccumulator &accumulator = block.accumulators[indices[(f + k) * 3 + i] - block.firstVertex];
+				accumulator.s += s;
+				accumulator.t += t;
+			}
+		}
+	}
+}
+
+static void FinalizeTangentFrame(Vertex &vertex, const TangentAccumulator &accumulator)
+{
+	D3DXVECTOR3 n = vertex.normal;
+	D3DXVec3Normalize(&n, &n);
+
+	//Gram-Schmidt. Sin coordenadas de textura (o con todas degeneradas) sirve cualquier tangente perpendicular a la normal
+	D3DXVECTOR3 t = accumulator.s - n * D3DXVec3Dot(&n, &accumulator.s);
+	if(D3DXVec3Dot(&t, &t) < 1e-20f) {
+		t = fabs(n.x) < 0.9f ? D3DXVECTOR3(1.0f, 0.0f, 0.0f) : D3DXVECTOR3(0.0f, 1.0f, 0.0f);
+		t -= n * D3DXVec3Dot(&n, &t);
+	}
+	D3DXVec3Normalize(&t, &t);
+
+	//bitangente = cross(n, t) * w
+	D3DXVECTOR3 b;
+	D3DXVec3Cross(&b, &n, &t);
+
+	vertex.normal = n;
+	vertex.tangent = D3DXVECTOR4(t.x, t.y, t.z, D3DXVec3Dot(&b, &accumulator.t) < 0.0f ? -1.0f : 1.0f);
+}
+
 HRESULT Mesh::CalculateTangents()
 {
-	//http://www.terathon.com/code/tangent.html
+	HRESULT hr;
+
+	const Vertex * const vertices = &m_vertices[0];
+	const DWORD * const indices = &m_indices[0];
 
-	HRESULT hr = S_OK;
+	//un bloque por hilo si hay suficientes caras
+	ThreadPool threadPool;
+	UINT numBlocks = m_totalFaces / MIN_TANGENT_BLOCK_FACES;
+
+	if(numBlocks > 1) {
+		if(FAILED(hr = threadPool.Init())) return hr;
+		numBlocks = std::min(numBlocks, threadPool.GetNumThreads());
+	}
+	else
+		numBlocks = 1;
 
-	D3DXVECTOR3 *tan1 = NULL;
-	D3DXVECTOR3 *tan2 = NULL;
+	vector<TangentBlock> blocks;
 
 	try
 	{
-		tan1 = new D3DXVECTOR3[m_totalVertices * 2];
-		tan2 = tan1 + m_totalVertices;
-		ZeroMemory(tan1, sizeof(D3DXVECTOR3) * m_totalVertices * 2);
+		blocks.resize(numBlocks);
+	}
+	catch (bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
 
-		for(UINT i=0; i<m_indices.size(); i+=3) 
-		{
-			const D3DXVECTOR3 &v1 = m_vertices[m_indices[i]].position;
-			const D3DXVECTOR3 &v2 = m_vertices[m_indices[i+1]].position;
-			const D3DXVECTOR3 &v3 = m_vertices[m_indices[i+2]].position;
-
-			const D3DXVECTOR2 &w1 = m_vertices[m_indices[i]].texcoord;
-			const D3DXVECTOR2 &w2 = m_vertices[m_indices[i+1]].texcoord;
-			const D3DXVECTOR2 &w3 = m_vertices[m_indices[i+2]].texcoord;
-
-			float x1 = v2.x - v1.x;
-			float x2 = v3.x - v1.x;
-			float y1 = v2.y - v1.y;
-			float y2 = v3.y - v1.y;
-			float z1 = v2.z - v1.z;
-			float z2 = v3.z - v1.z;
-
-			float s1 = w2.x - w1.x;
-			float s2 = w3.x - w1.x;
-			float t1 = w2.y - w1.y;
-			float t2 = w3.y - w1.y;
-
-			float r = 1.0f / (s1 * t2 - s2 * t1);
-			D3DXVECTOR3 sdir((t2 * x1 - t1 * x2) * r, (t2 * y1 - t1 * y2) * r, (t2 * z1 - t1 * z2) * r);
-			D3DXVECTOR3 tdir((s1 * x2 - s2 * x1) * r, (s1 * y2 - s2 * y1) * r, (s1 * z2 - s2 * z1) * r);
-
-			tan1[m_indices[i]] += sdir;
-			tan1[m_indices[i+1]] += sdir;
-			tan1[m_indices[i+2]] += sdir;
-
-			tan2[m_indices[i]] += tdir;
-			tan2[m_indices[i+1]] += tdir;
-			tan2[m_indices[i+2]] += tdir;
+	const auto FindVertexRange = [&](const UINT b) {
+		TangentBlock &block = blocks[b];
+		block.firstFace = static_cast<UINT>(static_cast<UINT64>(m_totalFaces) * b / numBlocks);
+		block.endFace = static_cast<UINT>(static_cast<UINT64>(m_totalFaces) * (b + 1) / numBlocks);
+
+		DWORD first = m_totalVertices, last = 0;
+		for(UINT i=block.firstFace * 3; i<block.endFace * 3; ++i) {
+			first = std::min<DWORD>(first, indices[i]);
+			last = std::max<DWORD>(last, indices[i]);
 		}
 
-		for(UINT i=0; i<m_totalVertices; ++i) 
-		{
-			const D3DXVECTOR3 &t = tan1[i];
+		block.firstVertex = first;
+		block.endVertex = first <= last ? last + 1 : first;
+	};
+
+	const auto Accumulate = [&](const UINT b, const UINT) {
+		AccumulateTangents(vertices, indices, blocks[b]);
+	};
+
+	//cada vértice suma lo de los bloques que lo usan
+	const UINT numVertexTasks = (m_totalVertices + TANGENT_VERTEX_GRAIN - 1) / TANGENT_VERTEX_GRAIN;
+
+	const auto Finalize = [&](const UINT task, const UINT) {
+		const UINT end = std::min(m_totalVertices, (task + 1) * TANGENT_VERTEX_GRAIN);
+
+		for(UINT v=task * TANGENT_VERTEX_GRAIN; v<end; ++v) {
+			TangentAccumulator accumulator = { D3DXVECTOR3(0.0f, 0.0f, 0.0f), D3DXVECTOR3(0.0f, 0.0f, 0.0f) };
+
+			for(UINT b=0; b<numBlocks; ++b) {
+				if(v >= blocks[b].firstVertex && v < blocks[b].endVertex) {
+					accumulator.s += blocks[b].accumulators[v - blocks[b].firstVertex].s;
+					accumulator.t += blocks[b].accumulators[v - blocks[b].firstVertex].t;
+				}
+			}
+
+			FinalizeTangentFrame(m_vertices[v], accumulator);
+		}
+	};
+
+	if(numBlocks > 1)
+		threadPool.ParallelFor(numBlocks, [&](const UINT b, const UINT) { FindVertexRange(b); });
+	else
+		FindVertexRange(0);
+
+	//si los rangos se superponen mucho (caras sin ningún orden) los acumuladores por hilo ocuparían demasiado: un solo bloque
+	UINT64 accumulatorsSize = 0;
+	for(UINT b=0; b<numBlocks; ++b)
+		accumulatorsSize += blocks[b].endVertex - blocks[b].firstVertex;
+
+	if(numBlocks > 1 && accumulatorsSize > static_cast<UINT64>(m_totalVertices) * MAX_TANGENT_ACCUMULATOR_FACTOR) {
+		numBlocks = 1;
+		blocks.resize(1);
+		FindVertexRange(0);
+	}
 
-			m_vertices[i].tangent.x = t.x;
-			m_vertices[i].tangent.y = t.y;
-			m_vertices[i].tangent.z = t.z;
+	try
+	{
+		for(UINT b=0; b<numBlocks; ++b) {
+			const TangentAccumulator zero = { D3DXVECTOR3(0.0f, 0.0f, 0.0f), D3DXVECTOR3(0.0f, 0.0f, 0.0f) };
+			blocks[b].accumulators.assign(blocks[b].endVertex - blocks[b].firstVertex, zero);
 		}
 	}
 	catch (bad_alloc &) 
 	{
 		MiscErrorWarning(BAD_ALLOC);
-		hr = E_FAIL;
+		return E_FAIL;
 	}
 
-	SAFE_DELETE_ARRAY(tan1);
+	if(numBlocks > 1) {
+		threadPool.ParallelFor(numBlocks, Accumulate);
+		threadPool.ParallelFor(numVertexTasks, Finalize);
+	}
+	else {
+		Accumulate(0, 0);
+		for(UINT task=0; task<numVertexTasks; ++task)
+			Finalize(task, 0);
+	}
 
-	return hr;
+	return S_OK;
 }
 
 HRESULT Mesh::Render(const UINT subset) const
@@ -846,10 +1444,23 @@ HRESULT Mesh::Render(const UINT subset) const
 		return E_FAIL;
 	}
 
+	if(m_chunked)
+	{
+		HRESULT hr;
+
+		for(UINT c=0; c<m_clusters.size(); ++c) {
+			if(m_clusters[c].subset == subset) {
+				if(FAILED(hr = RenderCluster(c))) return hr;
+			}
+		}
+
+		return S_OK;
+	}
+
 	//primero bindeamos el index y vertex buffer correspondiente al device context
 	m_d3dManager.IASetIndexBuffer(m_indexBuffer->GetBuffer(), DXGI_FORMAT_R32_UINT, 0);
 
-	const UINT stride = sizeof(Vertex);
+	const UINT stride = GetVertexStride();
 	const UINT offset = 0;
 	ID3D11Buffer *tmpBuffer = m_vertexBuffer->GetBuffer();
 	m_d3dManager.IASetVertexBuffers(0, 1, &tmpBuffer, &stride, &offset);
@@ -861,4 +1472,60 @@ HRESULT Mesh::Render(const UINT subset) const
 	return S_OK;
 }
 
-}
\ No newline at end of file
+HRESULT Mesh::RenderCluster(const UINT cluster, const UINT lod) const
+{
+	_ASSERT(m_ready && m_chunked);
+
+	_ASSERT(cluster < m_clusters.size() && lod <= GetNumClusterLODs(cluster));
+
+	if(!m_ready || !m_chunked || cluster >= m_clusters.size() || lod > GetNumClusterLODs(cluster)) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Mesh::RenderCluster");
+		return E_FAIL;
+	}
+
+	HRESULT hr;
+
+	//el cluster se sube a la GPU si no está residente
+	if(FAILED(hr = m_clusterCache->Bind(cluster))) return hr;
+
+	if(lod == 0)
+		m_d3dManager.DrawIndexed(m_clusters[cluster].faceCount * 3, 0, 0);
+	else {
+		const MeshClusterLOD &level = m_clusterLODs[m_clusterLODBases[cluster] + lod - 1];
+		m_d3dManager.DrawIndexed(level.indexCount, level.indexStart, 0);
+	}
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// Los datos se copian de m_vertices y m_indices o, si la mesh se cargó del caché, del archivo
+// proyectado, así que no hace falta copiar nada desde la memoria de video.
+//------------------------------------------------------------------------------------------
+HRESULT Mesh::GetGeometry(vector<Vertex> &vertices, vector<DWORD> &indices) const
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Mesh::GetGeometry");
+		return E_FAIL;
+	}
+
+	const Vertex * const meshVertices = GetVertices();
+	const DWORD * const meshIndices = GetIndices();
+
+	try 
+	{
+		vertices.assign(meshVertices, meshVertices + m_totalVertices);
+		indices.assign(meshIndices, meshIndices + m_totalFaces * 3);
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+}
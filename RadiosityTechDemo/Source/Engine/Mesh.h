@@ -1,9 +1,16 @@
 ﻿//------------------------------------------------------------------------------------------
 // File: Mesh.h
 //
-// La clase Mesh crea una ID3DX10Mesh desde un archivo .obj y sus Materials asociados
-// desde un archivo .mtl. Luego utiliza la ID3DX10Mesh optimizada para crear los vertex e 
-// index buffers que puedan ser usados con DirectX11.
+// La clase Mesh carga la geometría de un archivo .obj y sus Materials asociados desde un
+// archivo .mtl. La optimiza con MeshOptimizer (subsets por material, caché de vértices,
+// overdraw) y la usa para crear los vertex e index buffers que puedan ser usados con
+// DirectX11.
+// Una mesh por partes (chunked) se divide además en clusters espaciales con su caja
+// envolvente. No tiene buffers para la mesh completa: sus vértices e índices se leen del
+// archivo proyectado del caché y cada cluster se sube a la GPU cuando se dibuja, con un
+// presupuesto de memoria residente (ver MeshClusterCache). Opcionalmente cada cluster tiene
+// niveles de detalle simplificados con MeshSimplifier (se generan al cargar la mesh) para
+// dibujar la geometría lejana con menos triángulos.
 //
 // Author: Gabriel Clavero
 //------------------------------------------------------------------------------------------
@@ -21,6 +28,13 @@
 #include "InputLayouts.h"
 #include "D3DDevicesManager.h"
 #include "D3D11Resources.h"
+#include "OBJParser.h"
+#include "VertexDedupTable.h"
+#include "MappedFile.h"
+#include "MeshOptimizer.h"
+#include "CompactVertexCodec.h"
+#include "MeshClusterCache.h"
+#include "MeshSimplifier.h"
 
 #define ERROR_RESOURCE_VALUE 1
 
@@ -28,6 +42,7 @@ using std::vector;
 using std::bad_alloc;
 using std::stringstream;
 using std::endl;
+using std::ofstream;
 using std::wstring;
 using std::numeric_limits;
 using std::streamsize;
@@ -42,54 +57,144 @@ template<typename TYPE> BOOL IsErrorResource( TYPE data )
 	return FALSE;
 }
 
+//cabecera del archivo de caché de una mesh (en MESH_CACHE_DIRECTORY). Ver Mesh::LoadFromMeshCache
+struct MeshCacheHeader
+{
+	char magic[4];
+	UINT version;
+	UINT vertexSize;            //sizeof(Vertex) al escribir el archivo
+	UINT numVertices;
+	UINT numFaces;
+	UINT numAttribTableEntries;
+	UINT numClusters;           //0 => la mesh no es por partes
+	UINT numMaterials;
+	UINT materialFileLength;    //caracteres del nombre del .mtl. 0 => no hay .mtl
+	UINT64 objSize;             //tamaño y fecha de última modificación (FILETIME) del .obj y del .mtl
+	UINT64 objWriteTime;
+	UINT64 mtlSize;
+	UINT64 mtlWriteTime;
+	VertexCacheStatistics cacheStatisticsBefore;    //ver Mesh::GetVertexCacheStatistics
+	VertexCacheStatistics cacheStatisticsAfter;
+};
+
 class Mesh 
 {
 public:
 	Mesh(const D3DDevicesManager &d3d);
 	~Mesh();
 
-	//sólo debe llamarse a lo sumo una vez por objeto
-	HRESULT Init( const wstring &meshFile, const UINT numVertices, const UINT numNormals, const UINT numCoords );
+	//sólo debe llamarse a lo sumo una vez por objeto. Usa el caché de la mesh si el .obj y el .mtl no cambiaron.
+	//compactVertices: el vertex buffer usa CompactVertex si las coordenadas de textura entran en half float sin perder precisión.
+	//chunked: mesh por partes. Sus clusters residentes en la GPU cuentan en residencyBudget (obligatorio con chunked), que debe
+	//existir mientras exista la mesh y puede compartirse con otras meshes.
+	//lodLevels: niveles de detalle de cada cluster además de la geometría completa, en [0, MAX_LOD_LEVELS]. Sólo en meshes por partes
+	HRESULT Init( const wstring &meshFile, const bool compactVertices=false, const bool chunked=false, 
+	              MeshResidencyBudget * const residencyBudget=NULL, const UINT lodLevels=0 );
 
+	//en una mesh por partes dibuja todos los clusters del subset
 	HRESULT Render(const UINT subset) const;
 
+	//sólo en meshes por partes. Los índices del cluster empiezan en su primer vértice: el vertex shader ve SV_VertexID relativo a
+	//GetCluster(cluster)->vertexStart. lod: 0 => geometría completa, si no el nivel de detalle en [1, GetNumClusterLODs(cluster)]
+	HRESULT RenderCluster(const UINT cluster, const UINT lod=0) const;
+
+	bool IsChunked() const;
+	UINT GetNumClusters() const;
+	const MeshCluster *GetCluster(const UINT i) const;
+
+	//niveles de detalle generados para el cluster (puede haber menos que los pedidos si el cluster no se puede simplificar)
+	UINT GetNumClusterLODs(const UINT cluster) const;
+
+	//level en [1, GetNumClusterLODs(cluster)]. Cada nivel tiene a lo sumo la mitad de los triángulos del anterior
+	const MeshClusterLOD *GetClusterLOD(const UINT cluster, const UINT level) const;
+
+	//contadores del streaming de clusters (en cero si la mesh no es por partes)
+	void GetStreamingStatistics(MeshStreamingStatistics &statistics) const;
+
+	static const UINT MAX_LOD_LEVELS = 4;
+
 	const wstring &GetFileName() const;
 
+	//archivo .mtl referenciado por el .obj (relativo a MTLS_DIRECTORY). Vacío si no hay
+	const wstring &GetMaterialFileName() const;
+
 	UINT GetNumMaterials() const;
 	UINT GetAttributeTableEntries() const;
 
 	//devuelve el material usado por el i-ésimo subset de la mesh
 	const Material * const GetSubsetMaterial(const UINT i) const;
 
+	//devuelve el i-ésimo material de la mesh, en [0, GetNumMaterials())
+	Material *GetMaterial(const UINT i);
+
+	//devuelve el rango de caras y vértices del i-ésimo subset de la mesh
+	const D3DX10_ATTRIBUTE_RANGE *GetSubsetRange(const UINT i) const;
+
+	//copia los vértices e índices de la mesh optimizada a memoria de sistema (para algoritmos que corren en la CPU)
+	HRESULT GetGeometry(vector<Vertex> &vertices, vector<DWORD> &indices) const;
+
+	//los GetTotalVertices() vértices de la mesh optimizada, sin copiarlos. Válido mientras exista la mesh
+	const Vertex *GetVertices() const;
+
+	//ídem con los GetTotalFaces() * 3 índices
+	const DWORD *GetIndices() const;
+
 	UINT GetTotalFaces() const;
 	UINT GetTotalVertices() const;
 
-	ID3DX10Mesh *GetID3DX10Mesh() const;
+	//ACMR y ATVR (caché FIFO de MeshOptimizer::STATISTICS_CACHE_SIZE vértices) del .obj y de la mesh optimizada
+	void GetVertexCacheStatistics(VertexCacheStatistics &before, VertexCacheStatistics &after) const;
+
+	//NULL en una mesh por partes
 	ID3D11Buffer *GetVertexBuffer() const;
 
+	//true si el vertex buffer tiene CompactVertex (usar InputLayouts::GetCompactInputLayout) en lugar de Vertex
+	bool UsesCompactVertices() const;
+	UINT GetVertexStride() const;
+
+	//versión del procesamiento de las meshes (deduplicación, optimización, tangentes). Forma parte de la clave del caché de GI
+	static UINT GetProcessingVersion();
+
 private:
 	void SetTechniquesForMaterials();
-	HRESULT LoadGeometryFromOBJ( const wstring &strFileName,  const UINT numVertices, const UINT numNormals, const UINT numCoords );
+	HRESULT BuildOptimizedMesh();
+	HRESULT CreateBuffers(const void * const vertices, const void * const indices);
+	HRESULT CreateClusterCache(const Vertex * const vertices, const DWORD * const indices);
+
+	//genera m_lodLevels niveles de detalle de cada cluster con MeshSimplifier, en paralelo. Los bordes de los clusters no se mueven
+	HRESULT BuildClusterLODs(const Vertex * const vertices, const DWORD * const indices);
+
+	//reemplaza las caras de cada atributo por clusters espaciales: duplica los vértices compartidos entre clusters y deja en
+	//attributes el cluster de cada cara. clusterAttributes[c] es el atributo original del cluster c. Puede lanzar std::bad_alloc
+	void SplitIntoClusters(const unsigned int * const indices, unsigned int * const attributes, vector<UINT> &clusterAttributes);
+	HRESULT LoadGeometryFromOBJ( const wstring &strFileName );
 	HRESULT LoadMaterialsFromMTL( const wstring &strFileName );
 
-	DWORD AddVertex(const UINT a, const Vertex &v);
+	DWORD AddVertex(const OBJFaceVertex &faceVertex, const Vertex &v);
 
+	//las tangentes orientan los hemicubos de Radiosity: cambiar MESH_CACHE_FILE_VERSION si cambia el cálculo
 	HRESULT CalculateTangents();
 
+	HRESULT LoadFromMeshCache();
+	HRESULT StoreInMeshCache(const void * const vertices, const void * const indices) const;
+	HRESULT MapStoredGeometry();
+	static wstring GetMeshCacheFileName(const wstring &meshFile, const bool chunked);
+
 private:
 	const D3DDevicesManager &m_d3dManager;
 
 	enum OBJMTLError { OBJFILE_ERROR, MTLFILE_ERROR };		//excepciones para errores en archivos .obj y .mtl
 
-	static const UINT HASH_TABLE_SIZE = 8192;
-	vector<UINT> m_hashTable[HASH_TABLE_SIZE];
+	//vértices ya agregados del objeto ("g") actual del .obj
+	VertexDedupTable m_vertexTable;
 
 	wstring m_meshFile;
+	wstring m_materialFile;
 
 	//lista de materiales en la mesh
 	vector<Material> m_materials;
 
-	//malla completa
+	//malla completa. Luego de BuildOptimizedMesh, la mesh optimizada (vacíos si se cargó del caché)
 	vector<VERTEX> m_vertices;
 	vector<DWORD> m_indices;
 	vector<DWORD> m_attributes;
@@ -97,14 +202,44 @@ private:
 	UINT m_numAttribTableEntries;
 	D3DX10_ATTRIBUTE_RANGE *m_pAttribTable;
 
-	ID3DX10Mesh *m_mesh;
-
 	VertexBuffer *m_vertexBuffer;
 	IndexBuffer *m_indexBuffer;
 
 	UINT m_totalVertices;
 	UINT m_totalFaces;
 
+	//los vértices de m_vertexBuffer son CompactVertex
+	bool m_compactVertices;
+
+	//mesh por partes: clusters ordenados por subset y buffers de los clusters residentes (en lugar de m_vertexBuffer y m_indexBuffer)
+	bool m_chunked;
+	MeshResidencyBudget *m_residencyBudget;
+	vector<MeshCluster> m_clusters;
+	MeshClusterCache *m_clusterCache;
+
+	//niveles de detalle de los clusters: los del cluster c son [m_clusterLODBases[c], m_clusterLODBases[c + 1]) de m_clusterLODs y sus
+	//índices (relativos al primer vértice del cluster) son [m_lodIndexBases[c], m_lodIndexBases[c + 1]) de m_lodIndices.
+	//No se guardan en el caché de la mesh
+	UINT m_lodLevels;
+	vector<WORD> m_lodIndices;
+	vector<UINT> m_lodIndexBases;
+	vector<MeshClusterLOD> m_clusterLODs;
+	vector<UINT> m_clusterLODBases;
+
+	VertexCacheStatistics m_cacheStatisticsBefore;
+	VertexCacheStatistics m_cacheStatisticsAfter;
+
+	//formato de los archivos del caché de meshes. Cambiar la versión si cambia el procesamiento de la mesh (deduplicación,
+	//optimización, tangentes): también invalida el caché de GI, porque los hemicubos se orientan con las tangentes y el resultado
+	//se guarda por número de vértice (ver GetProcessingVersion)
+	static const char MESH_CACHE_FILE_MAGIC[4];
+	static const UINT MESH_CACHE_FILE_VERSION = 5;
+
+	//sólo si la mesh se cargó del caché: vértices e índices dentro del archivo proyectado, que queda abierto
+	MappedFile m_cacheFile;
+	const Vertex *m_cachedVertices;
+	const DWORD *m_cachedIndices;
+
 	bool m_ready;
 };
 
@@ -112,6 +247,14 @@ inline const wstring &Mesh::GetFileName() const
 {
 	return m_meshFile;
 }
+inline const wstring &Mesh::GetMaterialFileName() const
+{
+	return m_materialFile;
+}
+inline UINT Mesh::GetProcessingVersion()
+{
+	return MESH_CACHE_FILE_VERSION;
+}
 inline UINT Mesh::GetNumMaterials() const
 {
 	return static_cast<UINT> ( m_materials.size() );
@@ -139,9 +282,107 @@ inline const Material * const Mesh::GetSubsetMaterial(const UINT i) const
 
 	return &(m_materials[ m_pAttribTable[i].AttribId ]);
 }
-inline ID3DX10Mesh *Mesh::GetID3DX10Mesh() const
+inline Material *Mesh::GetMaterial(const UINT i)
+{
+	_ASSERT(i < m_materials.size());
+
+	if(i >= m_materials.size()) {
+		MiscErrorWarning(INVALID_PARAMETER, L"Mesh::GetMaterial");
+		return NULL;
+	}
+
+	return &(m_materials[i]);
+}
+inline const D3DX10_ATTRIBUTE_RANGE *Mesh::GetSubsetRange(const UINT i) const
+{
+	_ASSERT(i < m_numAttribTableEntries);
+
+	if(i >= m_numAttribTableEntries) {
+		MiscErrorWarning(INVALID_PARAMETER, L"Mesh::GetSubsetRange");
+		return NULL;
+	}
+
+	return &(m_pAttribTable[i]);
+}
+inline void Mesh::GetVertexCacheStatistics(VertexCacheStatistics &before, VertexCacheStatistics &after) const
+{
+	before = m_cacheStatisticsBefore;
+	after = m_cacheStatisticsAfter;
+}
+inline const Vertex *Mesh::GetVertices() const
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Mesh::GetVertices");
+		return NULL;
+	}
+
+	return m_cachedVertices != NULL ? m_cachedVertices : &m_vertices[0];
+}
+inline const DWORD *Mesh::GetIndices() const
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Mesh::GetIndices");
+		return NULL;
+	}
+
+	return m_cachedIndices != NULL ? m_cachedIndices : &m_indices[0];
+}
+inline bool Mesh::UsesCompactVertices() const
+{
+	return m_compactVertices;
+}
+inline bool Mesh::IsChunked() const
+{
+	return m_chunked;
+}
+inline UINT Mesh::GetNumClusters() const
+{
+	return static_cast<UINT> (m_clusters.size());
+}
+inline const MeshCluster *Mesh::GetCluster(const UINT i) const
+{
+	_ASSERT(i < m_clusters.size());
+
+	if(i >= m_clusters.size()) {
+		MiscErrorWarning(INVALID_PARAMETER, L"Mesh::GetCluster");
+		return NULL;
+	}
+
+	return &(m_clusters[i]);
+}
+inline UINT Mesh::GetNumClusterLODs(const UINT cluster) const
+{
+	_ASSERT(cluster < m_clusters.size());
+
+	if(cluster >= m_clusters.size() || m_clusterLODBases.empty()) return 0;
+
+	return m_clusterLODBases[cluster + 1] - m_clusterLODBases[cluster];
+}
+inline const MeshClusterLOD *Mesh::GetClusterLOD(const UINT cluster, const UINT level) const
+{
+	_ASSERT(level >= 1 && level <= GetNumClusterLODs(cluster));
+
+	if(level < 1 || level > GetNumClusterLODs(cluster)) {
+		MiscErrorWarning(INVALID_PARAMETER, L"Mesh::GetClusterLOD");
+		return NULL;
+	}
+
+	return &(m_clusterLODs[m_clusterLODBases[cluster] + level - 1]);
+}
+inline void Mesh::GetStreamingStatistics(MeshStreamingStatistics &statistics) const
+{
+	if(m_clusterCache)
+		statistics = m_clusterCache->GetStatistics();
+	else
+		ZeroMemory(&statistics, sizeof(MeshStreamingStatistics));
+}
+inline UINT Mesh::GetVertexStride() const
 {
-	return m_mesh;
+	return m_compactVertices ? sizeof(CompactVertex) : sizeof(Vertex);
 }
 inline ID3D11Buffer *Mesh::GetVertexBuffer() const
 {
@@ -152,7 +393,7 @@ inline ID3D11Buffer *Mesh::GetVertexBuffer() const
 		return NULL;
 	}
 
-	return m_vertexBuffer->GetBuffer();
+	return m_vertexBuffer ? m_vertexBuffer->GetBuffer() : NULL;
 }
 
 
@@ -0,0 +1,338 @@
+﻿//------------------------------------------------------------------------------------------
+// File: MeshClusterCache.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "MeshClusterCache.h"
+
+namespace DTFramework
+{
+
+MeshResidencyBudget::MeshResidencyBudget(const UINT64 budgetBytes)
+: m_budgetBytes(budgetBytes), m_residentBytes(0), m_peakResidentBytes(0), m_useCounter(0)
+{
+
+}
+
+MeshResidencyBudget::~MeshResidencyBudget()
+{
+	//las caches deben destruirse antes que el presupuesto
+	_ASSERT(m_caches.empty());
+}
+
+void MeshResidencyBudget::SetBudget(const UINT64 budgetBytes)
+{
+	_ASSERT(m_caches.empty());
+
+	m_budgetBytes = budgetBytes;
+}
+
+HRESULT MeshResidencyBudget::Register(MeshClusterCache * const cache)
+{
+	try
+	{
+		m_caches.push_back(cache);
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+void MeshResidencyBudget::Unregister(MeshClusterCache * const cache)
+{
+	vector<MeshClusterCache *>::iterator it = std::find(m_caches.begin(), m_caches.end(), cache);
+
+	if(it != m_caches.end())
+		m_caches.erase(it);
+}
+
+void MeshResidencyBudget::MakeRoom(const UINT64 bytes)
+{
+	while(m_residentBytes + bytes > m_budgetBytes)
+	{
+		MeshClusterCache *oldest = NULL;
+		UINT64 oldestUse = 0;
+
+		for(UINT i=0; i<m_caches.size(); ++i) 
+		{
+			UINT64 lastUse;
+			if(m_caches[i]->GetLeastRecentUse(lastUse) && (!oldest || lastUse < oldestUse)) {
+				oldest = m_caches[i];
+				oldestUse = lastUse;
+			}
+		}
+
+		if(!oldest) return;
+
+		oldest->EvictLeastRecent();
+	}
+}
+
+void MeshResidencyBudget::AddResident(const UINT64 bytes)
+{
+	m_residentBytes += bytes;
+	m_peakResidentBytes = std::max(m_peakResidentBytes, m_residentBytes);
+}
+
+void MeshResidencyBudget::RemoveResident(const UINT64 bytes)
+{
+	_ASSERT(bytes <= m_residentBytes);
+
+	m_residentBytes -= bytes;
+}
+
+UINT64 MeshResidencyBudget::NextUse()
+{
+	return ++m_useCounter;
+}
+
+MeshClusterCache::MeshClusterCache(const D3DDevicesManager &d3d, MeshResidencyBudget &budget)
+: m_d3dManager(d3d), m_budget(budget), m_clusters(NULL), m_numClusters(0), m_vertices(NULL), m_indices(NULL), m_compactVertices(false),
+  m_lodIndices(NULL), m_lodIndexBases(NULL), m_lruHead(NO_CLUSTER), m_lruTail(NO_CLUSTER), m_ready(false)
+{
+	ZeroMemory(&m_statistics, sizeof(MeshStreamingStatistics));
+	m_statistics.budgetBytes = budget.GetBudgetBytes();
+}
+
+MeshClusterCache::~MeshClusterCache()
+{
+	for(UINT i=0; i<m_residents.size(); ++i) {
+		SAFE_DELETE(m_residents[i].vertexBuffer);
+		SAFE_DELETE(m_residents[i].indexBuffer);
+	}
+
+	if(m_ready) {
+		m_budget.RemoveResident(m_statistics.residentBytes);
+		m_budget.Unregister(this);
+	}
+}
+
+HRESULT MeshClusterCache::Init(const MeshCluster * const clusters, const UINT numClusters, const Vertex * const vertices, const DWORD * const indices,
+                               const bool compactVertices, const WORD * const lodIndices, const UINT * const lodIndexBases)
+{
+	_ASSERT(!m_ready);
+
+	if(m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"MeshClusterCache::Init");
+		return E_FAIL;
+	}
+
+	if(!clusters || numClusters == 0 || !vertices || !indices || (lodIndices != NULL && lodIndexBases == NULL)) {
+		MiscErrorWarning(INVALID_PARAMETER, L"MeshClusterCache::Init");
+		return E_INVALIDARG;
+	}
+
+	UINT maxVertices = 0, maxIndices = 0;
+	for(UINT i=0; i<numClusters; ++i) {
+		maxVertices = std::max(maxVertices, clusters[i].vertexCount);
+		maxIndices = std::max(maxIndices, clusters[i].faceCount * 3 + (lodIndices ? lodIndexBases[i + 1] - lodIndexBases[i] : 0));
+	}
+
+	if(maxVertices > MAX_CLUSTER_VERTICES) {
+		MiscErrorWarning(INVALID_PARAMETER, L"MeshClusterCache::Init");
+		return E_INVALIDARG;
+	}
+
+	const ResidentCluster empty = { NULL, NULL, 0, NO_CLUSTER, NO_CLUSTER, 0 };
+
+	try
+	{
+		m_residents.assign(numClusters, empty);
+		m_indexScratch.resize(maxIndices);
+
+		if(compactVertices)
+			m_compactScratch.resize(maxVertices);
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	m_clusters = clusters;
+	m_numClusters = numClusters;
+	m_vertices = vertices;
+	m_indices = indices;
+	m_compactVertices = compactVertices;
+	m_lodIndices = lodIndices;
+	m_lodIndexBases = lodIndexBases;
+
+	HRESULT hr;
+
+	if(FAILED(hr = m_budget.Register(this))) return hr;
+
+	m_ready = true;
+
+	return S_OK;
+}
+
+HRESULT MeshClusterCache::Bind(const UINT cluster)
+{
+	_ASSERT(m_ready);
+
+	_ASSERT(cluster < m_numClusters);
+
+	if(!m_ready || cluster >= m_numClusters) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"MeshClusterCache::Bind");
+		return E_FAIL;
+	}
+
+	HRESULT hr;
+
+	if(m_residents[cluster].vertexBuffer == NULL) 
+	{
+		if(FAILED(hr = Stream(cluster))) return hr;
+	}
+	else
+	{
+		Unlink(cluster);
+	}
+
+	PushFront(cluster);
+
+	ResidentCluster &resident = m_residents[cluster];
+	resident.lastUse = m_budget.NextUse();
+
+	m_d3dManager.IASetIndexBuffer(resident.indexBuffer->GetBuffer(), DXGI_FORMAT_R16_UINT, 0);
+
+	const UINT stride = m_compactVertices ? sizeof(CompactVertex) : sizeof(Vertex);
+	const UINT offset = 0;
+	ID3D11Buffer *tmpBuffer = resident.vertexBuffer->GetBuffer();
+	m_d3dManager.IASetVertexBuffers(0, 1, &tmpBuffer, &stride, &offset);
+
+	return S_OK;
+}
+
+//crea los buffers del cluster desde el archivo proyectado. Antes descarta los clusters menos usados de la escena hasta que el nuevo entre en el presupuesto.
+//Los buffers de un cluster descartado mientras está bindeado siguen vivos hasta que el device context deja de referenciarlos
+HRESULT MeshClusterCache::Stream(const UINT cluster)
+{
+	HRESULT hr;
+
+	const MeshCluster &source = m_clusters[cluster];
+	ResidentCluster &resident = m_residents[cluster];
+
+	const UINT stride = m_compactVertices ? sizeof(CompactVertex) : sizeof(Vertex);
+	const UINT vertexBytes = source.vertexCount * stride;
+	const UINT numLODIndices = m_lodIndices ? m_lodIndexBases[cluster + 1] - m_lodIndexBases[cluster] : 0;
+	const UINT indexBytes = (source.faceCount * 3 + numLODIndices) * sizeof(WORD);
+
+	//el cluster todavía no está en la lista LRU: no se descarta a sí mismo
+	m_budget.MakeRoom(vertexBytes + indexBytes);
+
+	const Vertex * const vertices = m_vertices + source.vertexStart;
+	const void *vertexData = vertices;
+
+	if(m_compactVertices) {
+		CompactVertexCodec::Encode(vertices, source.vertexCount, &m_compactScratch[0]);
+		vertexData = &m_compactScratch[0];
+	}
+
+	//índices relativos al primer vértice del cluster: todos sus vértices están en [vertexStart, vertexStart + vertexCount)
+	const DWORD * const indices = m_indices + source.faceStart * static_cast<size_t> (3);
+	for(UINT i=0; i<source.faceCount * 3; ++i)
+		m_indexScratch[i] = static_cast<WORD> (indices[i] - source.vertexStart);
+
+	//los niveles de detalle ya tienen índices locales
+	if(numLODIndices > 0)
+		memcpy(&m_indexScratch[source.faceCount * 3], m_lodIndices + m_lodIndexBases[cluster], numLODIndices * sizeof(WORD));
+
+	if((resident.vertexBuffer = new (std::nothrow) VertexBuffer(m_d3dManager, vertexBytes, vertexData)) == NULL) {
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+	if((resident.indexBuffer = new (std::nothrow) IndexBuffer(m_d3dManager, indexBytes, &m_indexScratch[0])) == NULL) {
+		SAFE_DELETE(resident.vertexBuffer);
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	if(FAILED(hr = resident.vertexBuffer->Init()) || FAILED(hr = resident.indexBuffer->Init())) {
+		SAFE_DELETE(resident.vertexBuffer);
+		SAFE_DELETE(resident.indexBuffer);
+		return hr;
+	}
+
+	resident.bytes = vertexBytes + indexBytes;
+
+	m_statistics.bytesStreamed += resident.bytes;
+	m_statistics.clustersStreamed++;
+	m_statistics.residentBytes += resident.bytes;
+	m_statistics.peakResidentBytes = std::max(m_statistics.peakResidentBytes, m_statistics.residentBytes);
+
+	m_budget.AddResident(resident.bytes);
+
+	return S_OK;
+}
+
+void MeshClusterCache::Evict(const UINT cluster)
+{
+	ResidentCluster &resident = m_residents[cluster];
+
+	Unlink(cluster);
+
+	SAFE_DELETE(resident.vertexBuffer);
+	SAFE_DELETE(resident.indexBuffer);
+
+	m_statistics.residentBytes -= resident.bytes;
+	m_statistics.evictions++;
+
+	m_budget.RemoveResident(resident.bytes);
+
+	resident.bytes = 0;
+}
+
+bool MeshClusterCache::GetLeastRecentUse(UINT64 &lastUse) const
+{
+	if(m_lruTail == NO_CLUSTER) return false;
+
+	lastUse = m_residents[m_lruTail].lastUse;
+
+	return true;
+}
+
+void MeshClusterCache::EvictLeastRecent()
+{
+	_ASSERT(m_lruTail != NO_CLUSTER);
+
+	Evict(m_lruTail);
+}
+
+void MeshClusterCache::Unlink(const UINT cluster)
+{
+	ResidentCluster &resident = m_residents[cluster];
+
+	if(resident.previous != NO_CLUSTER) 
+		m_residents[resident.previous].next = resident.next;
+	else 
+		m_lruHead = resident.next;
+
+	if(resident.next != NO_CLUSTER) 
+		m_residents[resident.next].previous = resident.previous;
+	else 
+		m_lruTail = resident.previous;
+
+	resident.previous = resident.next = NO_CLUSTER;
+}
+
+void MeshClusterCache::PushFront(const UINT cluster)
+{
+	ResidentCluster &resident = m_residents[cluster];
+
+	resident.previous = NO_CLUSTER;
+	resident.next = m_lruHead;
+
+	if(m_lruHead != NO_CLUSTER) 
+		m_residents[m_lruHead].previous = cluster;
+	else 
+		m_lruTail = cluster;
+
+	m_lruHead = cluster;
+}
+
+}
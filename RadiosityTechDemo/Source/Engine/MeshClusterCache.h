@@ -0,0 +1,219 @@
+﻿//------------------------------------------------------------------------------------------
+// File: MeshClusterCache.h
+//
+// Vertex e index buffers de los clusters de una mesh por partes (ver Mesh::IsChunked). La
+// geometría completa queda en el archivo proyectado del caché de la mesh; cada cluster se
+// sube a la GPU la primera vez que se dibuja y queda residente mientras entre en el
+// presupuesto de memoria, que es uno solo para todas las meshes por partes de la escena
+// (MeshResidencyBudget). Cuando no entra se descartan los clusters usados hace más tiempo
+// de cualquiera de ellas (LRU). Los índices de cada cluster son de 16 bits y relativos a
+// su primer vértice. Los niveles de detalle del cluster (si hay) van en el mismo index
+// buffer, después de los índices de la geometría completa.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef MESH_CLUSTER_CACHE_H
+#define MESH_CLUSTER_CACHE_H
+
+#include <algorithm>
+
+#include "Utility.h"
+#include "D3DDevicesManager.h"
+#include "D3D11Resources.h"
+#include "CompactVertexCodec.h"
+
+using std::vector;
+
+namespace DTFramework
+{
+
+//cluster espacial de una mesh por partes. Sus caras y sus vértices son contiguos en la mesh y sus vértices no los usa otro cluster
+struct MeshCluster
+{
+	UINT faceStart;
+	UINT faceCount;
+	UINT vertexStart;
+	UINT vertexCount;           //a lo sumo MeshClusterCache::MAX_CLUSTER_VERTICES
+	UINT subset;                //entrada de la tabla de atributos de la mesh que contiene al cluster
+	D3DXVECTOR3 boundsMin;      //caja alineada a los ejes en el espacio de la mesh
+	D3DXVECTOR3 boundsMax;
+};
+
+//nivel de detalle simplificado de un cluster (ver Mesh::GetClusterLOD). Usa los vértices del cluster
+struct MeshClusterLOD
+{
+	UINT indexStart;            //primer índice en el index buffer del cluster (los faceCount * 3 primeros son la geometría completa)
+	UINT indexCount;
+	float error;                //distancia máxima a la superficie original, en unidades de la mesh
+};
+
+//contadores desde que se creó la mesh
+struct MeshStreamingStatistics
+{
+	UINT64 bytesStreamed;       //bytes de vertex e index buffers subidos a la GPU
+	UINT64 clustersStreamed;
+	UINT64 evictions;           //clusters de la mesh descartados para respetar el presupuesto
+	UINT64 residentBytes;       //sólo de la mesh
+	UINT64 peakResidentBytes;
+	UINT64 budgetBytes;         //el de toda la escena (MeshResidencyBudget)
+};
+
+class MeshClusterCache;
+
+//------------------------------------------------------------------------------------------
+// Memoria máxima de los clusters residentes de todos los MeshClusterCache que lo comparten
+// (los de una escena). Cuando un cluster no entra se descarta el usado hace más tiempo de
+// cualquiera de las meshes: cada cache tiene su lista LRU y la cola de cada lista es la más
+// antigua de su mesh, así que alcanza con comparar las colas.
+//------------------------------------------------------------------------------------------
+class MeshResidencyBudget
+{
+public:
+	MeshResidencyBudget(const UINT64 budgetBytes=static_cast<UINT64> (DEFAULT_BUDGET_MB) << 20);
+	~MeshResidencyBudget();
+
+	//sólo antes de crear el primer MeshClusterCache que lo usa
+	void SetBudget(const UINT64 budgetBytes);
+
+	UINT64 GetBudgetBytes() const;
+	UINT64 GetResidentBytes() const;
+	UINT64 GetPeakResidentBytes() const;
+
+	//meshes por partes que comparten el presupuesto
+	UINT GetNumCaches() const;
+
+	static const UINT DEFAULT_BUDGET_MB = 256;
+
+private:
+	friend class MeshClusterCache;
+
+	//no copiable
+	MeshResidencyBudget(const MeshResidencyBudget &);
+	MeshResidencyBudget &operator=(const MeshResidencyBudget &);
+
+	HRESULT Register(MeshClusterCache * const cache);
+	void Unregister(MeshClusterCache * const cache);
+
+	//descarta los clusters usados hace más tiempo (de cualquier cache) hasta que bytes más entren en el presupuesto, o no quede ninguno
+	void MakeRoom(const UINT64 bytes);
+	void AddResident(const UINT64 bytes);
+	void RemoveResident(const UINT64 bytes);
+
+	//orden de uso de los clusters, común a todas las caches
+	UINT64 NextUse();
+
+private:
+	vector<MeshClusterCache *> m_caches;
+
+	UINT64 m_budgetBytes;
+	UINT64 m_residentBytes;
+	UINT64 m_peakResidentBytes;
+	UINT64 m_useCounter;
+};
+
+class MeshClusterCache
+{
+public:
+	//budget: presupuesto compartido con las demás meshes de la escena. Debe existir mientras exista el objeto.
+	//Siempre queda residente al menos el último cluster dibujado
+	MeshClusterCache(const D3DDevicesManager &d3d, MeshResidencyBudget &budget);
+	~MeshClusterCache();
+
+	//clusters, vertices e indices (de 32 bits, con la numeración de la mesh) deben existir mientras exista el objeto.
+	//compactVertices: los vertex buffers se crean con CompactVertex. lodIndices (puede ser NULL): índices de los niveles de detalle,
+	//relativos al primer vértice de cada cluster. Los del cluster c son [lodIndexBases[c], lodIndexBases[c + 1]) y deben existir
+	//mientras exista el objeto. Sólo debe llamarse a lo sumo una vez por objeto
+	HRESULT Init(const MeshCluster * const clusters, const UINT numClusters, const Vertex * const vertices, const DWORD * const indices,
+	             const bool compactVertices, const WORD * const lodIndices=NULL, const UINT * const lodIndexBases=NULL);
+
+	//bindea el vertex y el index buffer del cluster (subiéndolo antes si no está residente) y lo marca como el usado más recientemente
+	HRESULT Bind(const UINT cluster);
+
+	const MeshStreamingStatistics &GetStatistics() const;
+
+	static const UINT MAX_CLUSTER_VERTICES = 65536;
+
+private:
+	//no copiable
+	MeshClusterCache(const MeshClusterCache &);
+	MeshClusterCache &operator=(const MeshClusterCache &);
+
+	HRESULT Stream(const UINT cluster);
+	void Evict(const UINT cluster);
+
+	//para MeshResidencyBudget::MakeRoom. false si no hay clusters residentes
+	bool GetLeastRecentUse(UINT64 &lastUse) const;
+	void EvictLeastRecent();
+
+	friend class MeshResidencyBudget;
+
+	//lista LRU: m_lruHead es el cluster usado más recientemente, m_lruTail el siguiente a descartar
+	void Unlink(const UINT cluster);
+	void PushFront(const UINT cluster);
+
+private:
+	static const UINT NO_CLUSTER = 0xFFFFFFFF;
+
+	struct ResidentCluster
+	{
+		VertexBuffer *vertexBuffer;     //NULL si el cluster no está residente
+		IndexBuffer *indexBuffer;
+		UINT bytes;
+		UINT previous;                  //vecinos en la lista LRU
+		UINT next;
+		UINT64 lastUse;                 //ver MeshResidencyBudget::NextUse
+	};
+
+	const D3DDevicesManager &m_d3dManager;
+	MeshResidencyBudget &m_budget;
+
+	const MeshCluster *m_clusters;
+	UINT m_numClusters;
+	const Vertex *m_vertices;
+	const DWORD *m_indices;
+	bool m_compactVertices;
+	const WORD *m_lodIndices;
+	const UINT *m_lodIndexBases;
+
+	vector<ResidentCluster> m_residents;
+	UINT m_lruHead;
+	UINT m_lruTail;
+
+	//datos de un cluster mientras se crean sus buffers
+	vector<CompactVertex> m_compactScratch;
+	vector<WORD> m_indexScratch;
+
+	MeshStreamingStatistics m_statistics;
+
+	bool m_ready;
+};
+
+inline UINT64 MeshResidencyBudget::GetBudgetBytes() const
+{
+	return m_budgetBytes;
+}
+
+inline UINT64 MeshResidencyBudget::GetResidentBytes() const
+{
+	return m_residentBytes;
+}
+
+inline UINT64 MeshResidencyBudget::GetPeakResidentBytes() const
+{
+	return m_peakResidentBytes;
+}
+
+inline UINT MeshResidencyBudget::GetNumCaches() const
+{
+	return static_cast<UINT> (m_caches.size());
+}
+
+inline const MeshStreamingStatistics &MeshClusterCache::GetStatistics() const
+{
+	return m_statistics;
+}
+
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,575 @@
+﻿//------------------------------------------------------------------------------------------
+// File: MeshOptimizer.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "MeshOptimizer.h"
+
+#include <cmath>
+#include <algorithm>
+
+using std::vector;
+
+namespace DTFramework
+{
+
+//parámetros del puntaje de Forsyth
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+//valencias (triángulos restantes de un vértice) con el puntaje en tabla
+static const unsigned int VALENCE_TABLE_SIZE = 64;
+
+//antes de que el contador de la caché FIFO simulada dé la vuelta se reinician las marcas de tiempo
+static const unsigned int MAX_CACHE_TIME = 0xF0000000;
+
+//orden de los clusters: mayor clave primero
+struct ClusterKeyGreater
+{
+	const vector<float> *keys;
+
+	bool operator()(const unsigned int a, const unsigned int b) const
+	{
+		return (*keys)[a] > (*keys)[b];
+	}
+};
+
+unsigned int MeshOptimizer::Optimize(unsigned int * const indices, unsigned int * const attributes, const unsigned int numFaces, 
+                                     const unsigned int numVertices, const float * const positions, const size_t positionStride, 
+                                     const float overdrawThreshold, vector<unsigned int> &remap, vector<MeshSubset> &subsets)
+{
+	subsets.clear();
+	remap.assign(numVertices, static_cast<unsigned int>(NO_VERTEX));
+
+	if(numFaces == 0) return 0;
+
+	SortByAttribute(indices, attributes, numFaces, subsets);
+
+	Workspace workspace;
+	workspace.localVertex.assign(numVertices, static_cast<unsigned int>(NO_VERTEX));
+	workspace.timestamps.assign(numVertices, 0);
+	workspace.time = 0;
+
+	//el orden sólo cambia dentro de cada subset
+	for(size_t s=0; s<subsets.size(); ++s) {
+		unsigned int * const subsetIndices = indices + subsets[s].faceStart * 3;
+
+		OptimizeVertexCache(subsetIndices, subsets[s].faceCount, workspace);
+
+		//con threshold 1 igual se cortarían clusters donde el ACMR baja al del tramo: no se reordena
+		if(overdrawThreshold > 1.0f)
+			OptimizeOverdraw(subsetIndices, subsets[s].faceCount, positions, positionStride, overdrawThreshold, workspace);
+	}
+
+	//vértices en el orden en que se leen: el vertex fetch recorre el vertex buffer casi secuencialmente
+	unsigned int usedVertices = 0;
+	for(size_t i=0; i<numFaces * static_cast<size_t>(3); ++i) {
+		unsigned int &newIndex = remap[indices[i]];
+		if(newIndex == NO_VERTEX) newIndex = usedVertices++;
+
+		indices[i] = newIndex;
+	}
+
+	for(size_t s=0; s<subsets.size(); ++s) {
+		const unsigned int *subsetIndices = indices + subsets[s].faceStart * 3;
+
+		unsigned int minVertex = NO_VERTEX, maxVertex = 0;
+		for(unsigned int i=0; i<subsets[s].faceCount * 3; ++i) {
+			minVertex = std::min(minVertex, subsetIndices[i]);
+			maxVertex = std::max(maxVertex, subsetIndices[i]);
+		}
+
+		subsets[s].vertexStart = minVertex;
+		subsets[s].vertexCount = maxVertex - minVertex + 1;
+	}
+
+	return usedVertices;
+}
+
+unsigned int MeshOptimizer::ClusterSpatially(const unsigned int * const indices, const unsigned int * const attributes, const unsigned int numFaces,
+                                             const float * const positions, const size_t positionStride, const unsigned int maxClusterFaces,
+                                             vector<unsigned int> &clusters, vector<unsigned int> &clusterAttributes)
+{
+	clusters.assign(numFaces, 0);
+	clusterAttributes.clear();
+
+	if(numFaces == 0) return 0;
+
+	const unsigned char * const positionBytes = reinterpret_cast<const unsigned char *>(positions);
+
+	//centroides (x, y, z) de cada cara
+	vector<float> centroids(numFaces * static_cast<size_t>(3));
+	for(unsigned int f=0; f<numFaces; ++f) {
+		for(unsigned int k=0; k<3; ++k) {
+			const float * const p = reinterpret_cast<const float *>(positionBytes + indices[f * 3 + k] * positionStride);
+			for(unsigned int axis=0; axis<3; ++axis)
+				centroids[f * 3 + axis] += p[axis] * (1.0f / 3.0f);
+		}
+	}
+
+	//caras ordenadas por atributo. Cada rango [begin, end) de order con un solo atributo se parte en el lugar
+	vector<unsigned int> order(numFaces);
+	for(unsigned int f=0; f<numFaces; ++f)
+		order[f] = f;
+
+	std::stable_sort(order.begin(), order.end(), [attributes](const unsigned int a, const unsigned int b) {
+		return attributes[a] < attributes[b];
+	});
+
+	const unsigned int maxFaces = std::max(maxClusterFaces, 1u);
+
+	//rangos pendientes. Se saca primero la mitad inferior para que los clusters sigan el orden de la partición
+	vector<std::pair<unsigned int, unsigned int> > ranges;
+
+	unsigned int numClusters = 0;
+	unsigned int attributeBegin = 0;
+
+	while(attributeBegin < numFaces)
+	{
+		unsigned int attributeEnd = attributeBegin + 1;
+		while(attributeEnd < numFaces && attributes[order[attributeEnd]] == attributes[order[attributeBegin]])
+			++attributeEnd;
+
+		ranges.push_back(std::make_pair(attributeBegin, attributeEnd));
+
+		while(!ranges.empty())
+		{
+			const unsigned int begin = ranges.back().first;
+			const unsigned int end = ranges.back().second;
+			ranges.pop_back();
+
+			if(end - begin <= maxFaces) {
+				for(unsigned int i=begin; i<end; ++i)
+					clusters[order[i]] = numClusters;
+
+				clusterAttributes.push_back(attributes[order[begin]]);
+				++numClusters;
+				continue;
+			}
+
+			float boundsMin[3], boundsMax[3];
+			for(unsigned int axis=0; axis<3; ++axis)
+				boundsMin[axis] = boundsMax[axis] = centroids[order[begin] * 3 + axis];
+
+			for(unsigned int i=begin + 1; i<end; ++i) {
+				for(unsigned int axis=0; axis<3; ++axis) {
+					boundsMin[axis] = std::min(boundsMin[axis], centroids[order[i] * 3 + axis]);
+					boundsMax[axis] = std::max(boundsMax[axis], centroids[order[i] * 3 + axis]);
+				}
+			}
+
+			unsigned int splitAxis = 0;
+			for(unsigned int axis=1; axis<3; ++axis) {
+				if(boundsMax[axis] - boundsMin[axis] > boundsMax[splitAxis] - boundsMin[splitAxis])
+					splitAxis = axis;
+			}
+
+			const unsigned int middle = begin + (end - begin) / 2;
+			const float * const centroid = &centroids[0];
+
+			std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, 
+			                 [centroid, splitAxis](const unsigned int a, const unsigned int b) {
+				return centroid[a * 3 + splitAxis] < centroid[b * 3 + splitAxis];
+			});
+
+			ranges.push_back(std::make_pair(middle, end));
+			ranges.push_back(std::make_pair(begin, middle));
+		}
+
+		attributeBegin = attributeEnd;
+	}
+
+	return numClusters;
+}
+
+//counting sort estable de las caras por atributo
+void MeshOptimizer::SortByAttribute(unsigned int * const indices, unsigned int * const attributes, const unsigned int numFaces, 
+                                    vector<MeshSubset> &subsets)
+{
+	const unsigned int maxAttribute = *std::max_element(attributes, attributes + numFaces);
+
+	vector<unsigned int> firstFace(maxAttribute + 2, 0);
+	for(unsigned int f=0; f<numFaces; ++f)
+		++firstFace[attributes[f] + 1];
+	for(unsigned int a=0; a<=maxAttribute; ++a)
+		firstFace[a + 1] += firstFace[a];
+
+	for(unsigned int a=0; a<=maxAttribute; ++a) {
+		if(firstFace[a + 1] == firstFace[a]) continue;
+
+		const MeshSubset subset = { a, firstFace[a], firstFace[a + 1] - firstFace[a], 0, 0 };
+		subsets.push_back(subset);
+	}
+
+	if(subsets.size() == 1) return;
+
+	vector<unsigned int> sortedIndices(numFaces * static_cast<size_t>(3));
+	for(unsigned int f=0; f<numFaces; ++f) {
+		const unsigned int destination = firstFace[attributes[f]]++;
+
+		sortedIndices[destination * 3] = indices[f * 3];
+		sortedIndices[destination * 3 + 1] = indices[f * 3 + 1];
+		sortedIndices[destination * 3 + 2] = indices[f * 3 + 2];
+	}
+
+	std::copy(sortedIndices.begin(), sortedIndices.end(), indices);
+
+	for(size_t s=0; s<subsets.size(); ++s)
+		std::fill(attributes + subsets[s].faceStart, attributes + subsets[s].faceStart + subsets[s].faceCount, subsets[s].attribute);
+}
+
+//------------------------------------------------------------------------------------------
+// Forsyth: se emite siempre el triángulo de mayor puntaje entre los que usan vértices de la
+// caché LRU simulada. El puntaje de un vértice premia estar al principio de la caché (los 3
+// del último triángulo tienen un puntaje fijo) y tener pocos triángulos restantes, para no
+// dejar vértices aislados que luego habría que volver a procesar. Si ningún triángulo usa
+// vértices de la caché se sigue con el primer triángulo no emitido en el orden original.
+//------------------------------------------------------------------------------------------
+void MeshOptimizer::OptimizeVertexCache(unsigned int * const indices, const unsigned int numFaces, Workspace &workspace)
+{
+	const unsigned int CACHE_SIZE = FORSYTH_CACHE_SIZE;
+
+	if(numFaces < 2) return;
+
+	//numeración local del subset
+	vector<unsigned int> vertices;
+	vector<unsigned int> triangles(numFaces * static_cast<size_t>(3));
+
+	for(size_t i=0; i<triangles.size(); ++i) {
+		unsigned int &local = workspace.localVertex[indices[i]];
+		if(local == NO_VERTEX) {
+			local = static_cast<unsigned int>(vertices.size());
+			vertices.push_back(indices[i]);
+		}
+		triangles[i] = local;
+	}
+
+	for(size_t v=0; v<vertices.size(); ++v)
+		workspace.localVertex[vertices[v]] = NO_VERTEX;
+
+	const unsigned int numSubsetVertices = static_cast<unsigned int>(vertices.size());
+
+	//tablas de puntaje
+	float cacheScores[CACHE_SIZE];
+	for(unsigned int i=0; i<CACHE_SIZE; ++i)
+		cacheScores[i] = i < 3 ? LAST_TRIANGLE_SCORE : powf(1.0f - (i - 3) / static_cast<float>(CACHE_SIZE - 3), CACHE_DECAY_POWER);
+
+	float valenceScores[VALENCE_TABLE_SIZE];
+	valenceScores[0] = 0.0f;
+	for(unsigned int i=1; i<VALENCE_TABLE_SIZE; ++i)
+		valenceScores[i] = VALENCE_BOOST_SCALE * powf(static_cast<float>(i), -VALENCE_BOOST_POWER);
+
+	//triángulos de cada vértice (CSR). Los no emitidos de v están en [adjacencyOffsets[v], adjacencyOffsets[v] + remaining[v])
+	vector<unsigned int> remaining(numSubsetVertices, 0);
+	for(size_t i=0; i<triangles.size(); ++i)
+		++remaining[triangles[i]];
+
+	vector<unsigned int> adjacencyOffsets(numSubsetVertices + 1, 0);
+	for(unsigned int v=0; v<numSubsetVertices; ++v)
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remaining[v];
+
+	vector<unsigned int> adjacency(triangles.size());
+	{
+		vector<unsigned int> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for(unsigned int t=0; t<numFaces; ++t) {
+			for(unsigned int k=0; k<3; ++k)
+				adjacency[cursor[triangles[t * 3 + k]]++] = t;
+		}
+	}
+
+	vector<int> cachePositions(numSubsetVertices, -1);
+	vector<float> vertexScores(numSubsetVertices);
+	vector<float> triangleScores(numFaces);
+	vector<char> emitted(numFaces, 0);
+
+	const auto VertexScore = [&](const unsigned int v) -> float {
+		const unsigned int valence = remaining[v];
+		if(valence == 0) return -1.0f;
+
+		const float cacheScore = cachePositions[v] < 0 ? 0.0f : cacheScores[cachePositions[v]];
+		const float valenceScore = valence < VALENCE_TABLE_SIZE ? valenceScores[valence] : 
+		                           VALENCE_BOOST_SCALE * powf(static_cast<float>(valence), -VALENCE_BOOST_POWER);
+
+		return cacheScore + valenceScore;
+	};
+
+	for(unsigned int v=0; v<numSubsetVertices; ++v)
+		vertexScores[v] = VertexScore(v);
+
+	unsigned int best = 0;
+	for(unsigned int t=0; t<numFaces; ++t) {
+		triangleScores[t] = vertexScores[triangles[t * 3]] + vertexScores[triangles[t * 3 + 1]] + vertexScores[triangles[t * 3 + 2]];
+		if(triangleScores[t] > triangleScores[best]) best = t;
+	}
+
+	unsigned int cache[CACHE_SIZE + 3];
+	unsigned int newCache[CACHE_SIZE + 3];
+	unsigned int cacheSize = 0;
+	unsigned int nextUnemitted = 0;
+
+	for(unsigned int output=0; output<numFaces; ++output)
+	{
+		if(best == NO_VERTEX) {
+			while(emitted[nextUnemitted]) ++nextUnemitted;
+			best = nextUnemitted;
+		}
+
+		const unsigned int * const triangle = &triangles[best * 3];
+
+		for(unsigned int k=0; k<3; ++k)
+			indices[output * 3 + k] = vertices[triangle[k]];
+
+		emitted[best] = 1;
+
+		//el triángulo deja de contar para sus vértices
+		for(unsigned int k=0; k<3; ++k) {
+			const unsigned int v = triangle[k];
+			unsigned int * const begin = &adjacency[adjacencyOffsets[v]];
+			unsigned int * const end = begin + remaining[v];
+
+			unsigned int * const position = std::find(begin, end, best);
+			*position = *(end - 1);
+			--remaining[v];
+		}
+
+		//LRU: los vértices del triángulo al principio, luego los que estaban en la caché
+		unsigned int newCacheSize = 0;
+		for(unsigned int k=0; k<3; ++k) {
+			if(std::find(newCache, newCache + newCacheSize, triangle[k]) == newCache + newCacheSize)
+				newCache[newCacheSize++] = triangle[k];
+		}
+		for(unsigned int i=0; i<cacheSize; ++i) {
+			if(cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+				newCache[newCacheSize++] = cache[i];
+		}
+
+		//los que quedan fuera de CACHE_SIZE salen de la caché. Se actualizan los puntajes de todos los vértices tocados y sus triángulos
+		for(unsigned int i=0; i<newCacheSize; ++i) {
+			const unsigned int v = newCache[i];
+			cachePositions[v] = i < CACHE_SIZE ? static_cast<int>(i) : -1;
+			vertexScores[v] = VertexScore(v);
+		}
+
+		for(unsigned int i=0; i<newCacheSize; ++i) {
+			const unsigned int v = newCache[i];
+			for(unsigned int j=0; j<remaining[v]; ++j) {
+				const unsigned int t = adjacency[adjacencyOffsets[v] + j];
+				triangleScores[t] = vertexScores[triangles[t * 3]] + vertexScores[triangles[t * 3 + 1]] + vertexScores[triangles[t * 3 + 2]];
+			}
+		}
+
+		cacheSize = std::min(newCacheSize, CACHE_SIZE);
+		std::copy(newCache, newCache + cacheSize, cache);
+
+		//el próximo es el mejor de los triángulos que usan vértices de la caché
+		best = NO_VERTEX;
+		float bestScore = -1.0f;
+
+		for(unsigned int i=0; i<cacheSize; ++i) {
+			const unsigned int v = cache[i];
+			for(unsigned int j=0; j<remaining[v]; ++j) {
+				const unsigned int t = adjacency[adjacencyOffsets[v] + j];
+				if(triangleScores[t] > bestScore) {
+					bestScore = triangleScores[t];
+					best = t;
+				}
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------------------
+// Overdraw: la secuencia optimizada para la caché se parte en clusters donde un triángulo
+// no reutiliza ningún vértice (la caché se vació) o donde el ACMR acumulado del cluster ya
+// llegó a threshold veces el del tramo, así los clusters no empeoran mucho la caché. Luego
+// los clusters se ordenan por la distancia de su centroide al centroide del subset en la
+// dirección de su normal media: primero los que miran hacia afuera, que suelen tapar a los
+// demás, para que el depth test descarte más píxeles.
+//------------------------------------------------------------------------------------------
+void MeshOptimizer::OptimizeOverdraw(unsigned int * const indices, const unsigned int numFaces, const float * const positions, 
+                                     const size_t positionStride, const float threshold, Workspace &workspace)
+{
+	const unsigned int CACHE_SIZE = STATISTICS_CACHE_SIZE;
+
+	if(numFaces < 2) return;
+
+	//clusters donde la caché se vacía
+	vector<unsigned int> hardBoundaries;
+
+	FlushFIFOCache(workspace, CACHE_SIZE);
+	for(unsigned int f=0; f<numFaces; ++f) {
+		if(SimulateFIFOCache(indices + f * 3, workspace, CACHE_SIZE) == 3 || f == 0)
+			hardBoundaries.push_back(f);
+	}
+	hardBoundaries.push_back(numFaces);
+
+	//cada uno se parte donde el ACMR del cluster alcanza threshold veces el del tramo completo
+	vector<unsigned int> clusters;
+
+	for(size_t h=0; h+1<hardBoundaries.size(); ++h)
+	{
+		const unsigned int begin = hardBoundaries[h];
+		const unsigned int end = hardBoundaries[h + 1];
+
+		FlushFIFOCache(workspace, CACHE_SIZE);
+		unsigned int misses = 0;
+		for(unsigned int f=begin; f<end; ++f)
+			misses += SimulateFIFOCache(indices + f * 3, workspace, CACHE_SIZE);
+
+		const float clusterThreshold = threshold * misses / (end - begin);
+
+		clusters.push_back(begin);
+
+		FlushFIFOCache(workspace, CACHE_SIZE);
+		unsigned int runningMisses = 0, runningFaces = 0;
+
+		for(unsigned int f=begin; f<end; ++f) {
+			runningMisses += SimulateFIFOCache(indices + f * 3, workspace, CACHE_SIZE);
+			++runningFaces;
+
+			if(runningMisses <= clusterThreshold * runningFaces && f + 1 < end) {
+				clusters.push_back(f + 1);
+				FlushFIFOCache(workspace, CACHE_SIZE);
+				runningMisses = runningFaces = 0;
+			}
+		}
+
+		//el último tramo no llegó al ACMR buscado: se une al cluster anterior
+		if(runningMisses > clusterThreshold * runningFaces && clusters.back() != begin)
+			clusters.pop_back();
+	}
+	clusters.push_back(numFaces);
+
+	const unsigned int numClusters = static_cast<unsigned int>(clusters.size() - 1);
+	if(numClusters < 2) return;
+
+	//centroide (ponderado por área) y normal media de cada cluster
+	vector<float> centroids(numClusters * 3, 0.0f);
+	vector<float> normals(numClusters * 3, 0.0f);
+	vector<float> areas(numClusters, 0.0f);
+	float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+	float meshArea = 0.0f;
+
+	for(unsigned int c=0; c<numClusters; ++c)
+	{
+		for(unsigned int f=clusters[c]; f<clusters[c + 1]; ++f)
+		{
+			const float *p[3];
+			for(unsigned int k=0; k<3; ++k)
+				p[k] = reinterpret_cast<const float *>(reinterpret_cast<const char *>(positions) + indices[f * 3 + k] * positionStride);
+
+			const float e1[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+			const float e2[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+			const float normal[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			const float area = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+			for(unsigned int k=0; k<3; ++k) {
+				centroids[c * 3 + k] += (p[0][k] + p[1][k] + p[2][k]) / 3.0f * area;
+				normals[c * 3 + k] += normal[k];
+			}
+			areas[c] += area;
+		}
+
+		for(unsigned int k=0; k<3; ++k)
+			meshCentroid[k] += centroids[c * 3 + k];
+		meshArea += areas[c];
+	}
+
+	if(meshArea > 0.0f) {
+		for(unsigned int k=0; k<3; ++k)
+			meshCentroid[k] /= meshArea;
+	}
+
+	vector<float> keys(numClusters, 0.0f);
+	vector<unsigned int> order(numClusters);
+
+	for(unsigned int c=0; c<numClusters; ++c)
+	{
+		order[c] = c;
+
+		const float *n = &normals[c * 3];
+		const float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if(areas[c] <= 0.0f || length <= 0.0f) continue;
+
+		for(unsigned int k=0; k<3; ++k)
+			keys[c] += (centroids[c * 3 + k] / areas[c] - meshCentroid[k]) * n[k] / length;
+	}
+
+	ClusterKeyGreater greater;
+	greater.keys = &keys;
+	std::stable_sort(order.begin(), order.end(), greater);
+
+	vector<unsigned int> sortedIndices;
+	sortedIndices.reserve(numFaces * static_cast<size_t>(3));
+
+	for(unsigned int c=0; c<numClusters; ++c)
+		sortedIndices.insert(sortedIndices.end(), indices + clusters[order[c]] * 3, indices + clusters[order[c] + 1] * 3);
+
+	std::copy(sortedIndices.begin(), sortedIndices.end(), indices);
+}
+
+unsigned int MeshOptimizer::SimulateFIFOCache(const unsigned int * const triangle, Workspace &workspace, const unsigned int cacheSize)
+{
+	unsigned int misses = 0;
+
+	//un vértice está en la caché si entró hace a lo sumo cacheSize vértices. Los aciertos no cambian el orden (FIFO)
+	for(unsigned int k=0; k<3; ++k) {
+		unsigned int &timestamp = workspace.timestamps[triangle[k]];
+		if(workspace.time - timestamp > cacheSize) {
+			timestamp = workspace.time++;
+			++misses;
+		}
+	}
+
+	return misses;
+}
+
+void MeshOptimizer::FlushFIFOCache(Workspace &workspace, const unsigned int cacheSize)
+{
+	if(workspace.time > MAX_CACHE_TIME) {
+		std::fill(workspace.timestamps.begin(), workspace.timestamps.end(), 0);
+		workspace.time = 0;
+	}
+
+	workspace.time += cacheSize + 1;
+}
+
+VertexCacheStatistics MeshOptimizer::AnalyzeVertexCache(const unsigned int * const indices, const unsigned int numFaces, 
+                                                        const unsigned int numVertices, const unsigned int cacheSize)
+{
+	VertexCacheStatistics statistics = { 0.0f, 0.0f };
+	if(numFaces == 0) return statistics;
+
+	Workspace workspace;
+	workspace.timestamps.assign(numVertices, 0);
+	workspace.time = 0;
+
+	FlushFIFOCache(workspace, cacheSize);
+
+	size_t misses = 0;
+	for(unsigned int f=0; f<numFaces; ++f) {
+		//sólo con más de ~4e9 fallos: se vacía la caché una vez
+		if(workspace.time > MAX_CACHE_TIME) FlushFIFOCache(workspace, cacheSize);
+
+		misses += SimulateFIFOCache(indices + f * 3, workspace, cacheSize);
+	}
+
+	vector<char> used(numVertices, 0);
+	unsigned int usedVertices = 0;
+	for(size_t i=0; i<numFaces * static_cast<size_t>(3); ++i) {
+		if(!used[indices[i]]) {
+			used[indices[i]] = 1;
+			++usedVertices;
+		}
+	}
+
+	statistics.acmr = static_cast<float>(static_cast<double>(misses) / numFaces);
+	statistics.atvr = usedVertices > 0 ? static_cast<float>(static_cast<double>(misses) / usedVertices) : 0.0f;
+
+	return statistics;
+}
+
+}
@@ -0,0 +1,102 @@
+﻿//------------------------------------------------------------------------------------------
+// File: MeshOptimizer.h
+//
+// Optimización de una lista de triángulos indexada para la GPU, sin D3DX ni Windows (sólo la
+// biblioteca estándar). Se usa en lugar de ID3DX10Mesh::Optimize:
+//   1. los triángulos se ordenan por atributo (material), uno o más subsets contiguos;
+//   2. dentro de cada subset se ordenan para la caché de vértices con el algoritmo de Forsyth
+//      ("Linear-Speed Vertex Cache Optimisation");
+//   3. la secuencia se parte en clusters donde la caché se vacía o el ACMR ya es bueno, y los
+//      clusters se ordenan de afuera hacia adentro para reducir el overdraw (Sander et al.,
+//      "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw");
+//   4. los vértices se renumeran en el orden en que los usan los triángulos (vertex fetch).
+// AnalyzeVertexCache mide el ACMR (vértices procesados por triángulo) y el ATVR (vértices
+// procesados por vértice) con una caché FIFO, para comparar antes y después.
+// ClusterSpatially parte los triángulos de cada atributo en clusters espaciales (meshes por
+// partes, ver Mesh::IsChunked). Usados como atributos de Optimize, cada cluster queda como un
+// subset con sus caras contiguas.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <vector>
+#include <cstddef>
+
+namespace DTFramework
+{
+
+//rango de caras y de vértices de un atributo, igual que D3DX10_ATTRIBUTE_RANGE
+struct MeshSubset
+{
+	unsigned int attribute;
+	unsigned int faceStart;
+	unsigned int faceCount;
+	unsigned int vertexStart;
+	unsigned int vertexCount;
+};
+
+struct VertexCacheStatistics
+{
+	float acmr;     //vértices procesados por triángulo: entre 0.5 (ideal en grillas grandes) y 3
+	float atvr;     //vértices procesados por vértice usado: 1 es ideal
+};
+
+class MeshOptimizer
+{
+public:
+	//tamaño de la caché del modelo de Forsyth y de la caché FIFO de las estadísticas (la de GPUs de la época de D3D10)
+	static const unsigned int FORSYTH_CACHE_SIZE = 32;
+	static const unsigned int STATISTICS_CACHE_SIZE = 16;
+
+	static const unsigned int NO_VERTEX = 0xFFFFFFFF;
+
+	//indices: numFaces * 3 índices de 32 bits. attributes: uno por cara. Se reordenan en el lugar y los índices quedan con la
+	//numeración nueva. positions: x, y, z (float) del vértice i en positions + i * positionStride bytes, con la numeración vieja.
+	//overdrawThreshold: ACMR máximo de los clusters respecto del de la secuencia optimizada (por ejemplo 1.05). <= 1 => no se optimiza
+	//el overdraw: queda el orden de OptimizeVertexCache.
+	//remap[i] es el índice nuevo del vértice i o NO_VERTEX si no lo usa ningún triángulo. Devuelve la cantidad de vértices usados.
+	//Puede lanzar std::bad_alloc
+	static unsigned int Optimize(unsigned int * const indices, unsigned int * const attributes, const unsigned int numFaces, 
+	                             const unsigned int numVertices, const float * const positions, const size_t positionStride, 
+	                             const float overdrawThreshold, std::vector<unsigned int> &remap, std::vector<MeshSubset> &subsets);
+
+	//parte las caras de cada atributo por la mediana de sus centroides sobre el eje más largo hasta que cada parte tenga a lo sumo
+	//maxClusterFaces caras. clusters[f] es el cluster de la cara f. Los clusters se numeran por atributo y luego en el orden de la
+	//partición (vecinos en el espacio, números cercanos); clusterAttributes[c] es el atributo del cluster c. Devuelve la cantidad
+	//de clusters. Puede lanzar std::bad_alloc
+	static unsigned int ClusterSpatially(const unsigned int * const indices, const unsigned int * const attributes, const unsigned int numFaces,
+	                                     const float * const positions, const size_t positionStride, const unsigned int maxClusterFaces,
+	                                     std::vector<unsigned int> &clusters, std::vector<unsigned int> &clusterAttributes);
+
+	static VertexCacheStatistics AnalyzeVertexCache(const unsigned int * const indices, const unsigned int numFaces, 
+	                                                const unsigned int numVertices, const unsigned int cacheSize=STATISTICS_CACHE_SIZE);
+
+private:
+	//datos de trabajo compartidos por todos los subsets. Los arreglos por vértice se indexan con la numeración de la mesh
+	struct Workspace
+	{
+		std::vector<unsigned int> localVertex;      //índice del vértice dentro del subset actual, NO_VERTEX si no está en él
+		std::vector<unsigned int> timestamps;       //caché FIFO simulada
+		unsigned int time;
+	};
+
+	static void SortByAttribute(unsigned int * const indices, unsigned int * const attributes, const unsigned int numFaces, 
+	                            std::vector<MeshSubset> &subsets);
+
+	static void OptimizeVertexCache(unsigned int * const indices, const unsigned int numFaces, Workspace &workspace);
+
+	static void OptimizeOverdraw(unsigned int * const indices, const unsigned int numFaces, const float * const positions, 
+	                             const size_t positionStride, const float threshold, Workspace &workspace);
+
+	//vértices que no estaban en la caché FIFO simulada al procesar un triángulo (y los agrega)
+	static unsigned int SimulateFIFOCache(const unsigned int * const triangle, Workspace &workspace, const unsigned int cacheSize);
+
+	static void FlushFIFOCache(Workspace &workspace, const unsigned int cacheSize);
+};
+
+}
+
+#endif
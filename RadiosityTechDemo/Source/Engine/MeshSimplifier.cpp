@@ -0,0 +1,273 @@
+﻿//------------------------------------------------------------------------------------------
+// File: MeshSimplifier.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "MeshSimplifier.h"
+
+#include <cmath>
+#include <algorithm>
+
+using std::vector;
+
+namespace DTFramework
+{
+
+const float MeshSimplifier::MIN_REDUCTION = 0.75f;
+
+//matriz simétrica de 4x4 de la suma de los cuadrados de las distancias a un conjunto de planos
+struct Quadric
+{
+	double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+};
+
+//contracción del vértice source sobre el vértice target
+struct EdgeCollapse
+{
+	unsigned int source;
+	unsigned int target;
+	double cost;
+
+	bool operator<(const EdgeCollapse &other) const
+	{
+		return cost < other.cost;
+	}
+};
+
+static inline const float *GetPosition(const float * const positions, const size_t positionStride, const unsigned int vertex)
+{
+	return reinterpret_cast<const float *>(reinterpret_cast<const unsigned char *>(positions) + vertex * positionStride);
+}
+
+static inline void AddQuadric(Quadric &q, const Quadric &other)
+{
+	q.xx += other.xx; q.xy += other.xy; q.xz += other.xz; q.xw += other.xw;
+	q.yy += other.yy; q.yz += other.yz; q.yw += other.yw;
+	q.zz += other.zz; q.zw += other.zw;
+	q.ww += other.ww;
+}
+
+static inline double EvaluateQuadric(const Quadric &q, const float * const p)
+{
+	const double x = p[0], y = p[1], z = p[2];
+
+	return q.xx * x * x + 2.0 * q.xy * x * y + 2.0 * q.xz * x * z + 2.0 * q.xw * x +
+	       q.yy * y * y + 2.0 * q.yz * y * z + 2.0 * q.yw * y + 
+	       q.zz * z * z + 2.0 * q.zw * z + 
+	       q.ww;
+}
+
+//producto vectorial de (b - a) y (c - a)
+static inline void TriangleNormal(const float * const a, const float * const b, const float * const c, double n[3])
+{
+	const double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	const double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+void MeshSimplifier::BuildLODChain(const unsigned int * const indices, const unsigned int numFaces, const float * const positions,
+                                   const size_t positionStride, const unsigned int numVertices, const unsigned int maxLevels,
+                                   const unsigned int minFaces, vector<unsigned int> &lodIndices, vector<SimplifiedLevel> &levels)
+{
+	levels.clear();
+
+	if(numFaces == 0 || maxLevels == 0) return;
+
+	vector<unsigned int> triangles(indices, indices + numFaces * static_cast<size_t>(3));
+	vector<char> alive(numFaces, 1);
+	unsigned int aliveFaces = numFaces;
+
+	//cuádrica de cada vértice: los planos de sus triángulos (sin pesar por el área: el costo es una suma de distancias al cuadrado)
+	const Quadric zero = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	vector<Quadric> quadrics(numVertices, zero);
+
+	//normal original de cada cara: una contracción no puede alejar un triángulo más de 90° de la superficie original
+	vector<double> faceNormals(numFaces * static_cast<size_t>(3));
+
+	for(unsigned int f=0; f<numFaces; ++f)
+	{
+		const float * const p0 = GetPosition(positions, positionStride, triangles[f * 3]);
+
+		double * const n = &faceNormals[f * 3];
+		TriangleNormal(p0, GetPosition(positions, positionStride, triangles[f * 3 + 1]), GetPosition(positions, positionStride, triangles[f * 3 + 2]), n);
+
+		const double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if(length <= 0.0) continue;
+
+		n[0] /= length; n[1] /= length; n[2] /= length;
+		const double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+
+		const Quadric plane = { n[0] * n[0], n[0] * n[1], n[0] * n[2], n[0] * d, n[1] * n[1], n[1] * n[2], n[1] * d, n[2] * n[2], n[2] * d, d * d };
+
+		for(unsigned int k=0; k<3; ++k)
+			AddQuadric(quadrics[triangles[f * 3 + k]], plane);
+	}
+
+	//vértices fijos: extremos de aristas que no tienen exactamente dos caras
+	vector<char> locked(numVertices, 0);
+	{
+		vector<unsigned long long> edges(numFaces * static_cast<size_t>(3));
+		for(unsigned int f=0; f<numFaces; ++f) {
+			for(unsigned int k=0; k<3; ++k) {
+				const unsigned long long a = triangles[f * 3 + k], b = triangles[f * 3 + (k + 1) % 3];
+				edges[f * 3 + k] = a < b ? (a << 32) | b : (b << 32) | a;
+			}
+		}
+
+		std::sort(edges.begin(), edges.end());
+
+		for(size_t begin=0; begin<edges.size(); )
+		{
+			size_t end = begin + 1;
+			while(end < edges.size() && edges[end] == edges[begin]) ++end;
+
+			if(end - begin != 2) {
+				locked[static_cast<unsigned int>(edges[begin] >> 32)] = 1;
+				locked[static_cast<unsigned int>(edges[begin] & 0xFFFFFFFF)] = 1;
+			}
+
+			begin = end;
+		}
+	}
+
+	vector<unsigned int> adjacencyOffsets(numVertices + 1);
+	vector<unsigned int> adjacency;
+	vector<EdgeCollapse> collapses;
+	vector<char> touched(numVertices);
+
+	unsigned int previousFaces = numFaces;
+	unsigned int targetFaces = numFaces / 2;
+	double maxCost = 0.0;
+
+	while(levels.size() < maxLevels && targetFaces >= minFaces)
+	{
+		//caras vivas de cada vértice
+		adjacencyOffsets.assign(numVertices + 1, 0);
+		for(unsigned int f=0; f<numFaces; ++f) {
+			if(!alive[f]) continue;
+			for(unsigned int k=0; k<3; ++k)
+				adjacencyOffsets[triangles[f * 3 + k] + 1]++;
+		}
+		for(unsigned int v=0; v<numVertices; ++v)
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+		adjacency.resize(adjacencyOffsets[numVertices]);
+		{
+			vector<unsigned int> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for(unsigned int f=0; f<numFaces; ++f) {
+				if(!alive[f]) continue;
+				for(unsigned int k=0; k<3; ++k)
+					adjacency[cursor[triangles[f * 3 + k]]++] = f;
+			}
+		}
+
+		//contracciones posibles ordenadas por error (cada arista aparece una vez por cara)
+		collapses.clear();
+		for(unsigned int f=0; f<numFaces; ++f) 
+		{
+			if(!alive[f]) continue;
+
+			for(unsigned int k=0; k<3; ++k) 
+			{
+				const unsigned int a = triangles[f * 3 + k], b = triangles[f * 3 + (k + 1) % 3];
+
+				if(!locked[a]) {
+					const EdgeCollapse collapse = { a, b, EvaluateQuadric(quadrics[a], GetPosition(positions, positionStride, b)) };
+					collapses.push_back(collapse);
+				}
+				if(!locked[b]) {
+					const EdgeCollapse collapse = { b, a, EvaluateQuadric(quadrics[b], GetPosition(positions, positionStride, a)) };
+					collapses.push_back(collapse);
+				}
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end());
+
+		touched.assign(numVertices, 0);
+		unsigned int performed = 0;
+
+		for(size_t i=0; i<collapses.size() && aliveFaces > targetFaces; ++i)
+		{
+			const unsigned int source = collapses[i].source;
+			const unsigned int target = collapses[i].target;
+
+			if(touched[source] || touched[target]) continue;
+
+			//ningún triángulo que queda puede darse vuelta ni quedar sin área
+			bool valid = true;
+			for(unsigned int j=adjacencyOffsets[source]; valid && j<adjacencyOffsets[source + 1]; ++j)
+			{
+				const unsigned int f = adjacency[j];
+				const unsigned int * const t = &triangles[f * 3];
+
+				if(!alive[f] || t[0] == target || t[1] == target || t[2] == target) continue;
+
+				const float *after[3];
+				for(unsigned int k=0; k<3; ++k)
+					after[k] = GetPosition(positions, positionStride, t[k] == source ? target : t[k]);
+
+				double n[3];
+				TriangleNormal(after[0], after[1], after[2], n);
+
+				const double * const original = &faceNormals[f * 3];
+				valid = n[0] * original[0] + n[1] * original[1] + n[2] * original[2] > 0.0;
+			}
+
+			if(!valid) continue;
+
+			for(unsigned int j=adjacencyOffsets[source]; j<adjacencyOffsets[source + 1]; ++j)
+			{
+				const unsigned int f = adjacency[j];
+				unsigned int * const t = &triangles[f * 3];
+
+				if(!alive[f]) continue;
+
+				if(t[0] == target || t[1] == target || t[2] == target) {
+					alive[f] = 0;
+					--aliveFaces;
+				} else {
+					for(unsigned int k=0; k<3; ++k)
+						if(t[k] == source) t[k] = target;
+				}
+			}
+
+			AddQuadric(quadrics[target], quadrics[source]);
+			maxCost = std::max(maxCost, collapses[i].cost);
+
+			touched[source] = touched[target] = 1;
+			++performed;
+		}
+
+		const bool reachedTarget = aliveFaces <= targetFaces;
+
+		if(!reachedTarget && performed > 0) continue;
+
+		//nivel nuevo si llegó a la mitad o, si ya no se puede simplificar, si redujo lo suficiente
+		if(reachedTarget || aliveFaces <= previousFaces * MIN_REDUCTION)
+		{
+			SimplifiedLevel level;
+			level.indexStart = static_cast<unsigned int>(lodIndices.size());
+			level.indexCount = aliveFaces * 3;
+			level.error = static_cast<float>(sqrt(std::max(maxCost, 0.0)));
+
+			for(unsigned int f=0; f<numFaces; ++f) {
+				if(alive[f])
+					lodIndices.insert(lodIndices.end(), &triangles[f * 3], &triangles[f * 3] + 3);
+			}
+
+			levels.push_back(level);
+			previousFaces = aliveFaces;
+		}
+
+		if(!reachedTarget) break;
+
+		targetFaces = aliveFaces / 2;
+	}
+}
+
+}
@@ -0,0 +1,52 @@
+﻿//------------------------------------------------------------------------------------------
+// File: MeshSimplifier.h
+//
+// Niveles de detalle de una mesh por contracción de aristas con el error cuadrático de
+// Garland y Heckbert. Usa sólo la biblioteca estándar de C++, igual que MeshOptimizer. Cada
+// contracción lleva un vértice sobre un vecino existente (half-edge collapse), así todos los
+// niveles usan los vértices de la mesh original y sólo cambian los índices. No se mueven:
+//   - los vértices de bordes (aristas con una sola cara: el límite de un cluster o una
+//     costura de coordenadas de textura) ni de aristas con más de dos caras, así los niveles
+//     de clusters vecinos no dejan grietas;
+//   - los vértices cuya contracción da vuelta algún triángulo.
+// En cada pasada se ordenan las contracciones posibles por error y se aplican las que no
+// tocan un vértice ya modificado en la pasada, hasta llegar a la cantidad de caras buscada.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <vector>
+#include <cstddef>
+
+namespace DTFramework
+{
+
+//un nivel de detalle generado por MeshSimplifier::BuildLODChain
+struct SimplifiedLevel
+{
+	unsigned int indexStart;    //primer índice del nivel en lodIndices
+	unsigned int indexCount;
+	float error;                //cota de la distancia a los planos de los triángulos originales, en unidades de las posiciones
+};
+
+class MeshSimplifier
+{
+public:
+	//indices: numFaces * 3 índices en [0, numVertices). positions: x, y, z (float) del vértice i en positions + i * positionStride bytes.
+	//Cada nivel tiene a lo sumo la mitad de las caras del anterior (el primero, de la mesh) y se genera mientras queden al menos
+	//minFaces caras, hasta maxLevels niveles. Si la mesh no se puede simplificar a la mitad se agrega el último nivel alcanzado
+	//sólo si tiene a lo sumo MIN_REDUCTION de las caras del anterior. Los índices de los niveles se agregan a lodIndices.
+	//Puede lanzar std::bad_alloc
+	static void BuildLODChain(const unsigned int * const indices, const unsigned int numFaces, const float * const positions,
+	                          const size_t positionStride, const unsigned int numVertices, const unsigned int maxLevels,
+	                          const unsigned int minFaces, std::vector<unsigned int> &lodIndices, std::vector<SimplifiedLevel> &levels);
+
+	static const float MIN_REDUCTION;
+};
+
+}
+
+#endif
\ No newline at end of file
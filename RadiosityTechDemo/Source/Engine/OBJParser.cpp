@@ -0,0 +1,450 @@
+﻿//------------------------------------------------------------------------------------------
+// File: OBJParser.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "OBJParser.h"
+
+namespace DTFramework
+{
+
+//potencias de 10 exactas en double
+static const double POWERS_OF_TEN[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool IsBlank(const char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool IsDigit(const char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline const char *SkipBlanks(const char *p, const char * const end)
+{
+	while(p < end && IsBlank(*p)) ++p;
+	return p;
+}
+
+//float en formato decimal ([+-]dígitos[.dígitos][(e|E)[+-]dígitos]). Devuelve NULL si no hay un número en p
+static const char *ParseFloat(const char *p, const char * const end, float &value)
+{
+	p = SkipBlanks(p, end);
+
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		++p;
+	}
+
+	//hasta 19 dígitos entran en un UINT64. Los demás sólo cambian el exponente
+	UINT64 mantissa = 0;
+	int exponent = 0;
+	UINT digits = 0;
+	bool anyDigit = false;
+
+	for(; p < end && IsDigit(*p); ++p) {
+		anyDigit = true;
+		if(digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if(mantissa != 0) ++digits;
+		}
+		else ++exponent;
+	}
+
+	if(p < end && *p == '.') {
+		for(++p; p < end && IsDigit(*p); ++p) {
+			anyDigit = true;
+			if(digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if(mantissa != 0) ++digits;
+				--exponent;
+			}
+		}
+	}
+
+	if(!anyDigit) return NULL;
+
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool negativeExponent = false;
+		if(q < end && (*q == '-' || *q == '+')) {
+			negativeExponent = *q == '-';
+			++q;
+		}
+
+		if(q < end && IsDigit(*q)) {
+			int e = 0;
+			for(; q < end && IsDigit(*q); ++q) {
+				if(e < 10000) e = e * 10 + (*q - '0');
+			}
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+
+	double result = static_cast<double>(mantissa);
+	if(mantissa != 0 && exponent != 0) {
+		const int absExponent = exponent < 0 ? -exponent : exponent;
+		const double scale = absExponent <= 22 ? POWERS_OF_TEN[absExponent] : pow(10.0, absExponent);
+		result = exponent < 0 ? result / scale : result * scale;
+	}
+
+	value = static_cast<float>(negative ? -result : result);
+
+	return p;
+}
+
+//entero sin signo mayor que 0. Devuelve NULL si no hay uno en p
+static const char *ParseIndex(const char *p, const char * const end, UINT &value)
+{
+	if(p >= end || !IsDigit(*p)) return NULL;
+
+	UINT64 result = 0;
+	for(; p < end && IsDigit(*p); ++p) {
+		result = result * 10 + (*p - '0');
+		if(result > 0xFFFFFFFF) return NULL;
+	}
+
+	if(result == 0) return NULL;
+
+	value = static_cast<UINT>(result);
+
+	return p;
+}
+
+//p/t/n o p//n. La normal es obligatoria, igual que antes con stringstream
+static const char *ParseFaceVertex(const char *p, const char * const end, OBJFaceVertex &vertex)
+{
+	p = SkipBlanks(p, end);
+
+	if((p = ParseIndex(p, end, vertex.position)) == NULL) return NULL;
+	if(p >= end || *p != '/') return NULL;
+	++p;
+
+	vertex.texCoord = 0;
+	if(p < end && *p != '/') {
+		if((p = ParseIndex(p, end, vertex.texCoord)) == NULL) return NULL;
+	}
+
+	if(p >= end || *p != '/') return NULL;
+	++p;
+
+	return ParseIndex(p, end, vertex.normal);
+}
+
+//nombre de un material o archivo: el primer token del resto de la línea
+static bool ParseName(const char *p, const char * const end, string &name)
+{
+	p = SkipBlanks(p, end);
+
+	const char *nameEnd = p;
+	while(nameEnd < end && !IsBlank(*nameEnd)) ++nameEnd;
+
+	if(nameEnd == p) return false;
+
+	name.assign(p, nameEnd);
+
+	return true;
+}
+
+OBJParser::OBJParser()
+{
+
+}
+
+void OBJParser::Clear()
+{
+	vector<D3DXVECTOR3>().swap(m_positions);
+	vector<D3DXVECTOR2>().swap(m_texCoords);
+	vector<D3DXVECTOR3>().swap(m_normals);
+	vector<OBJFace>().swap(m_faces);
+	vector<OBJEvent>().swap(m_events);
+}
+
+UINT64 OBJParser::AlignToLine(const char * const data, const UINT64 size, const UINT64 offset)
+{
+	if(offset == 0) return 0;
+	if(offset >= size) return size;
+
+	//si el byte anterior es un fin de línea, offset ya es el comienzo de una línea
+	const void * const newLine = memchr(data + offset - 1, '\n', static_cast<size_t>(size - offset + 1));
+
+	return newLine ? static_cast<UINT64>(static_cast<const char*>(newLine) - data) + 1 : size;
+}
+
+HRESULT OBJParser::Parse(const wstring &file, const UINT numThreads)
+{
+	HRESULT hr;
+
+	Clear();
+
+	MappedFile mappedFile;
+	if(FAILED(hr = mappedFile.Open(file))) {
+		ErrorWarning(L"OBJParser::Parse --> MappedFile::Open");
+		return hr;
+	}
+
+	const char * const data = reinterpret_cast<const char*>(mappedFile.GetData());
+	const UINT64 size = mappedFile.GetSize();
+
+	const UINT numChunks = size > 0 ? static_cast<UINT>((size + CHUNK_SIZE - 1) / CHUNK_SIZE) : 1;
+
+	vector<Chunk> chunks;
+	vector<UINT64> boundaries;
+
+	try
+	{
+		chunks.resize(numChunks);
+		boundaries.resize(numChunks + 1);
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	//el bloque i tiene las líneas que empiezan en [i * CHUNK_SIZE, (i + 1) * CHUNK_SIZE)
+	for(UINT i=0; i<numChunks; ++i)
+		boundaries[i] = AlignToLine(data, size, i * CHUNK_SIZE);
+	boundaries[numChunks] = size;
+
+	//con un solo bloque no vale la pena crear los hilos
+	ThreadPool threadPool;
+	const bool parallel = numChunks > 1;
+
+	if(parallel) {
+		if(FAILED(hr = threadPool.Init(numThreads))) return hr;
+
+		threadPool.ParallelFor(numChunks, [&](const UINT i, const UINT) {
+			ParseChunk(data + boundaries[i], data + boundaries[i + 1], chunks[i]);
+		});
+	}
+	else if(size > 0)
+		ParseChunk(data, data + size, chunks[0]);
+
+	for(UINT i=0; i<numChunks; ++i)
+	{
+		if(chunks[i].error == NO_ERROR_CODE) continue;
+
+		if(chunks[i].error == MESHFILE_ERROR) {
+			//número de línea absoluto: las líneas completas de los bloques anteriores
+			UINT64 line = chunks[i].errorLine;
+			for(UINT64 b=0; b<boundaries[i]; ++b)
+				if(data[b] == '\n') ++line;
+
+			std::wstringstream function;
+			function << L"OBJParser::Parse (línea " << line << L")";
+			MiscErrorWarning(MESHFILE_ERROR, function.str().c_str());
+		}
+		else
+			MiscErrorWarning(chunks[i].error);
+
+		return E_FAIL;
+	}
+
+	//concatenamos los bloques en el orden del archivo
+	vector<UINT> positionOffsets(numChunks), texCoordOffsets(numChunks), normalOffsets(numChunks), faceOffsets(numChunks);
+	UINT64 numPositions = 0, numTexCoords = 0, numNormals = 0, numFaces = 0, numEvents = 0;
+
+	for(UINT i=0; i<numChunks; ++i) {
+		positionOffsets[i] = static_cast<UINT>(numPositions);
+		texCoordOffsets[i] = static_cast<UINT>(numTexCoords);
+		normalOffsets[i] = static_cast<UINT>(numNormals);
+		faceOffsets[i] = static_cast<UINT>(numFaces);
+
+		numPositions += chunks[i].positions.size();
+		numTexCoords += chunks[i].texCoords.size();
+		numNormals += chunks[i].normals.size();
+		numFaces += chunks[i].faces.size();
+		numEvents += chunks[i].events.size();
+	}
+
+	//los índices del index buffer son DWORD
+	if(numPositions > 0xFFFFFFFF || numTexCoords > 0xFFFFFFFF || numNormals > 0xFFFFFFFF || numFaces * 3 > 0xFFFFFFFF) {
+		MiscErrorWarning(LENGTH_ERROR);
+		return E_FAIL;
+	}
+
+	try
+	{
+		m_positions.resize(static_cast<size_t>(numPositions));
+		m_texCoords.resize(static_cast<size_t>(numTexCoords));
+		m_normals.resize(static_cast<size_t>(numNormals));
+		m_faces.resize(static_cast<size_t>(numFaces));
+		m_events.reserve(static_cast<size_t>(numEvents));
+
+		//pocos y con strings: se copian en este hilo
+		for(UINT i=0; i<numChunks; ++i) {
+			for(UINT e=0; e<chunks[i].events.size(); ++e) {
+				m_events.push_back(chunks[i].events[e]);
+				m_events.back().face += faceOffsets[i];
+			}
+		}
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		Clear();
+		return E_FAIL;
+	}
+
+	const auto copyChunk = [&](const UINT i, const UINT) {
+		Chunk &chunk = chunks[i];
+
+		if(!chunk.positions.empty())
+			memcpy(&m_positions[positionOffsets[i]], &chunk.positions[0], chunk.positions.size() * sizeof(D3DXVECTOR3));
+		if(!chunk.texCoords.empty())
+			memcpy(&m_texCoords[texCoordOffsets[i]], &chunk.texCoords[0], chunk.texCoords.size() * sizeof(D3DXVECTOR2));
+		if(!chunk.normals.empty())
+			memcpy(&m_normals[normalOffsets[i]], &chunk.normals[0], chunk.normals.size() * sizeof(D3DXVECTOR3));
+		if(!chunk.faces.empty())
+			memcpy(&m_faces[faceOffsets[i]], &chunk.faces[0], chunk.faces.size() * sizeof(OBJFace));
+
+		//liberamos la memoria del bloque apenas se copia
+		vector<D3DXVECTOR3>().swap(chunk.positions);
+		vector<D3DXVECTOR2>().swap(chunk.texCoords);
+		vector<D3DXVECTOR3>().swap(chunk.normals);
+		vector<OBJFace>().swap(chunk.faces);
+	};
+
+	if(parallel)
+		threadPool.ParallelFor(numChunks, copyChunk);
+	else
+		copyChunk(0, 0);
+
+	if(!ValidateFaces()) {
+		MiscErrorWarning(MESHFILE_ERROR, L"OBJParser::Parse");
+		Clear();
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// Se ejecuta en los hilos del ThreadPool: no muestra mensajes ni lanza excepciones, sólo
+// guarda el código de error en el bloque. Los comandos no reconocidos se ignoran.
+//------------------------------------------------------------------------------------------
+void OBJParser::ParseChunk(const char *begin, const char * const end, Chunk &chunk)
+{
+	UINT line = 0;
+
+	try
+	{
+		//estimación gruesa para evitar la mayoría de las realocaciones (una línea de ~30 bytes)
+		chunk.positions.reserve(static_cast<size_t>((end - begin) / 64));
+
+		const char *p = begin;
+		while(p < end)
+		{
+			++line;
+
+			const char *lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+			const char * const next = lineEnd ? lineEnd + 1 : end;
+			if(!lineEnd) lineEnd = end;
+
+			p = SkipBlanks(p, lineEnd);
+
+			const char *command = p;
+			while(p < lineEnd && !IsBlank(*p)) ++p;
+			const size_t commandLength = p - command;
+
+			bool ok = true;
+
+			if(commandLength == 1 && command[0] == 'v')
+			{
+				D3DXVECTOR3 position;
+				ok = (p = ParseFloat(p, lineEnd, position.x)) && (p = ParseFloat(p, lineEnd, position.y)) &&
+				     (p = ParseFloat(p, lineEnd, position.z));
+				if(ok) chunk.positions.push_back(position);
+			}
+			else if(commandLength == 2 && command[0] == 'v' && command[1] == 't')
+			{
+				D3DXVECTOR2 texCoord;
+				ok = (p = ParseFloat(p, lineEnd, texCoord.x)) && (p = ParseFloat(p, lineEnd, texCoord.y));
+				if(ok) chunk.texCoords.push_back(texCoord);
+			}
+			else if(commandLength == 2 && command[0] == 'v' && command[1] == 'n')
+			{
+				D3DXVECTOR3 normal;
+				ok = (p = ParseFloat(p, lineEnd, normal.x)) && (p = ParseFloat(p, lineEnd, normal.y)) &&
+				     (p = ParseFloat(p, lineEnd, normal.z));
+				if(ok) chunk.normals.push_back(normal);
+			}
+			else if(commandLength == 1 && command[0] == 'f')
+			{
+				OBJFace face;
+				ok = (p = ParseFaceVertex(p, lineEnd, face.vertices[0])) && (p = ParseFaceVertex(p, lineEnd, face.vertices[1])) &&
+				     (p = ParseFaceVertex(p, lineEnd, face.vertices[2]));
+				if(ok) chunk.faces.push_back(face);
+			}
+			else if(commandLength == 1 && command[0] == 'g')
+			{
+				OBJEvent event;
+				event.type = OBJ_EVENT_GROUP;
+				event.face = static_cast<UINT>(chunk.faces.size());
+				chunk.events.push_back(event);
+			}
+			else if(commandLength == 6 && memcmp(command, "usemtl", 6) == 0)
+			{
+				OBJEvent event;
+				event.type = OBJ_EVENT_USEMTL;
+				event.face = static_cast<UINT>(chunk.faces.size());
+				ok = ParseName(p, lineEnd, event.name);
+				if(ok) chunk.events.push_back(event);
+			}
+			else if(commandLength == 6 && memcmp(command, "mtllib", 6) == 0)
+			{
+				OBJEvent event;
+				event.type = OBJ_EVENT_MTLLIB;
+				event.face = static_cast<UINT>(chunk.faces.size());
+				ok = ParseName(p, lineEnd, event.name);
+				if(ok) chunk.events.push_back(event);
+			}
+
+			if(!ok) {
+				chunk.error = MESHFILE_ERROR;
+				chunk.errorLine = line;
+				return;
+			}
+
+			p = next;
+		}
+	}
+	catch (std::bad_alloc &)
+	{
+		chunk.error = BAD_ALLOC;
+	}
+	catch (std::length_error &)
+	{
+		chunk.error = LENGTH_ERROR;
+	}
+}
+
+bool OBJParser::ValidateFaces() const
+{
+	const UINT numPositions = static_cast<UINT>(m_positions.size());
+	const UINT numTexCoords = static_cast<UINT>(m_texCoords.size());
+	const UINT numNormals = static_cast<UINT>(m_normals.size());
+
+	for(UINT f=0; f<m_faces.size(); ++f)
+	{
+		for(UINT v=0; v<3; ++v)
+		{
+			const OBJFaceVertex &vertex = m_faces[f].vertices[v];
+
+			if(vertex.position > numPositions || vertex.texCoord > numTexCoords || vertex.normal > numNormals)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+}
@@ -0,0 +1,142 @@
+﻿//------------------------------------------------------------------------------------------
+// File: OBJParser.h
+//
+// Lectura de la geometría de un archivo .obj. El archivo se proyecta en memoria (MappedFile)
+// y se divide en bloques que terminan en fin de línea, que se interpretan en paralelo con un
+// ThreadPool. Los números se leen directamente de los bytes del archivo, sin stringstream.
+// Luego los resultados de los bloques se concatenan en el orden del archivo. Las caras se
+// guardan con los índices del archivo. Los comandos que afectan a las caras siguientes (g,
+// usemtl, mtllib) se guardan como eventos con la posición de la cara en la que ocurren, y
+// Mesh los aplica en orden mientras agrega los vértices.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include <sstream>
+#include <cmath>
+#include <cstring>
+
+#include "Utility.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+using std::vector;
+using std::string;
+using std::wstring;
+
+namespace DTFramework
+{
+
+//índices de un vértice de una cara, base 1 como en el archivo. texCoord == 0 => sin coordenadas de textura
+struct OBJFaceVertex
+{
+	UINT position;
+	UINT texCoord;
+	UINT normal;
+};
+
+//sólo se leen los tres primeros vértices de cada cara (triángulos)
+struct OBJFace
+{
+	OBJFaceVertex vertices[3];
+};
+
+enum OBJEventType
+{
+	OBJ_EVENT_GROUP,        //g: nuevo objeto. Sus vértices no se comparten con los anteriores
+	OBJ_EVENT_USEMTL,       //usemtl: material de las caras siguientes
+	OBJ_EVENT_MTLLIB        //mtllib: archivo .mtl
+};
+
+struct OBJEvent
+{
+	OBJEventType type;
+	UINT face;              //cantidad de caras leídas antes del comando
+	string name;            //material o archivo .mtl
+};
+
+class OBJParser
+{
+public:
+	OBJParser();
+
+	//file es la ruta completa. numThreads == 0 => un hilo por núcleo lógico
+	HRESULT Parse(const wstring &file, const UINT numThreads=0);
+
+	const vector<D3DXVECTOR3> &GetPositions() const;
+	const vector<D3DXVECTOR2> &GetTexCoords() const;
+	const vector<D3DXVECTOR3> &GetNormals() const;
+	const vector<OBJFace> &GetFaces() const;
+	const vector<OBJEvent> &GetEvents() const;
+
+	//libera la memoria de los resultados
+	void Clear();
+
+private:
+	//resultados de un bloque del archivo
+	struct Chunk
+	{
+		vector<D3DXVECTOR3> positions;
+		vector<D3DXVECTOR2> texCoords;
+		vector<D3DXVECTOR3> normals;
+		vector<OBJFace> faces;
+		vector<OBJEvent> events;    //face relativo al bloque
+
+		UINT error;                 //código de MiscErrorWarning o NO_ERROR_CODE
+		UINT errorLine;             //línea (desde 1, relativa al bloque) del error de formato
+
+		Chunk() : error(NO_ERROR_CODE), errorLine(0) {}
+	};
+
+	static void ParseChunk(const char *begin, const char * const end, Chunk &chunk);
+
+	//primera posición en [offset, size] donde empieza una línea
+	static UINT64 AlignToLine(const char * const data, const UINT64 size, const UINT64 offset);
+
+	//verifica que las caras usen índices de vértices existentes
+	bool ValidateFaces() const;
+
+private:
+	static const UINT NO_ERROR_CODE = 0xFFFFFFFF;
+
+	//tamaño aproximado de los bloques. Varios por hilo para que el work stealing reparta la carga
+	static const UINT64 CHUNK_SIZE = 1 << 20;
+
+	vector<D3DXVECTOR3> m_positions;
+	vector<D3DXVECTOR2> m_texCoords;
+	vector<D3DXVECTOR3> m_normals;
+	vector<OBJFace> m_faces;
+	vector<OBJEvent> m_events;
+};
+
+inline const vector<D3DXVECTOR3> &OBJParser::GetPositions() const
+{
+	return m_positions;
+}
+
+inline const vector<D3DXVECTOR2> &OBJParser::GetTexCoords() const
+{
+	return m_texCoords;
+}
+
+inline const vector<D3DXVECTOR3> &OBJParser::GetNormals() const
+{
+	return m_normals;
+}
+
+inline const vector<OBJFace> &OBJParser::GetFaces() const
+{
+	return m_faces;
+}
+
+inline const vector<OBJEvent> &OBJParser::GetEvents() const
+{
+	return m_events;
+}
+
+}
+
+#endif
@@ -135,19 +135,14 @@ HRESULT OmniShadowMap::ComputeShadowMap(const Scene &scene, const Light &light)
 		DXGI_D3D_ErrorWarning(hr, L"OmniShadowMap::ComputeShadowMap --> SetMatrixArray");
 		return hr;
 	}
-	
-	D3DXMATRIX world;
-	D3DXMatrixIdentity(&world);
-	if(FAILED(hr = m_worldMatrixVariable->SetMatrix((float *) &( world ) ))) {
-		DXGI_D3D_ErrorWarning(hr, L"OmniShadowMap::ComputeShadowMap-->SetMatrix");
-		return hr;
-	}
 
-	if(FAILED( hr = m_d3dManager.ApplyEffectPass(m_technique->GetPassByIndex(0), 0) ) ) return  hr;
+	//gWorld de cada objeto la asigna Scene::DrawSceneMesh (world * identidad) antes de aplicar la technique
+	D3DXMATRIX identity;
+	D3DXMatrixIdentity(&identity);
 
-	
-	//dibujamos toda la escena desde el punto de vista de la luz hacia los 6 ejes para obtener el depth map cúbico ya que una luz omni esparce luz en todas direcciones
-	hr = Render(scene);
+	//dibujamos toda la escena desde el punto de vista de la luz hacia los 6 ejes para obtener el depth map cúbico ya que una luz omni esparce luz en todas direcciones.
+	//Los 6 frustums cubren todas las direcciones: no se descartan clusters
+	hr = Render(scene, m_worldMatrixVariable, identity, m_technique->GetPassByIndex(0), false);
 
 	return hr;
 }
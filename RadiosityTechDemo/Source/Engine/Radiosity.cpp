@@ -9,20 +9,29 @@
 namespace DTFramework
 {
 
-Radiosity::Radiosity(const D3DDevicesManager &d3d, const bool exportHemicubes, const bool enableProfiling, const UINT verticesBakedPerDispatch, const UINT numBounces)
+const char Radiosity::GI_DATA_FILE_MAGIC[4] = { 'G', 'I', 'V', 'D' };
+const char Radiosity::GI_CACHE_FILE_MAGIC[4] = { 'G', 'I', 'V', 'C' };
+
+//+z, +x, -x, +y, -y
+const UINT Radiosity::COMPACT_FACE_TILES[NUM_HEMICUBE_FACES] = { 0, 1, 1, 2, 2 };
+
+Radiosity::Radiosity(const D3DDevicesManager &d3d, const bool exportHemicubes, const bool enableProfiling, const UINT verticesBakedPerDispatch, const UINT numBounces, 
+                     const UINT hemicubeFaceSize, const bool compactHemicubeAtlas)
 : 
-VERTICES_BAKED_PER_DISPATCH(max(verticesBakedPerDispatch, (UINT) 1)), PASSES(max(numBounces, (UINT) 1)), 
-PARENT_HEMICUBES_TEXTURE_WIDTH(min(PARENT_HEMICUBES_TEXTURE_MAX_WIDTH, VERTICES_BAKED_PER_DISPATCH * HEMICUBE_FACE_SIZE * NUM_HEMICUBE_FACES)),
+HEMICUBE_FACE_SIZE(max(hemicubeFaceSize, (UINT) 1)),
+VERTICES_BAKED_PER_DISPATCH(GetVerticesBakedPerDispatch(verticesBakedPerDispatch, HEMICUBE_FACE_SIZE)), PASSES(max(numBounces, (UINT) 1)), 
+TILES_PER_HEMICUBE(compactHemicubeAtlas ? COMPACT_TILES_PER_HEMICUBE : NUM_HEMICUBE_FACES),
+PARENT_HEMICUBES_TEXTURE_WIDTH(min(PARENT_HEMICUBES_TEXTURE_MAX_WIDTH, VERTICES_BAKED_PER_DISPATCH * HEMICUBE_FACE_SIZE * TILES_PER_HEMICUBE)),
 FACES_PER_ROW(PARENT_HEMICUBES_TEXTURE_WIDTH / HEMICUBE_FACE_SIZE),
-FACES_PER_COLUMN( (UINT) ceil( (VERTICES_BAKED_PER_DISPATCH * NUM_HEMICUBE_FACES) / (float) FACES_PER_ROW )   ),
+FACES_PER_COLUMN( (UINT) ceil( (VERTICES_BAKED_PER_DISPATCH * TILES_PER_HEMICUBE) / (float) FACES_PER_ROW )   ),
 
 m_d3dManager(d3d), 
-m_hemiCubes(0), m_depthStencilBuffer(0),
-m_lastPassGIDataSRV(0), m_finalGIDataSRV(0),
+m_hemiCubes(0), m_hemicubeFormat(DXGI_FORMAT_R32G32B32A32_FLOAT), m_depthStencilBuffer(0),
+m_lastPassGIDataSRV(0), m_finalGIDataSRV(0), m_numGIVertices(0), m_cachedGIDataBuffer(0),
 
 m_profiling(enableProfiling), m_timer(d3d), m_timer2(d3d), m_hemicubeRenderingTime(0), m_totalIntegrationTime(0), m_totalAlgorithmTime(0),
 
-m_exportHemicubes(exportHemicubes), m_ready(false)
+m_exportHemicubes(exportHemicubes), m_useGICache(!enableProfiling && !exportHemicubes), m_lodTexelError(0.0f), m_ready(false)
 {
 
 }
@@ -36,6 +45,7 @@ Radiosity::~Radiosity()
 
 	SAFE_DELETE(m_hemiCubes);
 	SAFE_DELETE(m_depthStencilBuffer);
+	SAFE_DELETE(m_cachedGIDataBuffer);
 
 	if(m_outputFile.is_open())
 		m_outputFile.close();
@@ -51,6 +61,11 @@ HRESULT Radiosity::Init()
 		return E_FAIL;
 	}
 
+	if(!IsValidHemicubeFaceSize(HEMICUBE_FACE_SIZE)) {
+		MiscErrorWarning(INVALID_PARAMETER, L"Radiosity::Init");
+		return E_INVALIDARG;
+	}
+
 	HRESULT hr;
 
 	if(m_profiling) {
@@ -60,14 +75,59 @@ HRESULT Radiosity::Init()
 	}
 
 	ComputeVertexWeight();
-	
+
+	if(FAILED(hr = CreateHemicubeTargets())) return hr;
+
+	return S_OK;
+}
+
+HRESULT Radiosity::ComputeGIDataForScene(Renderer &renderer, Scene &scene, Light &light)
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready || scene.GetNumObjects() == 0) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Radiosity::ComputeGIDataForScene");
+		return E_FAIL;
+	}
+
+	HRESULT hr;
+
+	m_numGIVertices = scene.GetTotalGIVertices();
+
+	GICacheHeader cacheHeader;
+	bool useCache = m_useGICache;
+
+	if(useCache) 
+	{
+		//si no se pueden leer los archivos de la escena simplemente no usamos el caché
+		useCache = SUCCEEDED(ComputeGICacheHeader(scene, light, cacheHeader));
+
+		if(useCache) {
+			if(FAILED(hr = LoadGIDataFromCache(cacheHeader))) return hr;
+			if(hr == S_OK) return S_OK;
+		}
+	}
+
+	if(FAILED(hr = BakeGIData(renderer, scene, light))) return hr;
+
+	//un error al escribir el caché no invalida el resultado recién calculado
+	if(useCache)
+		StoreGIDataInCache(cacheHeader);
+
+	return S_OK;
+}
+
+HRESULT Radiosity::CreateHemicubeTargets()
+{
+	HRESULT hr;
+
 	//crear e inicializar la texture donde renderizaremos los hemicubos
 	if((m_hemiCubes = new (std::nothrow) RenderableTexture(m_d3dManager)) == NULL) {
 		MiscErrorWarning(BAD_ALLOC);
 		return E_FAIL;
 	}
 	//el formato DXGI_FORMAT_R32G32B32_FLOAT no es soportado por casi ninguna tarjeta D3D11
-	if(FAILED(hr = m_hemiCubes->Init(PARENT_HEMICUBES_TEXTURE_WIDTH, FACES_PER_COLUMN * HEMICUBE_FACE_SIZE, false, 0, DXGI_FORMAT_R32G32B32A32_FLOAT, true))) return hr;
+	if(FAILED(hr = m_hemiCubes->Init(PARENT_HEMICUBES_TEXTURE_WIDTH, FACES_PER_COLUMN * HEMICUBE_FACE_SIZE, false, 0, m_hemicubeFormat, true))) return hr;
 
 	//depth stencil buffer (debe tener el mismo tamaño en texels que la textura donde renderizamos los hemicubos)
 	if((m_depthStencilBuffer = new (std::nothrow) Texture2D_NOAA(m_d3dManager, PARENT_HEMICUBES_TEXTURE_WIDTH, FACES_PER_COLUMN * HEMICUBE_FACE_SIZE, 1, 1, 
@@ -86,7 +146,7 @@ HRESULT Radiosity::ProcessScene(Renderer &renderer, Scene &scene, Light &light,
 {
 	HRESULT hr;
 
-	for(UINT i=0; i<m_vertices.size(); i += VERTICES_BAKED_PER_DISPATCH) {
+	for(UINT i=0; i<GetNumBakedVertices(); i += VERTICES_BAKED_PER_DISPATCH) {
 		if(FAILED(hr = ProcessVertex(renderer, scene, light, pass, i))) return hr;
 	}
 
@@ -96,9 +156,11 @@ HRESULT Radiosity::ProcessScene(Renderer &renderer, Scene &scene, Light &light,
 
 //------------------------------------------------------------------------------------------
 // Renderización de los hemicubos de los VERTICES_BAKED_PER_DISPATCH vértices (o el resto si
-// es menor) comenzando desde el vértice con id vertexId.
+// es menor) comenzando desde la posición vertexId de los vértices a renderizar.
 // La renderización se efectúa con los objetos renderer, scene y light. Luego de finalizar
 // se invoca al método de integración.
+// Con un error de LOD los clusters lejanos de cada vértice se dibujan con menos detalle: el
+// punto de vista de LOD de la escena es la posición del vértice mientras se renderiza su hemicubo.
 //------------------------------------------------------------------------------------------
 HRESULT Radiosity::ProcessVertex(Renderer &renderer, Scene &scene, Light &light, const UINT pass, const UINT vertexId)
 {
@@ -117,11 +179,15 @@ HRESULT Radiosity::ProcessVertex(Renderer &renderer, Scene &scene, Light &light,
 	m_d3dManager.ClearDepthStencilView(m_depthStencilBuffer->GetDepthStencilView(), D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
 
 	//renderizar hemicubo para cada vértice
-	for(UINT i=vertexId; i<min(vertexId + VERTICES_BAKED_PER_DISPATCH, m_vertices.size()); ++i) 
+	for(UINT i=vertexId; i<min(vertexId + VERTICES_BAKED_PER_DISPATCH, GetNumBakedVertices()); ++i) 
 	{
+		const GIVertex &vertex = m_vertices[GetBakedVertex(i)];
+
+		scene.SetLODViewpoint(&vertex.position, HEMICUBE_FACE_SIZE, GetLODTexelError());
+
 		for(UINT face=0; face<5; ++face) 
 		{
-			const UINT textureNumber = ((i - vertexId) * NUM_HEMICUBE_FACES + face);
+			const UINT textureNumber = GetFaceTile(i - vertexId, face);
 			const UINT textureRow = textureNumber / FACES_PER_ROW;
 			const UINT textureColumn = textureNumber % FACES_PER_ROW;
 
@@ -143,24 +209,25 @@ HRESULT Radiosity::ProcessVertex(Renderer &renderer, Scene &scene, Light &light,
 
 			//view y projection matrices
 			D3DXMATRIX view;
-			VertexCameraMatrix(m_vertices[i], face, view);
+			VertexCameraMatrix(vertex, face, view);
 			
 			D3DXMATRIX projection;
 			D3DXMatrixPerspectiveFovLH(&projection,  static_cast<float> (D3DX_PI) / 2.0f, 1.0f, 0.1f, 3500.0f);	
 			
 			//primer bounce => cielo y geometría sin luz
 			if(pass == 0)
-				hr = renderer.AuxiliarRenderDepthAndSkybox(scene, light, m_vertices[i].position, view, projection, DEVICE_STATE_RASTER_SOLID_CULLNONE_SCISSOR);
+				hr = renderer.AuxiliarRenderDepthAndSkybox(scene, light, vertex.position, view, projection, DEVICE_STATE_RASTER_SOLID_CULLNONE_SCISSOR);
 			//segundo bounce (o primero si no hay cielo) => iluminación directa + primer rebote del sky light 
 			else if(pass == 1)	
-				hr = renderer.Render(scene, &light, m_vertices[i].position, view, projection, m_lastPassGIDataSRV, DEVICE_STATE_RASTER_SOLID_CULLBACK_SCISSOR, false);
+				hr = renderer.Render(scene, &light, vertex.position, view, projection, m_lastPassGIDataSRV, DEVICE_STATE_RASTER_SOLID_CULLBACK_SCISSOR, false);
 			//tercer bounce (o segundo si no hay cielo) => sólo iluminación del rebote anterior
 			else
-				hr = renderer.Render(scene, NULL, m_vertices[i].position, view, projection, m_lastPassGIDataSRV, DEVICE_STATE_RASTER_SOLID_CULLBACK_SCISSOR);
+				hr = renderer.Render(scene, NULL, vertex.position, view, projection, m_lastPassGIDataSRV, DEVICE_STATE_RASTER_SOLID_CULLBACK_SCISSOR);
 			
 			if(FAILED(hr)) {
 				ID3D11RenderTargetView *rtvs[1] = {NULL};
 				m_d3dManager.OMSetRenderTargets(0, rtvs, NULL);
+				scene.SetLODViewpoint(NULL);
 				return hr;
 			}
 
@@ -181,13 +248,14 @@ HRESULT Radiosity::ProcessVertex(Renderer &renderer, Scene &scene, Light &light,
 	ID3D11RenderTargetView *rtvs[1] = {NULL};
 	m_d3dManager.OMSetRenderTargets(0, rtvs, NULL);
 
+	scene.SetLODViewpoint(NULL);
 	
 	if(m_profiling) {
 		m_timer.UpdateForGPU();
 		m_hemicubeRenderingTime +=  m_timer.GetTimeElapsed();
 	}
 
-	hr = IntegrateHemicubeRadiance(vertexId, min(VERTICES_BAKED_PER_DISPATCH, m_vertices.size() - vertexId), pass);
+	hr = IntegrateHemicubeRadiance(vertexId, min(VERTICES_BAKED_PER_DISPATCH, GetNumBakedVertices() - vertexId), pass);
 
 	return hr;
 }
@@ -227,94 +295,57 @@ void Radiosity::ComputeVertexWeight()
 	m_giCalcConstants.vertexWeight = 1.0f/(totalWeightZ + totalWeightY*4.0f);
 }
 
-HRESULT Radiosity::PrepareGIVerticesVector(const Mesh &mesh)
+//CalculateTangents de la mesh ya dejó la normal y la tangente ortonormales: sólo falta la bitangente. Para las cámaras de los hemicubos
+//la base siempre es (tangente, cross(normal, tangente), normal) sin importar tangent.w, así la view matrix nunca refleja la escena.
+//La world matrix de cada objeto es rotación y traslación, así que la base sigue siendo ortonormal.
+//La orientación de los hemicubos cambia el resultado: si cambia esta base, cambiar GI_CACHE_FILE_VERSION
+HRESULT Radiosity::PrepareGIVerticesVector(const Scene &scene)
 {
-	HRESULT hr;
-
-	InputLayouts inputLayout(m_d3dManager);
-
-	const D3D11_INPUT_ELEMENT_DESC * const stdLayoutDesc = inputLayout.GetStandardLayoutDesc();
-	const UINT stdLayoutNumElements = inputLayout.GetStandardLayoutNumElements();
-
-	UINT positionOffset, normalOffset, tangentOffset;
-
-	//cargar offsets de vectores requeridos en el Vertex
-	for(UINT i = 0; i < stdLayoutNumElements; ++i) {
-		const D3D11_INPUT_ELEMENT_DESC &element = stdLayoutDesc[i];
-		string semantic(element.SemanticName);
-		if(semantic == "POSITION")
-			positionOffset = element.AlignedByteOffset;
-		else if(semantic == "NORMAL")
-			normalOffset = element.AlignedByteOffset;
-		else if(semantic == "TANGENT")
-			tangentOffset = element.AlignedByteOffset;
-	}
-
-	//copiar el vertex buffer de la mesh a un staging buffer para que el CPU pueda leerlo
-	D3D11_BUFFER_DESC vbDesc;
-	mesh.GetVertexBuffer()->GetDesc(&vbDesc);
-
-	StagingBuffer stagingBuffer(m_d3dManager, vbDesc.ByteWidth);
-	if(FAILED( hr = stagingBuffer.Init() )) return hr;
-
-	m_d3dManager.CopyResource( stagingBuffer.GetBuffer(), mesh.GetVertexBuffer() );
-
-	//map staging buffer
-	D3D11_MAPPED_SUBRESOURCE mapped;
-	if( FAILED(hr = m_d3dManager.Map(stagingBuffer.GetBuffer(), 0, D3D11_MAP_READ, 0, &mapped) )) return hr;
-
-	const unsigned char *rawVB = (const unsigned char *) (mapped.pData);
-
-	try {
-		//copiar vertices a un vector de vertices (posicion, normal tangente y bitangente)
-		const unsigned char *positions = (const unsigned char *)(rawVB + positionOffset);
-		const unsigned char *normals = (const unsigned char *)(rawVB + normalOffset);
-		const unsigned char *tangents = (const unsigned char *)(rawVB + tangentOffset);
-
-		const UINT numVertices = mesh.GetTotalVertices();
-		m_vertices.reserve( numVertices );
-		m_vertices.clear();
-
-		for(UINT i=0; i<numVertices; ++i) {
-			GIVertex tmp;
-
-			tmp.position = *((D3DXVECTOR3 *) positions);
-			tmp.normal = *((D3DXVECTOR3 *) normals);
-			tmp.tangent = *((D3DXVECTOR3 *) tangents);
-
-			D3DXVec3Normalize(&(tmp.normal), &(tmp.normal));
-			D3DXVec3Normalize(&(tmp.tangent), &tmp.tangent);
-			D3DXVec3Cross(&(tmp.bitangent), &(tmp.normal), &(tmp.tangent));				//bitangente. Perpendicular al plano formado por los otros dos vectores
-			D3DXVec3Normalize(&(tmp.bitangent), &(tmp.bitangent));
-		
-			m_vertices.push_back(tmp);
-
-			positions += sizeof(Vertex);
-			normals += sizeof(Vertex);
-			tangents += sizeof(Vertex);
-		}	
+	try 
+	{
+		m_vertices.resize(scene.GetTotalGIVertices());
 	}
 	catch (std::bad_alloc &) 
 	{
 		MiscErrorWarning(BAD_ALLOC);
-		hr = E_FAIL;
+		return E_FAIL;
 	}
 	catch (std::length_error &) 
 	{
 		MiscErrorWarning(LENGTH_ERROR);
-		hr = E_FAIL;
+		return E_FAIL;
 	}
 
-	m_d3dManager.Unmap(stagingBuffer.GetBuffer(), 0);
+	for(UINT o=0; o<scene.GetNumObjects(); ++o) 
+	{
+		const SceneObject &object = scene.GetSceneObject(o);
+		const Mesh * const mesh = scene.GetMesh(object.mesh);
 
-	return hr;
+		const Vertex * const vertices = mesh ? mesh->GetVertices() : NULL;
+		if(vertices == NULL) return E_FAIL;
+
+		const UINT numVertices = mesh->GetTotalVertices();
+
+		for(UINT i=0; i<numVertices; ++i) {
+			GIVertex &giVertex = m_vertices[object.giVertexOffset + i];
+
+			const D3DXVECTOR3 tangent(vertices[i].tangent.x, vertices[i].tangent.y, vertices[i].tangent.z);
+
+			D3DXVec3TransformCoord(&(giVertex.position), &(vertices[i].position), &(object.world));
+			D3DXVec3TransformNormal(&(giVertex.normal), &(vertices[i].normal), &(object.world));
+			D3DXVec3TransformNormal(&(giVertex.tangent), &tangent, &(object.world));
+			D3DXVec3Cross(&(giVertex.bitangent), &(giVertex.normal), &(giVertex.tangent));
+		}
+	}
+
+	return S_OK;
 }
 
 //------------------------------------------------------------------------------------------
 // left y top: origen del rectángulo scissor (en el render target)
 // face: índice de la cara del hemicubo. 0,1,2,3,4: +z, +x, -x, +y, -y resp.
 //------------------------------------------------------------------------------------------
-inline void Radiosity::GetFaceScissorRectangle(const UINT face, const UINT left, const UINT top, D3D11_RECT &scissorRect)
+void Radiosity::GetFaceScissorRectangle(const UINT face, const UINT left, const UINT top, D3D11_RECT &scissorRect) const
 {
 	switch(face) 
 	{
@@ -351,11 +382,23 @@ inline void Radiosity::GetFaceScissorRectangle(const UINT face, const UINT left,
 	}
 }
 
+UINT Radiosity::GetVerticesBakedPerDispatch(const UINT verticesBakedPerDispatch, const UINT faceSize)
+{
+	UINT vertices = max(verticesBakedPerDispatch, (UINT) 1);
+
+	if(faceSize > DEFAULT_HEMICUBE_FACE_SIZE) {
+		const UINT scale = faceSize / DEFAULT_HEMICUBE_FACE_SIZE;
+		vertices = max(vertices / (scale * scale), (UINT) 1);
+	}
+
+	return vertices;
+}
+
 //------------------------------------------------------------------------------------------
 // Construye view matrix dado un vértice y un índice de cara del hemicubo.
 // face: índice de la cara del hemicubo. 0,1,2,3,4: +z, +x, -x, +y, -y resp.
 //------------------------------------------------------------------------------------------
-inline void Radiosity::VertexCameraMatrix(const GIVertex &vertex, const UINT face, D3DXMATRIX &viewMatrix)
+void Radiosity::VertexCameraMatrix(const GIVertex &vertex, const UINT face, D3DXMATRIX &viewMatrix)
 {
 	D3DXVECTOR3 x(vertex.tangent.x, vertex.tangent.y, vertex.tangent.z);
 	D3DXVECTOR3 y(vertex.bitangent.x, vertex.bitangent.y, vertex.bitangent.z);
@@ -396,6 +439,291 @@ inline void Radiosity::VertexCameraMatrix(const GIVertex &vertex, const UINT fac
 }
 
 
+//------------------------------------------------------------------------------------------
+// Formato del archivo:
+//   char[4] "GIVD", UINT versión, UINT cantidad de vértices, UINT pasadas, UINT tamaño de cara del hemicubo,
+//   seguido de un float4 (r, g, b, 0) de irradiancia por vértice en el orden del vertex buffer de la escena.
+//------------------------------------------------------------------------------------------
+HRESULT Radiosity::ExportGIData(const wstring &file) const
+{
+	_ASSERT(m_ready && m_finalGIDataSRV);
+
+	if(!m_ready || !m_finalGIDataSRV) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Radiosity::ExportGIData");
+		return E_FAIL;
+	}
+
+	char header[20];
+	const UINT values[4] = { GI_DATA_FILE_VERSION, m_numGIVertices, PASSES, HEMICUBE_FACE_SIZE };
+
+	memcpy(header, GI_DATA_FILE_MAGIC, 4);
+	memcpy(header + 4, values, sizeof(values));
+
+	return WriteFinalGIData(file, header, sizeof(header));
+}
+
+HRESULT Radiosity::WriteFinalGIData(const wstring &file, const void * const header, const UINT headerSize) const
+{
+	HRESULT hr;
+
+	//leer el buffer final desde la memoria de video sin importar si fue generado en la CPU o en la GPU
+	ID3D11Resource *pRes = NULL;
+	m_finalGIDataSRV->GetResource(&pRes);
+
+	ID3D11Buffer *giBuffer = static_cast<ID3D11Buffer *>(pRes);
+
+	D3D11_BUFFER_DESC desc;
+	giBuffer->GetDesc(&desc);
+
+	const UINT numVertices = m_numGIVertices;
+
+	if(desc.ByteWidth < numVertices * 16) {
+		SAFE_RELEASE(pRes);
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Radiosity::WriteFinalGIData");
+		return E_FAIL;
+	}
+
+	StagingBuffer stagingBuffer(m_d3dManager, desc.ByteWidth);
+	if(FAILED(hr = stagingBuffer.Init())) {
+		SAFE_RELEASE(pRes);
+		return hr;
+	}
+
+	const float *giData = stagingBuffer.GetMappedData(giBuffer);
+
+	SAFE_RELEASE(pRes);
+
+	if(!giData) return E_FAIL;
+
+	ofstream output;
+	output.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+	try 
+	{
+		output.open(file.c_str(), std::ios::binary);
+
+		output.write((const char *) header, headerSize);
+		output.write((const char *) giData, numVertices * 16);
+	}
+	catch (std::ofstream::failure &) 
+	{
+		MiscErrorWarning(IFSTREAM_ERROR, L"Radiosity::WriteFinalGIData");
+		hr = E_FAIL;
+	}
+
+	if(output.is_open())
+		output.close();
+
+	stagingBuffer.CloseMappedData();
+
+	return hr;
+}
+
+HRESULT Radiosity::ReadFinalGIData(vector<float> &giData) const
+{
+	_ASSERT(m_ready && m_finalGIDataSRV);
+
+	if(!m_ready || !m_finalGIDataSRV) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Radiosity::ReadFinalGIData");
+		return E_FAIL;
+	}
+
+	HRESULT hr;
+
+	try
+	{
+		giData.resize(m_numGIVertices * static_cast<size_t> (4));
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	//igual que WriteFinalGIData
+	ID3D11Resource *pRes = NULL;
+	m_finalGIDataSRV->GetResource(&pRes);
+
+	ID3D11Buffer *giBuffer = static_cast<ID3D11Buffer *>(pRes);
+
+	D3D11_BUFFER_DESC desc;
+	giBuffer->GetDesc(&desc);
+
+	if(desc.ByteWidth < m_numGIVertices * 16) {
+		SAFE_RELEASE(pRes);
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Radiosity::ReadFinalGIData");
+		return E_FAIL;
+	}
+
+	StagingBuffer stagingBuffer(m_d3dManager, desc.ByteWidth);
+	if(FAILED(hr = stagingBuffer.Init())) {
+		SAFE_RELEASE(pRes);
+		return hr;
+	}
+
+	const float *mappedData = stagingBuffer.GetMappedData(giBuffer);
+
+	SAFE_RELEASE(pRes);
+
+	if(!mappedData) return E_FAIL;
+
+	if(m_numGIVertices > 0)
+		memcpy(&giData[0], mappedData, m_numGIVertices * 16);
+
+	stagingBuffer.CloseMappedData();
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// Caché de GI. Los archivos se nombran con el hash de la escena: al modificar la escena, el .obj
+// o el .mtl se calcula de nuevo la GI. Si sólo cambian los parámetros (pasadas, tamaño de los
+// hemicubos, luz) el archivo existente se sobrescribe con el nuevo resultado.
+// Formato del archivo: GICacheHeader seguido de un float4 de irradiancia por vértice (igual que ExportGIData).
+//------------------------------------------------------------------------------------------
+
+//FNV-1a de 64 bits
+static const UINT64 FNV_OFFSET_BASIS = 14695981039346656037ULL;
+static const UINT64 FNV_PRIME = 1099511628211ULL;
+
+static HRESULT HashFileContents(const wstring &file, UINT64 &hash)
+{
+	MappedFile mappedFile;
+
+	HRESULT hr;
+	if(FAILED(hr = mappedFile.Open(file))) return hr;
+
+	const BYTE * const data = mappedFile.GetData();
+	const UINT64 size = mappedFile.GetSize();
+
+	for(UINT64 i=0; i<size; ++i) {
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+
+	//el tamaño separa el contenido de archivos consecutivos
+	hash ^= size;
+	hash *= FNV_PRIME;
+
+	return S_OK;
+}
+
+HRESULT Radiosity::ComputeGICacheHeader(const Scene &scene, const Light &light, GICacheHeader &header) const
+{
+	//ceros también en el relleno de LightProperties para poder comparar cabeceras con memcmp
+	ZeroMemory(&header, sizeof(GICacheHeader));
+
+	memcpy(header.magic, GI_CACHE_FILE_MAGIC, 4);
+	header.version = GI_CACHE_FILE_VERSION;
+	header.numVertices = scene.GetTotalGIVertices();
+	header.meshProcessingVersion = Mesh::GetProcessingVersion();
+	header.passes = PASSES;
+	header.hemicubeFaceSize = HEMICUBE_FACE_SIZE;
+	header.hemicubeRenderer = GetHemicubeRendererId();
+	header.raysPerVertex = GetRaysPerVertex();
+	header.hemicubeFormat = static_cast<UINT> (m_hemicubeFormat);
+	header.solver = GetSolverId();
+	header.solverTolerance = GetSolverTolerance();
+	header.irradianceCacheError = GetIrradianceCacheError();
+	header.weldVertices = WeldsVertices() ? 1 : 0;
+	header.lodTexelError = GetLODTexelError();
+	header.skyModel = GetSkyModelId();
+
+	header.lightType = static_cast<UINT> (light.GetType());
+	header.lightZNear = light.GetZNear();
+	header.lightZFar = light.GetZFar();
+	header.lightVolumeWidth = light.GetLightVolumeWidth();
+	header.lightVolumeHeight = light.GetLightVolumeHeight();
+
+	header.light = light.GetProperties();
+	header.light.pad1 = header.light.pad2 = header.light.pad3 = 0;
+
+	HRESULT hr;
+
+	header.sceneHash = FNV_OFFSET_BASIS;
+
+	//el archivo de escena ya incluye la posición y rotación de cada objeto
+	if(FAILED(hr = HashFileContents(SCENES_DIRECTORY + scene.GetFileName(), header.sceneHash))) return hr;
+
+	for(UINT i=0; i<scene.GetNumMeshes(); ++i) 
+	{
+		const Mesh * const mesh = scene.GetMesh(i);
+		if(!mesh) return E_FAIL;
+
+		if(FAILED(hr = HashFileContents(MESHES_DIRECTORY + mesh->GetFileName(), header.sceneHash))) return hr;
+
+		if(mesh->GetMaterialFileName().length() > 0) {
+			if(FAILED(hr = HashFileContents(MTLS_DIRECTORY + mesh->GetMaterialFileName(), header.sceneHash))) return hr;
+		}
+	}
+
+	return S_OK;
+}
+
+wstring Radiosity::GetGICacheFileName(const GICacheHeader &header)
+{
+	WCHAR name[32];
+	swprintf_s(name, L"%016I64x.gic", header.sceneHash);
+
+	return GI_CACHE_DIRECTORY + wstring(name);
+}
+
+//devuelve S_FALSE si no hay un archivo válido para header. Sólo falla si no se pudo crear el buffer con los datos leídos
+HRESULT Radiosity::LoadGIDataFromCache(const GICacheHeader &header)
+{
+	MappedFile mappedFile;
+
+	if(FAILED(mappedFile.Open(GetGICacheFileName(header)))) return S_FALSE;
+
+	const UINT64 dataSize = static_cast<UINT64> (header.numVertices) * 16;
+
+	if(mappedFile.GetSize() != sizeof(GICacheHeader) + dataSize) return S_FALSE;
+	if(memcmp(mappedFile.GetData(), &header, sizeof(GICacheHeader)) != 0) return S_FALSE;
+
+	HRESULT hr;
+
+	//ImmutableBuffer copia los datos al crearse, así que la vista del archivo puede cerrarse enseguida
+	SAFE_DELETE(m_cachedGIDataBuffer);
+
+	if((m_cachedGIDataBuffer = new (std::nothrow) ImmutableBuffer(m_d3dManager, header.numVertices * 16, header.numVertices, 
+	                                                               mappedFile.GetData() + sizeof(GICacheHeader), DXGI_FORMAT_R32G32B32A32_FLOAT)) == NULL) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+	if(FAILED(hr = m_cachedGIDataBuffer->Init())) return hr;
+
+	m_finalGIDataSRV = m_cachedGIDataBuffer->GetShaderResourceView();
+
+	return S_OK;
+}
+
+HRESULT Radiosity::StoreGIDataInCache(const GICacheHeader &header) const
+{
+	if(!CreateDirectory(GI_CACHE_DIRECTORY, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+		ErrorWarning(L"Radiosity::StoreGIDataInCache --> CreateDirectory");
+		return E_FAIL;
+	}
+
+	//se escribe a un archivo temporal y luego se reemplaza el definitivo para no dejar nunca un archivo a medio escribir
+	const wstring file = GetGICacheFileName(header);
+	const wstring tmpFile = file + L".tmp";
+
+	HRESULT hr;
+	if(FAILED(hr = WriteFinalGIData(tmpFile, &header, sizeof(GICacheHeader)))) {
+		DeleteFile(tmpFile.c_str());
+		return hr;
+	}
+
+	if(!MoveFileEx(tmpFile.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+		ErrorWarning(L"Radiosity::StoreGIDataInCache --> MoveFileEx");
+		DeleteFile(tmpFile.c_str());
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
 inline static float RoundPixelColorValue(const float value)
 {
 	float tmp = fabs(value) - floor(fabs(value));
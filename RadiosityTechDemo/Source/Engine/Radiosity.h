@@ -24,6 +24,7 @@
 #include "D3D11Resources.h"
 #include "D3DDevicesManager.h"
 #include "Timer.h"
+#include "MappedFile.h"
 
 using std::ofstream;
 using std::max;
@@ -40,60 +41,176 @@ struct GI_Calculation_Constants
 	UINT numVertices;
 };
 
+//cabecera del archivo de caché de GI. Un archivo se reutiliza sólo si todos los campos coinciden
+struct GICacheHeader
+{
+	char magic[4];
+	UINT version;
+	UINT64 sceneHash;           //hash del contenido de los archivos de escena, .obj y .mtl
+	UINT numVertices;
+	UINT meshProcessingVersion; //ver Mesh::GetProcessingVersion. La numeración y las tangentes de los vértices dependen de ella
+	UINT passes;
+	UINT hemicubeFaceSize;
+	UINT hemicubeRenderer;      //ver Radiosity::GetHemicubeRendererId
+	UINT raysPerVertex;         //ver Radiosity::GetRaysPerVertex
+	UINT hemicubeFormat;        //DXGI_FORMAT de la textura de hemicubos
+	UINT solver;                //ver Radiosity::GetSolverId
+	float solverTolerance;
+	float irradianceCacheError; //0 => un hemicubo por vértice. Ver Radiosity::GetIrradianceCacheError
+	UINT weldVertices;          //ver Radiosity::WeldsVertices
+	float lodTexelError;        //ver Radiosity::GetLODTexelError
+	UINT skyModel;              //ver Radiosity::GetSkyModelId
+	UINT lightType;
+	float lightZNear;
+	float lightZFar;
+	float lightVolumeWidth;
+	float lightVolumeHeight;
+	LightProperties light;
+};
+
 class Radiosity
 {
 public:
+	//ancho y alto de las caras del hemicubo. Menos texels para previsualizar, más para el resultado final
+	static const UINT DEFAULT_HEMICUBE_FACE_SIZE = 64;
+	static const UINT MIN_HEMICUBE_FACE_SIZE = 32;
+	static const UINT MAX_HEMICUBE_FACE_SIZE = 256;
+
+	//con caras más grandes que DEFAULT_HEMICUBE_FACE_SIZE se integran menos vértices por dispatch (ver GetVerticesBakedPerDispatch).
+	//compactHemicubeAtlas: ver COMPACT_FACE_TILES
 	Radiosity(const D3DDevicesManager &d3d, const bool exportHemicubes=false, const bool enableProfiling=false, 
-	          const UINT verticesBakedPerDispatch=256, const UINT numBounces=2);
+	          const UINT verticesBakedPerDispatch=256, const UINT numBounces=2, const UINT hemicubeFaceSize=DEFAULT_HEMICUBE_FACE_SIZE, 
+	          const bool compactHemicubeAtlas=false);
 	virtual ~Radiosity();
 
 	//sólo debe llamarse a lo sumo una vez por objeto
 	virtual HRESULT Init();
 	
-	//calcula datos de iluminación indirecta dado un renderizador, una escena y una luz
-	virtual HRESULT ComputeGIDataForScene(Renderer &renderer, Scene &scene, Light &light) = 0;
+	//calcula datos de iluminación indirecta dado un renderizador, una escena y una luz. Si el caché de GI está
+	//habilitado y hay un resultado guardado para la misma escena y los mismos parámetros se usa ese y no se calcula nada
+	HRESULT ComputeGIDataForScene(Renderer &renderer, Scene &scene, Light &light);
+
+	//habilitado por defecto salvo que se pida profiling o exportar los hemicubos (en esos casos interesa ejecutar el algoritmo)
+	void SetGICacheEnabled(const bool enable);
+
+	//error máximo en texels de los niveles de detalle con que se dibujan los clusters de los objetos con lod N en los hemicubos
+	//(ver Scene::SetLODViewpoint). 0 (por defecto) => siempre la geometría completa
+	void SetLODTexelError(const float maxTexelError);
 
 	//srv con valores de iluminación indirecta para cada vértice de la escena
 	ID3D11ShaderResourceView *GetGIData() const;
 
+	//copia a memoria de sistema los datos de iluminación indirecta finales (float4 por vértice, igual que ExportGIData)
+	HRESULT ReadFinalGIData(vector<float> &giData) const;
+
 	const UINT GetHemicubeFaceSize() const;
 
+	//potencia de dos entre MIN_HEMICUBE_FACE_SIZE y MAX_HEMICUBE_FACE_SIZE
+	static bool IsValidHemicubeFaceSize(const UINT faceSize);
+
+	//escribe a disco los datos de iluminación indirecta finales (float4 por vértice) en formato binario
+	HRESULT ExportGIData(const wstring &file) const;
+
 protected:
 	void ComputeVertexWeight();
 
-	HRESULT ProcessScene(Renderer &renderer, Scene &scene, Light &light, const UINT pass);
-	HRESULT ProcessVertex(Renderer &renderer, Scene &scene, Light &light, const UINT pass, const UINT vertexId);
+	//ejecuta todas las pasadas del algoritmo. Debe dejar el resultado en m_finalGIDataSRV
+	virtual HRESULT BakeGIData(Renderer &renderer, Scene &scene, Light &light) = 0;
+
+	//identifica quién renderiza los hemicubos. Los resultados de distintos renderizadores no se comparten en el caché
+	virtual UINT GetHemicubeRendererId() const;
+
+	//rayos por vértice si la visibilidad se calcula lanzando rayos en lugar de renderizar hemicubos, o 0
+	virtual UINT GetRaysPerVertex() const;
+
+	//identifica cómo se calculan los rebotes (y con qué tolerancia si el solver converge). Tampoco se comparten en el caché
+	virtual UINT GetSolverId() const;
+	virtual float GetSolverTolerance() const;
+
+	//error máximo del submuestreo de vértices con caché de irradiancia, o 0 si se renderizan todos los hemicubos
+	virtual float GetIrradianceCacheError() const;
+
+	//true si los vértices con la misma posición y casi la misma normal se integran una sola vez
+	virtual bool WeldsVertices() const;
+
+	//error de los niveles de detalle en los hemicubos, o 0 si se renderizan con la geometría completa
+	virtual float GetLODTexelError() const;
+
+	//identifica cómo se evalúa el cielo en los hemicubos: 0 => Skybox en la GPU, otro valor => la versión de la tabla de la CPU
+	virtual UINT GetSkyModelId() const;
+
+	//crea los render targets donde se renderizan los hemicubos. Las clases derivadas pueden usar otro destino
+	virtual HRESULT CreateHemicubeTargets();
+
+	virtual HRESULT ProcessScene(Renderer &renderer, Scene &scene, Light &light, const UINT pass);
+	virtual HRESULT ProcessVertex(Renderer &renderer, Scene &scene, Light &light, const UINT pass, const UINT vertexId);
 
 	virtual HRESULT IntegrateHemicubeRadiance(const UINT vertexId, const UINT verticesBaked, const UINT pass) = 0;
 
-	HRESULT PrepareGIVerticesVector(const Mesh &mesh);
+	//un vértice GI por vértice de cada objeto de la escena, en world space (ver SceneObject::giVertexOffset)
+	HRESULT PrepareGIVerticesVector(const Scene &scene);
+
+	//vértices cuyo hemicubo se renderiza, en el orden en que se procesan. Ver m_bakedVertices
+	UINT GetNumBakedVertices() const;
+	UINT GetBakedVertex(const UINT position) const;
 
 	void ExportHemicubeFaces(const float * const hemicubeData, const UINT vertexId, const UINT pass) const;
 
-	static void GetFaceScissorRectangle(const UINT face, const UINT left, const UINT top, D3D11_RECT &scissorRect);
+	HRESULT ComputeGICacheHeader(const Scene &scene, const Light &light, GICacheHeader &header) const;
+	HRESULT LoadGIDataFromCache(const GICacheHeader &header);
+	HRESULT StoreGIDataInCache(const GICacheHeader &header) const;
+	static wstring GetGICacheFileName(const GICacheHeader &header);
+
+	//lee el buffer final de la memoria de video y lo escribe a disco precedido por header
+	HRESULT WriteFinalGIData(const wstring &file, const void * const header, const UINT headerSize) const;
+
+	void GetFaceScissorRectangle(const UINT face, const UINT left, const UINT top, D3D11_RECT &scissorRect) const;
+
+	//índice del tile de HEMICUBE_FACE_SIZE² de la textura de hemicubos donde se renderiza la cara face del hemicubo de la posición slot
+	UINT GetFaceTile(const UINT slot, const UINT face) const;
 	static void VertexCameraMatrix(const GIVertex &vertex, const UINT face, D3DXMATRIX &viewMatrix);
 
+	//la textura de hemicubos ocupa lo mismo que con caras de DEFAULT_HEMICUBE_FACE_SIZE y verticesBakedPerDispatch vértices
+	static UINT GetVerticesBakedPerDispatch(const UINT verticesBakedPerDispatch, const UINT faceSize);
+
 protected:
 	static const UINT NUM_HEMICUBE_FACES = 5;
-	
-	//ancho y alto de las caras del hemicubo
-	static const UINT HEMICUBE_FACE_SIZE = 64;
+
+	//de las caras laterales sólo se usa la mitad que cae dentro del hemisferio (ver GetFaceScissorRectangle), y las mitades
+	//usadas de +x y -x, y de +y y -y, son complementarias. En el atlas compacto cada par comparte un tile: 3 tiles por
+	//hemicubo en lugar de 5. Los compute shaders de GPURadiosity usan el atlas de 5 tiles
+	static const UINT COMPACT_TILES_PER_HEMICUBE = 3;
+	static const UINT COMPACT_FACE_TILES[NUM_HEMICUBE_FACES];
 
 	static const UINT PARENT_HEMICUBES_TEXTURE_MAX_WIDTH = 8192;
 
+	//formato del archivo escrito por ExportGIData
+	static const char GI_DATA_FILE_MAGIC[4];
+	static const UINT GI_DATA_FILE_VERSION = 1;
+
+	//formato de los archivos del caché de GI (en GI_CACHE_DIRECTORY)
+	static const char GI_CACHE_FILE_MAGIC[4];
+	static const UINT GI_CACHE_FILE_VERSION = 9;
+
+	//ancho y alto de las caras del hemicubo
+	const UINT HEMICUBE_FACE_SIZE;
+
 	//define cantidad de vértices a integrar por ejecución de IntegrateHemicubeRadiance
 	const UINT VERTICES_BAKED_PER_DISPATCH;
 
 	const UINT PASSES;
 
+	//NUM_HEMICUBE_FACES o COMPACT_TILES_PER_HEMICUBE
+	const UINT TILES_PER_HEMICUBE;
+
 	//Todos los hemicubos están en un sólo RenderableTexture. Este es el ancho (en texels) del mismo. 
 	//El máximo permitido es PARENT_HEMICUBES_TEXTURE_MAX_WIDTH y depende de VERTICES_BAKED_PER_DISPATCH
 	const UINT PARENT_HEMICUBES_TEXTURE_WIDTH;		
 	
-	//Cantidad de caras de hemicubos que hay a lo ancho de la RenderableTexture principal. Se calcula automáticamente.
+	//Cantidad de tiles (caras de hemicubos) que hay a lo ancho de la RenderableTexture principal. Se calcula automáticamente.
 	const UINT FACES_PER_ROW;
 
-	//Cantidad de caras de hemicubos que hay a lo alto de la RenderableTexture principal. Se calcula automáticamente.
+	//Cantidad de tiles (caras de hemicubos) que hay a lo alto de la RenderableTexture principal. Se calcula automáticamente.
 	const UINT FACES_PER_COLUMN;
 
 
@@ -106,6 +223,9 @@ protected:
 	//renderable texture para los hemicubos
 	RenderableTexture *m_hemiCubes;
 
+	//formato de m_hemiCubes. Las clases derivadas pueden cambiarlo antes de Init
+	DXGI_FORMAT m_hemicubeFormat;
+
 	//depth stencil buffer para renderización de los hemicubos
 	Texture2D_NOAA *m_depthStencilBuffer;
 
@@ -116,9 +236,19 @@ protected:
 	//datos de iluminacion global finales. Es un valor de irradiancia en formato float4 para cada vértice de la escena
 	ID3D11ShaderResourceView *m_finalGIDataSRV;
 
+	//cantidad de float4 válidos en m_finalGIDataSRV. Con un resultado leído del caché m_vertices está vacío
+	UINT m_numGIVertices;
+
+	//buffer con los datos de GI leídos del caché. Si no es NULL m_finalGIDataSRV apunta a su SRV
+	ImmutableBuffer *m_cachedGIDataBuffer;
+
 	//vertices de la escena en memoria de sistema
 	vector<GIVertex> m_vertices;
 
+	//índices en m_vertices de los vértices que se renderizan. Vacío => todos, en orden. ProcessScene procesa los lotes
+	//de VERTICES_BAKED_PER_DISPATCH en este orden y los vertexId de ProcessVertex e IntegrateHemicubeRadiance son posiciones en él
+	vector<UINT> m_bakedVertices;
+
 	//Profiling
 	const bool m_profiling;
 	Timer m_timer;
@@ -130,6 +260,11 @@ protected:
 
 	
 	const bool m_exportHemicubes;
+
+	bool m_useGICache;
+
+	//ver SetLODTexelError
+	float m_lodTexelError;
 	
 	bool m_ready;
 };
@@ -139,11 +274,81 @@ inline ID3D11ShaderResourceView *Radiosity::GetGIData() const
 	return m_finalGIDataSRV;
 }
 
+inline void Radiosity::SetGICacheEnabled(const bool enable)
+{
+	m_useGICache = enable;
+}
+
+inline void Radiosity::SetLODTexelError(const float maxTexelError)
+{
+	m_lodTexelError = max(maxTexelError, 0.0f);
+}
+
+inline UINT Radiosity::GetHemicubeRendererId() const
+{
+	return 0;	//Direct3D
+}
+
+inline UINT Radiosity::GetRaysPerVertex() const
+{
+	return 0;
+}
+
+inline UINT Radiosity::GetSolverId() const
+{
+	return 0;	//PASSES pasadas de gathering renderizando todos los hemicubos
+}
+
+inline float Radiosity::GetSolverTolerance() const
+{
+	return 0.0f;
+}
+
+inline float Radiosity::GetIrradianceCacheError() const
+{
+	return 0.0f;
+}
+
+inline bool Radiosity::WeldsVertices() const
+{
+	return false;
+}
+
+inline float Radiosity::GetLODTexelError() const
+{
+	return m_lodTexelError;
+}
+
+inline UINT Radiosity::GetSkyModelId() const
+{
+	return 0;
+}
+
+inline UINT Radiosity::GetNumBakedVertices() const
+{
+	return m_bakedVertices.empty() ? static_cast<UINT>(m_vertices.size()) : static_cast<UINT>(m_bakedVertices.size());
+}
+
+inline UINT Radiosity::GetBakedVertex(const UINT position) const
+{
+	return m_bakedVertices.empty() ? position : m_bakedVertices[position];
+}
+
 inline const UINT Radiosity::GetHemicubeFaceSize() const
 {
 	return HEMICUBE_FACE_SIZE;
 }
 
+inline UINT Radiosity::GetFaceTile(const UINT slot, const UINT face) const
+{
+	return slot * TILES_PER_HEMICUBE + (TILES_PER_HEMICUBE == NUM_HEMICUBE_FACES ? face : COMPACT_FACE_TILES[face]);
+}
+
+inline bool Radiosity::IsValidHemicubeFaceSize(const UINT faceSize)
+{
+	return faceSize >= MIN_HEMICUBE_FACE_SIZE && faceSize <= MAX_HEMICUBE_FACE_SIZE && (faceSize & (faceSize - 1)) == 0;
+}
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,283 @@
+﻿//------------------------------------------------------------------------------------------
+// File: RayTracedRadiosity.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "RayTracedRadiosity.h"
+
+namespace DTFramework
+{
+
+//mezcla de bits de un entero (función de finalización de MurmurHash3)
+static inline UINT HashVertex(UINT x)
+{
+	x ^= x >> 16;
+	x *= 0x85EBCA6B;
+	x ^= x >> 13;
+	x *= 0xC2B2AE35;
+	x ^= x >> 16;
+
+	return x;
+}
+
+//inverso radical en base 2: los bits de i en orden inverso como fracción binaria
+static inline float RadicalInverse(UINT i)
+{
+	i = (i << 16) | (i >> 16);
+	i = ((i & 0x00FF00FF) << 8) | ((i & 0xFF00FF00) >> 8);
+	i = ((i & 0x0F0F0F0F) << 4) | ((i & 0xF0F0F0F0) >> 4);
+	i = ((i & 0x33333333) << 2) | ((i & 0xCCCCCCCC) >> 2);
+	i = ((i & 0x55555555) << 1) | ((i & 0xAAAAAAAA) >> 1);
+
+	return static_cast<float>(i * 2.3283064365386963e-10);
+}
+
+//la esfera de los hemicubos es el rango del hemicubo de Direct3D (mismos planos que la proyección de Radiosity::ProcessVertex)
+RayTracedRadiosity::RayTracedRadiosity(const D3DDevicesManager &d3d, const bool enableProfiling, const UINT verticesBakedPerDispatch,
+                                       const UINT numBounces, const UINT numThreads, const UINT raysPerVertex, const bool reuseFormFactors,
+                                       const RadiositySolver solver, const float convergenceTolerance, const float irradianceCacheError,
+                                       const bool weldVertices)
+:
+SoftwareRadiosity(d3d, false, enableProfiling, verticesBakedPerDispatch, numBounces, numThreads, MIN_HEMICUBE_FACE_SIZE, reuseFormFactors,
+                  solver, convergenceTolerance, irradianceCacheError, weldVertices),
+m_raysPerVertex(raysPerVertex), m_bvhTimer(d3d), m_bvhBuildTime(0), m_raysCast(0)
+{
+
+}
+
+RayTracedRadiosity::~RayTracedRadiosity()
+{
+
+}
+
+HRESULT RayTracedRadiosity::InitResources()
+{
+	if(m_raysPerVertex == 0 || m_raysPerVertex > MAX_RAYS_PER_VERTEX) {
+		MiscErrorWarning(INVALID_PARAMETER, L"RayTracedRadiosity::InitResources");
+		return E_INVALIDARG;
+	}
+
+	HRESULT hr;
+
+	if(FAILED(hr = SoftwareRadiosity::InitResources())) return hr;
+
+	//el patrón es el mismo para todos los vértices
+	try
+	{
+		m_sampleU.resize(m_raysPerVertex);
+		m_sampleV.resize(m_raysPerVertex);
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	for(UINT i=0; i<m_raysPerVertex; ++i) {
+		m_sampleU[i] = (i + 0.5f) / m_raysPerVertex;
+		m_sampleV[i] = RadicalInverse(i);
+	}
+
+	return S_OK;
+}
+
+HRESULT RayTracedRadiosity::CreateHemicubeTargets()
+{
+	return S_OK;
+}
+
+HRESULT RayTracedRadiosity::BakeGIData(Renderer &renderer, Scene &scene, Light &light)
+{
+	HRESULT hr;
+
+	m_bvhBuildTime = 0;
+	m_raysCast = 0;
+
+	if(FAILED(hr = SoftwareRadiosity::BakeGIData(renderer, scene, light))) return hr;
+
+	if(m_profiling) {
+		m_outputFile << "Rays per Vertex:\t\t\t\t\t\t" << m_raysPerVertex << endl;
+		m_outputFile << "Ray Tracing BVH:\t\t\t\t\t\t" << m_bvh.GetNumNodes() << " nodes, " << m_bvh.GetNumTriangles() << " triangles, "
+		             << m_bvhBuildTime << " seconds." << endl;
+		m_outputFile << "Rays Cast:\t\t\t\t\t\t\t" << m_raysCast << " ("
+		             << (m_hemicubeRenderingTime > 0 ? m_raysCast / m_hemicubeRenderingTime / 1.0e6 : 0.0) << " Mrays per second)" << endl;
+	}
+
+	return S_OK;
+}
+
+HRESULT RayTracedRadiosity::PrepareSceneData(const Scene &scene, const Light &light)
+{
+	HRESULT hr;
+
+	if(FAILED(hr = SoftwareRadiosity::PrepareSceneData(scene, light))) return hr;
+
+	if(m_profiling)
+		m_bvhTimer.Update();
+
+	const UINT numTriangles = static_cast<UINT>(m_indices.size() / 3);
+
+	try
+	{
+		m_triangleMasks.resize(numTriangles);
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	for(UINT t=0; t<numTriangles; ++t)
+		m_triangleMasks[t] = m_materials[m_triangleMaterials[t]].transparent ? TRANSPARENT_TRIANGLE : 0;
+
+	if(numTriangles > 0) {
+		if(FAILED(hr = m_bvh.Build(&m_positionX[0], &m_positionY[0], &m_positionZ[0], &m_indices[0], numTriangles, &m_triangleMasks[0])))
+			return hr;
+	}
+
+	if(m_profiling) {
+		m_bvhTimer.Update();
+		m_bvhBuildTime = m_bvhTimer.GetTimeElapsed();
+	}
+
+	return S_OK;
+}
+
+HRESULT RayTracedRadiosity::ProcessVertex(Renderer &renderer, Scene &scene, Light &light, const UINT pass, const UINT vertexId)
+{
+	if(m_profiling)
+		m_timer.Update();
+
+	const UINT verticesBaked = min(VERTICES_BAKED_PER_DISPATCH, GetNumBakedVertices() - vertexId);
+
+	m_threadPool.ParallelFor(verticesBaked, [&](const UINT i, const UINT thread) {
+		Workspace &workspace = *(m_workspaces[thread]);
+		const UINT begin = static_cast<UINT>(workspace.formFactors.size());
+
+		TraceVertex(GetBakedVertex(vertexId + i), pass, workspace);
+
+		if(m_recordingFormFactors) {
+			const FormFactorRow row = { &workspace, begin, static_cast<UINT>(workspace.formFactors.size()) - begin };
+			m_batchRows[i] = row;
+		}
+	});
+
+	if(m_recordingFormFactors)
+		AppendFormFactorRows(verticesBaked);
+
+	m_raysCast += (UINT64) verticesBaked * m_raysPerVertex;
+
+	if(m_profiling) {
+		m_timer.Update();
+		m_hemicubeRenderingTime += m_timer.GetTimeElapsed();
+	}
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// Rayos con distribución coseno alrededor de la normal: con (u, v) en [0, 1)^2 la dirección
+// local es (sqrt(u) cos 2πv, sqrt(u) sin 2πv, sqrt(1 - u)). Cada rayo aporta 1 / raysPerVertex
+// de la radiancia que ve, igual que un texel aporta su delta form factor normalizado:
+//   pasada 0 => el cielo si no impacta geometría opaca (los transparentes se ignoran).
+//   luego    => la geometría de adelante sombreada como en SoftwareRasterizer
+//               (difuso * (a0, a1, a2) + ambiental * a3 con los atributos interpolados).
+// Con la matriz de form factors cada impacto suma 1 / raysPerVertex * baricéntrica * difuso
+// (dividido por vertexWeight, que ApplyFormFactors vuelve a multiplicar).
+//------------------------------------------------------------------------------------------
+void RayTracedRadiosity::TraceVertex(const UINT vertex, const UINT pass, Workspace &workspace) const
+{
+	const GIVertex &giVertex = m_vertices[vertex];
+	const UINT rowBegin = static_cast<UINT>(workspace.formFactors.size());
+
+	const bool saturate = pass > 0 && m_lastPassGIDataSRV != NULL;
+	const float rayWeight = 1.0f / m_raysPerVertex;
+	const float formFactorWeight = rayWeight / m_giCalcConstants.vertexWeight;
+	const float twoPi = 2.0f * static_cast<float>(D3DX_PI);
+
+	//cada vértice desplaza el patrón de otra manera: los errores de vértices vecinos no se correlacionan
+	const UINT hash = HashVertex(vertex);
+	const float offsetU = (hash & 0xFFFF) / 65536.0f;
+	const float offsetV = (hash >> 16) / 65536.0f;
+
+	float irradiance[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	for(UINT r=0; r<m_raysPerVertex; ++r)
+	{
+		float u = m_sampleU[r] + offsetU;
+		float v = m_sampleV[r] + offsetV;
+		if(u >= 1.0f) u -= 1.0f;
+		if(v >= 1.0f) v -= 1.0f;
+
+		const float radius = sqrt(u);
+		const float phi = twoPi * v;
+
+		D3DXVECTOR3 direction = giVertex.tangent * (radius * cos(phi)) + giVertex.bitangent * (radius * sin(phi)) +
+		                        giVertex.normal * sqrt(max(1.0f - u, 0.0f));
+		D3DXVec3Normalize(&direction, &direction);
+
+		TriangleHit hit;
+
+		if(pass == 0)
+		{
+			if(!m_bvh.Intersect(giVertex.position, direction, HEMICUBE_Z_NEAR, HEMICUBE_Z_FAR, TRANSPARENT_TRIANGLE, false, hit))
+			{
+				const D3DXVECTOR3 sky = m_skyTable.Lookup(direction);
+
+				irradiance[0] += sky.x;
+				irradiance[1] += sky.y;
+				irradiance[2] += sky.z;
+			}
+
+			irradiance[3] += 1.0f;
+			continue;
+		}
+
+		if(!m_bvh.Intersect(giVertex.position, direction, HEMICUBE_Z_NEAR, HEMICUBE_Z_FAR, 0, true, hit)) continue;
+
+		const DWORD * const indices = &m_indices[hit.triangle * 3];
+		const float barycentrics[3] = { max(1.0f - hit.u - hit.v, 0.0f), hit.u, hit.v };
+		const RasterMaterial &material = m_materials[m_triangleMaterials[hit.triangle]];
+
+		float attributes[RasterVertices::NUM_ATTRIBUTES];
+		for(UINT a=0; a<RasterVertices::NUM_ATTRIBUTES; ++a)
+			attributes[a] = barycentrics[0] * m_shading[a][indices[0]] + barycentrics[1] * m_shading[a][indices[1]] +
+			                barycentrics[2] * m_shading[a][indices[2]];
+
+		for(UINT c=0; c<3; ++c) {
+			float color = material.diffuse[c] * attributes[c] + material.ambient[c] * attributes[3];
+			if(saturate) color = min(max(color, 0.0f), 1.0f);
+
+			irradiance[c] += color;
+		}
+
+		irradiance[3] += 1.0f;
+
+		if(m_recordingFormFactors && !workspace.formFactorsFailed)
+		{
+			try
+			{
+				AddTriangleFormFactor(hit.triangle, barycentrics, formFactorWeight, workspace);
+			}
+			catch (std::bad_alloc &)
+			{
+				workspace.formFactorsFailed = true;
+			}
+		}
+	}
+
+	//la fila queda en workspace.formFactors. Preparar entryOfVertex para la próxima
+	if(m_recordingFormFactors) {
+		for(UINT i=rowBegin; i<workspace.formFactors.size(); ++i)
+			workspace.entryOfVertex[workspace.formFactors[i].source] = NO_FORM_FACTOR_ENTRY;
+	}
+
+	const DirectX::XMVECTOR vertexIrradiance = DirectX::XMVectorScale(DirectX::XMVectorSet(irradiance[0], irradiance[1], irradiance[2], irradiance[3]),
+	                                                                   rayWeight);
+
+	m_currentPassCpuGIData[vertex] = vertexIrradiance;
+	m_cpuGITempData[vertex] = DirectX::XMVectorAdd(m_cpuGITempData[vertex], vertexIrradiance);
+}
+
+}
@@ -0,0 +1,91 @@
+﻿//------------------------------------------------------------------------------------------
+// File: RayTracedRadiosity.h
+//
+// Implementación del algoritmo de radiosidad que no renderiza hemicubos: la irradiancia de
+// cada vértice se estima lanzando rayos con distribución coseno contra una TriangleBVH de la
+// mesh de la escena. Con esa distribución la irradiancia (normalizada igual que la integral
+// del hemicubo) es el promedio de la radiancia que ve cada rayo. No hay aliasing de los
+// texels del hemicubo ni textura de hemicubos. La iluminación por vértice, los materiales,
+// las sombras, el cielo, la matriz de form factors (un elemento por rayo que impacta), el
+// solver progresivo, el caché de irradiancia y los vértices soldados son los de
+// SoftwareRadiosity. Los rayos de los vértices de cada dispatch se reparten entre los hilos.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef RAY_TRACED_RADIOSITY_H
+#define RAY_TRACED_RADIOSITY_H
+
+#include "SoftwareRadiosity.h"
+#include "TriangleBVH.h"
+#include "Timer.h"
+
+namespace DTFramework
+{
+
+class RayTracedRadiosity : public SoftwareRadiosity
+{
+public:
+	//numThreads == 0 => un hilo por núcleo lógico. raysPerVertex en [1, MAX_RAYS_PER_VERTEX]. Los demás parámetros: ver SoftwareRadiosity
+	RayTracedRadiosity(const D3DDevicesManager &d3d, const bool enableProfiling=false, const UINT verticesBakedPerDispatch=256,
+	                   const UINT numBounces=2, const UINT numThreads=0, const UINT raysPerVertex=DEFAULT_RAYS_PER_VERTEX,
+	                   const bool reuseFormFactors=true, const RadiositySolver solver=RADIOSITY_SOLVER_GATHERING,
+	                   const float convergenceTolerance=DEFAULT_CONVERGENCE_TOLERANCE, const float irradianceCacheError=0.0f,
+	                   const bool weldVertices=true);
+	virtual ~RayTracedRadiosity();
+
+	static const UINT DEFAULT_RAYS_PER_VERTEX = 1024;
+	static const UINT MAX_RAYS_PER_VERTEX = 65536;
+
+protected:
+	virtual HRESULT BakeGIData(Renderer &renderer, Scene &scene, Light &light);
+
+	//agrega el patrón de rayos
+	virtual HRESULT InitResources();
+
+	virtual UINT GetHemicubeRendererId() const;
+	virtual UINT GetRaysPerVertex() const;
+
+	//no hay textura de hemicubos
+	virtual HRESULT CreateHemicubeTargets();
+
+	//agrega la BVH a los datos de SoftwareRadiosity
+	virtual HRESULT PrepareSceneData(const Scene &scene, const Light &light);
+
+	virtual HRESULT ProcessVertex(Renderer &renderer, Scene &scene, Light &light, const UINT pass, const UINT vertexId);
+
+	//lanza los rayos del vértice vertex y guarda su irradiancia igual que CPURadiosity::IntegrateVertex
+	void TraceVertex(const UINT vertex, const UINT pass, Workspace &workspace) const;
+
+private:
+	//máscara de TriangleBVH de los materiales transparentes (no tapan el cielo en la primera pasada)
+	static const UINT TRANSPARENT_TRIANGLE = 1;
+
+	const UINT m_raysPerVertex;
+
+	//puntos de Hammersley en [0, 1)^2, uno por rayo. Cada vértice los desplaza (Cranley-Patterson) según su índice
+	vector<float> m_sampleU;
+	vector<float> m_sampleV;
+
+	TriangleBVH m_bvh;
+	vector<UINT> m_triangleMasks;
+
+	//profiling
+	Timer m_bvhTimer;
+	double m_bvhBuildTime;      //tiempo en segundos de construcción de la BVH (incluido en el tiempo de preparación de la escena)
+	UINT64 m_raysCast;
+};
+
+inline UINT RayTracedRadiosity::GetHemicubeRendererId() const
+{
+	return 2;	//rayos contra TriangleBVH
+}
+
+inline UINT RayTracedRadiosity::GetRaysPerVertex() const
+{
+	return m_raysPerVertex;
+}
+
+}
+
+#endif
@@ -9,6 +9,9 @@
 namespace DTFramework
 {
 
+//definición de static member variables
+const D3DXVECTOR3 Renderer::SKY_COLOR_BIAS(0.84f, 0.84f, 0.74f);
+
 Renderer::Renderer(const D3DDevicesManager &d3d)
 : m_d3dManager(d3d), m_timer(d3d), m_inputLayouts(d3d), m_deviceStates(0), m_shadowMap(0), m_lightType(DIRECTIONAL_LIGHT), m_skyBox(0),
 m_depthOnlyEffect(d3d), m_depthOnlyTechnique(0), m_depthOnlyWVP(0), m_hudEnabled(true), m_giEnabled(true), m_ready(false)
@@ -99,7 +102,7 @@ HRESULT Renderer::Init(const LightType lightType, const UINT shadowMapSize, cons
 	m_depthOnlyWVP = tmp->GetVariableByName("gWVP")->AsMatrix();
 
 	//input layouts. Creamos dos. Uno con vertex de 4 elementos (posicion, normal, tex coord y tangente) y otro con solo posición
-	if(FAILED(hr = m_inputLayouts.Init(INPUT_LAYOUT_STANDARD | INPUT_LAYOUT_POSITION_ONLY))) return hr;
+	if(FAILED(hr = m_inputLayouts.Init(INPUT_LAYOUT_STANDARD | INPUT_LAYOUT_COMPACT | INPUT_LAYOUT_POSITION_ONLY))) return hr;
 
 	//Primitive topology. Nunca debería cambiar
 	m_d3dManager.IASetPrimitiveTopology(  D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
@@ -191,7 +194,7 @@ HRESULT Renderer::Render(Scene &scene, Light * const light, const D3DXVECTOR3 &c
 
 	HRESULT hr=S_OK;
 
-	const D3DXMATRIX wvpMatrix = view * projection;		//world es identidad
+	const D3DXMATRIX wvpMatrix = view * projection;		//Scene::Render agrega la world matrix de cada objeto
 
 	//1. si especificamos una luz y aún no se actualizó, calculamos las sombras
 	if(light && light->ShouldUpdate()) {
@@ -202,23 +205,23 @@ HRESULT Renderer::Render(Scene &scene, Light * const light, const D3DXVECTOR3 &c
 	m_d3dManager.OMSetBlendState();
 	m_d3dManager.OMSetDepthStencilState( m_deviceStates->GetDepthStencilState( DEVICE_STATE_DEPTHSTENCIL_ENABLED ), 1 );
 	m_d3dManager.RSSetState( m_deviceStates->GetRasterizerState( rasterizerState ) );
-	m_d3dManager.IASetInputLayout( m_inputLayouts.GetStandardInputLayout() );
 	m_d3dManager.IASetPrimitiveTopology(  D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
 
 	//3. dibujar la escena
 	if(light && light->ShouldUpdate()) {
 		if(FAILED(hr = scene.Render(&cameraPosition, &(light->GetProperties()), 1, m_shadowMap->GetShadowMap(), 
-		                            light->GetType() != POINT_LIGHT ? &(light->GetViewProjectionMatrix()) : NULL, GIData, &wvpMatrix )))
+		                            light->GetType() != POINT_LIGHT ? &(light->GetViewProjectionMatrix()) : NULL, GIData, &wvpMatrix, 
+		                            m_inputLayouts )))
 		{
 			return hr;
 		}
 
 		light->OnOffUpdateDone();
 	} else if(light) {
-		if(FAILED(hr = scene.Render(&cameraPosition, NULL, 1, NULL, NULL, GIData, &wvpMatrix))) return hr;
+		if(FAILED(hr = scene.Render(&cameraPosition, NULL, 1, NULL, NULL, GIData, &wvpMatrix, m_inputLayouts))) return hr;
 	} else {
 		//si light es NULL quiere decir que no debemos renderizar con luces por lo tanto pasamos 0 active lights aquí
-		if(FAILED(hr = scene.Render(&cameraPosition, NULL, 0, NULL, NULL, GIData, &wvpMatrix))) return hr;
+		if(FAILED(hr = scene.Render(&cameraPosition, NULL, 0, NULL, NULL, GIData, &wvpMatrix, m_inputLayouts))) return hr;
 	}
 
 	//4. renderizar el cielo LUEGO de renderizar la escena es una técnica de optimización. El cielo se renderiza con profundidad 1.0f
@@ -249,15 +252,9 @@ HRESULT Renderer::AuxiliarRenderDepthAndSkybox(Scene &scene, const Light &light,
 	m_d3dManager.IASetPrimitiveTopology(  D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
 	m_d3dManager.IASetInputLayout(m_inputLayouts.GetPositionOnlyInputLayout());
 
-	//1. depthonly
-	D3DXMATRIX viewProjection = view * projection;
-	if(FAILED(hr = m_depthOnlyWVP->SetMatrix((float *) &viewProjection))) { 
-		DXGI_D3D_ErrorWarning(hr, L"SetMatrix");
-		return hr; 
-	}
-
-	if(FAILED(hr = m_d3dManager.ApplyEffectPass(m_depthOnlyTechnique->GetPassByIndex(0), 0) )) return hr; 
-	if(FAILED(hr = scene.DrawSceneMesh())) return hr;
+	//1. depthonly. gWVP de cada objeto la asigna Scene::DrawSceneMesh, con los mismos niveles de detalle que usa Scene::Render
+	const D3DXMATRIX viewProjection = view * projection;
+	if(FAILED(hr = scene.DrawSceneMesh(m_depthOnlyWVP, viewProjection, m_depthOnlyTechnique->GetPassByIndex(0), true, true))) return hr;
 
 	//2. skybox
 	if(FAILED(hr = RenderSkyAndSun(light, view, projection, true))) return hr;
@@ -303,9 +300,7 @@ HRESULT Renderer::RenderSkyAndSun(const Light &light, const D3DXMATRIX &view, co
 	D3DXVECTOR3 sunDirection = light.GetDirection() - light.GetPosition();
 	D3DXVec3Normalize(&sunDirection, &sunDirection);
 
-	D3DXVECTOR3 bias = D3DXVECTOR3(0.84f, 0.84f, 0.74f);
-
-	return m_skyBox->Render(view, projection, sunDirection, bias, lowRes);
+	return m_skyBox->Render(view, projection, sunDirection, SKY_COLOR_BIAS, lowRes);
 }
 
 }
\ No newline at end of file
@@ -67,6 +67,14 @@ public:
 	void TurnOnOffHUD();
 	void TurnOnOffGI();
 
+	//profiling: skyboxes renderizados y cuántos de ellos generaron la sky texture (ver Skybox::Render)
+	UINT GetSkyTextureRequests() const;
+	UINT GetSkyTextureRenders() const;
+
+public:
+	//factor que se aplica al color del cielo al renderizar el skybox
+	static const D3DXVECTOR3 SKY_COLOR_BIAS;
+
 private:
 	void PrepareHUDInfo(const Camera &camera, const Light &light) const;
 	HRESULT RenderSkyAndSun(const Light &light, const D3DXMATRIX &view, const D3DXMATRIX &projection, const bool lowRes=false);
@@ -109,6 +117,14 @@ inline void Renderer::TurnOnOffGI()
 {
 	m_giEnabled = !m_giEnabled;
 }
+inline UINT Renderer::GetSkyTextureRequests() const
+{
+	return m_skyBox ? m_skyBox->GetSkyTextureRequests() : 0;
+}
+inline UINT Renderer::GetSkyTextureRenders() const
+{
+	return m_skyBox ? m_skyBox->GetSkyTextureRenders() : 0;
+}
 
 }
 
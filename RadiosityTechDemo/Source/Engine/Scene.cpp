@@ -21,16 +21,24 @@ const float Scene::LIGHT_Z_FAR = 1000.0f;
 
 const float Scene::TRANSPARENCY_BOUNDARY = 0.15f;
 
+//ampliación máxima de la proyección de una cara de hemicubo respecto de su centro (1 / cos^2 en la esquina, a 54.7°)
+static const float HEMICUBE_MAX_MAGNIFICATION = 3.0f;
+
 Scene::Scene(const D3DDevicesManager &d3d)
-: m_d3dManager(d3d), m_commonShader(d3d), m_sceneMesh(0), m_zFar(Z_FAR), m_zNear(Z_NEAR), 
-m_shadowMapsSize(SHADOW_MAP_SIZE), m_scale(1.0f), m_showSky(1), m_ready(false)
+: m_d3dManager(d3d), m_commonShader(d3d), m_totalGIVertices(0), m_objectGIViewsSource(0), m_meshResidentMB(MeshResidencyBudget::DEFAULT_BUDGET_MB),
+m_lodEnabled(false), m_lodViewpoint(0.0f, 0.0f, 0.0f), m_lodTexelsPerUnit(0.0f), m_lodMaxTexelError(0.0f),
+m_clustersDrawn(0), m_clustersCulled(0), m_lodTrianglesDrawn(0), m_lodFullDetailTriangles(0), m_hasLightViewProjection(false), 
+m_zFar(Z_FAR), m_zNear(Z_NEAR), m_shadowMapsSize(SHADOW_MAP_SIZE), m_hemicubeFaceSize(0), m_scale(1.0f), m_showSky(1), m_ready(false)
 {
-
+	D3DXMatrixIdentity(&m_lightViewProjection);
 }
 
 Scene::~Scene()
 {
-	SAFE_DELETE(m_sceneMesh);
+	ReleaseObjectGIViews();
+
+	for(UINT i=0; i<m_meshes.size(); ++i)
+		SAFE_DELETE(m_meshes[i]);
 }
 
 HRESULT Scene::Init(const wstring &sceneFile, Camera * const camera, Light * const light)
@@ -46,6 +54,8 @@ HRESULT Scene::Init(const wstring &sceneFile, Camera * const camera, Light * con
 
 	HRESULT hr;
 
+	m_sceneFile = sceneFile;
+
 	wstring file = SCENES_DIRECTORY + sceneFile;
 
 	if(FAILED(hr = LoadSceneFromFile(file, camera, light))) return hr;
@@ -55,30 +65,157 @@ HRESULT Scene::Init(const wstring &sceneFile, Camera * const camera, Light * con
 	float fov =  static_cast<float> (D3DX_PI) * 0.25f;
 	camera->SetProjectionMatrix(aspect, fov, m_zNear, m_zFar);
 
-	if(m_sceneMeshProperties.file.length() == 0) {
-		MessageBox(NULL, L"Archivo de escena no contiene un objeto 3D.", L"Error", MB_OK);
+	if(m_objectProperties.empty()) {
+		ErrorMessage(L"Archivo de escena no contiene un objeto 3D.", L"Error");
 		return E_FAIL;
 	}
 
-	//para el único objeto .obj especificado en el archivo de la escena vamos a crear el Mesh asociado
-	if((m_sceneMesh = new (std::nothrow) Mesh(m_d3dManager)) == NULL) {
-		MiscErrorWarning(BAD_ALLOC);
-		return E_FAIL;
-	}
-	if(FAILED(hr = m_sceneMesh->Init(m_sceneMeshProperties.file, m_sceneMeshProperties.num_vertices, 
-	                                 m_sceneMeshProperties.num_normals, m_sceneMeshProperties.num_texCoords))) 
-	{										
-		return hr;
-	}
+	if(FAILED(hr = CreateObjects())) return hr;
 
 	//material shaders
 	if(FAILED(hr = m_commonShader.Init() )) return hr;
 
+	//con un .fxo sin gWorld los objetos transformados se iluminarían (y se hornearían en la primera pasada) en el espacio del objeto
+	if(!m_commonShader.SupportsWorldMatrix()) 
+	{
+		for(UINT i=0; i<m_objects.size(); ++i) 
+		{
+			if(!D3DXMatrixIsIdentity(&(m_objects[i].world))) {
+				ErrorMessage(L"commonMaterialShader.fxo no tiene gWorld: recompilar Shaders/commonMaterialShader.fx para usar objetos con rotación o posición.", L"Error");
+				return E_FAIL;
+			}
+		}
+	}
+
+	//las techniques de cada material se buscan por nombre una sola vez y no en cada Render
+	for(UINT m=0; m<m_meshes.size(); ++m)
+		for(UINT i=0; i<m_meshes[m]->GetNumMaterials(); ++i)
+			if(FAILED(hr = m_commonShader.ResolveTechniques(*(m_meshes[m]->GetMaterial(i))) )) return hr;
+
 	m_ready = true;
 
 	return hr;
 }
 
+//------------------------------------------------------------------------------------------
+// Una Mesh por cada (.obj, compactvertices, chunked, lod) distinto y un SceneObject por bloque newobject.
+// Los vértices GI de los objetos quedan uno tras otro en el orden del archivo de escena.
+//------------------------------------------------------------------------------------------
+HRESULT Scene::CreateObjects()
+{
+	HRESULT hr;
+
+	const UINT numObjects = static_cast<UINT> (m_objectProperties.size());
+
+	//propiedades del primer objeto que creó cada mesh, para buscar meshes ya creadas
+	vector<const MeshProperties *> meshKeys;
+
+	try
+	{
+		m_objects.resize(numObjects);
+		m_objectGIViewBases.resize(numObjects + 1);
+		meshKeys.reserve(numObjects);
+		m_meshes.reserve(numObjects);
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	m_totalGIVertices = 0;
+
+	//un solo presupuesto para todas las meshes por partes
+	m_meshResidency.SetBudget(static_cast<UINT64> (m_meshResidentMB) << 20);
+
+	for(UINT i=0; i<numObjects; ++i)
+	{
+		MeshProperties &properties = m_objectProperties[i];
+
+		if(properties.file.length() == 0) {
+			ErrorMessage(L"Objeto de la escena sin archivo .obj.", L"Error");
+			return E_FAIL;
+		}
+
+		//los niveles de detalle son por cluster
+		if(properties.lodLevels > 0)
+			properties.chunked = true;
+
+		UINT mesh = 0;
+		while(mesh < meshKeys.size() && (meshKeys[mesh]->file != properties.file || meshKeys[mesh]->compactVertices != properties.compactVertices ||
+		                                 meshKeys[mesh]->chunked != properties.chunked || meshKeys[mesh]->lodLevels != properties.lodLevels))
+			++mesh;
+
+		if(mesh == meshKeys.size())
+		{
+			Mesh *newMesh;
+			if((newMesh = new (std::nothrow) Mesh(m_d3dManager)) == NULL) {
+				MiscErrorWarning(BAD_ALLOC);
+				return E_FAIL;
+			}
+
+			//hay lugar reservado: push_back no lanza excepciones
+			m_meshes.push_back(newMesh);
+			meshKeys.push_back(&properties);
+
+			if(FAILED(hr = newMesh->Init(properties.file, properties.compactVertices, properties.chunked, &m_meshResidency, 
+			                             properties.lodLevels))) return hr;
+		}
+
+		SceneObject &object = m_objects[i];
+
+		object.mesh = mesh;
+		object.giVertexOffset = m_totalGIVertices;
+
+		D3DXMATRIX rotation, translation;
+		D3DXMatrixRotationYawPitchRoll(&rotation, D3DXToRadian(properties.rot.y), D3DXToRadian(properties.rot.x), D3DXToRadian(properties.rot.z));
+		D3DXMatrixTranslation(&translation, properties.pos.x, properties.pos.y, properties.pos.z);
+		object.world = rotation * translation;
+
+		const UINT meshVertices = m_meshes[mesh]->GetTotalVertices();
+
+		if(meshVertices > numeric_limits<UINT>::max() - m_totalGIVertices) {
+			MiscErrorWarning(INVALID_PARAMETER, L"Scene::CreateObjects");
+			return E_FAIL;
+		}
+
+		m_totalGIVertices += meshVertices;
+	}
+
+	try
+	{
+		m_subsetBases.resize(m_meshes.size() + 1);
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	m_subsetBases[0] = 0;
+	for(UINT m=0; m<m_meshes.size(); ++m)
+		m_subsetBases[m + 1] = m_subsetBases[m] + m_meshes[m]->GetAttributeTableEntries();
+
+	//una vista de GIData por objeto o, en las meshes por partes, por cluster
+	m_objectGIViewBases[0] = 0;
+	for(UINT i=0; i<numObjects; ++i) {
+		const Mesh &mesh = *(m_meshes[m_objects[i].mesh]);
+		m_objectGIViewBases[i + 1] = m_objectGIViewBases[i] + (mesh.IsChunked() ? mesh.GetNumClusters() : 1);
+	}
+
+	try
+	{
+		m_objectGIViews.assign(m_objectGIViewBases.back(), NULL);
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
 
 //------------------------------------------------------------------------------------------
 // activeLights == 0 => no utilizaremos luces direccionales en esta renderización. Por lo tanto, no utilizaremos el mapa de sombras.
@@ -86,9 +223,17 @@ HRESULT Scene::Init(const wstring &sceneFile, Camera * const camera, Light * con
 // light == NULL => no actualizaremos la luz en esta renderización PERO si activeLights > 0 sí habrá luz en la misma.
 //
 // GIData == NULL => no utilizaremos iluminación global en esta renderización.
+//
+// El input layout de cada objeto (estándar o compacto) se toma de inputLayouts.
+//
+// Las meshes por partes se dibujan cluster por cluster. Los que quedan fuera del frustum no
+// se dibujan (ni se suben a la GPU) y el material sólo se vuelve a asignar cuando cambia el
+// subset. Cada cluster usa su propia vista de GIData porque SV_VertexID cuenta desde su
+// primer vértice. Con un punto de vista de LOD cada cluster se dibuja con su nivel de detalle.
 //------------------------------------------------------------------------------------------
 HRESULT Scene::Render(const D3DXVECTOR3 * const cameraPos, const LightProperties * const light, const UINT activeLights, ID3D11ShaderResourceView *shadowMap,
-                      const D3DXMATRIX * const lightVPM, ID3D11ShaderResourceView *GIData, const D3DXMATRIX * const viewProjection)
+                      const D3DXMATRIX * const lightVPM, ID3D11ShaderResourceView *GIData, const D3DXMATRIX * const viewProjection,
+                      const InputLayouts &inputLayouts)
 {
 	_ASSERT(m_ready);
 
@@ -102,52 +247,409 @@ HRESULT Scene::Render(const D3DXVECTOR3 * const cameraPos, const LightProperties
 	//variables del frame
 	if(FAILED( hr = m_commonShader.SetShaderVariablesPerFrame(*cameraPos, light, shadowMap, activeLights ) ) ) return hr;
 	
-	//variables del objeto (mesh) actual
-	if(FAILED(hr = m_commonShader.SetShaderVariablesPerObject((*viewProjection), lightVPM, GIData) ) ) return hr;
+	//la view projection de la luz sólo llega cuando la luz se actualiza, pero cada objeto necesita la suya en todos los frames
+	if(lightVPM) {
+		m_lightViewProjection = *lightVPM;
+		m_hasLightViewProjection = true;
+	}
+
+	if(GIData) {
+		if(FAILED(hr = UpdateObjectGIViews(GIData))) return hr;
+	}
 
-	//itero por todos los subsets de la scene mesh
-	const UINT nAttributes = m_sceneMesh->GetAttributeTableEntries();
-	for(UINT iSubset = 0; iSubset < nAttributes; ++iSubset ) 
+	for(UINT iObject = 0; iObject < m_objects.size(); ++iObject)
 	{
-		//tomar el subset material
-		const Material * const material = m_sceneMesh->GetSubsetMaterial(iSubset);
+		const SceneObject &object = m_objects[iObject];
+		const Mesh &mesh = *(m_meshes[object.mesh]);
+
+		m_d3dManager.IASetInputLayout( mesh.UsesCompactVertices() ? inputLayouts.GetCompactInputLayout() : inputLayouts.GetStandardInputLayout() );
+
+		const D3DXMATRIX wvp = object.world * (*viewProjection);
+		const D3DXMATRIX lightWVP = object.world * m_lightViewProjection;
+
+		ID3D11ShaderResourceView * const objectGIData = GetObjectGIView(iObject, 0, GIData);
+
+		//variables del objeto actual
+		if(FAILED(hr = m_commonShader.SetShaderVariablesPerObject(object.world, wvp, m_hasLightViewProjection ? &lightWVP : NULL, objectGIData) ) ) 
+			return hr;
+
+		if(mesh.IsChunked())
+		{
+			UINT currentSubset = numeric_limits<UINT>::max();
+
+			const D3DXVECTOR3 objectViewpoint = GetObjectLODViewpoint(object);
+
+			for(UINT iCluster = 0; iCluster < mesh.GetNumClusters(); ++iCluster)
+			{
+				const MeshCluster &cluster = *(mesh.GetCluster(iCluster));
+
+				if(IsClusterCulled(cluster, wvp)) continue;
+
+				if(cluster.subset != currentSubset)
+				{
+					const Material * const material = mesh.GetSubsetMaterial(cluster.subset);
+
+					if(!material) return E_FAIL;
 
-		if(!material) return E_FAIL;
+					if(FAILED(hr = m_commonShader.SetShaderVariablesPerMaterial(*material) )) return hr;
 
-		if(FAILED(hr = m_commonShader.SetShaderVariablesPerMaterial(*material) )) return hr;
+					if(FAILED(hr = m_commonShader.SetTechnique(*material, GIData ? true : false) )) return hr;
 
-		if(FAILED(hr = m_commonShader.SetTechnique(*material, GIData ? true : false) )) return hr;
+					currentSubset = cluster.subset;
+				}
+
+				if(GIData) {
+					if(FAILED(hr = m_commonShader.SetGIMeshData(GetObjectGIView(iObject, iCluster, GIData)) )) return hr;
+				}
+
+				if(FAILED( hr = m_d3dManager.ApplyEffectPass( m_commonShader.GetTechnique()->GetPassByIndex(0), 0 ) )) return hr;
+
+				if(FAILED(hr = mesh.RenderCluster(iCluster, SelectClusterLOD(mesh, iCluster, objectViewpoint, true)))) return hr;
+			}
+
+			continue;
+		}
+
+		//itero por todos los subsets de la mesh del objeto
+		const UINT nAttributes = mesh.GetAttributeTableEntries();
+		for(UINT iSubset = 0; iSubset < nAttributes; ++iSubset ) 
+		{
+			//tomar el subset material
+			const Material * const material = mesh.GetSubsetMaterial(iSubset);
+
+			if(!material) return E_FAIL;
+
+			if(FAILED(hr = m_commonShader.SetShaderVariablesPerMaterial(*material) )) return hr;
 
-		if(FAILED( hr = m_d3dManager.ApplyEffectPass( m_commonShader.GetTechnique()->GetPassByIndex(0), 0 ) )) return hr;
-			
-		if(FAILED(hr = m_sceneMesh->Render(iSubset))) return hr;
+			if(FAILED(hr = m_commonShader.SetTechnique(*material, GIData ? true : false) )) return hr;
+
+			if(FAILED( hr = m_d3dManager.ApplyEffectPass( m_commonShader.GetTechnique()->GetPassByIndex(0), 0 ) )) return hr;
+				
+			if(FAILED(hr = mesh.Render(iSubset))) return hr;
+		}
 	}
 
 	return S_OK;
 }
 
-//dibuja la scene mesh sin setear pipeline states ni techniques ni render targets. Se toma el estado que esté configurado actualmente
-HRESULT Scene::DrawSceneMesh() const
+//dibuja los objetos de la escena sin setear pipeline states ni render targets. Se toma el estado que esté configurado actualmente.
+//Sólo se asigna la matriz transform de cada objeto y se aplica pass
+HRESULT Scene::DrawSceneMesh(ID3DX11EffectMatrixVariable * const transform, const D3DXMATRIX &viewProjection, ID3DX11EffectPass * const pass,
+                             const bool cullClusters, const bool useLODs) const
 {
-	_ASSERT(m_ready);
+	_ASSERT(m_ready && transform && pass);
 
-	if(!m_ready) {
+	if(!m_ready || !transform || !pass) {
 		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Scene::DrawSceneMesh");
 		return E_FAIL;
 	}
 
 	HRESULT hr;
 
-	const UINT nAttributes = m_sceneMesh->GetAttributeTableEntries();
-	for(UINT iSubset = 0; iSubset < nAttributes; ++iSubset ) 
+	for(UINT iObject = 0; iObject < m_objects.size(); ++iObject)
+	{
+		const SceneObject &object = m_objects[iObject];
+		const Mesh &mesh = *(m_meshes[object.mesh]);
+
+		const D3DXMATRIX objectTransform = object.world * viewProjection;
+
+		if(FAILED(hr = transform->SetMatrix((float *) &objectTransform))) {
+			DXGI_D3D_ErrorWarning(hr, L"Scene::DrawSceneMesh --> SetMatrix");
+			return hr;
+		}
+
+		if(FAILED(hr = m_d3dManager.ApplyEffectPass(pass, 0) )) return hr;
+
+		if(mesh.IsChunked())
+		{
+			const D3DXVECTOR3 objectViewpoint = GetObjectLODViewpoint(object);
+
+			for(UINT iCluster = 0; iCluster < mesh.GetNumClusters(); ++iCluster)
+			{
+				const MeshCluster &cluster = *(mesh.GetCluster(iCluster));
+				const Material * const material = mesh.GetSubsetMaterial(cluster.subset);
+
+				if(!material) return E_FAIL;
+
+				if(material->GetAlpha() < TRANSPARENCY_BOUNDARY) continue;
+
+				if(cullClusters && IsClusterCulled(cluster, objectTransform)) continue;
+
+				if(FAILED ( hr = mesh.RenderCluster(iCluster, useLODs ? SelectClusterLOD(mesh, iCluster, objectViewpoint, false) : 0) ) ) return hr;
+			}
+
+			continue;
+		}
+
+		const UINT nAttributes = mesh.GetAttributeTableEntries();
+		for(UINT iSubset = 0; iSubset < nAttributes; ++iSubset ) 
+		{
+			const Material * const material = mesh.GetSubsetMaterial( iSubset );
+
+			if(!material) return E_FAIL;
+
+			if(material->GetAlpha() < TRANSPARENCY_BOUNDARY) continue;		//materiales transparentes dejan pasar la luz
+
+			if(FAILED ( hr = mesh.Render(iSubset) ) ) return hr;
+		}
+	}
+
+	return S_OK;
+}
+
+void Scene::SetLODViewpoint(const D3DXVECTOR3 * const viewpoint, const UINT faceSize, const float maxTexelError)
+{
+	m_lodEnabled = viewpoint != NULL && faceSize > 0 && maxTexelError > 0.0f;
+
+	if(!m_lodEnabled) return;
+
+	m_lodViewpoint = *viewpoint;
+	m_lodTexelsPerUnit = faceSize * 0.5f * HEMICUBE_MAX_MAGNIFICATION;
+	m_lodMaxTexelError = maxTexelError;
+}
+
+D3DXVECTOR3 Scene::GetObjectLODViewpoint(const SceneObject &object) const
+{
+	D3DXVECTOR3 objectViewpoint(0.0f, 0.0f, 0.0f);
+
+	if(m_lodEnabled) {
+		D3DXMATRIX inverseWorld;
+		D3DXMatrixInverse(&inverseWorld, NULL, &object.world);
+		D3DXVec3TransformCoord(&objectViewpoint, &m_lodViewpoint, &inverseWorld);
+	}
+
+	return objectViewpoint;
+}
+
+//------------------------------------------------------------------------------------------
+// Un error de e unidades a distancia d ocupa a lo sumo e * m_lodTexelsPerUnit / d texels
+// (en la esquina de la cara, donde la proyección más amplía). d es la distancia a la caja del
+// cluster, así que el cluster que contiene al punto de vista siempre usa la geometría completa.
+//------------------------------------------------------------------------------------------
+UINT Scene::SelectClusterLOD(const Mesh &mesh, const UINT cluster, const D3DXVECTOR3 &objectViewpoint, const bool countTriangles) const
+{
+	if(!m_lodEnabled) return 0;
+
+	const MeshCluster &bounds = *(mesh.GetCluster(cluster));
+	const UINT numLODs = mesh.GetNumClusterLODs(cluster);
+
+	D3DXVECTOR3 delta;
+	delta.x = std::max(std::max(bounds.boundsMin.x - objectViewpoint.x, objectViewpoint.x - bounds.boundsMax.x), 0.0f);
+	delta.y = std::max(std::max(bounds.boundsMin.y - objectViewpoint.y, objectViewpoint.y - bounds.boundsMax.y), 0.0f);
+	delta.z = std::max(std::max(bounds.boundsMin.z - objectViewpoint.z, objectViewpoint.z - bounds.boundsMax.z), 0.0f);
+
+	const float distance = D3DXVec3Length(&delta);
+
+	//los niveles tienen error creciente: el último que cumple es el más simple
+	UINT lod = 0;
+	if(distance > 0.0f) {
+		const float maxError = m_lodMaxTexelError * distance / m_lodTexelsPerUnit;
+
+		while(lod < numLODs && mesh.GetClusterLOD(cluster, lod + 1)->error <= maxError)
+			++lod;
+	}
+
+	if(countTriangles) {
+		m_lodFullDetailTriangles += bounds.faceCount;
+		m_lodTrianglesDrawn += lod == 0 ? bounds.faceCount : mesh.GetClusterLOD(cluster, lod)->indexCount / 3;
+	}
+
+	return lod;
+}
+
+//------------------------------------------------------------------------------------------
+// La caja está fuera si sus 8 esquinas en clip space quedan del lado de afuera de un mismo
+// plano del frustum (-w <= x, y <= w, 0 <= z <= w). Es conservador: una caja que cruza una
+// esquina del frustum puede no descartarse.
+//------------------------------------------------------------------------------------------
+bool Scene::IsClusterCulled(const MeshCluster &cluster, const D3DXMATRIX &transform) const
+{
+	UINT outside[6] = { 0, 0, 0, 0, 0, 0 };
+
+	for(UINT corner=0; corner<8; ++corner)
+	{
+		const D3DXVECTOR3 p(corner & 1 ? cluster.boundsMax.x : cluster.boundsMin.x, corner & 2 ? cluster.boundsMax.y : cluster.boundsMin.y,
+		                    corner & 4 ? cluster.boundsMax.z : cluster.boundsMin.z);
+
+		D3DXVECTOR4 clip;
+		D3DXVec3Transform(&clip, &p, &transform);
+
+		if(clip.x < -clip.w) outside[0]++;
+		if(clip.x > clip.w) outside[1]++;
+		if(clip.y < -clip.w) outside[2]++;
+		if(clip.y > clip.w) outside[3]++;
+		if(clip.z < 0.0f) outside[4]++;
+		if(clip.z > clip.w) outside[5]++;
+	}
+
+	for(UINT plane=0; plane<6; ++plane) {
+		if(outside[plane] == 8) {
+			m_clustersCulled++;
+			return true;
+		}
+	}
+
+	m_clustersDrawn++;
+
+	return false;
+}
+
+//------------------------------------------------------------------------------------------
+// El vertex shader lee la GI con Load(SV_VertexID), que cuenta desde el comienzo del vertex
+// buffer de la mesh. Cada objeto con giVertexOffset > 0 usa entonces una vista de GIData que
+// empieza en su primer vértice GI, y cada cluster de una mesh por partes una que empieza en el
+// primer vértice GI del cluster. Las vistas se recrean sólo cuando cambia GIData; se guarda
+// una referencia a GIData para que su dirección no pueda reutilizarse mientras tanto.
+//------------------------------------------------------------------------------------------
+HRESULT Scene::UpdateObjectGIViews(ID3D11ShaderResourceView * const GIData)
+{
+	if(GIData == m_objectGIViewsSource) return S_OK;
+
+	ReleaseObjectGIViews();
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+	GIData->GetDesc(&srvDesc);
+
+	if(srvDesc.ViewDimension != D3D11_SRV_DIMENSION_BUFFER || srvDesc.Buffer.ElementWidth < m_totalGIVertices) {
+		MiscErrorWarning(INVALID_PARAMETER, L"Scene::UpdateObjectGIViews");
+		return E_INVALIDARG;
+	}
+
+	const UINT firstElement = srvDesc.Buffer.ElementOffset;
+
+	ID3D11Resource *pRes = NULL;
+	GIData->GetResource(&pRes);
+
+	HRESULT hr = S_OK;
+
+	for(UINT i=0; i<m_objects.size() && SUCCEEDED(hr); ++i)
+	{
+		const Mesh &mesh = *(m_meshes[m_objects[i].mesh]);
+		const UINT numViews = m_objectGIViewBases[i + 1] - m_objectGIViewBases[i];
+
+		for(UINT v=0; v<numViews && SUCCEEDED(hr); ++v)
+		{
+			const UINT vertexStart = mesh.IsChunked() ? mesh.GetCluster(v)->vertexStart : 0;
+			const UINT vertexCount = mesh.IsChunked() ? mesh.GetCluster(v)->vertexCount : mesh.GetTotalVertices();
+
+			if(m_objects[i].giVertexOffset + vertexStart == 0) continue;
+
+			srvDesc.Buffer.ElementOffset = firstElement + m_objects[i].giVertexOffset + vertexStart;
+			srvDesc.Buffer.ElementWidth = vertexCount;
+
+			hr = m_d3dManager.CreateShaderResourceView(pRes, &srvDesc, &(m_objectGIViews[m_objectGIViewBases[i] + v]));
+		}
+	}
+
+	SAFE_RELEASE(pRes);
+
+	if(FAILED(hr)) {
+		ReleaseObjectGIViews();
+		return hr;
+	}
+
+	m_objectGIViewsSource = GIData;
+	m_objectGIViewsSource->AddRef();
+
+	return S_OK;
+}
+
+ID3D11ShaderResourceView *Scene::GetObjectGIView(const UINT object, const UINT cluster, ID3D11ShaderResourceView * const GIData) const
+{
+	if(!GIData) return NULL;
+
+	ID3D11ShaderResourceView * const view = m_objectGIViews[m_objectGIViewBases[object] + cluster];
+
+	return view != NULL ? view : GIData;
+}
+
+void Scene::ReleaseObjectGIViews()
+{
+	for(UINT i=0; i<m_objectGIViews.size(); ++i)
+		SAFE_RELEASE(m_objectGIViews[i]);
+
+	SAFE_RELEASE(m_objectGIViewsSource);
+}
+
+HRESULT Scene::GetSceneGeometry(vector<Vertex> &vertices, vector<DWORD> &indices, vector<UINT> * const triangleSubsets) const
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Scene::GetSceneGeometry");
+		return E_FAIL;
+	}
+
+	UINT totalFaces = 0;
+	for(UINT i=0; i<m_objects.size(); ++i)
+		totalFaces += m_meshes[m_objects[i].mesh]->GetTotalFaces();
+
+	try 
+	{
+		vertices.resize(m_totalGIVertices);
+		indices.resize(static_cast<size_t> (totalFaces) * 3);
+
+		if(triangleSubsets)
+			triangleSubsets->assign(totalFaces, 0);
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+	catch (std::length_error &) 
 	{
-		const Material * const material = m_sceneMesh->GetSubsetMaterial( iSubset );
+		MiscErrorWarning(LENGTH_ERROR);
+		return E_FAIL;
+	}
+
+	UINT firstFace = 0;
+
+	for(UINT i=0; i<m_objects.size(); ++i)
+	{
+		const SceneObject &object = m_objects[i];
+		const Mesh &mesh = *(m_meshes[object.mesh]);
+
+		const Vertex * const meshVertices = mesh.GetVertices();
+		const DWORD * const meshIndices = mesh.GetIndices();
+
+		if(!meshVertices || !meshIndices) return E_FAIL;
 
-		if(!material) return E_FAIL;
+		//world es rotación y traslación: las normales y tangentes se transforman con la misma matriz
+		for(UINT v=0; v<mesh.GetTotalVertices(); ++v) 
+		{
+			const Vertex &source = meshVertices[v];
+			Vertex &destination = vertices[object.giVertexOffset + v];
+
+			destination = source;
+
+			D3DXVec3TransformCoord(&(destination.position), &(source.position), &(object.world));
+			D3DXVec3TransformNormal(&(destination.normal), &(source.normal), &(object.world));
+
+			D3DXVECTOR3 tangent(source.tangent.x, source.tangent.y, source.tangent.z);
+			D3DXVec3TransformNormal(&tangent, &tangent, &(object.world));
+			destination.tangent = D3DXVECTOR4(tangent.x, tangent.y, tangent.z, source.tangent.w);
+		}
+
+		const size_t firstIndex = static_cast<size_t> (firstFace) * 3;
+		const UINT numIndices = mesh.GetTotalFaces() * 3;
+
+		for(UINT j=0; j<numIndices; ++j)
+			indices[firstIndex + j] = meshIndices[j] + object.giVertexOffset;
+
+		if(triangleSubsets) 
+		{
+			for(UINT s=0; s<mesh.GetAttributeTableEntries(); ++s) 
+			{
+				const D3DX10_ATTRIBUTE_RANGE * const range = mesh.GetSubsetRange(s);
 
-		if(material->GetAlpha() < TRANSPARENCY_BOUNDARY) continue;		//materiales transparentes dejan pasar la luz
+				const UINT lastFace = std::min(range->FaceStart + range->FaceCount, mesh.GetTotalFaces());
+				for(UINT f=range->FaceStart; f<lastFace; ++f)
+					(*triangleSubsets)[firstFace + f] = m_subsetBases[object.mesh] + s;
+			}
+		}
 
-		if(FAILED ( hr = m_sceneMesh->Render(iSubset) ) ) return hr;
+		firstFace += mesh.GetTotalFaces();
 	}
 
 	return S_OK;
@@ -195,7 +697,6 @@ HRESULT Scene::LoadSceneFromFile(const wstring &sceneFile, Camera * const camera
 		LightType lightType;
 		float z_far=LIGHT_Z_FAR, z_near=LIGHT_Z_NEAR;
 		float lightHeight = LIGHT_VOLUME_HEIGHT, lightWidth = LIGHT_VOLUME_WIDTH;		//solo para luces direccionales
-		UINT objectsCount = 0;
 
 		while( !inputFile.eof() && inputFile.peek() != EOF ) 
 		{
@@ -252,7 +753,7 @@ HRESULT Scene::LoadSceneFromFile(const wstring &sceneFile, Camera * const camera
 				if(isLightActive)
 					lightProperties.pos = tmp;
 				else if(is3DObjectActive)
-					m_sceneMeshProperties.pos = tmp;
+					m_objectProperties.back().pos = tmp;
 				else if(isCameraActive)
 					camera->SetEyeVector(tmp);
 				else 
@@ -387,6 +888,11 @@ HRESULT Scene::LoadSceneFromFile(const wstring &sceneFile, Camera * const camera
 				inputFile >> m_shadowMapsSize;
 				if(m_shadowMapsSize <= 0) throw SCENE_FILE_ERROR;
 			}
+			else if(strCommand == "hemicubefacesize")
+			{
+				inputFile >> m_hemicubeFaceSize;
+				if(m_hemicubeFaceSize <= 0) throw SCENE_FILE_ERROR;
+			}
 			else if(strCommand == "projzfar")
 			{
 				if(isCameraActive)
@@ -403,43 +909,26 @@ HRESULT Scene::LoadSceneFromFile(const wstring &sceneFile, Camera * const camera
 			}
 			else if(strCommand == "newobject")
 			{
-				if(is3DObjectActive || isCameraActive || isLightActive || objectsCount > 0) 
+				if(is3DObjectActive || isCameraActive || isLightActive) 
 					throw SCENE_FILE_ERROR;
 
+				m_objectProperties.push_back(MeshProperties());
+
 				is3DObjectActive = true;
-				++objectsCount;
 			}
 			else if(strCommand == "endobject")
 			{
 				if(!is3DObjectActive) throw SCENE_FILE_ERROR;
 				is3DObjectActive = false;
 			}
-			else if(strCommand == "numvertices")
-			{
-				if(is3DObjectActive)
-					inputFile >> m_sceneMeshProperties.num_vertices;
-				else 
-					throw SCENE_FILE_ERROR;
-
-				if(m_sceneMeshProperties.num_vertices <= 0) throw SCENE_FILE_ERROR;
-			}
-			else if(strCommand == "numnormals")
-			{
-				if(is3DObjectActive)
-					inputFile >> m_sceneMeshProperties.num_normals;
-				else 
-					throw SCENE_FILE_ERROR;
-
-				if(m_sceneMeshProperties.num_normals <= 0) throw SCENE_FILE_ERROR;
-			}
-			else if(strCommand == "numtexcoords")
+			else if(strCommand == "numvertices" || strCommand == "numnormals" || strCommand == "numtexcoords")
 			{
+				//ya no se usan: OBJParser lee el .obj completo antes de reservar memoria. Se aceptan por compatibilidad
+				UINT count;
 				if(is3DObjectActive)
-					inputFile >> m_sceneMeshProperties.num_texCoords;
+					inputFile >> count;
 				else 
 					throw SCENE_FILE_ERROR;
-
-				if(m_sceneMeshProperties.num_texCoords <= 0) throw SCENE_FILE_ERROR;
 			}
 			else if(strCommand == "file")
 			{
@@ -456,18 +945,54 @@ HRESULT Scene::LoadSceneFromFile(const wstring &sceneFile, Camera * const camera
 						throw 'e';
 					}
 
-					m_sceneMeshProperties.file = wstring(wstrNameC);
+					m_objectProperties.back().file = wstring(wstrNameC);
 
 				} else 
 					throw SCENE_FILE_ERROR;
 			}
+			else if(strCommand == "compactvertices")
+			{
+				int tmp;
+				inputFile >> tmp;
+
+				if(is3DObjectActive)
+					m_objectProperties.back().compactVertices = tmp != 0;
+				else 
+					throw SCENE_FILE_ERROR;
+			}
+			else if(strCommand == "chunked")
+			{
+				int tmp;
+				inputFile >> tmp;
+
+				if(is3DObjectActive)
+					m_objectProperties.back().chunked = tmp != 0;
+				else 
+					throw SCENE_FILE_ERROR;
+			}
+			else if(strCommand == "lod")
+			{
+				UINT tmp;
+				inputFile >> tmp;
+
+				if(is3DObjectActive && tmp <= Mesh::MAX_LOD_LEVELS)
+					m_objectProperties.back().lodLevels = tmp;
+				else 
+					throw SCENE_FILE_ERROR;
+			}
+			else if(strCommand == "meshresidentmb")
+			{
+				inputFile >> m_meshResidentMB;
+
+				if(m_meshResidentMB == 0) throw SCENE_FILE_ERROR;
+			}
 			else if(strCommand == "rotation")
 			{
 				float x,y,z;
 				inputFile >> x >> y >> z;
 
 				if(is3DObjectActive)
-					m_sceneMeshProperties.rot = D3DXVECTOR3(x,y,z);
+					m_objectProperties.back().rot = D3DXVECTOR3(x,y,z);
 				else 
 					throw SCENE_FILE_ERROR;
 			}
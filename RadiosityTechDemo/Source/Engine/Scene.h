@@ -1,9 +1,18 @@
 ﻿//------------------------------------------------------------------------------------------
 // File: Scene.h
 //
-// Carga una escena desde un archivo .txt. Crea la Mesh asociada y 
+// Carga una escena desde un archivo .txt. Crea las Mesh asociadas y 
 // configura las propiedades de la cámara y la luz de la escena según lo especificado
 // en el archivo de entrada.
+// Cada bloque newobject es un objeto con su propia world matrix. Los objetos que usan el
+// mismo .obj comparten una sola Mesh (y sus buffers en GPU); sólo los vértices GI son
+// por objeto, uno tras otro en el orden del archivo de escena.
+// Los objetos con chunked 1 usan una mesh por partes: se dibujan cluster por cluster,
+// descartando los que quedan fuera del frustum, y sólo los clusters dibujados se suben a la
+// GPU (a lo sumo meshresidentmb megabytes entre todas las meshes por partes de la escena,
+// descartando los clusters usados hace más tiempo de cualquiera de ellas). Con lod N (que
+// implica chunked 1) cada cluster tiene además N niveles de detalle, que se usan sólo
+// mientras haya un punto de vista de LOD (ver SetLODViewpoint: los hemicubos de la radiosidad).
 // También define dos funciones de renderización para dibujar toda la escena.
 //
 // Author: Gabriel Clavero
@@ -22,6 +31,7 @@
 #include "Camera.h"
 
 #include "Mesh.h"
+#include "InputLayouts.h"
 #include "CommonMaterialShader.h"
 
 using std::vector;
@@ -35,19 +45,27 @@ namespace DTFramework
 struct MeshProperties
 {
 	D3DXVECTOR3 pos;            //posición
-	D3DXVECTOR3 rot;            //rotación
+	D3DXVECTOR3 rot;            //rotación en grados alrededor de x, y, z
 	wstring file;
-	UINT num_vertices;          //cantidad total de vertices en el archivo .obj
-	UINT num_normals;           //cantidad total de normales
-	UINT num_texCoords;         //cantidad total de coordenadas de textura
+	bool compactVertices;       //vertex buffer en formato CompactVertex (línea compactvertices 1 del objeto)
+	bool chunked;               //mesh por partes (línea chunked 1 del objeto)
+	UINT lodLevels;             //niveles de detalle de cada cluster (línea lod N del objeto). > 0 implica chunked
 
 	MeshProperties()
-	: pos(D3DXVECTOR3(0, 0, 0)), rot(D3DXVECTOR3(0,0,0)), num_vertices(0), num_normals(0), num_texCoords(0)
+	: pos(D3DXVECTOR3(0, 0, 0)), rot(D3DXVECTOR3(0,0,0)), compactVertices(false), chunked(false), lodLevels(0)
 	{
 
 	}
 };
 
+//instancia de una Mesh en la escena
+struct SceneObject
+{
+	UINT mesh;                  //índice de la Mesh (Scene::GetMesh). Varios objetos pueden compartirla
+	D3DXMATRIX world;           //rotación y luego traslación de MeshProperties
+	UINT giVertexOffset;        //índice del primer vértice GI del objeto. Sus vértices GI son los de la mesh en el mismo orden
+};
+
 class Scene
 {
 public:
@@ -57,21 +75,93 @@ public:
 	//sólo debe llamarse a lo sumo una vez por objeto
 	HRESULT Init(const wstring &sceneFile, Camera * const camera, Light * const light);
 
+	//GIData: un elemento por vértice GI de la escena (GetTotalGIVertices)
 	HRESULT Render(const D3DXVECTOR3 * const cameraPos, const LightProperties * const light, const UINT activeLights, ID3D11ShaderResourceView *shadowMap,
-	               const D3DXMATRIX * const lightVPM, ID3D11ShaderResourceView *GIData, const D3DXMATRIX * const viewProjection);
+	               const D3DXMATRIX * const lightVPM, ID3D11ShaderResourceView *GIData, const D3DXMATRIX * const viewProjection,
+	               const InputLayouts &inputLayouts);
+
+	//antes de dibujar cada objeto asigna world * viewProjection a transform y aplica pass. cullClusters: descartar los clusters de
+	//las meshes por partes que quedan fuera del frustum de viewProjection (false si viewProjection no es una proyección).
+	//useLODs: usar los niveles de detalle de SetLODViewpoint, igual que Render (para que la profundidad coincida con la de Render)
+	HRESULT DrawSceneMesh(ID3DX11EffectMatrixVariable * const transform, const D3DXMATRIX &viewProjection, ID3DX11EffectPass * const pass,
+	                      const bool cullClusters=true, const bool useLODs=false) const;
+
+	//------------------------------------------------------------------------------------------
+	// Niveles de detalle de los clusters vistos desde viewpoint (en world space) en una cara
+	// de hemicubo de faceSize texels (90° de campo visual). Se usa el nivel más simple cuyo
+	// error proyectado a la distancia del cluster es a lo sumo maxTexelError texels.
+	// viewpoint == NULL => siempre la geometría completa.
+	//------------------------------------------------------------------------------------------
+	void SetLODViewpoint(const D3DXVECTOR3 * const viewpoint, const UINT faceSize=0, const float maxTexelError=0.0f);
+
+	UINT GetNumObjects() const;
+	const SceneObject &GetSceneObject(const UINT i) const;
+
+	//meshes distintas de la escena
+	UINT GetNumMeshes() const;
+	const Mesh *GetMesh(const UINT i) const;
+
+	//memoria de los clusters residentes de todas las meshes por partes (meshresidentmb)
+	const MeshResidencyBudget &GetMeshResidency() const;
+
+	//suma de los vértices de todos los objetos
+	UINT GetTotalGIVertices() const;
+
+	//vértices (en world space) e índices de todos los objetos, concatenados en el orden de los vértices GI. Si triangleSubsets
+	//no es NULL se guarda para cada triángulo GetSubsetBase(mesh) + subset de su mesh
+	HRESULT GetSceneGeometry(vector<Vertex> &vertices, vector<DWORD> &indices, vector<UINT> * const triangleSubsets=NULL) const;
 
-	HRESULT DrawSceneMesh() const;
+	//índice del primer subset de la mesh i si se numeran los subsets de todas las meshes uno tras otro
+	UINT GetSubsetBase(const UINT i) const;
+	UINT GetTotalSubsets() const;
 
-	const Mesh *GetSceneMesh() const;
+	//archivo de escena (relativo a SCENES_DIRECTORY)
+	const wstring &GetFileName() const;
 
 	UINT GetShadowMapsSize() const;
 	float GetScale() const;
 
+	//tamaño de las caras de los hemicubos pedido por la escena (hemicubefacesize). 0 si no lo especifica
+	UINT GetHemicubeFaceSize() const;
+
 	bool ShowSky() const;
 
+	//profiling: búsquedas de techniques por nombre (sólo al cargar) y subsets dibujados por Render
+	UINT GetTechniqueLookups() const;
+	UINT GetMaterialDraws() const;
+
+	//profiling: clusters de meshes por partes dibujados y descartados por el frustum desde que se cargó la escena
+	UINT64 GetClustersDrawn() const;
+	UINT64 GetClustersCulled() const;
+
+	//profiling: triángulos de los clusters dibujados por Render con un punto de vista de LOD y los que tendrían con la geometría
+	//completa. DrawSceneMesh no cuenta
+	UINT64 GetLODTrianglesDrawn() const;
+	UINT64 GetLODFullDetailTriangles() const;
+
+	static float GetTransparencyBoundary();
+
 private:
 	HRESULT LoadSceneFromFile(const wstring &sceneFile, Camera * const camera, Light * const light);
 
+	HRESULT CreateObjects();
+
+	HRESULT UpdateObjectGIViews(ID3D11ShaderResourceView * const GIData);
+	void ReleaseObjectGIViews();
+
+	//vista de GIData del objeto (cluster: índice del cluster en una mesh por partes, 0 si no)
+	ID3D11ShaderResourceView *GetObjectGIView(const UINT object, const UINT cluster, ID3D11ShaderResourceView * const GIData) const;
+
+	//true si la caja del cluster queda fuera del frustum de transform (world * view projection)
+	bool IsClusterCulled(const MeshCluster &cluster, const D3DXMATRIX &transform) const;
+
+	//nivel de detalle para RenderCluster. objectViewpoint: el punto de vista de LOD en el espacio del objeto.
+	//countTriangles: sumar a los contadores de LOD (sólo Render, para no contar dos veces la pasada de profundidad)
+	UINT SelectClusterLOD(const Mesh &mesh, const UINT cluster, const D3DXVECTOR3 &objectViewpoint, const bool countTriangles) const;
+
+	//punto de vista de LOD en el espacio del objeto (las world matrix sólo rotan y trasladan: las distancias no cambian)
+	D3DXVECTOR3 GetObjectLODViewpoint(const SceneObject &object) const;
+
 private:
 	static const float Z_FAR;
 	static const float Z_NEAR;
@@ -91,14 +181,48 @@ private:
 	//material shaders
 	CommonMaterialShader m_commonShader;
 
-	//objeto mesh
-	Mesh *m_sceneMesh;
-	MeshProperties m_sceneMeshProperties;
+	wstring m_sceneFile;
+
+	//un MeshProperties por bloque newobject del archivo de escena
+	vector<MeshProperties> m_objectProperties;
+
+	vector<Mesh *> m_meshes;
+	vector<UINT> m_subsetBases;                 //ver GetSubsetBase. Tiene GetNumMeshes() + 1 elementos
+	vector<SceneObject> m_objects;
+	UINT m_totalGIVertices;
+
+	//vistas de GIData que empiezan en el primer vértice GI de cada objeto o, en las meshes por partes, de cada cluster de cada
+	//objeto (NULL si empiezan en 0). Las del objeto i son las m_objectGIViewBases[i]..m_objectGIViewBases[i + 1] - 1. Ver UpdateObjectGIViews
+	vector<ID3D11ShaderResourceView *> m_objectGIViews;
+	vector<UINT> m_objectGIViewBases;
+	ID3D11ShaderResourceView *m_objectGIViewsSource;
+
+	//megabytes de clusters residentes entre todas las meshes por partes (meshresidentmb), compartidos con m_meshResidency.
+	//Las meshes se destruyen en ~Scene, antes que m_meshResidency
+	UINT m_meshResidentMB;
+	MeshResidencyBudget m_meshResidency;
+
+	//punto de vista de LOD (SetLODViewpoint). m_lodTexelsPerUnit: texels que ocupa una unidad a distancia 1
+	bool m_lodEnabled;
+	D3DXVECTOR3 m_lodViewpoint;
+	float m_lodTexelsPerUnit;
+	float m_lodMaxTexelError;
+
+	//profiling. mutable: DrawSceneMesh es const
+	mutable UINT64 m_clustersDrawn;
+	mutable UINT64 m_clustersCulled;
+	mutable UINT64 m_lodTrianglesDrawn;
+	mutable UINT64 m_lodFullDetailTriangles;
+
+	//view projection de la luz del último Render que la recibió. Cada objeto la combina con su world matrix
+	D3DXMATRIX m_lightViewProjection;
+	bool m_hasLightViewProjection;
 
 	//propiedades de la escena
 	float m_zFar;
 	float m_zNear;
 	UINT m_shadowMapsSize;
+	UINT m_hemicubeFaceSize;
 	float m_scale;
 	bool m_showSky;
 
@@ -115,21 +239,104 @@ inline float Scene::GetScale() const
 	return m_scale;
 }
 
+inline UINT Scene::GetHemicubeFaceSize() const
+{
+	return m_hemicubeFaceSize;
+}
+
+inline float Scene::GetTransparencyBoundary()
+{
+	return TRANSPARENCY_BOUNDARY;
+}
+inline const wstring &Scene::GetFileName() const
+{
+	return m_sceneFile;
+}
+
+inline UINT Scene::GetTechniqueLookups() const
+{
+	return m_commonShader.GetTechniqueLookups();
+}
+
+inline UINT Scene::GetMaterialDraws() const
+{
+	return m_commonShader.GetTechniqueBinds();
+}
+
+inline UINT64 Scene::GetClustersDrawn() const
+{
+	return m_clustersDrawn;
+}
+
+inline UINT64 Scene::GetClustersCulled() const
+{
+	return m_clustersCulled;
+}
+
+inline UINT64 Scene::GetLODTrianglesDrawn() const
+{
+	return m_lodTrianglesDrawn;
+}
+
+inline UINT64 Scene::GetLODFullDetailTriangles() const
+{
+	return m_lodFullDetailTriangles;
+}
+
 inline bool Scene::ShowSky() const
 {
 	return m_showSky;
 }
 
-inline const Mesh *Scene::GetSceneMesh() const
+inline UINT Scene::GetNumObjects() const
+{
+	return static_cast<UINT> (m_objects.size());
+}
+
+inline const SceneObject &Scene::GetSceneObject(const UINT i) const
+{
+	_ASSERT(i < m_objects.size());
+
+	return m_objects[i];
+}
+
+inline UINT Scene::GetNumMeshes() const
+{
+	return static_cast<UINT> (m_meshes.size());
+}
+
+inline const MeshResidencyBudget &Scene::GetMeshResidency() const
+{
+	return m_meshResidency;
+}
+
+inline const Mesh *Scene::GetMesh(const UINT i) const
 {
 	_ASSERT(m_ready);
 
-	if(!m_ready) {
-		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Scene::GetSceneMesh");
+	if(!m_ready || i >= m_meshes.size()) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"Scene::GetMesh");
 		return NULL;
 	}
 
-	return m_sceneMesh;
+	return m_meshes[i];
+}
+
+inline UINT Scene::GetTotalGIVertices() const
+{
+	return m_totalGIVertices;
+}
+
+inline UINT Scene::GetSubsetBase(const UINT i) const
+{
+	_ASSERT(i < m_subsetBases.size());
+
+	return m_subsetBases[i];
+}
+
+inline UINT Scene::GetTotalSubsets() const
+{
+	return m_subsetBases.empty() ? 0 : m_subsetBases.back();
 }
 
 }
@@ -31,7 +31,7 @@ cbuffer cbPerMaterial
 
 cbuffer cpPerObject
 {
-	//matrix gWorld;                    // World matrix siempre la identidad
+	matrix gWorld;                      // World matrix del objeto (ver newobject en Scene)
 	matrix gWVP;                        // World * View * Projection matrix
 };
 
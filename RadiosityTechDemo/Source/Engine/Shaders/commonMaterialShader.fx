@@ -38,11 +38,11 @@ PS_INPUT VS( VS_INPUT input, in uint VertexID : SV_VertexID )
 {
     PS_INPUT output;
 
-	//posicin, tangente y normal necesitan estar en world space para iluminacin
-	//pero world es identidad de manera que solo copiamos
-	output.posW = input.posL;                 //mul(float4(input.posL, 1.0f), gWorld).xyz;
-	output.tangentW = input.tangentL;         //mul(float4(input.tangentL, 0.0f), gWorld).xyz;
-	output.normalW = input.normalL;	          //mul(float4(input.normalL, 0.0f), gWorld).xyz;
+	//posicin, tangente y normal necesitan estar en world space para iluminacin. World es una rotacin
+	//ms una traslacin, as que no hace falta la inversa transpuesta para la normal
+	output.posW = mul(float4(input.posL, 1.0f), gWorld).xyz;
+	output.tangentW = mul(float4(input.tangentL, 0.0f), gWorld).xyz;
+	output.normalW = mul(float4(input.normalL, 0.0f), gWorld).xyz;
 
 	//posicion a clip space para display
 	output.posH = mul(float4(input.posL, 1.0f), gWVP);
@@ -74,12 +74,13 @@ HRESULT ShadowMap::PrepareForRender()
 	return S_OK;
 }
 
-HRESULT ShadowMap::Render(const Scene &scene)
+HRESULT ShadowMap::Render(const Scene &scene, ID3DX11EffectMatrixVariable * const transform, const D3DXMATRIX &viewProjection, ID3DX11EffectPass * const pass,
+                          const bool cullClusters)
 {
 	HRESULT hr;
 
 	//dibujar la escena 
-	if(FAILED(hr = scene.DrawSceneMesh())) return hr;
+	if(FAILED(hr = scene.DrawSceneMesh(transform, viewProjection, pass, cullClusters))) return hr;
 
 	//restaurar estados del pipeline a lo que ya estaba
 	m_d3dManager.OMSetRenderTargets(1, m_oldRenderTargets, m_oldDepthStencilViews[0]);
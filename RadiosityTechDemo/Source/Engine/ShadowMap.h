@@ -45,7 +45,9 @@ public:
 protected:
 	HRESULT PrepareShaderAndDeviceStates(const wstring &shaderFile);
 	HRESULT PrepareForRender();
-	HRESULT Render(const Scene &scene);
+	//transform, viewProjection, pass y cullClusters: ver Scene::DrawSceneMesh
+	HRESULT Render(const Scene &scene, ID3DX11EffectMatrixVariable * const transform, const D3DXMATRIX &viewProjection, ID3DX11EffectPass * const pass,
+	               const bool cullClusters=true);
 
 protected:
 	const D3DDevicesManager &m_d3dManager;
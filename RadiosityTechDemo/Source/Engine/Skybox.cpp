@@ -15,18 +15,27 @@ const UINT Skybox::NUM_INDICES_SKYBOX = 6;
 
 
 Skybox::Skybox(const D3DDevicesManager &d3d)
-: m_d3dManager(d3d), m_skyTextureEffect(d3d), m_skyBoxEffect(d3d), m_inputLayouts(d3d), m_skyTexture(0), m_skyTextureLowRes(0),
+: m_d3dManager(d3d), m_skyTextureEffect(d3d), m_skyBoxEffect(d3d), m_inputLayouts(d3d), m_skyTextureRequests(0), m_skyTextureRenders(0),
 m_biasVariable(0), m_sunDirectionVariable(0), m_viewMatrixVariable(0), m_projMatrixVariable(0),
 m_technique(0), m_vertexBuffer(0), m_indexBuffer(0), m_skyTextureVariable(0), m_skyBoxTechnique(0), m_skyBoxVertexBuffer(0), m_skyBoxIndexBuffer(0),
 m_deviceStates(0), m_ready(false)
 {
-
+	m_skyTexture.texture = NULL;
+	m_skyTexture.lastUse = 0;
+	m_skyTexture.valid = false;
+
+	for(UINT i=0; i<LOW_RES_SKY_TEXTURES; ++i) {
+		m_skyTextureLowRes[i].texture = NULL;
+		m_skyTextureLowRes[i].lastUse = 0;
+		m_skyTextureLowRes[i].valid = false;
+	}
 }
 
 Skybox::~Skybox()
 {
-	SAFE_DELETE(m_skyTexture);
-	SAFE_DELETE(m_skyTextureLowRes);
+	SAFE_DELETE(m_skyTexture.texture);
+	for(UINT i=0; i<LOW_RES_SKY_TEXTURES; ++i)
+		SAFE_DELETE(m_skyTextureLowRes[i].texture);
 
 	SAFE_DELETE(m_deviceStates);
 
@@ -38,14 +47,25 @@ Skybox::~Skybox()
 
 HRESULT Skybox::CreateLowResTexture(const UINT width, const UINT height)
 {
-	SAFE_DELETE(m_skyTextureLowRes);
+	HRESULT hr;
 
-	if((m_skyTextureLowRes = new (std::nothrow) RenderableTexture(m_d3dManager)) == NULL) { 
-		MiscErrorWarning(BAD_ALLOC); 
-		return E_FAIL;
+	for(UINT i=0; i<LOW_RES_SKY_TEXTURES; ++i) 
+	{
+		CachedSkyTexture &cached = m_skyTextureLowRes[i];
+
+		SAFE_DELETE(cached.texture);
+		cached.lastUse = 0;
+		cached.valid = false;
+
+		if((cached.texture = new (std::nothrow) RenderableTexture(m_d3dManager)) == NULL) { 
+			MiscErrorWarning(BAD_ALLOC); 
+			return E_FAIL;
+		}
+
+		if(FAILED(hr = cached.texture->Init(width, height, false, 1.0f))) return hr;
 	}
 
-	return m_skyTextureLowRes->Init(width, height, false, 1.0f);
+	return S_OK;
 }
 
 HRESULT Skybox::Init()
@@ -64,9 +84,9 @@ HRESULT Skybox::Init()
 
 	try 
 	{
-		m_skyTexture = new RenderableTexture(m_d3dManager);
+		m_skyTexture.texture = new RenderableTexture(m_d3dManager);
 
-		if(FAILED(hr = m_skyTexture->Init(static_cast<UINT>(mainViewPort.Width), static_cast<UINT>(mainViewPort.Height), false, 1.0f))) return hr;
+		if(FAILED(hr = m_skyTexture.texture->Init(static_cast<UINT>(mainViewPort.Width), static_cast<UINT>(mainViewPort.Height), false, 1.0f))) return hr;
 
 		if(!FAILED(hr = m_skyTextureEffect.LoadPrecompiledShader(SKY_TEXTURE_EFFECT_FILE))) 
 		{
@@ -186,13 +206,19 @@ HRESULT Skybox::Render(const D3DXMATRIX &view, const D3DXMATRIX &projection, con
 		return E_FAIL;
 	}
 
-	if(useLowResTexture && !m_skyTextureLowRes) {
+	if(useLowResTexture && !m_skyTextureLowRes[0].texture) {
 		MiscErrorWarning(INVALID_PARAMETER, L"Skybox::Render");
 		return E_INVALIDARG;
 	}
 
 	HRESULT hr;
 
+	SkyTextureKey key;
+	MakeSkyTextureKey(view, projection, sunDir, bias, key);
+
+	bool generate;
+	CachedSkyTexture &skyTexture = FindSkyTexture(key, useLowResTexture, generate);
+
 	//0. Guardar los estados que venían seteados en el pipeline para restaurarlos luego de hacer el render skybox
 	UINT numViewports = 1;
 	D3D11_VIEWPORT oldViewports[1];
@@ -209,64 +235,67 @@ HRESULT Skybox::Render(const D3DXMATRIX &view, const D3DXMATRIX &projection, con
 	UINT oldStencilRef;
 	m_d3dManager.OMGetDepthStencilState(&oldDepthStencilState, &oldStencilRef);
 
-	// 1. Dibujamos el sky a una textura
-
-	//pipeline states
-	m_d3dManager.RSSetState( m_deviceStates->GetRasterizerState( DEVICE_STATE_RASTER_SOLID_CULLNONE ));
+	//pipeline states de los dos pasos
 	m_d3dManager.OMSetDepthStencilState( m_deviceStates->GetDepthStencilState( DEVICE_STATE_DEPTHSTENCIL_ENABLED_EQUAL_MASK_ZERO ), 0);
-	m_d3dManager.IASetInputLayout(m_inputLayouts.GetPositionOnlyInputLayout());
-
-	//vertex buffer
-	UINT stride = sizeof(D3DXVECTOR3);
-	UINT offset = 0;
-	ID3D11Buffer *tmpBuffer = m_vertexBuffer->GetBuffer();
-	m_d3dManager.IASetVertexBuffers(0, 1, &tmpBuffer, &stride, &offset);
-
-	//index buffer
-	m_d3dManager.IASetIndexBuffer(m_indexBuffer->GetBuffer(), DXGI_FORMAT_R16_UINT, 0);
-
-	//primitive topology
 	m_d3dManager.IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-	//actualizar valores de variables en el shader
-	HRESULT hr1, hr2, hr3, hr4;
-	hr1 = m_viewMatrixVariable->SetMatrix((float *) &view);
-	hr2 = m_projMatrixVariable->SetMatrix((float *) &projection);
-	hr3 = m_sunDirectionVariable->SetFloatVector((float *) &sunDir);
-	hr4 = m_biasVariable->SetFloatVector((float *) &bias);
+	UINT stride;
+	UINT offset;
+	ID3D11Buffer *tmpBuffer;
+
+	// 1. Dibujamos el sky a una textura, si la textura no tiene ya el cielo con estos parámetros
+	if(generate)
+	{
+		//pipeline states
+		m_d3dManager.RSSetState( m_deviceStates->GetRasterizerState( DEVICE_STATE_RASTER_SOLID_CULLNONE ));
+		m_d3dManager.IASetInputLayout(m_inputLayouts.GetPositionOnlyInputLayout());
+
+		//vertex buffer
+		stride = sizeof(D3DXVECTOR3);
+		offset = 0;
+		tmpBuffer = m_vertexBuffer->GetBuffer();
+		m_d3dManager.IASetVertexBuffers(0, 1, &tmpBuffer, &stride, &offset);
+
+		//index buffer
+		m_d3dManager.IASetIndexBuffer(m_indexBuffer->GetBuffer(), DXGI_FORMAT_R16_UINT, 0);
+
+		//actualizar valores de variables en el shader
+		HRESULT hr1, hr2, hr3, hr4;
+		hr1 = m_viewMatrixVariable->SetMatrix((float *) &view);
+		hr2 = m_projMatrixVariable->SetMatrix((float *) &projection);
+		hr3 = m_sunDirectionVariable->SetFloatVector((float *) &sunDir);
+		hr4 = m_biasVariable->SetFloatVector((float *) &bias);
 		
-	if(FAILED(hr1) || FAILED(hr2) || FAILED(hr3) || FAILED(hr4)) {
-		DXGI_D3D_ErrorWarning(E_FAIL, L"Skybox::Render --> Set Shader Variables");
-		SAFE_RELEASE(renderTargets[0]);
-		SAFE_RELEASE(depthStencilViews[0]);
-		SAFE_RELEASE(oldDepthStencilState);
-		SAFE_RELEASE(oldRasterizerState);
-		return E_FAIL;
-	}
+		if(FAILED(hr1) || FAILED(hr2) || FAILED(hr3) || FAILED(hr4)) {
+			DXGI_D3D_ErrorWarning(E_FAIL, L"Skybox::Render --> Set Shader Variables");
+			SAFE_RELEASE(renderTargets[0]);
+			SAFE_RELEASE(depthStencilViews[0]);
+			SAFE_RELEASE(oldDepthStencilState);
+			SAFE_RELEASE(oldRasterizerState);
+			return E_FAIL;
+		}
 
-	if(FAILED( hr = m_d3dManager.ApplyEffectPass(m_technique->GetPassByIndex(0), 0) )) {
-		SAFE_RELEASE(renderTargets[0]);
-		SAFE_RELEASE(depthStencilViews[0]);
-		SAFE_RELEASE(oldDepthStencilState);
-		SAFE_RELEASE(oldRasterizerState);
-		return hr;
-	}
+		if(FAILED( hr = m_d3dManager.ApplyEffectPass(m_technique->GetPassByIndex(0), 0) )) {
+			SAFE_RELEASE(renderTargets[0]);
+			SAFE_RELEASE(depthStencilViews[0]);
+			SAFE_RELEASE(oldDepthStencilState);
+			SAFE_RELEASE(oldRasterizerState);
+			return hr;
+		}
 
-	//textura que usaremos (si es GI usamos una más chica, pues primero renderizamos el sky texture y 
-	//luego lo usamos para el sky box pero las caras del hemicubo son sólo de 64x64)
-	if(useLowResTexture)
-		m_skyTextureLowRes->Begin();
-	else
-		m_skyTexture->Begin();
+		//textura que usaremos (si es GI usamos una más chica, pues primero renderizamos el sky texture y 
+		//luego lo usamos para el sky box pero las caras del hemicubo son sólo de 64x64)
+		skyTexture.texture->Begin();
 
-	//dibujar
-	m_d3dManager.DrawIndexed(NUM_INDICES, 0, 0);
+		//dibujar
+		m_d3dManager.DrawIndexed(NUM_INDICES, 0, 0);
 
-	if(useLowResTexture)
-		m_skyTextureLowRes->End();
-	else
-		m_skyTexture->End();
+		skyTexture.texture->End();
 
+		skyTexture.key = key;
+		skyTexture.valid = true;
+		++m_skyTextureRenders;
+	}
 
 	// 2. Ponemos la textura del sky a un quad que ocupa la mitad superior del render target que estaba seteado al llamar a esta función render
 
@@ -288,7 +317,7 @@ HRESULT Skybox::Render(const D3DXMATRIX &view, const D3DXMATRIX &projection, con
 	m_d3dManager.IASetIndexBuffer(m_skyBoxIndexBuffer->GetBuffer(), DXGI_FORMAT_R16_UINT, 0);
 	
 	//pasar textura
-	if(FAILED( hr = m_skyTextureVariable->SetResource( useLowResTexture ? m_skyTextureLowRes->GetColorTexture() : m_skyTexture->GetColorTexture() ))) {
+	if(FAILED( hr = m_skyTextureVariable->SetResource( skyTexture.texture->GetColorTexture() ))) {
 		DXGI_D3D_ErrorWarning(hr, L"Skybox::Render --> SetResource");
 		SAFE_RELEASE(renderTargets[0]);
 		SAFE_RELEASE(depthStencilViews[0]);
@@ -321,4 +350,120 @@ HRESULT Skybox::Render(const D3DXMATRIX &view, const D3DXMATRIX &projection, con
 	return hr;
 }
 
-}
\ No newline at end of file
+void Skybox::MakeSkyTextureKey(const D3DXMATRIX &view, const D3DXMATRIX &projection, const D3DXVECTOR3 &sunDir, const D3DXVECTOR3 &bias, 
+                               SkyTextureKey &key)
+{
+	//skyTexture.fx sólo usa (float3x3) gView
+	D3DXMatrixIdentity(&key.rotation);
+	for(UINT i=0; i<3; ++i)
+		for(UINT j=0; j<3; ++j)
+			key.rotation(i, j) = view(i, j);
+
+	key.projection = projection;
+	key.sunDirection = sunDir;
+	key.bias = bias;
+}
+
+Skybox::CachedSkyTexture &Skybox::FindSkyTexture(const SkyTextureKey &key, const bool lowRes, bool &generate)
+{
+	++m_skyTextureRequests;
+
+	CachedSkyTexture * const textures = lowRes ? m_skyTextureLowRes : &m_skyTexture;
+	const UINT numTextures = lowRes ? LOW_RES_SKY_TEXTURES : 1;
+
+	UINT oldest = 0;
+	for(UINT i=0; i<numTextures; ++i) 
+	{
+		if(textures[i].valid && memcmp(&textures[i].key, &key, sizeof(SkyTextureKey)) == 0) {
+			textures[i].lastUse = m_skyTextureRequests;
+			generate = false;
+			return textures[i];
+		}
+
+		if(!textures[i].valid || (textures[oldest].valid && textures[i].lastUse < textures[oldest].lastUse)) 
+			oldest = i;
+	}
+
+	//si la generación falla la textura no debe quedar válida con otros parámetros
+	textures[oldest].valid = false;
+	textures[oldest].lastUse = m_skyTextureRequests;
+	generate = true;
+
+	return textures[oldest];
+}
+
+//------------------------------------------------------------------------------------------
+// viewer y sunDirection deben estar normalizados. 
+// Ver http://www.cs.utah.edu/~shirley/papers/sunsky/sunsky.pdf Sección 2.3 Ecuación (1)
+//------------------------------------------------------------------------------------------
+D3DXVECTOR3 Skybox::CIEStandardSky(const D3DXVECTOR3 &viewer, const D3DXVECTOR3 &sunDirection)
+{
+	const float cosThetaS = std::min(std::max(sunDirection.y, -1.0f), 1.0f);
+	const float cosGamma = std::min(std::max(D3DXVec3Dot(&viewer, &sunDirection), -1.0f), 1.0f);
+	const float cosTheta = viewer.y;
+
+	//debajo del horizonte la luminancia es negativa y el shader la lleva a cero
+	if(cosTheta <= 0.0f) return D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+
+	const float gamma = acos(cosGamma);       //ángulo entre viewer y sun direction
+	const float thetaS = acos(cosThetaS);     //ángulo entre sunDirection y la normal
+
+	//luminancia
+	const float Yc = ( (0.91f + 10.0f * exp(-3.0f * gamma) + 0.45f * cosGamma * cosGamma) * (1.0f - exp(-0.32f / cosTheta)) )
+	                 / ( (0.91f + 10.0f * exp(-3.0f * thetaS) + 0.45f * cosThetaS * cosThetaS) * (1.0f - exp(-0.32f)) );
+
+	const float luminance = std::max(Yc, 0.0f);
+
+	return D3DXVECTOR3(0.25f * luminance, 0.65f * luminance, 1.0f * luminance);
+}
+
+SkyRadianceTable::SkyRadianceTable()
+: m_sunDirection(0.0f, 0.0f, 0.0f), m_bias(0.0f, 0.0f, 0.0f), m_valid(false)
+{
+
+}
+
+HRESULT SkyRadianceTable::Update(const D3DXVECTOR3 &sunDirection, const D3DXVECTOR3 &bias)
+{
+	if(m_valid && sunDirection == m_sunDirection && bias == m_bias) return S_OK;
+
+	m_valid = false;
+
+	try
+	{
+		m_radiance.resize(RESOLUTION * RESOLUTION);
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	//y mínima de las direcciones de la tabla: el cielo en el horizonte sin el corte a cero de y <= 0
+	static const float HORIZON_Y = 1.0e-3f;
+
+	for(UINT z=0; z<RESOLUTION; ++z) 
+	{
+		const float pz = z * 2.0f / (RESOLUTION - 1) - 1.0f;
+
+		for(UINT x=0; x<RESOLUTION; ++x) 
+		{
+			const float px = x * 2.0f / (RESOLUTION - 1) - 1.0f;
+
+			D3DXVECTOR3 direction(px, std::max(1.0f - fabs(px) - fabs(pz), HORIZON_Y), pz);
+			D3DXVec3Normalize(&direction, &direction);
+
+			const D3DXVECTOR3 sky = Skybox::CIEStandardSky(direction, sunDirection);
+
+			m_radiance[z * RESOLUTION + x] = D3DXVECTOR3(sky.x * bias.x, sky.y * bias.y, sky.z * bias.z);
+		}
+	}
+
+	m_sunDirection = sunDirection;
+	m_bias = bias;
+	m_valid = true;
+
+	return S_OK;
+}
+
+}
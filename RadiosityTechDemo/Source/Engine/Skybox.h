@@ -2,7 +2,9 @@
 // File: Skybox.h
 //
 // Esta clase permite renderizar un sky box con el modelo estándar del CIE. 
-// Ver Shaders/skyTexture.fx y Shaders/skyBox.fx.
+// Ver Shaders/skyTexture.fx y Shaders/skyBox.fx. La sky texture generada se guarda junto con
+// los parámetros que la definen (rotación de la cámara, proyección, sol y bias) y sólo se
+// vuelve a generar si alguno cambia. SkyRadianceTable es el equivalente para la CPU.
 //
 // Author: Gabriel Clavero
 //------------------------------------------------------------------------------------------
@@ -10,6 +12,8 @@
 #ifndef SKY_BOX_H
 #define SKY_BOX_H
 
+#include <algorithm>
+
 #include "Utility.h"
 #include "CompiledShader.h"
 #include "InputLayouts.h"
@@ -18,6 +22,8 @@
 #include "D3DDevicesManager.h"
 #include "D3D11Resources.h"
 
+using std::vector;
+
 namespace DTFramework
 {
 
@@ -32,13 +38,47 @@ public:
 
 	HRESULT Render(const D3DXMATRIX &view, const D3DXMATRIX &projection, const D3DXVECTOR3 &sunDir, const D3DXVECTOR3 bias = D3DXVECTOR3(1,1,1), const bool useLowResTexture=false);
 
-	//crear textura de diferente resolución que la del backbuffer, para renderizaciones más pequeñas
+	//crear texturas de diferente resolución que la del backbuffer, para renderizaciones más pequeñas (caras de los hemicubos)
 	HRESULT CreateLowResTexture(const UINT width, const UINT height);
+
+	//profiling: llamadas a Render y cuántas de ellas generaron la sky texture
+	UINT GetSkyTextureRequests() const;
+	UINT GetSkyTextureRenders() const;
+
+	//modelo estándar del CIE evaluado en la CPU. Misma fórmula que CIEStandardSky en Shaders/skyTexture.fx
+	static D3DXVECTOR3 CIEStandardSky(const D3DXVECTOR3 &viewer, const D3DXVECTOR3 &sunDirection);
 	
+private:
+	//parámetros con los que se generó una sky texture. De view sólo se usa la rotación (el cielo está en el infinito)
+	struct SkyTextureKey
+	{
+		D3DXMATRIX rotation;
+		D3DXMATRIX projection;
+		D3DXVECTOR3 sunDirection;
+		D3DXVECTOR3 bias;
+	};
+
+	struct CachedSkyTexture
+	{
+		RenderableTexture *texture;
+		SkyTextureKey key;
+		UINT lastUse;       //valor de m_skyTextureRequests en el último uso
+		bool valid;         //texture tiene el cielo de key
+	};
+
+	static void MakeSkyTextureKey(const D3DXMATRIX &view, const D3DXMATRIX &projection, const D3DXVECTOR3 &sunDir, const D3DXVECTOR3 &bias, 
+	                              SkyTextureKey &key);
+
+	//textura con el cielo de key. Si no hay ninguna, la usada hace más tiempo y generate = true (hay que renderizar el cielo en ella)
+	CachedSkyTexture &FindSkyTexture(const SkyTextureKey &key, const bool lowRes, bool &generate);
+
 private:
 	static const UINT NUM_INDICES;
 	static const UINT NUM_INDICES_SKYBOX;
 
+	//cada vértice del bake renderiza 5 caras con orientaciones distintas. Vértices vecinos de una superficie plana repiten las 5
+	static const UINT LOW_RES_SKY_TEXTURES = 8;
+
 	const D3DDevicesManager &m_d3dManager;
 
 	CompiledShader m_skyTextureEffect;
@@ -46,8 +86,11 @@ private:
 
 	InputLayouts m_inputLayouts;
 
-	RenderableTexture *m_skyTexture;
-	RenderableTexture *m_skyTextureLowRes;
+	CachedSkyTexture m_skyTexture;
+	CachedSkyTexture m_skyTextureLowRes[LOW_RES_SKY_TEXTURES];
+
+	UINT m_skyTextureRequests;
+	UINT m_skyTextureRenders;
 	
 	//skyTexture shader variables
 	ID3DX11EffectVectorVariable *m_biasVariable;
@@ -78,6 +121,68 @@ private:
 	bool m_ready;
 };
 
+inline UINT Skybox::GetSkyTextureRequests() const
+{
+	return m_skyTextureRequests;
+}
+
+inline UINT Skybox::GetSkyTextureRenders() const
+{
+	return m_skyTextureRenders;
+}
+
+//------------------------------------------------------------------------------------------
+// CIEStandardSky por un bias precalculado para una dirección del sol, para los algoritmos que
+// evalúan el cielo en muchas direcciones en la CPU sin acos ni exp por muestra. El hemisferio
+// superior se guarda con proyección octaédrica: la dirección (x, y, z) va al punto
+// (x, z) / (|x| + y + |z|) del cuadrado [-1, 1]^2, que se lee con interpolación bilineal.
+// Las esquinas del cuadrado (fuera del rombo del hemisferio) repiten el cielo del horizonte
+// para que la interpolación cerca del mismo no mezcle con ceros.
+//------------------------------------------------------------------------------------------
+class SkyRadianceTable
+{
+public:
+	SkyRadianceTable();
+
+	//recalcula la tabla sólo si cambió la dirección del sol (normalizada) o el bias
+	HRESULT Update(const D3DXVECTOR3 &sunDirection, const D3DXVECTOR3 &bias);
+
+	//direction normalizada. Cero debajo del horizonte, igual que CIEStandardSky
+	D3DXVECTOR3 Lookup(const D3DXVECTOR3 &direction) const;
+
+	static const UINT RESOLUTION = 512;     //lado de la tabla. Un texel cubre a lo sumo 0.4 grados
+
+	//cambiar si cambia el cálculo, la proyección o la interpolación de la tabla: forma parte de la clave del caché de GI
+	static const UINT VERSION = 1;
+
+private:
+	vector<D3DXVECTOR3> m_radiance;     //RESOLUTION x RESOLUTION, por filas de z
+	D3DXVECTOR3 m_sunDirection;
+	D3DXVECTOR3 m_bias;
+	bool m_valid;
+};
+
+inline D3DXVECTOR3 SkyRadianceTable::Lookup(const D3DXVECTOR3 &direction) const
+{
+	_ASSERT(m_valid);
+
+	if(direction.y <= 0.0f) return D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+
+	const float scale = 0.5f * (RESOLUTION - 1) / (fabs(direction.x) + direction.y + fabs(direction.z));
+	const float u = direction.x * scale + 0.5f * (RESOLUTION - 1);
+	const float v = direction.z * scale + 0.5f * (RESOLUTION - 1);
+
+	const UINT x = std::min(static_cast<UINT>(u), RESOLUTION - 2);
+	const UINT z = std::min(static_cast<UINT>(v), RESOLUTION - 2);
+	const float tx = u - x;
+	const float tz = v - z;
+
+	const D3DXVECTOR3 * const row0 = &m_radiance[z * RESOLUTION + x];
+	const D3DXVECTOR3 * const row1 = row0 + RESOLUTION;
+
+	return (row0[0] * (1.0f - tx) + row0[1] * tx) * (1.0f - tz) + (row1[0] * (1.0f - tx) + row1[1] * tx) * tz;
+}
+
 }
 
 #endif
\ No newline at end of file
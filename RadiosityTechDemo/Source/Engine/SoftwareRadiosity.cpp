@@ -0,0 +1,1416 @@
+﻿//------------------------------------------------------------------------------------------
+// File: SoftwareRadiosity.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "SoftwareRadiosity.h"
+
+namespace DTFramework
+{
+
+//definición de static member variables (mismos planos que la proyección de Radiosity::ProcessVertex)
+const float SoftwareRadiosity::HEMICUBE_Z_NEAR = 0.1f;
+const float SoftwareRadiosity::HEMICUBE_Z_FAR = 3500.0f;
+
+const float SoftwareRadiosity::DEFAULT_CONVERGENCE_TOLERANCE = 0.01f;
+
+//------------------------------------------------------------------------------------------
+// Ejes de vista de cada cara del hemicubo, expresados con las coordenadas locales del vértice
+// (tangente, bitangente, normal) = (0, 1, 2). Equivalente a Radiosity::VertexCameraMatrix.
+// Por ejemplo la cara +x (1) tiene x = -normal, y = bitangente, z = tangente.
+//------------------------------------------------------------------------------------------
+static const UINT FACE_AXES[5][3] = { {0, 1, 2}, {2, 1, 0}, {2, 1, 0}, {0, 2, 1}, {0, 2, 1} };
+static const float FACE_SIGNS[5][3] = { {1.0f, 1.0f, 1.0f}, {-1.0f, 1.0f, 1.0f}, {1.0f, 1.0f, -1.0f}, {1.0f, -1.0f, 1.0f}, {1.0f, 1.0f, -1.0f} };
+
+SoftwareRadiosity::SoftwareRadiosity(const D3DDevicesManager &d3d, const bool exportHemicubes, const bool enableProfiling, 
+                                     const UINT verticesBakedPerDispatch, const UINT numBounces, const UINT numThreads, const UINT hemicubeFaceSize, 
+                                     const bool reuseFormFactors, const RadiositySolver solver, const float convergenceTolerance, 
+                                     const float irradianceCacheError, const bool weldVertices)
+: 
+CPURadiosity(d3d, exportHemicubes, enableProfiling, verticesBakedPerDispatch, numBounces, numThreads, hemicubeFaceSize, false, irradianceCacheError, weldVertices),
+m_hemicubeAtlas(0), m_omniZNear(0), m_omniZFar(0), m_sunDirection(0.0f, 1.0f, 0.0f), m_reuseFormFactors(reuseFormFactors), 
+m_recordingFormFactors(false), m_formFactorsReady(false), m_formFactorsDiscarded(false), m_formFactorEntries(0), m_lastPassIrradiance(0), m_setupTime(0), 
+m_formFactorTime(0), m_solver(solver), m_convergenceTolerance(convergenceTolerance), m_progressiveSolved(false), m_progressiveShots(0)
+{
+
+}
+
+SoftwareRadiosity::~SoftwareRadiosity()
+{
+	for(UINT i=0; i<m_workspaces.size(); ++i)
+		SAFE_DELETE(m_workspaces[i]);
+
+	for(UINT i=0; i<m_shadowMaps.size(); ++i)
+		SAFE_DELETE(m_shadowMaps[i]);
+
+	if(m_hemicubeAtlas) _aligned_free(m_hemicubeAtlas);
+	if(m_lastPassIrradiance) _aligned_free(m_lastPassIrradiance);
+}
+
+HRESULT SoftwareRadiosity::InitResources()
+{
+	HRESULT hr;
+
+	//CPURadiosity::InitResources crea el thread pool, que define cuántos workspaces se necesitan
+	if(FAILED(hr = CPURadiosity::InitResources())) return hr;
+
+	//un rasterizador del tamaño de una cara por hilo
+	try 
+	{
+		m_workspaces.reserve(m_threadPool.GetNumThreads());
+		for(UINT i=0; i<m_threadPool.GetNumThreads(); ++i) 
+		{
+			Workspace *workspace = NULL;
+			if((workspace = new (std::nothrow) Workspace()) == NULL) {
+				MiscErrorWarning(BAD_ALLOC);
+				return E_FAIL;
+			}
+			m_workspaces.push_back(workspace);
+
+			if(FAILED(hr = workspace->rasterizer.Init(HEMICUBE_FACE_SIZE, HEMICUBE_FACE_SIZE))) return hr;
+		}
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// No se necesitan render targets de Direct3D. Los hemicubos se escriben en memoria de sistema
+// con el mismo formato que tendría la textura luego de copiarla a un staging texture.
+//------------------------------------------------------------------------------------------
+HRESULT SoftwareRadiosity::CreateHemicubeTargets()
+{
+	const size_t size = sizeof(float) * 4 * PARENT_HEMICUBES_TEXTURE_WIDTH * FACES_PER_COLUMN * HEMICUBE_FACE_SIZE;
+
+	if((m_hemicubeAtlas = (float *) _aligned_malloc(size, 16)) == NULL) {
+		MiscErrorWarning(BAD_ALIGNED_ALLOC);
+		return E_FAIL;
+	}
+
+	ZeroMemory(m_hemicubeAtlas, size);
+
+	return S_OK;
+}
+
+HRESULT SoftwareRadiosity::BakeGIData(Renderer &renderer, Scene &scene, Light &light)
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"SoftwareRadiosity::BakeGIData");
+		return E_FAIL;
+	}
+
+	if(scene.GetTotalGIVertices() <= 0) {
+		MiscErrorWarning(INVALID_PARAMETER, L"SoftwareRadiosity::BakeGIData");
+		return E_INVALIDARG;
+	}
+
+	HRESULT hr;
+
+	if(m_profiling) {
+		m_formFactorTime = 0;
+		m_timer.Update();
+	}
+
+	m_progressiveSolved = false;
+	m_residualHistory.clear();
+	m_progressiveShots = 0;
+
+	if(FAILED(hr = PrepareSceneData(scene, light))) return hr;
+
+	if(m_profiling) {
+		m_timer.Update();
+		m_setupTime = m_timer.GetTimeElapsed();
+	}
+
+	if(FAILED(hr = CPURadiosity::BakeGIData(renderer, scene, light))) return hr;
+
+	if(m_profiling) {
+		m_outputFile << "Software Rasterizer Threads:\t\t\t\t\t" << m_threadPool.GetNumThreads() << endl;
+		m_outputFile << "Software Scene Setup Time:\t\t\t\t\t" << m_setupTime << " seconds." << endl;
+
+		if(m_formFactorsReady) {
+			m_outputFile << "Form Factor Matrix Entries:\t\t\t\t\t" << m_formFactorEntries << " (" 
+			             << (m_formFactorEntries * sizeof(FormFactorEntry)) / (1024.0 * 1024.0) << " MB, " 
+			             << m_formFactorEntries / (double) max((UINT) 1, GetNumBakedVertices()) << " per rendered vertex)" << endl;
+			m_outputFile << (m_progressiveSolved ? "Progressive Solver Time:\t\t\t\t\t" : "Form Factor Passes Time:\t\t\t\t\t") 
+			             << m_formFactorTime << " seconds." << endl;
+		}
+
+		if(m_progressiveSolved) {
+			const bool converged = !m_residualHistory.empty() && m_residualHistory.back() <= m_convergenceTolerance;
+
+			m_outputFile << "Progressive Solver Shots:\t\t\t\t\t" << m_progressiveShots << " (" << (converged ? "converged" : "not converged") 
+			             << ", tolerance " << m_convergenceTolerance << ")" << endl;
+
+			//una línea por barrida (un disparo por vértice renderizado) y la última
+			for(UINT i=0; i<m_residualHistory.size(); ++i)
+				m_outputFile << "Progressive Solver Residual Energy " << i << ":\t\t\t\t" << m_residualHistory[i] << endl;
+		}
+		else if(m_formFactorsDiscarded) {
+			m_outputFile << "Form Factor Matrix:\t\t\t\t\t\tdiscarded (more than " << MAX_FORM_FACTOR_ENTRIES << " entries)" << endl;
+		}
+	}
+
+	return S_OK;
+}
+
+HRESULT SoftwareRadiosity::ProcessScene(Renderer &renderer, Scene &scene, Light &light, const UINT pass)
+{
+	HRESULT hr;
+
+	//el solver progresivo ya distribuyó la energía de todos los rebotes
+	if(m_progressiveSolved)
+		return S_OK;
+
+	//desde el segundo rebote la radiancia de los hemicubos es el difuso por la irradiancia interpolada de la pasada anterior
+	if(pass >= 2 && m_formFactorsReady)
+		return ApplyFormFactors();
+
+	//la primera pasada iluminada tiene la misma visibilidad que las siguientes. Se guardan sus form factors si habrá más pasadas
+	//o si los usará el solver progresivo
+	const UINT lastPass = scene.ShowSky() ? PASSES - 1 : PASSES;
+	const bool progressive = m_solver == RADIOSITY_SOLVER_PROGRESSIVE;
+	m_recordingFormFactors = pass == 1 && (progressive || (lastPass >= 2 && m_reuseFormFactors)) && !m_exportHemicubes && !m_formFactorsDiscarded;
+
+	if(m_recordingFormFactors) 
+	{
+		try 
+		{
+			m_formFactors.clear();
+			m_formFactorRowOffsets.assign(1, 0);
+			m_formFactorRowOffsets.reserve(m_vertices.size() + 1);
+			m_batchRows.resize(VERTICES_BAKED_PER_DISPATCH);
+
+			for(UINT i=0; i<m_workspaces.size(); ++i) {
+				m_workspaces[i]->entryOfVertex.assign(m_positionX.size(), NO_FORM_FACTOR_ENTRY);
+				m_workspaces[i]->formFactorsFailed = false;
+			}
+		}
+		catch (std::bad_alloc &) 
+		{
+			DiscardFormFactors();
+		}
+	}
+
+	//la iluminación de los vértices sólo cambia entre pasadas
+	PrepareVertexShading(light, pass);
+
+	if(FAILED(hr = CPURadiosity::ProcessScene(renderer, scene, light, pass))) return hr;
+
+	if(m_recordingFormFactors) {
+		m_recordingFormFactors = false;
+		m_formFactorsReady = true;
+		m_formFactorEntries = m_formFactors.size();
+
+		if(progressive) {
+			if(FAILED(hr = SolveProgressive())) return hr;
+		}
+	}
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// Renderización de los hemicubos de los VERTICES_BAKED_PER_DISPATCH vértices (o el resto si
+// es menor) comenzando desde el vértice con id vertexId. Cada hilo renderiza hemicubos 
+// completos y los copia a su lugar en m_hemicubeAtlas. Luego se integra igual que en CPURadiosity.
+//------------------------------------------------------------------------------------------
+HRESULT SoftwareRadiosity::ProcessVertex(Renderer &renderer, Scene &scene, Light &light, const UINT pass, const UINT vertexId)
+{
+	if(m_profiling)
+		m_timer.Update();
+
+	const UINT verticesBaked = min(VERTICES_BAKED_PER_DISPATCH, GetNumBakedVertices() - vertexId);
+
+	m_threadPool.ParallelFor(verticesBaked, [&](const UINT i, const UINT thread) {
+		Workspace &workspace = *(m_workspaces[thread]);
+		const UINT begin = static_cast<UINT>(workspace.formFactors.size());
+
+		RenderHemicube(GetBakedVertex(vertexId + i), i, pass, workspace);
+
+		if(m_recordingFormFactors) {
+			const FormFactorRow row = { &workspace, begin, static_cast<UINT>(workspace.formFactors.size()) - begin };
+			m_batchRows[i] = row;
+		}
+	});
+
+	if(m_recordingFormFactors)
+		AppendFormFactorRows(verticesBaked);
+
+	if(m_profiling) {
+		m_timer.Update();
+		m_hemicubeRenderingTime += m_timer.GetTimeElapsed();
+	}
+
+	if(m_exportHemicubes)
+		ExportHemicubeFaces(m_hemicubeAtlas, vertexId, pass);
+
+	IntegrateHemicubes(m_hemicubeAtlas, PARENT_HEMICUBES_TEXTURE_WIDTH * 4 * sizeof(float), vertexId, verticesBaked);
+
+	return S_OK;
+}
+
+HRESULT SoftwareRadiosity::PrepareSceneData(const Scene &scene, const Light &light)
+{
+	HRESULT hr;
+
+	//los vértices quedan en el mismo orden que los vértices GI y cada triángulo con el índice de su RasterMaterial
+	vector<Vertex> vertices;
+	if(FAILED(hr = scene.GetSceneGeometry(vertices, m_indices, &m_triangleMaterials))) return hr;
+
+	const UINT numVertices = static_cast<UINT>(vertices.size());
+
+	try 
+	{
+		m_positionX.resize(numVertices);
+		m_positionY.resize(numVertices);
+		m_positionZ.resize(numVertices);
+		m_normals.resize(numVertices);
+
+		for(UINT i=0; i<numVertices; ++i) {
+			m_positionX[i] = vertices[i].position.x;
+			m_positionY[i] = vertices[i].position.y;
+			m_positionZ[i] = vertices[i].position.z;
+
+			D3DXVec3Normalize(&m_normals[i], &(vertices[i].normal));
+		}
+
+		for(UINT i=0; i<RasterVertices::NUM_ATTRIBUTES; ++i)
+			m_shading[i].assign(numVertices, 0.0f);
+
+		m_directDiffuse.assign(numVertices, 0.0f);
+		m_directAmbient.assign(numVertices, 0.0f);
+
+		for(UINT i=0; i<m_workspaces.size(); ++i) {
+			Workspace &workspace = *(m_workspaces[i]);
+
+			workspace.localX.resize(numVertices);
+			workspace.localY.resize(numVertices);
+			workspace.localZ.resize(numVertices);
+			workspace.clipX.resize(numVertices);
+			workspace.clipY.resize(numVertices);
+			workspace.clipZ.resize(numVertices);
+			workspace.clipW.resize(numVertices);
+			workspace.outcodes.resize(numVertices);
+		}
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+	catch (std::length_error &) 
+	{
+		MiscErrorWarning(LENGTH_ERROR);
+		return E_FAIL;
+	}
+
+	if(FAILED(hr = PrepareMaterials(scene, light))) return hr;
+
+	//dirección del sol igual que en Renderer::RenderSkyAndSun
+	m_sunDirection = light.GetDirection() - light.GetPosition();
+	D3DXVec3Normalize(&m_sunDirection, &m_sunDirection);
+
+	//sólo se recalcula si el sol cambió desde el último bake
+	if(FAILED(hr = m_skyTable.Update(m_sunDirection, Renderer::SKY_COLOR_BIAS))) return hr;
+
+	if(FAILED(hr = ComputeDirectLighting(light))) return hr;
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// Un RasterMaterial por subset de cada mesh (Scene::GetSubsetBase), compartido por todos los
+// objetos que la usan. Se combinan las constantes del material, el color promedio de su textura
+// difusa y el color ambiental de la luz, igual que en el pixel shader de commonMaterialShader.fx:
+// ((GI * Kd + lit) * tex) con lit = Kd * difusa + Ka * ambiental.
+//------------------------------------------------------------------------------------------
+HRESULT SoftwareRadiosity::PrepareMaterials(const Scene &scene, const Light &light)
+{
+	HRESULT hr;
+
+	const LightProperties &lightProperties = light.GetProperties();
+
+	try 
+	{
+		m_materials.resize(scene.GetTotalSubsets());
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	for(UINT m=0; m<scene.GetNumMeshes(); ++m) 
+	{
+		const Mesh * const mesh = scene.GetMesh(m);
+		if(!mesh) return E_FAIL;
+
+		for(UINT i=0; i<mesh->GetAttributeTableEntries(); ++i) 
+		{
+			const Material * const material = mesh->GetSubsetMaterial(i);
+
+			if(!material) return E_FAIL;
+
+			D3DXVECTOR3 textureColor;
+			if(FAILED(hr = ComputeAverageTextureColor(material->GetDiffuseTextureSRV(), textureColor))) return hr;
+
+			const MaterialLightProperties &properties = material->GetLightProperties();
+
+			RasterMaterial &rasterMaterial = m_materials[scene.GetSubsetBase(m) + i];
+
+			rasterMaterial.diffuse[0] = properties.diffuse.x * textureColor.x;
+			rasterMaterial.diffuse[1] = properties.diffuse.y * textureColor.y;
+			rasterMaterial.diffuse[2] = properties.diffuse.z * textureColor.z;
+
+			rasterMaterial.ambient[0] = properties.ambient.x * lightProperties.ambient.r * textureColor.x;
+			rasterMaterial.ambient[1] = properties.ambient.y * lightProperties.ambient.g * textureColor.y;
+			rasterMaterial.ambient[2] = properties.ambient.z * lightProperties.ambient.b * textureColor.z;
+
+			rasterMaterial.transparent = material->GetAlpha() < Scene::GetTransparencyBoundary();
+		}
+	}
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// Color promedio de una textura. Se lee el último nivel de mipmap (1x1 si la textura tiene la
+// cadena completa). Los formatos no soportados (por ejemplo los comprimidos) devuelven blanco,
+// es decir que el material usa sólo su color difuso.
+//------------------------------------------------------------------------------------------
+HRESULT SoftwareRadiosity::ComputeAverageTextureColor(ID3D11ShaderResourceView *srv, D3DXVECTOR3 &color) const
+{
+	color = D3DXVECTOR3(1.0f, 1.0f, 1.0f);
+
+	if(!srv) return S_OK;
+
+	HRESULT hr;
+
+	ID3D11Resource *pRes = NULL;
+	srv->GetResource(&pRes);
+
+	if(!pRes) return S_OK;
+
+	D3D11_RESOURCE_DIMENSION dimension;
+	pRes->GetType(&dimension);
+
+	if(dimension != D3D11_RESOURCE_DIMENSION_TEXTURE2D) {
+		SAFE_RELEASE(pRes);
+		return S_OK;
+	}
+
+	D3D11_TEXTURE2D_DESC desc;
+	static_cast<ID3D11Texture2D *>(pRes)->GetDesc(&desc);
+
+	bool bgra = false, srgb = false, floatFormat = false;
+
+	switch(desc.Format) 
+	{
+		case DXGI_FORMAT_R8G8B8A8_UNORM:                                break;
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:   srgb = true;            break;
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+		case DXGI_FORMAT_B8G8R8X8_UNORM:        bgra = true;            break;
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:   bgra = srgb = true;     break;
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:    floatFormat = true;     break;
+		default:
+			SAFE_RELEASE(pRes);
+			return S_OK;
+	}
+
+	const UINT mip = desc.MipLevels - 1;
+	const UINT width = max(desc.Width >> mip, (UINT) 1);
+	const UINT height = max(desc.Height >> mip, (UINT) 1);
+
+	StagingTexture stagingTex(m_d3dManager, width, height, desc.Format);
+	if(FAILED(hr = stagingTex.Init())) {
+		SAFE_RELEASE(pRes);
+		return hr;
+	}
+
+	m_d3dManager.CopySubresourceRegion(stagingTex.GetTexture(), 0, 0, 0, 0, pRes, D3D11CalcSubresource(mip, 0, desc.MipLevels), NULL);
+
+	SAFE_RELEASE(pRes);
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if(FAILED(hr = m_d3dManager.Map(stagingTex.GetTexture(), 0, D3D11_MAP_READ, 0, &mapped))) return hr;
+
+	double sum[3] = { 0, 0, 0 };
+
+	for(UINT y=0; y<height; ++y) 
+	{
+		const unsigned char * const row = reinterpret_cast<const unsigned char *>(mapped.pData) + y * mapped.RowPitch;
+
+		for(UINT x=0; x<width; ++x) 
+		{
+			float texel[3];
+
+			if(floatFormat) {
+				const float * const p = reinterpret_cast<const float *>(row) + x * 4;
+				texel[0] = p[0]; texel[1] = p[1]; texel[2] = p[2];
+			}
+			else {
+				const unsigned char * const p = row + x * 4;
+				texel[0] = p[bgra ? 2 : 0] / 255.0f;
+				texel[1] = p[1] / 255.0f;
+				texel[2] = p[bgra ? 0 : 2] / 255.0f;
+
+				//el sampler devuelve valores lineales para formatos sRGB
+				if(srgb) {
+					for(UINT c=0; c<3; ++c)
+						texel[c] = pow(texel[c], 2.2f);
+				}
+			}
+
+			sum[0] += texel[0];
+			sum[1] += texel[1];
+			sum[2] += texel[2];
+		}
+	}
+
+	m_d3dManager.Unmap(stagingTex.GetTexture(), 0);
+
+	const double texels = (double) width * height;
+	color = D3DXVECTOR3((float) (sum[0] / texels), (float) (sum[1] / texels), (float) (sum[2] / texels));
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// La luz no se mueve durante el cálculo así que la iluminación directa de cada vértice 
+// (incluyendo sombras y atenuación) se calcula una sola vez. Las sombras usan shadow maps 
+// renderizados por software: uno para luces direccionales y un cubo para point lights.
+//------------------------------------------------------------------------------------------
+HRESULT SoftwareRadiosity::ComputeDirectLighting(const Light &light)
+{
+	const bool directional = light.GetType() == DIRECTIONAL_LIGHT;
+	const UINT numViews = directional ? 1 : 6;
+	const UINT mapSize = directional ? SHADOW_MAP_SIZE : OMNI_SHADOW_MAP_SIZE;
+
+	try 
+	{
+		m_shadowViewProjections.clear();
+
+		if(directional) {
+			m_shadowViewProjections.push_back(light.GetViewProjectionMatrix());
+		}
+		else {
+			m_omniZFar = light.GetRange();
+			m_omniZNear = max(m_omniZFar * 0.001f, 0.01f);
+
+			D3DXMATRIX projection;
+			D3DXMatrixPerspectiveFovLH(&projection, static_cast<float> (D3DX_PI) / 2.0f, 1.0f, m_omniZNear, m_omniZFar);
+
+			//+x, -x, +y, -y, +z, -z
+			const D3DXVECTOR3 directions[6] = { D3DXVECTOR3(1,0,0), D3DXVECTOR3(-1,0,0), D3DXVECTOR3(0,1,0), D3DXVECTOR3(0,-1,0), D3DXVECTOR3(0,0,1), D3DXVECTOR3(0,0,-1) };
+			const D3DXVECTOR3 ups[6] = { D3DXVECTOR3(0,1,0), D3DXVECTOR3(0,1,0), D3DXVECTOR3(0,0,-1), D3DXVECTOR3(0,0,1), D3DXVECTOR3(0,1,0), D3DXVECTOR3(0,1,0) };
+
+			for(UINT i=0; i<6; ++i) {
+				const D3DXVECTOR3 target = light.GetPosition() + directions[i];
+
+				D3DXMATRIX view;
+				D3DXMatrixLookAtLH(&view, &(light.GetPosition()), &target, &ups[i]);
+				m_shadowViewProjections.push_back(view * projection);
+			}
+		}
+
+		//los shadow maps se crean la primera vez o cuando cambia el tipo de luz
+		if(m_shadowMaps.size() != numViews || m_shadowMaps[0]->GetWidth() != mapSize) 
+		{
+			for(UINT i=0; i<m_shadowMaps.size(); ++i)
+				SAFE_DELETE(m_shadowMaps[i]);
+			m_shadowMaps.clear();
+
+			for(UINT i=0; i<numViews; ++i) {
+				SoftwareRasterizer *shadowMap = NULL;
+				if((shadowMap = new (std::nothrow) SoftwareRasterizer()) == NULL) {
+					MiscErrorWarning(BAD_ALLOC);
+					return E_FAIL;
+				}
+				m_shadowMaps.push_back(shadowMap);
+
+				HRESULT hr;
+				if(FAILED(hr = shadowMap->Init(mapSize, mapSize))) return hr;
+			}
+		}
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	m_threadPool.ParallelFor(numViews, [&](const UINT view, const UINT thread) {
+		RenderShadowMap(view, *(m_workspaces[thread]));
+	});
+
+	//factores de iluminación directa por vértice. Ver DirectionalLight y PointLight en lights.fx
+	const LightProperties &properties = light.GetProperties();
+	const UINT numVertices = static_cast<UINT>(m_positionX.size());
+	const UINT VERTICES_PER_TASK = 1024;
+
+	m_threadPool.ParallelFor((numVertices + VERTICES_PER_TASK - 1) / VERTICES_PER_TASK, [&](const UINT task, const UINT thread) 
+	{
+		const UINT last = min(numVertices, (task + 1) * VERTICES_PER_TASK);
+
+		for(UINT i=task * VERTICES_PER_TASK; i<last; ++i) 
+		{
+			const D3DXVECTOR3 position(m_positionX[i], m_positionY[i], m_positionZ[i]);
+
+			float diffuse = 0.0f;
+			float ambient = 0.0f;
+
+			if(directional) 
+			{
+				if(light.IsOn()) {
+					D3DXVECTOR3 lightVec = properties.pos - properties.dir;
+					D3DXVec3Normalize(&lightVec, &lightVec);
+
+					const float diffuseFactor = max(0.0f, D3DXVec3Dot(&m_normals[i], &lightVec));
+
+					diffuse = diffuseFactor > 0.0f ? diffuseFactor * ComputeShadowFactor(light, position) : 0.0f;
+					ambient = 1.0f;
+				}
+			}
+			else 
+			{
+				D3DXVECTOR3 lightVec = properties.pos - position;
+				const float d = D3DXVec3Length(&lightVec);
+
+				//fuera del rango sólo hay color ambiental (sin atenuar)
+				if(d > properties.range) {
+					ambient = 1.0f;
+				}
+				else if(light.IsOn()) {
+					lightVec /= max(d, 1e-6f);
+
+					const float diffuseFactor = max(0.0f, D3DXVec3Dot(&m_normals[i], &lightVec));
+					const D3DXVECTOR3 distances(1.0f, d / 256.0f, d * d);
+					const float attenuation = D3DXVec3Dot(&(properties.att), &distances);
+
+					diffuse = diffuseFactor > 0.0f ? diffuseFactor * ComputeShadowFactor(light, position) / attenuation : 0.0f;
+					ambient = 1.0f / attenuation;
+				}
+			}
+
+			m_directDiffuse[i] = diffuse;
+			m_directAmbient[i] = ambient;
+		}
+	});
+
+	return S_OK;
+}
+
+void SoftwareRadiosity::RenderShadowMap(const UINT view, Workspace &workspace)
+{
+	const D3DXMATRIX &m = m_shadowViewProjections[view];
+	const UINT numVertices = static_cast<UINT>(m_positionX.size());
+
+	for(UINT i=0; i<numVertices; ++i) {
+		const float x = m_positionX[i], y = m_positionY[i], z = m_positionZ[i];
+
+		workspace.clipX[i] = x * m._11 + y * m._21 + z * m._31 + m._41;
+		workspace.clipY[i] = x * m._12 + y * m._22 + z * m._32 + m._42;
+		workspace.clipZ[i] = x * m._13 + y * m._23 + z * m._33 + m._43;
+		workspace.clipW[i] = x * m._14 + y * m._24 + z * m._34 + m._44;
+	}
+
+	SoftwareRasterizer &shadowMap = *(m_shadowMaps[view]);
+
+	const RasterVertices vertices = GetRasterVertices(workspace, false);
+
+	//los materiales transparentes no proyectan sombra (igual que Scene::DrawSceneMesh)
+	shadowMap.Clear();
+	shadowMap.ComputeOutcodes(vertices, numVertices, &(workspace.outcodes[0]));
+	shadowMap.DrawTriangles(vertices, &m_indices[0], static_cast<UINT>(m_indices.size() / 3), &m_triangleMaterials[0], &m_materials[0], 
+	                        RASTER_DEPTH_ONLY | RASTER_SKIP_TRANSPARENT);
+}
+
+//------------------------------------------------------------------------------------------
+// PCF de 4x4 texels como en shadowFunctions.fx. Para luces direccionales se compara la 
+// profundidad en NDC menos el bias de la luz. Para point lights se compara la distancia en
+// view space de la cara del cubo correspondiente.
+//------------------------------------------------------------------------------------------
+float SoftwareRadiosity::ComputeShadowFactor(const Light &light, const D3DXVECTOR3 &position) const
+{
+	const bool directional = light.GetType() == DIRECTIONAL_LIGHT;
+
+	UINT view = 0;
+	if(!directional) {
+		const D3DXVECTOR3 d = position - light.GetPosition();
+		const float ax = fabs(d.x), ay = fabs(d.y), az = fabs(d.z);
+
+		if(ax >= ay && ax >= az) view = d.x >= 0.0f ? 0 : 1;
+		else if(ay >= az)        view = d.y >= 0.0f ? 2 : 3;
+		else                     view = d.z >= 0.0f ? 4 : 5;
+	}
+
+	D3DXVECTOR4 clip;
+	D3DXVec3Transform(&clip, &position, &m_shadowViewProjections[view]);
+
+	if(clip.w <= 0.0f) return 0.0f;
+
+	const float ndcX = clip.x / clip.w;
+	const float ndcY = clip.y / clip.w;
+	const float ndcZ = clip.z / clip.w;
+
+	//puntos fuera del volumen de la luz estan en sombra
+	if(directional && (ndcX < -1.0f || ndcX > 1.0f || ndcY < -1.0f || ndcY > 1.0f || ndcZ < 0.0f || ndcZ > 1.0f)) 
+		return 0.0f;
+
+	const SoftwareRasterizer &shadowMap = *(m_shadowMaps[view]);
+	const int size = static_cast<int>(shadowMap.GetWidth());
+	const float * const depth = shadowMap.GetDepthBuffer();
+
+	const float u = (0.5f * ndcX + 0.5f) * size;
+	const float v = (0.5f - 0.5f * ndcY) * size;
+
+	const int firstX = static_cast<int>(floor(u - 0.5f)) - 1;
+	const int firstY = static_cast<int>(floor(v - 0.5f)) - 1;
+
+	const float reference = directional ? ndcZ - light.GetShadowMapBias() : clip.w;
+
+	float sum = 0.0f;
+	for(int y=firstY; y<firstY+4; ++y) {
+		for(int x=firstX; x<firstX+4; ++x) {
+			const int tx = min(max(x, 0), size - 1);
+			const int ty = min(max(y, 0), size - 1);
+
+			const float storedDepth = depth[ty * shadowMap.GetPitch() + tx];
+
+			if(directional) {
+				if(reference <= storedDepth) sum += 1.0f;
+			}
+			else {
+				//profundidad en view space a partir del valor z/w del depth buffer. 1% de tolerancia como bias
+				const float n = m_omniZNear, f = m_omniZFar;
+				const float storedDistance = n * f / (f - storedDepth * (f - n));
+
+				if(reference <= storedDistance * 1.01f) sum += 1.0f;
+			}
+		}
+	}
+
+	return sum / 16.0f;
+}
+
+//------------------------------------------------------------------------------------------
+// Atributos por vértice de la pasada. Ver RasterMaterial:
+//   (a0, a1, a2) = irradiancia de la pasada anterior + luz difusa directa (sólo en la pasada 1)
+//   a3 = factor de la luz ambiental (sólo en la pasada 1)
+//------------------------------------------------------------------------------------------
+void SoftwareRadiosity::PrepareVertexShading(const Light &light, const UINT pass)
+{
+	const bool useGI = pass > 0 && m_lastPassGIDataSRV != NULL;
+	const bool directLight = pass == 1;
+
+	const D3DXCOLOR &lightDiffuse = light.GetProperties().diffuse;
+	const float diffuseColor[3] = { lightDiffuse.r, lightDiffuse.g, lightDiffuse.b };
+
+	const UINT numVertices = static_cast<UINT>(m_positionX.size());
+
+	for(UINT i=0; i<numVertices; ++i) 
+	{
+		const float * const gi = useGI ? reinterpret_cast<const float *>(&m_currentPassCpuGIData[i]) : NULL;
+
+		for(UINT c=0; c<3; ++c)
+			m_shading[c][i] = (gi ? gi[c] : 0.0f) + (directLight ? diffuseColor[c] * m_directDiffuse[i] : 0.0f);
+
+		m_shading[3][i] = directLight ? m_directAmbient[i] : 0.0f;
+	}
+}
+
+RasterVertices SoftwareRadiosity::GetRasterVertices(const Workspace &workspace, const bool withShading) const
+{
+	RasterVertices vertices;
+
+	vertices.x = &(workspace.clipX[0]);
+	vertices.y = &(workspace.clipY[0]);
+	vertices.z = &(workspace.clipZ[0]);
+	vertices.w = &(workspace.clipW[0]);
+
+	for(UINT i=0; i<RasterVertices::NUM_ATTRIBUTES; ++i)
+		vertices.attributes[i] = withShading ? &(m_shading[i][0]) : NULL;
+
+	vertices.outcodes = &(workspace.outcodes[0]);
+
+	return vertices;
+}
+
+//------------------------------------------------------------------------------------------
+// Renderiza las 5 caras del hemicubo del vértice vertex en el lugar slot del atlas. Las
+// posiciones de la escena se pasan una vez al espacio local del vértice. Cada cara es una
+// permutación de esos ejes seguida de la proyección de 90 grados.
+//------------------------------------------------------------------------------------------
+void SoftwareRadiosity::RenderHemicube(const UINT vertex, const UINT slot, const UINT pass, Workspace &workspace) const
+{
+	const GIVertex &giVertex = m_vertices[vertex];
+	const UINT numVertices = static_cast<UINT>(m_positionX.size());
+	const UINT numTriangles = static_cast<UINT>(m_indices.size() / 3);
+	const UINT rowBegin = static_cast<UINT>(workspace.formFactors.size());
+
+	//espacio local del vértice: (p - posición) · (tangente, bitangente, normal)
+	{
+		const __m128 originX = _mm_set1_ps(giVertex.position.x);
+		const __m128 originY = _mm_set1_ps(giVertex.position.y);
+		const __m128 originZ = _mm_set1_ps(giVertex.position.z);
+
+		const D3DXVECTOR3 * const axes[3] = { &giVertex.tangent, &giVertex.bitangent, &giVertex.normal };
+		float * const outputs[3] = { &workspace.localX[0], &workspace.localY[0], &workspace.localZ[0] };
+
+		UINT i = 0;
+		for(; i + 4 <= numVertices; i += 4) 
+		{
+			const __m128 dx = _mm_sub_ps(_mm_loadu_ps(&m_positionX[i]), originX);
+			const __m128 dy = _mm_sub_ps(_mm_loadu_ps(&m_positionY[i]), originY);
+			const __m128 dz = _mm_sub_ps(_mm_loadu_ps(&m_positionZ[i]), originZ);
+
+			for(UINT a=0; a<3; ++a) {
+				const __m128 l = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_set1_ps(axes[a]->x)), _mm_mul_ps(dy, _mm_set1_ps(axes[a]->y))), 
+				                            _mm_mul_ps(dz, _mm_set1_ps(axes[a]->z)));
+				_mm_storeu_ps(outputs[a] + i, l);
+			}
+		}
+		for(; i < numVertices; ++i) 
+		{
+			const float dx = m_positionX[i] - giVertex.position.x;
+			const float dy = m_positionY[i] - giVertex.position.y;
+			const float dz = m_positionZ[i] - giVertex.position.z;
+
+			for(UINT a=0; a<3; ++a)
+				outputs[a][i] = dx * axes[a]->x + dy * axes[a]->y + dz * axes[a]->z;
+		}
+	}
+
+	const float * const local[3] = { &workspace.localX[0], &workspace.localY[0], &workspace.localZ[0] };
+
+	//proyección D3DXMatrixPerspectiveFovLH(PI/2, 1, near, far)
+	const float projA = HEMICUBE_Z_FAR / (HEMICUBE_Z_FAR - HEMICUBE_Z_NEAR);
+	const float projB = -HEMICUBE_Z_NEAR * HEMICUBE_Z_FAR / (HEMICUBE_Z_FAR - HEMICUBE_Z_NEAR);
+
+	//primer bounce => geometría negra (sin materiales transparentes) y cielo. Luego => geometría iluminada
+	UINT flags;
+	if(pass == 0)
+		flags = RASTER_DEPTH_ONLY | RASTER_SKIP_TRANSPARENT;
+	else
+		flags = RASTER_CULL_BACK | (m_lastPassGIDataSRV != NULL ? RASTER_SATURATE : 0) | (m_recordingFormFactors ? RASTER_TRIANGLE_IDS : 0);
+
+	SoftwareRasterizer &rasterizer = workspace.rasterizer;
+	const RasterVertices vertices = GetRasterVertices(workspace, pass > 0);
+
+	for(UINT face=0; face<NUM_HEMICUBE_FACES; ++face) 
+	{
+		const float * const srcX = local[FACE_AXES[face][0]];
+		const float * const srcY = local[FACE_AXES[face][1]];
+		const float * const srcZ = local[FACE_AXES[face][2]];
+
+		const __m128 signX = _mm_set1_ps(FACE_SIGNS[face][0]);
+		const __m128 signY = _mm_set1_ps(FACE_SIGNS[face][1]);
+		const __m128 signZ = _mm_set1_ps(FACE_SIGNS[face][2]);
+		const __m128 a = _mm_set1_ps(projA);
+		const __m128 b = _mm_set1_ps(projB);
+
+		UINT i = 0;
+		for(; i + 4 <= numVertices; i += 4) 
+		{
+			const __m128 viewZ = _mm_mul_ps(_mm_loadu_ps(srcZ + i), signZ);
+
+			_mm_storeu_ps(&workspace.clipX[i], _mm_mul_ps(_mm_loadu_ps(srcX + i), signX));
+			_mm_storeu_ps(&workspace.clipY[i], _mm_mul_ps(_mm_loadu_ps(srcY + i), signY));
+			_mm_storeu_ps(&workspace.clipZ[i], _mm_add_ps(_mm_mul_ps(viewZ, a), b));
+			_mm_storeu_ps(&workspace.clipW[i], viewZ);
+		}
+		for(; i < numVertices; ++i) 
+		{
+			const float viewZ = srcZ[i] * FACE_SIGNS[face][2];
+
+			workspace.clipX[i] = srcX[i] * FACE_SIGNS[face][0];
+			workspace.clipY[i] = srcY[i] * FACE_SIGNS[face][1];
+			workspace.clipZ[i] = viewZ * projA + projB;
+			workspace.clipW[i] = viewZ;
+		}
+
+		//rectángulo scissor para no renderizar todo un cubo sino un hemicubo
+		D3D11_RECT scissorRect;
+		GetFaceScissorRectangle(face, 0, 0, scissorRect);
+
+		rasterizer.SetScissor(scissorRect.left, scissorRect.top, scissorRect.right, scissorRect.bottom);
+		rasterizer.Clear();
+		rasterizer.ComputeOutcodes(vertices, numVertices, &(workspace.outcodes[0]));
+		rasterizer.DrawTriangles(vertices, &m_indices[0], numTriangles, &m_triangleMaterials[0], &m_materials[0], flags);
+
+		CopyFaceToAtlas(rasterizer, pass == 0 ? &giVertex : NULL, slot, face);
+
+		if(m_recordingFormFactors)
+			AccumulateFormFactors(face, workspace);
+	}
+
+	//la fila queda en workspace.formFactors. Preparar entryOfVertex para la próxima
+	if(m_recordingFormFactors) {
+		for(UINT i=rowBegin; i<workspace.formFactors.size(); ++i)
+			workspace.entryOfVertex[workspace.formFactors[i].source] = NO_FORM_FACTOR_ENTRY;
+	}
+}
+
+//------------------------------------------------------------------------------------------
+// Copia el rectángulo scissor de una cara renderizada a su lugar en el atlas (en el atlas compacto
+// el resto del tile es de la cara complementaria). Si skyVertex no es NULL los texels que no
+// fueron cubiertos por geometría reciben el color del cielo en esa dirección.
+//------------------------------------------------------------------------------------------
+void SoftwareRadiosity::CopyFaceToAtlas(const SoftwareRasterizer &rasterizer, const GIVertex * const skyVertex, const UINT slot, const UINT face) const
+{
+	const UINT faceNumber = GetFaceTile(slot, face);
+	const UINT faceRow = faceNumber / FACES_PER_ROW;
+	const UINT faceCol = faceNumber % FACES_PER_ROW;
+
+	float * const faceData = m_hemicubeAtlas + (faceRow * HEMICUBE_FACE_SIZE * PARENT_HEMICUBES_TEXTURE_WIDTH + faceCol * HEMICUBE_FACE_SIZE) * 4;
+
+	D3D11_RECT scissorRect;
+	GetFaceScissorRectangle(face, 0, 0, scissorRect);
+
+	//ejes de la cara en world space para calcular la dirección de cada texel del cielo
+	D3DXVECTOR3 right(0.0f, 0.0f, 0.0f), up(0.0f, 0.0f, 0.0f), forward(0.0f, 0.0f, 0.0f);
+	if(skyVertex) {
+		const D3DXVECTOR3 axes[3] = { skyVertex->tangent, skyVertex->bitangent, skyVertex->normal };
+		right = axes[FACE_AXES[face][0]] * FACE_SIGNS[face][0];
+		up = axes[FACE_AXES[face][1]] * FACE_SIGNS[face][1];
+		forward = axes[FACE_AXES[face][2]] * FACE_SIGNS[face][2];
+	}
+
+	const float * const depth = rasterizer.GetDepthBuffer();
+	const float * const red = rasterizer.GetColorBuffer(0);
+	const float * const green = rasterizer.GetColorBuffer(1);
+	const float * const blue = rasterizer.GetColorBuffer(2);
+	const UINT pitch = rasterizer.GetPitch();
+
+	for(UINT y=scissorRect.top; y<(UINT) scissorRect.bottom; ++y) 
+	{
+		float *texel = faceData + (y * PARENT_HEMICUBES_TEXTURE_WIDTH + scissorRect.left) * 4;
+
+		for(UINT x=scissorRect.left; x<(UINT) scissorRect.right; ++x, texel += 4) 
+		{
+			const UINT i = y * pitch + x;
+			const bool covered = depth[i] < 1.0f;
+
+			texel[0] = red[i];
+			texel[1] = green[i];
+			texel[2] = blue[i];
+			texel[3] = covered ? 1.0f : 0.0f;
+
+			if(skyVertex && !covered) 
+			{
+				const float ndcX = ((x + 0.5f) / HEMICUBE_FACE_SIZE) * 2.0f - 1.0f;
+				const float ndcY = 1.0f - ((y + 0.5f) / HEMICUBE_FACE_SIZE) * 2.0f;
+
+				D3DXVECTOR3 direction = right * ndcX + up * ndcY + forward;
+				D3DXVec3Normalize(&direction, &direction);
+
+				const D3DXVECTOR3 sky = m_skyTable.Lookup(direction);
+
+				texel[0] = sky.x;
+				texel[1] = sky.y;
+				texel[2] = sky.z;
+				texel[3] = 1.0f;
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------------------
+// Suma a la fila del vértice actual los form factors de los texels de la cara face. Cada 
+// texel ve un punto del triángulo guardado en el buffer de ids; sus coordenadas baricéntricas
+// se obtienen intersecando el rayo del centro del texel con el triángulo en view space (las 
+// mismas que usa la interpolación con corrección de perspectiva del rasterizador). Así el 
+// texel aporta delta form factor * baricéntrica * difuso a cada uno de los 3 vértices.
+//------------------------------------------------------------------------------------------
+void SoftwareRadiosity::AccumulateFormFactors(const UINT face, Workspace &workspace) const
+{
+	if(workspace.formFactorsFailed) return;
+
+	const SoftwareRasterizer &rasterizer = workspace.rasterizer;
+	const UINT * const triangleIds = rasterizer.GetTriangleIdBuffer();
+	const UINT pitch = rasterizer.GetPitch();
+
+	const HemicubeFaceRange &range = m_integrator.GetFaceRange(face);
+
+	try 
+	{
+		for(UINT y=range.rowBegin; y<range.rowEnd; ++y) 
+		{
+			const float ndcY = 1.0f - ((y + 0.5f) / HEMICUBE_FACE_SIZE) * 2.0f;
+
+			for(UINT x=range.columnBegin; x<range.columnEnd; ++x) 
+			{
+				const UINT triangle = triangleIds[y * pitch + x];
+				if(triangle == SoftwareRasterizer::NO_TRIANGLE) continue;
+
+				const float ndcX = ((x + 0.5f) / HEMICUBE_FACE_SIZE) * 2.0f - 1.0f;
+
+				//posiciones en view space de la cara: (clipX, clipY, clipW)
+				const DWORD * const indices = &m_indices[triangle * 3];
+				const D3DXVECTOR3 p0(workspace.clipX[indices[0]], workspace.clipY[indices[0]], workspace.clipW[indices[0]]);
+				const D3DXVECTOR3 p1(workspace.clipX[indices[1]], workspace.clipY[indices[1]], workspace.clipW[indices[1]]);
+				const D3DXVECTOR3 p2(workspace.clipX[indices[2]], workspace.clipY[indices[2]], workspace.clipW[indices[2]]);
+
+				//Möller-Trumbore con origen en el vértice del hemicubo
+				const D3DXVECTOR3 direction(ndcX, ndcY, 1.0f);
+				const D3DXVECTOR3 edge1 = p1 - p0;
+				const D3DXVECTOR3 edge2 = p2 - p0;
+
+				D3DXVECTOR3 p, q;
+				D3DXVec3Cross(&p, &direction, &edge2);
+
+				const float determinant = D3DXVec3Dot(&edge1, &p);
+
+				float barycentrics[3] = { 1.0f / 3.0f, 1.0f / 3.0f, 1.0f / 3.0f };
+				if(fabs(determinant) > 1e-12f) 
+				{
+					const D3DXVECTOR3 t = -p0;
+					D3DXVec3Cross(&q, &t, &edge1);
+
+					const float u = D3DXVec3Dot(&t, &p) / determinant;
+					const float v = D3DXVec3Dot(&direction, &q) / determinant;
+
+					//los texels del borde pueden quedar apenas fuera del triángulo
+					barycentrics[0] = max(1.0f - u - v, 0.0f);
+					barycentrics[1] = max(u, 0.0f);
+					barycentrics[2] = max(v, 0.0f);
+
+					const float sum = barycentrics[0] + barycentrics[1] + barycentrics[2];
+					for(UINT k=0; k<3; ++k)
+						barycentrics[k] /= sum;
+				}
+
+				AddTriangleFormFactor(triangle, barycentrics, m_integrator.GetWeight(face, y, x), workspace);
+			}
+		}
+	}
+	catch (std::bad_alloc &) 
+	{
+		workspace.formFactorsFailed = true;
+	}
+}
+
+void SoftwareRadiosity::AddTriangleFormFactor(const UINT triangle, const float * const barycentrics, const float weight, Workspace &workspace) const
+{
+	const DWORD * const indices = &m_indices[triangle * 3];
+	const float * const diffuse = m_materials[m_triangleMaterials[triangle]].diffuse;
+
+	for(UINT k=0; k<3; ++k) 
+	{
+		UINT &entry = workspace.entryOfVertex[indices[k]];
+		if(entry == NO_FORM_FACTOR_ENTRY) {
+			const FormFactorEntry newEntry = { indices[k], { 0.0f, 0.0f, 0.0f } };
+			entry = static_cast<UINT>(workspace.formFactors.size());
+			workspace.formFactors.push_back(newEntry);
+		}
+
+		float * const entryWeight = workspace.formFactors[entry].weight;
+		const float vertexWeight = weight * barycentrics[k];
+
+		entryWeight[0] += vertexWeight * diffuse[0];
+		entryWeight[1] += vertexWeight * diffuse[1];
+		entryWeight[2] += vertexWeight * diffuse[2];
+	}
+}
+
+void SoftwareRadiosity::AppendFormFactorRows(const UINT verticesBaked)
+{
+	bool failed = false;
+	size_t entries = m_formFactors.size();
+
+	for(UINT i=0; i<m_workspaces.size(); ++i)
+		failed |= m_workspaces[i]->formFactorsFailed;
+
+	for(UINT i=0; i<verticesBaked; ++i)
+		entries += m_batchRows[i].count;
+
+	if(failed || entries > MAX_FORM_FACTOR_ENTRIES) {
+		DiscardFormFactors();
+		return;
+	}
+
+	//las filas se agregan en el orden de los vértices renderizados
+	try 
+	{
+		m_formFactors.reserve(max(entries, min(m_formFactors.capacity() * 2, (size_t) MAX_FORM_FACTOR_ENTRIES)));
+
+		for(UINT i=0; i<verticesBaked; ++i) 
+		{
+			const FormFactorRow &row = m_batchRows[i];
+			const FormFactorEntry * const rowEntries = row.count > 0 ? &(row.workspace->formFactors[row.begin]) : NULL;
+
+			m_formFactors.insert(m_formFactors.end(), rowEntries, rowEntries + row.count);
+			m_formFactorRowOffsets.push_back(static_cast<UINT>(m_formFactors.size()));
+		}
+	}
+	catch (std::bad_alloc &) 
+	{
+		DiscardFormFactors();
+		return;
+	}
+
+	for(UINT i=0; i<m_workspaces.size(); ++i)
+		m_workspaces[i]->formFactors.clear();
+}
+
+void SoftwareRadiosity::DiscardFormFactors()
+{
+	m_recordingFormFactors = false;
+	m_formFactorsReady = false;
+	m_formFactorsDiscarded = true;
+
+	//liberar la memoria, no sólo vaciar los vectores
+	vector<FormFactorEntry>().swap(m_formFactors);
+	vector<UINT>().swap(m_formFactorRowOffsets);
+
+	for(UINT i=0; i<m_workspaces.size(); ++i) {
+		vector<FormFactorEntry>().swap(m_workspaces[i]->formFactors);
+		vector<UINT>().swap(m_workspaces[i]->entryOfVertex);
+	}
+}
+
+//------------------------------------------------------------------------------------------
+// Pasada de radiosidad sin renderizar: la irradiancia de cada vértice es la suma de los 
+// elementos de su fila por la irradiancia de la pasada anterior de cada vértice fuente. Se 
+// reparte por vértices entre los hilos y cada elemento es un multiply-add de un XMVECTOR.
+// A diferencia de los hemicubos renderizados, la radiancia no se satura a [0, 1]. Con caché
+// de irradiancia sólo hay filas para las muestras y el resto de los vértices se interpola.
+//------------------------------------------------------------------------------------------
+HRESULT SoftwareRadiosity::ApplyFormFactors()
+{
+	const UINT numVertices = static_cast<UINT>(m_vertices.size());
+	const UINT numBaked = GetNumBakedVertices();
+
+	_ASSERT(m_formFactorsReady && m_formFactorRowOffsets.size() == numBaked + 1);
+
+	if(m_profiling)
+		m_timer.Update();
+
+	if(!m_lastPassIrradiance) {
+		if((m_lastPassIrradiance = (DirectX::XMVECTOR *) _aligned_malloc(sizeof(DirectX::XMVECTOR) * numVertices, 16)) == NULL) {
+			MiscErrorWarning(BAD_ALIGNED_ALLOC);
+			return E_FAIL;
+		}
+	}
+
+	//m_currentPassCpuGIData se sobrescribe con el resultado de esta pasada
+	memcpy(m_lastPassIrradiance, m_currentPassCpuGIData, sizeof(DirectX::XMVECTOR) * numVertices);
+
+	const DirectX::XMVECTOR vertexWeight = DirectX::XMVectorReplicate(m_giCalcConstants.vertexWeight);
+
+	m_threadPool.ParallelFor(numBaked, [&](const UINT row, const UINT thread) {
+		const UINT vertex = GetBakedVertex(row);
+		DirectX::XMVECTOR irradiance = DirectX::XMVectorZero();
+
+		const UINT end = m_formFactorRowOffsets[row + 1];
+		for(UINT i=m_formFactorRowOffsets[row]; i<end; ++i) {
+			const FormFactorEntry &entry = m_formFactors[i];
+			const DirectX::XMVECTOR weight = DirectX::XMLoadFloat3(reinterpret_cast<const DirectX::XMFLOAT3 *>(entry.weight));
+
+			irradiance = DirectX::XMVectorMultiplyAdd(weight, m_lastPassIrradiance[entry.source], irradiance);
+		}
+
+		irradiance = DirectX::XMVectorMultiply(irradiance, vertexWeight);
+
+		m_currentPassCpuGIData[vertex] = irradiance;
+		m_cpuGITempData[vertex] = DirectX::XMVectorAdd(m_cpuGITempData[vertex], irradiance);
+	}, INTEGRATION_GRAIN_SIZE);
+
+	if(m_profiling) {
+		m_timer.Update();
+		m_formFactorTime += m_timer.GetTimeElapsed();
+	}
+
+	CompleteUnbakedVertices();
+
+	return S_OK;
+}
+
+//energía que entregaría un vértice al disparar: su energía sin distribuir por la suma de su columna
+static inline float ShotEnergy(DirectX::FXMVECTOR unshot, const DirectX::XMFLOAT3 &columnSum)
+{
+	return DirectX::XMVectorGetX(DirectX::XMVector3Dot(unshot, DirectX::XMLoadFloat3(&columnSum)));
+}
+
+//------------------------------------------------------------------------------------------
+// Refinamiento progresivo (shooting). La energía sin distribuir de cada vértice empieza siendo
+// la irradiancia de la primera pasada iluminada. En cada disparo el vértice u con más energía
+// para entregar (su energía sin distribuir por la suma de su columna) la reparte a los vértices
+// que lo ven: su columna de la matriz de form factors, que se obtiene transponiendo las filas.
+// Lo que recibe cada vértice se suma a la solución y a su propia energía sin distribuir. La
+// energía residual es la suma de lo que entregarían todos los vértices. Se detiene cuando es
+// menor que m_convergenceTolerance por la inicial. Los vértices se eligen con una cola de 
+// prioridad con actualizaciones perezosas: las entradas viejas se descartan al salir.
+// Con caché de irradiancia se resuelve sobre las muestras (la energía de un vértice 
+// interpolado es la de sus muestras) y al final se interpola lo que recibió cada una. Con
+// vértices soldados, igual sobre el primer vértice de cada grupo.
+//------------------------------------------------------------------------------------------
+HRESULT SoftwareRadiosity::SolveProgressive()
+{
+	HRESULT hr;
+
+	const UINT numVertices = static_cast<UINT>(m_vertices.size());
+	const UINT numBaked = GetNumBakedVertices();
+
+	_ASSERT(m_formFactorsReady && m_formFactorRowOffsets.size() == numBaked + 1);
+
+	if(m_profiling)
+		m_timer.Update();
+
+	if(UsesIrradianceCache() || UsesWelding()) {
+		if(FAILED(hr = ProjectFormFactorsOnBakedVertices())) return hr;
+	}
+
+	typedef std::pair<float, UINT> Candidate;
+
+	vector<UINT> columnOffsets;
+	vector<FormFactorEntry> columns;
+	vector<float> priorities;
+	vector<DirectX::XMFLOAT3> columnSums;
+	vector<Candidate> heap;
+
+	try 
+	{
+		//transponer: en la columna de u, source es el vértice que recibe. Los índices son posiciones en el orden de
+		//renderización, que sin caché de irradiancia coinciden con los vértices
+		columnOffsets.assign(numBaked + 1, 0);
+		for(size_t i=0; i<m_formFactors.size(); ++i)
+			++columnOffsets[m_formFactors[i].source + 1];
+		for(UINT i=0; i<numBaked; ++i)
+			columnOffsets[i + 1] += columnOffsets[i];
+
+		columns.resize(m_formFactors.size());
+
+		vector<UINT> cursor(columnOffsets.begin(), columnOffsets.end() - 1);
+		for(UINT v=0; v<numBaked; ++v) {
+			for(UINT i=m_formFactorRowOffsets[v]; i<m_formFactorRowOffsets[v + 1]; ++i) {
+				FormFactorEntry &entry = columns[cursor[m_formFactors[i].source]++];
+				entry = m_formFactors[i];
+				entry.source = v;
+			}
+		}
+
+		//las filas ya no se usan
+		vector<FormFactorEntry>().swap(m_formFactors);
+		vector<UINT>().swap(m_formFactorRowOffsets);
+
+		priorities.assign(numBaked, 0.0f);
+		columnSums.resize(numBaked);
+		heap.reserve(numBaked);
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	if(!m_lastPassIrradiance) {
+		if((m_lastPassIrradiance = (DirectX::XMVECTOR *) _aligned_malloc(sizeof(DirectX::XMVECTOR) * numVertices, 16)) == NULL) {
+			MiscErrorWarning(BAD_ALIGNED_ALLOC);
+			return E_FAIL;
+		}
+	}
+
+	//energía sin distribuir, por posición. Ya incluye vertexWeight, igual que cada pasada de m_currentPassCpuGIData
+	DirectX::XMVECTOR * const unshot = (DirectX::XMVECTOR *) _aligned_malloc(sizeof(DirectX::XMVECTOR) * max(numBaked, (UINT) 1), 16);
+	if(!unshot) {
+		MiscErrorWarning(BAD_ALIGNED_ALLOC);
+		return E_FAIL;
+	}
+
+	for(UINT b=0; b<numBaked; ++b)
+		unshot[b] = m_currentPassCpuGIData[GetBakedVertex(b)];
+
+	//lo que recibe cada vértice de todos los rebotes
+	DirectX::XMVECTOR * const received = m_lastPassIrradiance;
+	memset(received, 0, sizeof(DirectX::XMVECTOR) * numVertices);
+
+	const DirectX::XMVECTOR vertexWeight = DirectX::XMVectorReplicate(m_giCalcConstants.vertexWeight);
+
+	for(UINT u=0; u<numBaked; ++u) 
+	{
+		DirectX::XMVECTOR sum = DirectX::XMVectorZero();
+		for(UINT i=columnOffsets[u]; i<columnOffsets[u + 1]; ++i)
+			sum = DirectX::XMVectorAdd(sum, DirectX::XMLoadFloat3(reinterpret_cast<const DirectX::XMFLOAT3 *>(columns[i].weight)));
+
+		DirectX::XMStoreFloat3(&columnSums[u], DirectX::XMVectorMultiply(sum, vertexWeight));
+	}
+
+	double residual = 0;
+	for(UINT v=0; v<numBaked; ++v) {
+		priorities[v] = ShotEnergy(unshot[v], columnSums[v]);
+		residual += priorities[v];
+
+		if(priorities[v] > 0.0f)
+			heap.push_back(Candidate(priorities[v], v));
+	}
+	std::make_heap(heap.begin(), heap.end());
+
+	const double initialResidual = residual;
+	const double targetResidual = initialResidual * m_convergenceTolerance;
+	const UINT64 maxShots = (UINT64) MAX_PROGRESSIVE_SWEEPS * numBaked;
+
+	m_residualHistory.push_back(initialResidual > 0 ? 1.0 : 0.0);
+
+	UINT64 shots = 0;
+	while(residual > targetResidual && shots < maxShots && !heap.empty()) 
+	{
+		std::pop_heap(heap.begin(), heap.end());
+		const Candidate candidate = heap.back();
+		heap.pop_back();
+
+		const UINT u = candidate.second;
+		if(candidate.first != priorities[u]) continue;	//la prioridad cambió después de encolarlo
+
+		const DirectX::XMVECTOR shot = DirectX::XMVectorMultiply(unshot[u], vertexWeight);
+		unshot[u] = DirectX::XMVectorZero();
+		residual -= priorities[u];
+		priorities[u] = 0.0f;
+
+		for(UINT i=columnOffsets[u]; i<columnOffsets[u + 1]; ++i) 
+		{
+			const FormFactorEntry &entry = columns[i];
+			const UINT v = entry.source;
+
+			const DirectX::XMVECTOR energy = DirectX::XMVectorMultiply(DirectX::XMLoadFloat3(reinterpret_cast<const DirectX::XMFLOAT3 *>(entry.weight)), shot);
+
+			const UINT vertex = GetBakedVertex(v);
+			received[vertex] = DirectX::XMVectorAdd(received[vertex], energy);
+			unshot[v] = DirectX::XMVectorAdd(unshot[v], energy);
+
+			const float priority = ShotEnergy(unshot[v], columnSums[v]);
+			residual += priority - priorities[v];
+			priorities[v] = priority;
+
+			heap.push_back(Candidate(priority, v));
+			std::push_heap(heap.begin(), heap.end());
+		}
+
+		++shots;
+
+		//por cada barrida: la suma exacta (la incremental acumula error) y la cola sin entradas viejas
+		if(shots % numBaked == 0 || heap.size() > 4 * (size_t) numBaked) 
+		{
+			residual = 0;
+			heap.clear();
+			for(UINT v=0; v<numBaked; ++v) {
+				residual += priorities[v];
+				if(priorities[v] > 0.0f)
+					heap.push_back(Candidate(priorities[v], v));
+			}
+			std::make_heap(heap.begin(), heap.end());
+
+			if(shots % numBaked == 0)
+				m_residualHistory.push_back(initialResidual > 0 ? residual / initialResidual : 0.0);
+		}
+	}
+
+	if(shots % numBaked != 0)
+		m_residualHistory.push_back(initialResidual > 0 ? max(residual, 0.0) / initialResidual : 0.0);
+
+	_aligned_free(unshot);
+
+	for(UINT b=0; b<numBaked; ++b) {
+		const UINT vertex = GetBakedVertex(b);
+		m_cpuGITempData[vertex] = DirectX::XMVectorAdd(m_cpuGITempData[vertex], received[vertex]);
+	}
+
+	//los vértices no renderizados reciben la interpolación de lo que recibieron sus muestras (o lo de su grupo)
+	CompleteUnbakedVertices(received, m_cpuGITempData);
+
+	m_progressiveShots = static_cast<UINT>(shots);
+	m_progressiveSolved = true;
+
+	if(m_profiling) {
+		m_timer.Update();
+		m_formFactorTime += m_timer.GetTimeElapsed();
+	}
+
+	return S_OK;
+}
+
+//------------------------------------------------------------------------------------------
+// La irradiancia de un vértice interpolado es la suma de la de sus muestras por sus pesos, así
+// que un elemento (fuente interpolada, w) equivale a un elemento (muestra, w * peso) por cada
+// muestra de la fuente. Un vértice soldado es su grupo con peso uno. Los elementos de una fila
+// con la misma muestra se suman en uno solo.
+//------------------------------------------------------------------------------------------
+HRESULT SoftwareRadiosity::ProjectFormFactorsOnBakedVertices()
+{
+	const UINT numBaked = GetNumBakedVertices();
+
+	try 
+	{
+		vector<UINT> rowOffsets;
+		vector<FormFactorEntry> entries;
+		vector<UINT> entryOfSample(numBaked, NO_FORM_FACTOR_ENTRY);
+
+		rowOffsets.reserve(numBaked + 1);
+		rowOffsets.push_back(0);
+		entries.reserve(m_formFactors.size());
+
+		for(UINT row=0; row<numBaked; ++row) 
+		{
+			const UINT begin = static_cast<UINT>(entries.size());
+
+			for(UINT i=m_formFactorRowOffsets[row]; i<m_formFactorRowOffsets[row + 1]; ++i) 
+			{
+				const FormFactorEntry &entry = m_formFactors[i];
+
+				UINT count = 0;
+				const IrradianceCacheWeight *weights = NULL;
+				if(UsesIrradianceCache())
+					weights = m_irradianceCache.GetWeights(entry.source, count);
+
+				//una muestra es su propia interpolación, y un vértice soldado es el de su grupo
+				const IrradianceCacheWeight itself = { entry.source, 1.0f };
+				if(count == 0) {
+					weights = &itself;
+					count = 1;
+				}
+
+				for(UINT k=0; k<count; ++k) 
+				{
+					const UINT sample = GetBakedPosition(weights[k].sample);
+
+					if(entryOfSample[sample] == NO_FORM_FACTOR_ENTRY) {
+						entryOfSample[sample] = static_cast<UINT>(entries.size());
+
+						const FormFactorEntry zero = { sample, { 0.0f, 0.0f, 0.0f } };
+						entries.push_back(zero);
+					}
+
+					FormFactorEntry &projected = entries[entryOfSample[sample]];
+					for(UINT c=0; c<3; ++c)
+						projected.weight[c] += entry.weight[c] * weights[k].weight;
+				}
+			}
+
+			for(UINT i=begin; i<entries.size(); ++i)
+				entryOfSample[entries[i].source] = NO_FORM_FACTOR_ENTRY;
+
+			rowOffsets.push_back(static_cast<UINT>(entries.size()));
+		}
+
+		m_formFactors.swap(entries);
+		m_formFactorRowOffsets.swap(rowOffsets);
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	return S_OK;
+}
+
+}
@@ -0,0 +1,245 @@
+﻿//------------------------------------------------------------------------------------------
+// File: SoftwareRadiosity.h
+//
+// Implementación del algoritmo de radiosidad que renderiza los hemicubos por software, con
+// SoftwareRasterizer, repartiendo los vértices de cada dispatch entre los hilos del thread
+// pool de CPURadiosity. La integración es la misma de CPURadiosity. Permite calcular GI en máquinas
+// sin GPU o en servidores. Simplificaciones respecto de la renderización con Direct3D: la
+// iluminación directa y las sombras se evalúan por vértice (Gouraud, sin especular ni normal
+// maps) y las texturas difusas se reducen a su color promedio.
+// A partir del segundo rebote la geometría y la visibilidad no cambian, sólo la irradiancia
+// que se reúne. Por eso la primera pasada iluminada guarda, por vértice, una fila dispersa de
+// form factors (vértice fuente, suma de delta form factors * baricéntrica * difuso) y las 
+// pasadas siguientes se calculan como un producto matriz dispersa-vector sin renderizar.
+// Con RADIOSITY_SOLVER_PROGRESSIVE la misma matriz se usa para refinamiento progresivo: se
+// dispara la energía del vértice con más energía sin distribuir hasta que la energía restante
+// sea menor que una fracción de la inicial, en lugar de una cantidad fija de pasadas.
+// Con caché de irradiancia (o vértices soldados) las filas son sólo las de los vértices
+// renderizados; los rebotes se completan igual que las pasadas renderizadas y el solver
+// progresivo trabaja sobre los vértices renderizados.
+// 
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef SOFTWARE_RADIOSITY_H
+#define SOFTWARE_RADIOSITY_H
+
+#include "CPURadiosity.h"
+#include "SoftwareRasterizer.h"
+#include "Skybox.h"
+
+namespace DTFramework
+{
+
+//cómo se calculan los rebotes posteriores a la primera pasada iluminada
+enum RadiositySolver
+{
+	RADIOSITY_SOLVER_GATHERING = 0,     //las pasadas que falten hasta PASSES
+	RADIOSITY_SOLVER_PROGRESSIVE        //shooting hasta que la energía sin distribuir sea menor que convergenceTolerance * la inicial
+};
+
+class SoftwareRadiosity : public CPURadiosity
+{
+public:
+	//numThreads == 0 => un hilo por núcleo lógico. reuseFormFactors == false => renderizar los hemicubos en todas las pasadas
+	//de gathering. El solver progresivo siempre usa la matriz de form factors y necesita numBounces >= 2.
+	//irradianceCacheError y weldVertices: ver CPURadiosity
+	SoftwareRadiosity(const D3DDevicesManager &d3d, const bool exportHemicubes=false, const bool enableProfiling=false, const UINT verticesBakedPerDispatch=256, 
+	                  const UINT numBounces=2, const UINT numThreads=0, const UINT hemicubeFaceSize=DEFAULT_HEMICUBE_FACE_SIZE, 
+	                  const bool reuseFormFactors=true, const RadiositySolver solver=RADIOSITY_SOLVER_GATHERING, 
+	                  const float convergenceTolerance=DEFAULT_CONVERGENCE_TOLERANCE, const float irradianceCacheError=0.0f, 
+	                  const bool weldVertices=true);
+	virtual ~SoftwareRadiosity();
+
+	static const float DEFAULT_CONVERGENCE_TOLERANCE;
+
+protected:
+	virtual HRESULT BakeGIData(Renderer &renderer, Scene &scene, Light &light);
+
+	//agrega un rasterizador por hilo
+	virtual HRESULT InitResources();
+
+	virtual UINT GetHemicubeRendererId() const;
+	virtual UINT GetSolverId() const;
+	virtual float GetSolverTolerance() const;
+
+	//los hemicubos se rasterizan en la CPU con la geometría completa: no hay niveles de detalle
+	virtual float GetLODTexelError() const;
+
+	//el cielo sale de m_skyTable en lugar de la sky texture
+	virtual UINT GetSkyModelId() const;
+
+	virtual HRESULT CreateHemicubeTargets();
+
+	virtual HRESULT ProcessScene(Renderer &renderer, Scene &scene, Light &light, const UINT pass);
+	virtual HRESULT ProcessVertex(Renderer &renderer, Scene &scene, Light &light, const UINT pass, const UINT vertexId);
+
+protected:
+	//elemento de una fila de la matriz de form factors: cuánto de la irradiancia del vértice source llega al vértice de la fila
+	struct FormFactorEntry
+	{
+		UINT source;
+		float weight[3];    //suma de delta form factor * coordenada baricéntrica * difuso del material, por canal
+	};
+
+	//datos propios de cada hilo
+	struct Workspace
+	{
+		SoftwareRasterizer rasterizer;
+
+		//posiciones de la escena en el espacio local del vértice (tangente, bitangente, normal)
+		vector<float> localX, localY, localZ;
+
+		//posiciones en clip space de la cara actual
+		vector<float> clipX, clipY, clipZ, clipW;
+		vector<unsigned char> outcodes;
+
+		//filas de form factors de los hemicubos que renderizó este hilo en el lote actual
+		vector<FormFactorEntry> formFactors;
+		vector<UINT> entryOfVertex;     //posición en formFactors de cada vértice fuente de la fila actual o NO_FORM_FACTOR_ENTRY
+		bool formFactorsFailed;         //no hubo memoria para alguna fila
+
+		Workspace() : formFactorsFailed(false) {}
+	};
+
+	//fila de un vértice del lote actual dentro de los formFactors de un workspace
+	struct FormFactorRow
+	{
+		const Workspace *workspace;
+		UINT begin;
+		UINT count;
+	};
+
+	//geometría, materiales e iluminación directa por vértice. Las clases derivadas pueden agregar sus propios datos
+	virtual HRESULT PrepareSceneData(const Scene &scene, const Light &light);
+	HRESULT PrepareMaterials(const Scene &scene, const Light &light);
+	HRESULT ComputeAverageTextureColor(ID3D11ShaderResourceView *srv, D3DXVECTOR3 &color) const;
+
+	HRESULT ComputeDirectLighting(const Light &light);
+	void RenderShadowMap(const UINT view, Workspace &workspace);
+	float ComputeShadowFactor(const Light &light, const D3DXVECTOR3 &position) const;
+
+	void PrepareVertexShading(const Light &light, const UINT pass);
+
+	void RenderHemicube(const UINT vertex, const UINT slot, const UINT pass, Workspace &workspace) const;
+	void CopyFaceToAtlas(const SoftwareRasterizer &rasterizer, const GIVertex * const skyVertex, const UINT slot, const UINT face) const;
+
+	RasterVertices GetRasterVertices(const Workspace &workspace, const bool withShading) const;
+
+	//form factors de los texels de la cara recién renderizada por workspace.rasterizer
+	void AccumulateFormFactors(const UINT face, Workspace &workspace) const;
+
+	//suma weight * baricéntrica * difuso del triángulo a los elementos de sus 3 vértices en la fila actual de workspace. Puede lanzar std::bad_alloc
+	void AddTriangleFormFactor(const UINT triangle, const float * const barycentrics, const float weight, Workspace &workspace) const;
+
+	//agrega las filas del lote actual a la matriz de form factors
+	void AppendFormFactorRows(const UINT verticesBaked);
+	void DiscardFormFactors();
+
+	//calcula una pasada completa como producto de la matriz de form factors por la irradiancia de la pasada anterior
+	HRESULT ApplyFormFactors();
+
+	//refinamiento progresivo a partir de la irradiancia de la primera pasada iluminada. Reemplaza a las pasadas siguientes
+	HRESULT SolveProgressive();
+
+	//reemplaza los vértices fuente interpolados por sus muestras (con el peso de la interpolación) y los soldados por su
+	//grupo, así la fuente de cada elemento pasa a ser una posición en el orden de renderización
+	HRESULT ProjectFormFactorsOnBakedVertices();
+
+protected:
+	static const UINT SHADOW_MAP_SIZE = 1024;
+	static const UINT OMNI_SHADOW_MAP_SIZE = 512;
+
+	static const float HEMICUBE_Z_NEAR;
+	static const float HEMICUBE_Z_FAR;
+
+	static const UINT NO_FORM_FACTOR_ENTRY = 0xFFFFFFFF;
+
+	//límite de la matriz de form factors (16 bytes por elemento). Si se supera se vuelven a renderizar los hemicubos
+	static const UINT MAX_FORM_FACTOR_ENTRIES = 16 * 1024 * 1024;
+
+	//el solver progresivo se detiene aunque no converja luego de disparar esta cantidad de veces la cantidad de vértices
+	static const UINT MAX_PROGRESSIVE_SWEEPS = 64;
+
+	//uno por hilo de m_threadPool
+	vector<Workspace *> m_workspaces;
+
+	//textura de hemicubos en memoria de sistema (mismo formato que m_hemiCubes: float4 por texel)
+	float *m_hemicubeAtlas;
+
+	//geometría de la escena (todos los objetos en world space, ver Scene::GetSceneGeometry) en formato SoA
+	vector<float> m_positionX, m_positionY, m_positionZ;
+	vector<D3DXVECTOR3> m_normals;
+	vector<DWORD> m_indices;
+	vector<UINT> m_triangleMaterials;
+	vector<RasterMaterial> m_materials;
+
+	//iluminación por vértice de la pasada actual. Ver RasterMaterial
+	vector<float> m_shading[RasterVertices::NUM_ATTRIBUTES];
+
+	//iluminación directa por vértice (incluye sombra y atenuación): factor difuso y factor ambiental
+	vector<float> m_directDiffuse;
+	vector<float> m_directAmbient;
+
+	//shadow maps por software. 1 para luces direccionales, 6 (un cubo) para point lights
+	vector<SoftwareRasterizer *> m_shadowMaps;
+	vector<D3DXMATRIX> m_shadowViewProjections;
+	float m_omniZNear;
+	float m_omniZFar;
+
+	D3DXVECTOR3 m_sunDirection;
+	SkyRadianceTable m_skyTable;        //cielo de la primera pasada (con Renderer::SKY_COLOR_BIAS) para m_sunDirection
+
+	//matriz dispersa de form factors en formato CSR: la fila del vértice v es [m_formFactorRowOffsets[v], m_formFactorRowOffsets[v+1])
+	const bool m_reuseFormFactors;
+	bool m_recordingFormFactors;
+	bool m_formFactorsReady;
+	bool m_formFactorsDiscarded;                //no entraron en memoria o en MAX_FORM_FACTOR_ENTRIES
+	size_t m_formFactorEntries;
+	vector<UINT> m_formFactorRowOffsets;
+	vector<FormFactorEntry> m_formFactors;
+	vector<FormFactorRow> m_batchRows;
+	DirectX::XMVECTOR *m_lastPassIrradiance;    //copia de m_currentPassCpuGIData de la pasada anterior
+
+	double m_setupTime;     //tiempo en segundos que tardamos en preparar geometría, materiales y sombras
+	double m_formFactorTime;    //tiempo en segundos de las pasadas calculadas con la matriz de form factors
+
+	const RadiositySolver m_solver;
+	const float m_convergenceTolerance;
+	bool m_progressiveSolved;
+
+	//profiling del solver progresivo: energía sin distribuir relativa a la inicial luego de cada barrida (numVertices disparos)
+	vector<double> m_residualHistory;
+	UINT m_progressiveShots;
+};
+
+inline UINT SoftwareRadiosity::GetHemicubeRendererId() const
+{
+	return 1;	//SoftwareRasterizer
+}
+
+inline UINT SoftwareRadiosity::GetSolverId() const
+{
+	if(m_solver == RADIOSITY_SOLVER_PROGRESSIVE) return 2;
+
+	return m_reuseFormFactors ? 1 : 0;	//1: pasadas de gathering con la matriz de form factors
+}
+
+inline float SoftwareRadiosity::GetSolverTolerance() const
+{
+	return m_solver == RADIOSITY_SOLVER_PROGRESSIVE ? m_convergenceTolerance : 0.0f;
+}
+
+inline float SoftwareRadiosity::GetLODTexelError() const
+{
+	return 0.0f;
+}
+
+inline UINT SoftwareRadiosity::GetSkyModelId() const
+{
+	return SkyRadianceTable::VERSION;
+}
+
+}
+
+#endif
@@ -0,0 +1,506 @@
+﻿//------------------------------------------------------------------------------------------
+// File: SoftwareRasterizer.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "SoftwareRasterizer.h"
+
+namespace DTFramework
+{
+
+//definición de static member variables
+const float SoftwareRasterizer::GUARD_BAND = 4.0f;
+
+//------------------------------------------------------------------------------------------
+// Plano f(x, y) = c + dx * x + dy * y evaluado de a 4 pixeles. Se usa tanto para las edge
+// functions como para interpolar la profundidad y los atributos.
+//------------------------------------------------------------------------------------------
+struct RasterPlane
+{
+	__m128 c;
+	__m128 dx;
+	__m128 dy;
+};
+
+static inline void SetPlane(RasterPlane &plane, const float c, const float dx, const float dy)
+{
+	plane.c = _mm_set1_ps(c);
+	plane.dx = _mm_set1_ps(dx);
+	plane.dy = _mm_set1_ps(dy);
+}
+
+static inline __m128 EvaluatePlane(const RasterPlane &plane, const __m128 x, const __m128 y)
+{
+	return _mm_add_ps(plane.c, _mm_add_ps(_mm_mul_ps(plane.dx, x), _mm_mul_ps(plane.dy, y)));
+}
+
+static inline __m128 Select(const __m128 mask, const __m128 a, const __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+SoftwareRasterizer::SoftwareRasterizer()
+: m_width(0), m_height(0), m_pitch(0), m_scissorLeft(0), m_scissorTop(0), m_scissorRight(0), m_scissorBottom(0),
+m_ndcLeft(-1.0f), m_ndcRight(1.0f), m_ndcBottom(-1.0f), m_ndcTop(1.0f), m_depth(0), m_triangleIds(0), m_ready(false)
+{
+	m_color[0] = m_color[1] = m_color[2] = NULL;
+}
+
+SoftwareRasterizer::~SoftwareRasterizer()
+{
+	if(m_depth) _aligned_free(m_depth);
+
+	for(UINT i=0; i<3; ++i)
+		if(m_color[i]) _aligned_free(m_color[i]);
+
+	if(m_triangleIds) _aligned_free(m_triangleIds);
+}
+
+HRESULT SoftwareRasterizer::Init(const UINT width, const UINT height)
+{
+	_ASSERT(!m_ready);
+
+	if(m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"SoftwareRasterizer::Init");
+		return E_FAIL;
+	}
+
+	if(width == 0 || height == 0) {
+		MiscErrorWarning(INVALID_PARAMETER, L"SoftwareRasterizer::Init");
+		return E_INVALIDARG;
+	}
+
+	m_width = width;
+	m_height = height;
+
+	//las filas se procesan de a 4 pixeles con loads alineados
+	m_pitch = (width + 3) & ~3;
+
+	const size_t size = sizeof(float) * m_pitch * m_height;
+
+	m_depth = (float *) _aligned_malloc(size, 16);
+	for(UINT i=0; i<3; ++i)
+		m_color[i] = (float *) _aligned_malloc(size, 16);
+	m_triangleIds = (UINT *) _aligned_malloc(sizeof(UINT) * m_pitch * m_height, 16);
+
+	if(!m_depth || !m_color[0] || !m_color[1] || !m_color[2] || !m_triangleIds) {
+		MiscErrorWarning(BAD_ALIGNED_ALLOC);
+		return E_FAIL;
+	}
+
+	SetScissor(0, 0, m_width, m_height);
+
+	m_ready = true;
+
+	Clear();
+
+	return S_OK;
+}
+
+void SoftwareRasterizer::SetScissor(const UINT left, const UINT top, const UINT right, const UINT bottom)
+{
+	m_scissorLeft = min(left, m_width);
+	m_scissorRight = min(max(right, m_scissorLeft), m_width);
+	m_scissorTop = min(top, m_height);
+	m_scissorBottom = min(max(bottom, m_scissorTop), m_height);
+
+	//el mismo rectángulo en NDC, para los outcodes
+	m_ndcLeft = (m_scissorLeft / (float) m_width) * 2.0f - 1.0f;
+	m_ndcRight = (m_scissorRight / (float) m_width) * 2.0f - 1.0f;
+	m_ndcTop = 1.0f - (m_scissorTop / (float) m_height) * 2.0f;
+	m_ndcBottom = 1.0f - (m_scissorBottom / (float) m_height) * 2.0f;
+}
+
+void SoftwareRasterizer::Clear(const float depth)
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"SoftwareRasterizer::Clear");
+		return;
+	}
+
+	const __m128 depthValue = _mm_set1_ps(depth);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128i noTriangle = _mm_set1_epi32((int) NO_TRIANGLE);
+	const UINT size = m_pitch * m_height;
+
+	for(UINT i=0; i<size; i += 4) {
+		_mm_store_ps(m_depth + i, depthValue);
+		_mm_store_ps(m_color[0] + i, zero);
+		_mm_store_ps(m_color[1] + i, zero);
+		_mm_store_ps(m_color[2] + i, zero);
+		_mm_store_si128((__m128i *) (m_triangleIds + i), noTriangle);
+	}
+}
+
+inline unsigned char SoftwareRasterizer::Outcode(const float x, const float y, const float z, const float w) const
+{
+	unsigned char code = 0;
+
+	if(x < m_ndcLeft * w)   code |= OUTCODE_LEFT;
+	if(x > m_ndcRight * w)  code |= OUTCODE_RIGHT;
+	if(y < m_ndcBottom * w) code |= OUTCODE_BOTTOM;
+	if(y > m_ndcTop * w)    code |= OUTCODE_TOP;
+	if(z < 0.0f)            code |= OUTCODE_NEAR;
+	if(z > w)               code |= OUTCODE_FAR;
+
+	return code;
+}
+
+void SoftwareRasterizer::ComputeOutcodes(const RasterVertices &vertices, const UINT count, unsigned char * const outcodes) const
+{
+	_ASSERT(m_ready && outcodes);
+
+	const __m128 left = _mm_set1_ps(m_ndcLeft);
+	const __m128 right = _mm_set1_ps(m_ndcRight);
+	const __m128 bottom = _mm_set1_ps(m_ndcBottom);
+	const __m128 top = _mm_set1_ps(m_ndcTop);
+	const __m128 zero = _mm_setzero_ps();
+
+	UINT i = 0;
+
+	//4 vértices por iteración. Cada comparación produce una máscara por vértice que se combina con su bit
+	for(; i + 4 <= count; i += 4) 
+	{
+		const __m128 x = _mm_loadu_ps(vertices.x + i);
+		const __m128 y = _mm_loadu_ps(vertices.y + i);
+		const __m128 z = _mm_loadu_ps(vertices.z + i);
+		const __m128 w = _mm_loadu_ps(vertices.w + i);
+
+		__m128i code = _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(x, _mm_mul_ps(left, w))), _mm_set1_epi32(OUTCODE_LEFT));
+		code = _mm_or_si128(code, _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(x, _mm_mul_ps(right, w))), _mm_set1_epi32(OUTCODE_RIGHT)));
+		code = _mm_or_si128(code, _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(y, _mm_mul_ps(bottom, w))), _mm_set1_epi32(OUTCODE_BOTTOM)));
+		code = _mm_or_si128(code, _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(y, _mm_mul_ps(top, w))), _mm_set1_epi32(OUTCODE_TOP)));
+		code = _mm_or_si128(code, _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(z, zero)), _mm_set1_epi32(OUTCODE_NEAR)));
+		code = _mm_or_si128(code, _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(z, w)), _mm_set1_epi32(OUTCODE_FAR)));
+
+		//empaquetar los 4 enteros de 32 bits en 4 bytes consecutivos
+		code = _mm_packs_epi32(code, code);
+		code = _mm_packus_epi16(code, code);
+
+		const int packed = _mm_cvtsi128_si32(code);
+		memcpy(outcodes + i, &packed, 4);
+	}
+
+	for(; i < count; ++i)
+		outcodes[i] = Outcode(vertices.x[i], vertices.y[i], vertices.z[i], vertices.w[i]);
+}
+
+inline void SoftwareRasterizer::LoadVertex(const RasterVertices &vertices, const DWORD index, const bool loadAttributes, ClipVertex &v) const
+{
+	v.x = vertices.x[index];
+	v.y = vertices.y[index];
+	v.z = vertices.z[index];
+	v.w = vertices.w[index];
+
+	for(UINT i=0; i<RasterVertices::NUM_ATTRIBUTES; ++i)
+		v.attributes[i] = (loadAttributes && vertices.attributes[i]) ? vertices.attributes[i][index] : 0.0f;
+}
+
+//------------------------------------------------------------------------------------------
+// Sutherland-Hodgman contra el near plane (z >= 0) y los 4 planos de la guard band. 
+// polygon y temp deben tener lugar para MAX_CLIPPED_VERTICES vértices. El resultado queda 
+// en polygon y se devuelve la cantidad de vértices.
+//------------------------------------------------------------------------------------------
+UINT SoftwareRasterizer::ClipPolygon(ClipVertex *polygon, ClipVertex *temp, UINT count) const
+{
+	ClipVertex *input = polygon;
+	ClipVertex *output = temp;
+
+	for(UINT plane=0; plane<5 && count >= 3; ++plane) 
+	{
+		float distance[MAX_CLIPPED_VERTICES];
+		bool anyOutside = false;
+
+		for(UINT i=0; i<count; ++i) {
+			const ClipVertex &v = input[i];
+			switch(plane) 
+			{
+				case 0: distance[i] = v.z; break;
+				case 1: distance[i] = GUARD_BAND * v.w - v.x; break;
+				case 2: distance[i] = GUARD_BAND * v.w + v.x; break;
+				case 3: distance[i] = GUARD_BAND * v.w - v.y; break;
+				case 4: distance[i] = GUARD_BAND * v.w + v.y; break;
+			}
+			anyOutside |= distance[i] < 0.0f;
+		}
+
+		if(!anyOutside) continue;
+
+		UINT outCount = 0;
+		for(UINT i=0; i<count; ++i) 
+		{
+			const UINT next = (i + 1) % count;
+			const ClipVertex &a = input[i];
+			const ClipVertex &b = input[next];
+
+			if(distance[i] >= 0.0f && outCount < MAX_CLIPPED_VERTICES)
+				output[outCount++] = a;
+
+			//la arista cruza el plano => agregar la intersección
+			if((distance[i] >= 0.0f) != (distance[next] >= 0.0f) && outCount < MAX_CLIPPED_VERTICES) 
+			{
+				const float t = distance[i] / (distance[i] - distance[next]);
+				ClipVertex &v = output[outCount++];
+
+				v.x = a.x + t * (b.x - a.x);
+				v.y = a.y + t * (b.y - a.y);
+				v.z = a.z + t * (b.z - a.z);
+				v.w = a.w + t * (b.w - a.w);
+				for(UINT k=0; k<RasterVertices::NUM_ATTRIBUTES; ++k)
+					v.attributes[k] = a.attributes[k] + t * (b.attributes[k] - a.attributes[k]);
+			}
+		}
+
+		count = outCount;
+		std::swap(input, output);
+	}
+
+	if(input != polygon) {
+		for(UINT i=0; i<count; ++i)
+			polygon[i] = input[i];
+	}
+
+	return count;
+}
+
+inline void SoftwareRasterizer::ProjectVertex(const ClipVertex &v, ScreenVertex &s) const
+{
+	s.invW = 1.0f / v.w;
+
+	//viewport que cubre todo el render target
+	s.x = (v.x * s.invW * 0.5f + 0.5f) * m_width;
+	s.y = (0.5f - v.y * s.invW * 0.5f) * m_height;
+	s.z = v.z * s.invW;
+
+	for(UINT i=0; i<RasterVertices::NUM_ATTRIBUTES; ++i)
+		s.attributes[i] = v.attributes[i] * s.invW;
+}
+
+void SoftwareRasterizer::DrawTriangles(const RasterVertices &vertices, const DWORD * const indices, const UINT numTriangles, 
+                                       const UINT * const triangleMaterials, const RasterMaterial * const materials, const UINT flags)
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"SoftwareRasterizer::DrawTriangles");
+		return;
+	}
+
+	_ASSERT((flags & RASTER_DEPTH_ONLY) || (materials && triangleMaterials));
+
+	const bool depthOnly = (flags & RASTER_DEPTH_ONLY) != 0;
+
+	ClipVertex polygon[MAX_CLIPPED_VERTICES];
+	ClipVertex temp[MAX_CLIPPED_VERTICES];
+	ScreenVertex projected[MAX_CLIPPED_VERTICES];
+
+	for(UINT t=0; t<numTriangles; ++t) 
+	{
+		const RasterMaterial *material = (materials && triangleMaterials) ? &materials[triangleMaterials[t]] : NULL;
+
+		if((flags & RASTER_SKIP_TRANSPARENT) && material && material->transparent) continue;
+
+		const DWORD i0 = indices[t * 3];
+		const DWORD i1 = indices[t * 3 + 1];
+		const DWORD i2 = indices[t * 3 + 2];
+
+		unsigned char c0, c1, c2;
+		if(vertices.outcodes) {
+			c0 = vertices.outcodes[i0];
+			c1 = vertices.outcodes[i1];
+			c2 = vertices.outcodes[i2];
+		}
+		else {
+			c0 = Outcode(vertices.x[i0], vertices.y[i0], vertices.z[i0], vertices.w[i0]);
+			c1 = Outcode(vertices.x[i1], vertices.y[i1], vertices.z[i1], vertices.w[i1]);
+			c2 = Outcode(vertices.x[i2], vertices.y[i2], vertices.z[i2], vertices.w[i2]);
+		}
+
+		//los tres vértices fuera del mismo plano => el triángulo no es visible
+		if(c0 & c1 & c2) continue;
+
+		LoadVertex(vertices, i0, !depthOnly, polygon[0]);
+		LoadVertex(vertices, i1, !depthOnly, polygon[1]);
+		LoadVertex(vertices, i2, !depthOnly, polygon[2]);
+
+		UINT count = 3;
+		if(c0 | c1 | c2)
+			count = ClipPolygon(polygon, temp, count);
+
+		if(count < 3) continue;
+
+		for(UINT i=0; i<count; ++i)
+			ProjectVertex(polygon[i], projected[i]);
+
+		for(UINT i=1; i+1<count; ++i)
+			RasterizeTriangle(projected[0], projected[i], projected[i+1], material, t, flags);
+	}
+}
+
+void SoftwareRasterizer::RasterizeTriangle(const ScreenVertex &v0, const ScreenVertex &v1, const ScreenVertex &v2, const RasterMaterial * const material, 
+                                           const UINT triangle, const UINT flags)
+{
+	const ScreenVertex *a = &v0;
+	const ScreenVertex *b = &v1;
+	const ScreenVertex *c = &v2;
+
+	//área con signo (el doble). Positiva => sentido horario en pantalla (front face en D3D)
+	float area = (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
+
+	if(!(area > 0.0f)) {
+		if(!(area < 0.0f) || (flags & RASTER_CULL_BACK)) return;
+
+		std::swap(b, c);
+		area = -area;
+	}
+
+	//bounding box en pixeles (los centros de pixel están en +0.5) recortado por el scissor
+	const float minXf = min(a->x, min(b->x, c->x));
+	const float maxXf = max(a->x, max(b->x, c->x));
+	const float minYf = min(a->y, min(b->y, c->y));
+	const float maxYf = max(a->y, max(b->y, c->y));
+
+	const int minX = max((int) m_scissorLeft, (int) ceil(minXf - 0.5f));
+	const int maxX = min((int) m_scissorRight - 1, (int) floor(maxXf - 0.5f));
+	const int minY = max((int) m_scissorTop, (int) ceil(minYf - 0.5f));
+	const int maxY = min((int) m_scissorBottom - 1, (int) floor(maxYf - 0.5f));
+
+	if(minX > maxX || minY > maxY) return;
+
+	//edge functions evaluadas en los centros de pixel: e(x, y) = c + dx * x + dy * y
+	const ScreenVertex *edgeStart[3] = { b, c, a };
+	const ScreenVertex *edgeEnd[3] = { c, a, b };
+
+	float edgeC[3], edgeDx[3], edgeDy[3];
+	RasterPlane edges[3];
+
+	for(UINT i=0; i<3; ++i) {
+		const ScreenVertex &p = *edgeStart[i];
+		const ScreenVertex &q = *edgeEnd[i];
+
+		edgeDx[i] = -(q.y - p.y);
+		edgeDy[i] = q.x - p.x;
+		edgeC[i] = (q.y - p.y) * p.x - (q.x - p.x) * p.y + 0.5f * (edgeDx[i] + edgeDy[i]);
+
+		SetPlane(edges[i], edgeC[i], edgeDx[i], edgeDy[i]);
+	}
+
+	//planos de interpolación: f = fa + (fb - fa) * e1 / area + (fc - fa) * e2 / area
+	const float invArea = 1.0f / area;
+
+	const bool depthOnly = (flags & RASTER_DEPTH_ONLY) != 0;
+	const UINT numPlanes = depthOnly ? 1 : 2 + RasterVertices::NUM_ATTRIBUTES;
+
+	RasterPlane planes[2 + RasterVertices::NUM_ATTRIBUTES];
+	for(UINT i=0; i<numPlanes; ++i) 
+	{
+		float fa, fb, fc;
+		if(i == 0) { fa = a->z; fb = b->z; fc = c->z; }
+		else if(i == 1) { fa = a->invW; fb = b->invW; fc = c->invW; }
+		else { fa = a->attributes[i-2]; fb = b->attributes[i-2]; fc = c->attributes[i-2]; }
+
+		const float f1 = (fb - fa) * invArea;
+		const float f2 = (fc - fa) * invArea;
+
+		SetPlane(planes[i], fa + f1 * edgeC[1] + f2 * edgeC[2], f1 * edgeDx[1] + f2 * edgeDx[2], f1 * edgeDy[1] + f2 * edgeDy[2]);
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+	__m128 diffuse[3], ambient[3];
+	for(UINT i=0; i<3; ++i) {
+		diffuse[i] = _mm_set1_ps(material ? material->diffuse[i] : 0.0f);
+		ambient[i] = _mm_set1_ps(material ? material->ambient[i] : 0.0f);
+	}
+
+	const bool writeIds = (flags & RASTER_TRIANGLE_IDS) != 0;
+	const __m128i triangleId = _mm_set1_epi32((int) triangle);
+
+	const int tileMask = ~((int) TILE_SIZE - 1);
+
+	for(int tileY = minY & tileMask; tileY <= maxY; tileY += TILE_SIZE) 
+	{
+		const int y0 = max(tileY, minY);
+		const int y1 = min(tileY + (int) TILE_SIZE - 1, maxY);
+
+		for(int tileX = minX & tileMask; tileX <= maxX; tileX += TILE_SIZE) 
+		{
+			const int x0 = max(tileX, minX);
+			const int x1 = min(tileX + (int) TILE_SIZE - 1, maxX);
+
+			//descartar el tile si alguna edge function es negativa en sus 4 esquinas
+			bool outside = false;
+			for(UINT i=0; i<3 && !outside; ++i) {
+				const float maxEdge = edgeC[i] + max(edgeDx[i] * x0, edgeDx[i] * x1) + max(edgeDy[i] * y0, edgeDy[i] * y1);
+				outside = maxEdge < 0.0f;
+			}
+			if(outside) continue;
+
+			const __m128 laneMin = _mm_set1_ps((float) x0);
+			const __m128 laneMax = _mm_set1_ps((float) x1);
+
+			for(int y = y0; y <= y1; ++y) 
+			{
+				const __m128 py = _mm_set1_ps((float) y);
+
+				//tileX es múltiplo de 4 así que los loads quedan alineados
+				for(int x = tileX; x <= x1; x += 4) 
+				{
+					const __m128 px = _mm_add_ps(_mm_set1_ps((float) x), laneOffsets);
+
+					__m128 mask = _mm_and_ps(_mm_cmpge_ps(px, laneMin), _mm_cmple_ps(px, laneMax));
+					mask = _mm_and_ps(mask, _mm_cmpge_ps(EvaluatePlane(edges[0], px, py), zero));
+					mask = _mm_and_ps(mask, _mm_cmpge_ps(EvaluatePlane(edges[1], px, py), zero));
+					mask = _mm_and_ps(mask, _mm_cmpge_ps(EvaluatePlane(edges[2], px, py), zero));
+
+					if(_mm_movemask_ps(mask) == 0) continue;
+
+					//depth test LESS
+					const UINT offset = y * m_pitch + x;
+					const __m128 z = EvaluatePlane(planes[0], px, py);
+					const __m128 depth = _mm_load_ps(m_depth + offset);
+
+					mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmplt_ps(z, depth), _mm_cmpge_ps(z, zero)));
+
+					if(_mm_movemask_ps(mask) == 0) continue;
+
+					_mm_store_ps(m_depth + offset, Select(mask, z, depth));
+
+					__m128 color[3];
+					if(depthOnly) {
+						color[0] = color[1] = color[2] = zero;
+					}
+					else {
+						//corrección de perspectiva
+						const __m128 w = _mm_div_ps(one, EvaluatePlane(planes[1], px, py));
+
+						__m128 attributes[RasterVertices::NUM_ATTRIBUTES];
+						for(UINT i=0; i<RasterVertices::NUM_ATTRIBUTES; ++i)
+							attributes[i] = _mm_mul_ps(EvaluatePlane(planes[2+i], px, py), w);
+
+						for(UINT i=0; i<3; ++i) {
+							color[i] = _mm_add_ps(_mm_mul_ps(diffuse[i], attributes[i]), _mm_mul_ps(ambient[i], attributes[3]));
+							if(flags & RASTER_SATURATE)
+								color[i] = _mm_min_ps(_mm_max_ps(color[i], zero), one);
+						}
+					}
+
+					for(UINT i=0; i<3; ++i)
+						_mm_store_ps(m_color[i] + offset, Select(mask, color[i], _mm_load_ps(m_color[i] + offset)));
+
+					if(writeIds) {
+						__m128i * const ids = (__m128i *) (m_triangleIds + offset);
+						_mm_store_si128(ids, _mm_castps_si128(Select(mask, _mm_castsi128_ps(triangleId), _mm_castsi128_ps(_mm_load_si128(ids)))));
+					}
+				}
+			}
+		}
+	}
+}
+
+}
@@ -0,0 +1,183 @@
+﻿//------------------------------------------------------------------------------------------
+// File: SoftwareRasterizer.h
+//
+// Rasterizador de triángulos por software (C++ portable con intrínsecas SSE2). Procesa
+// vértices ya transformados a clip space, recorta contra el near plane y una guard band,
+// descarta triángulos con outcodes, y rasteriza por tiles de 8x8 evaluando las edge 
+// functions de a 4 pixeles. La profundidad y los atributos se interpolan con corrección de 
+// perspectiva. Es usado por SoftwareRadiosity para renderizar hemicubos y shadow maps sin GPU.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef SOFTWARE_RASTERIZER_H
+#define SOFTWARE_RASTERIZER_H
+
+#include <malloc.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Utility.h"
+
+using std::min;
+using std::max;
+
+namespace DTFramework
+{
+
+//flags de DrawTriangles
+enum RasterFlags 
+{ 
+	RASTER_CULL_BACK = 1,            //descartar triángulos en sentido antihorario (igual que D3D11_CULL_BACK)
+	RASTER_DEPTH_ONLY = 2,           //escribir sólo profundidad. El color de la geometría queda en negro
+	RASTER_SATURATE = 4,             //llevar el color final al rango [0, 1]
+	RASTER_SKIP_TRANSPARENT = 8,     //no dibujar los materiales marcados como transparentes
+	RASTER_TRIANGLE_IDS = 16         //escribir en el buffer de ids el índice del triángulo visible en cada pixel
+};
+
+//bits de los outcodes de cada vértice
+enum RasterOutcodes
+{
+	OUTCODE_LEFT = 1, OUTCODE_RIGHT = 2, OUTCODE_BOTTOM = 4, OUTCODE_TOP = 8, OUTCODE_NEAR = 16, OUTCODE_FAR = 32
+};
+
+//------------------------------------------------------------------------------------------
+// Color de un pixel: diffuse * (a0, a1, a2) + ambient * a3, donde a0..a3 son los atributos
+// interpolados de los vértices.
+//------------------------------------------------------------------------------------------
+struct RasterMaterial
+{
+	float diffuse[3];
+	float ambient[3];
+	bool transparent;
+};
+
+//vértices en clip space en formato SoA
+struct RasterVertices
+{
+	static const UINT NUM_ATTRIBUTES = 4;
+
+	const float *x;
+	const float *y;
+	const float *z;
+	const float *w;
+
+	const float *attributes[NUM_ATTRIBUTES];    //pueden ser NULL con RASTER_DEPTH_ONLY
+
+	const unsigned char *outcodes;              //calculados con ComputeOutcodes. NULL => se calculan por triángulo
+};
+
+class SoftwareRasterizer
+{
+public:
+	SoftwareRasterizer();
+	~SoftwareRasterizer();
+
+	//sólo debe llamarse a lo sumo una vez por objeto
+	HRESULT Init(const UINT width, const UINT height);
+
+	//rectángulo [left, right) x [top, bottom) en pixeles. Por defecto es todo el render target
+	void SetScissor(const UINT left, const UINT top, const UINT right, const UINT bottom);
+
+	//limpia todo el render target (no sólo el scissor). Los ids de triángulo quedan en NO_TRIANGLE
+	void Clear(const float depth=1.0f);
+
+	//calcula los outcodes de count vértices contra el volumen definido por el scissor actual
+	void ComputeOutcodes(const RasterVertices &vertices, const UINT count, unsigned char * const outcodes) const;
+
+	//dibuja numTriangles triángulos. triangleMaterials[i] es el índice en materials del triángulo i
+	void DrawTriangles(const RasterVertices &vertices, const DWORD * const indices, const UINT numTriangles, 
+	                   const UINT * const triangleMaterials, const RasterMaterial * const materials, const UINT flags);
+
+	UINT GetWidth() const;
+	UINT GetHeight() const;
+
+	//cantidad de floats por fila de los buffers (múltiplo de 4)
+	UINT GetPitch() const;
+
+	const float *GetDepthBuffer() const;
+	const float *GetColorBuffer(const UINT channel) const;    //channel: 0, 1, 2 = r, g, b
+
+	//índice (en el arreglo de DrawTriangles) del triángulo visible en cada pixel. Sólo se escribe con RASTER_TRIANGLE_IDS
+	const UINT *GetTriangleIdBuffer() const;
+
+	static const UINT NO_TRIANGLE = 0xFFFFFFFF;
+
+private:
+	struct ClipVertex
+	{
+		float x, y, z, w;
+		float attributes[RasterVertices::NUM_ATTRIBUTES];
+	};
+
+	struct ScreenVertex
+	{
+		float x, y, z, invW;
+		float attributes[RasterVertices::NUM_ATTRIBUTES];    //divididos por w
+	};
+
+	unsigned char Outcode(const float x, const float y, const float z, const float w) const;
+
+	void LoadVertex(const RasterVertices &vertices, const DWORD index, const bool loadAttributes, ClipVertex &v) const;
+	UINT ClipPolygon(ClipVertex *polygon, ClipVertex *temp, UINT count) const;
+	void ProjectVertex(const ClipVertex &v, ScreenVertex &s) const;
+
+	void RasterizeTriangle(const ScreenVertex &v0, const ScreenVertex &v1, const ScreenVertex &v2, const RasterMaterial * const material, 
+	                       const UINT triangle, const UINT flags);
+
+private:
+	static const UINT TILE_SIZE = 8;
+
+	//los triángulos que salen de la guard band se recortan para mantener la precisión de las edge functions
+	static const float GUARD_BAND;
+
+	//máximo de vértices luego de recortar un triángulo contra el near plane y los 4 planos de la guard band
+	static const UINT MAX_CLIPPED_VERTICES = 8;
+
+	UINT m_width;
+	UINT m_height;
+	UINT m_pitch;
+
+	//scissor en pixeles y en NDC
+	UINT m_scissorLeft, m_scissorTop, m_scissorRight, m_scissorBottom;
+	float m_ndcLeft, m_ndcRight, m_ndcBottom, m_ndcTop;
+
+	float *m_depth;
+	float *m_color[3];
+	UINT *m_triangleIds;
+
+	bool m_ready;
+};
+
+inline UINT SoftwareRasterizer::GetWidth() const
+{
+	return m_width;
+}
+inline UINT SoftwareRasterizer::GetHeight() const
+{
+	return m_height;
+}
+inline UINT SoftwareRasterizer::GetPitch() const
+{
+	return m_pitch;
+}
+inline const float *SoftwareRasterizer::GetDepthBuffer() const
+{
+	return m_depth;
+}
+inline const float *SoftwareRasterizer::GetColorBuffer(const UINT channel) const
+{
+	_ASSERT(channel < 3);
+
+	return m_color[channel];
+}
+inline const UINT *SoftwareRasterizer::GetTriangleIdBuffer() const
+{
+	return m_triangleIds;
+}
+
+}
+
+#endif
@@ -0,0 +1,231 @@
+﻿//------------------------------------------------------------------------------------------
+// File: ThreadPool.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "ThreadPool.h"
+
+namespace DTFramework
+{
+
+ThreadPool::ThreadPool()
+: m_task(0), m_grainSize(1), m_ranges(0), m_secondsPerCount(0), m_generation(0), m_activeWorkers(0), m_numThreads(1), m_stop(false), m_ready(false)
+{
+
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_workAvailable.notify_all();
+
+	for(UINT i=0; i<m_threads.size(); ++i)
+		m_threads[i].join();
+
+	SAFE_DELETE_ARRAY(m_ranges);
+}
+
+HRESULT ThreadPool::Init(const UINT numThreads)
+{
+	_ASSERT(!m_ready);
+
+	if(m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"ThreadPool::Init");
+		return E_FAIL;
+	}
+
+	m_numThreads = numThreads;
+	if(m_numThreads == 0)
+		m_numThreads = std::max(std::thread::hardware_concurrency(), (unsigned int) 1);
+
+	LARGE_INTEGER countsPerSecond;
+	QueryPerformanceFrequency(&countsPerSecond);
+	m_secondsPerCount = 1.0 / (double) countsPerSecond.QuadPart;
+
+	try 
+	{
+		m_ranges = new WorkRange[m_numThreads];
+		m_statistics.resize(m_numThreads);
+
+		//el hilo que llama a ParallelFor es el hilo 0, así que creamos uno menos
+		m_threads.reserve(m_numThreads - 1);
+		for(UINT i=1; i<m_numThreads; ++i)
+			m_threads.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+	}
+	catch (std::bad_alloc &) 
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+	catch (std::system_error &) 
+	{
+		ErrorWarning(L"ThreadPool::Init --> std::thread");
+		return E_FAIL;
+	}
+
+	m_ready = true;
+
+	return S_OK;
+}
+
+void ThreadPool::ParallelFor(const UINT count, const Task &task, const UINT grainSize)
+{
+	_ASSERT(m_ready);
+
+	if(!m_ready) {
+		MiscErrorWarning(INVALID_FUNCTION_CALL, L"ThreadPool::ParallelFor");
+		return;
+	}
+
+	if(count == 0) return;
+
+	for(UINT i=0; i<m_numThreads; ++i)
+		m_statistics[i] = ThreadStatistics();
+
+	m_task = &task;
+	m_grainSize = std::max(grainSize, (UINT) 1);
+
+	//sin hilos auxiliares o con un único índice no vale la pena despertar a nadie
+	if(m_threads.empty() || count == 1) {
+		m_ranges[0].begin = 0;
+		m_ranges[0].end = count;
+
+		RunTasks(0);
+
+		m_task = NULL;
+		return;
+	}
+
+	//rangos iniciales contiguos y del mismo tamaño. Los hilos todavía duermen, así que no hace falta bloquearlos
+	for(UINT i=0; i<m_numThreads; ++i) {
+		m_ranges[i].begin = (UINT) ((UINT64) count * i / m_numThreads);
+		m_ranges[i].end = (UINT) ((UINT64) count * (i+1) / m_numThreads);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_activeWorkers = m_threads.size();
+		++m_generation;
+	}
+	m_workAvailable.notify_all();
+
+	RunTasks(0);
+
+	//esperar a que todos los hilos auxiliares terminen antes de devolver el control
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(m_activeWorkers > 0)
+		m_workDone.wait(lock);
+
+	m_task = NULL;
+}
+
+void ThreadPool::RunTasks(const UINT threadIndex)
+{
+	ThreadStatistics &statistics = m_statistics[threadIndex];
+
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+
+	UINT begin, last;
+
+	for(;;) 
+	{
+		if(!PopIndices(threadIndex, begin, last)) {
+			//sin trabajo propio. Si tampoco hay nada para robar terminamos
+			if(!StealIndices(threadIndex)) break;
+
+			++statistics.steals;
+			continue;
+		}
+
+		for(UINT i=begin; i<last; ++i)
+			(*m_task)(i, threadIndex);
+
+		statistics.tasks += last - begin;
+	}
+
+	QueryPerformanceCounter(&end);
+	statistics.busyTime = (end.QuadPart - start.QuadPart) * m_secondsPerCount;
+}
+
+bool ThreadPool::PopIndices(const UINT threadIndex, UINT &begin, UINT &end)
+{
+	WorkRange &range = m_ranges[threadIndex];
+
+	std::lock_guard<std::mutex> lock(range.mutex);
+
+	if(range.begin >= range.end) return false;
+
+	begin = range.begin;
+	end = std::min(range.begin + m_grainSize, range.end);
+	range.begin = end;
+
+	return true;
+}
+
+//------------------------------------------------------------------------------------------
+// Roba la segunda mitad de los índices pendientes del primer hilo que tenga alguno y la pasa
+// a ser el rango propio. Sólo se llama cuando el rango propio está vacío. Los índices robados
+// no están en ningún rango mientras se mueven, pero como es el mismo hilo el que los va a
+// procesar nadie puede terminar antes de tiempo.
+//------------------------------------------------------------------------------------------
+bool ThreadPool::StealIndices(const UINT threadIndex)
+{
+	for(UINT i=1; i<m_numThreads; ++i) 
+	{
+		WorkRange &victim = m_ranges[(threadIndex + i) % m_numThreads];
+
+		UINT begin, end;
+		{
+			std::lock_guard<std::mutex> lock(victim.mutex);
+
+			if(victim.begin >= victim.end) continue;
+
+			begin = victim.begin + (victim.end - victim.begin) / 2;
+			end = victim.end;
+			victim.end = begin;
+		}
+
+		WorkRange &range = m_ranges[threadIndex];
+
+		std::lock_guard<std::mutex> lock(range.mutex);
+		range.begin = begin;
+		range.end = end;
+
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::WorkerLoop(const UINT threadIndex)
+{
+	UINT lastGeneration = 0;
+
+	for(;;) 
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while(!m_stop && m_generation == lastGeneration)
+				m_workAvailable.wait(lock);
+
+			if(m_stop) return;
+
+			lastGeneration = m_generation;
+		}
+
+		RunTasks(threadIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(--m_activeWorkers == 0)
+				m_workDone.notify_one();
+		}
+	}
+}
+
+}
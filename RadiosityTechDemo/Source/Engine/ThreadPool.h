@@ -0,0 +1,129 @@
+﻿//------------------------------------------------------------------------------------------
+// File: ThreadPool.h
+//
+// Conjunto de hilos persistentes para repartir trabajo independiente entre todos los
+// núcleos del procesador. ParallelFor ejecuta una tarea por índice y bloquea al hilo que
+// lo invoca (que también trabaja) hasta que todos los índices hayan sido procesados.
+// Los índices se reparten en rangos contiguos, uno por hilo. Un hilo que termina su rango
+// le roba la mitad de lo que le queda a otro (work stealing), así cada hilo procesa índices
+// consecutivos y aun así la carga queda balanceada.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <system_error>
+#include <algorithm>
+
+#include "Utility.h"
+
+using std::vector;
+
+namespace DTFramework
+{
+
+class ThreadPool
+{
+public:
+	//task(índice, número de hilo). El número de hilo está en [0, GetNumThreads())
+	typedef std::function<void (const UINT, const UINT)> Task;
+
+	//datos de un hilo durante el último ParallelFor
+	struct ThreadStatistics
+	{
+		UINT tasks;          //índices procesados
+		UINT steals;         //rangos robados a otros hilos
+		double busyTime;     //segundos desde que empezó a trabajar hasta que no encontró más índices
+
+		ThreadStatistics()
+		: tasks(0), steals(0), busyTime(0)
+		{
+
+		}
+	};
+
+	ThreadPool();
+	~ThreadPool();
+
+	//sólo debe llamarse a lo sumo una vez por objeto. numThreads == 0 => un hilo por núcleo lógico
+	HRESULT Init(const UINT numThreads=0);
+
+	//ejecuta task para todos los índices en [0, count). Cada hilo toma de a grainSize índices de su rango
+	void ParallelFor(const UINT count, const Task &task, const UINT grainSize=1);
+
+	UINT GetNumThreads() const;
+
+	const ThreadStatistics &GetLastRunStatistics(const UINT thread) const;
+
+private:
+	//rango de índices pendientes de un hilo. El dueño toma del principio y los ladrones del final
+	struct WorkRange
+	{
+		std::mutex mutex;
+		UINT begin;
+		UINT end;
+
+		char padding[64];    //evitar false sharing entre rangos de distintos hilos
+
+		WorkRange()
+		: begin(0), end(0)
+		{
+
+		}
+	};
+
+	void WorkerLoop(const UINT threadIndex);
+	void RunTasks(const UINT threadIndex);
+
+	bool PopIndices(const UINT threadIndex, UINT &begin, UINT &end);
+	bool StealIndices(const UINT threadIndex);
+
+	//no copiable
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+
+private:
+	vector<std::thread> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_workAvailable;
+	std::condition_variable m_workDone;
+
+	//trabajo actual
+	const Task *m_task;
+	UINT m_grainSize;
+	WorkRange *m_ranges;                     //uno por hilo
+
+	vector<ThreadStatistics> m_statistics;   //uno por hilo
+	double m_secondsPerCount;
+
+	UINT m_generation;        //se incrementa con cada ParallelFor para despertar a los hilos
+	UINT m_activeWorkers;     //hilos auxiliares que todavía no terminaron el trabajo actual
+
+	UINT m_numThreads;        //incluye al hilo que invoca ParallelFor
+
+	bool m_stop;
+	bool m_ready;
+};
+
+inline UINT ThreadPool::GetNumThreads() const
+{
+	return m_numThreads;
+}
+
+inline const ThreadPool::ThreadStatistics &ThreadPool::GetLastRunStatistics(const UINT thread) const
+{
+	_ASSERT(thread < m_statistics.size());
+
+	return m_statistics[thread];
+}
+
+}
+
+#endif
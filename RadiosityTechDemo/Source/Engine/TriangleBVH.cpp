@@ -0,0 +1,406 @@
+﻿//------------------------------------------------------------------------------------------
+// File: TriangleBVH.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "TriangleBVH.h"
+
+#include <cfloat>
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+namespace DTFramework
+{
+
+static inline float SurfaceArea(const D3DXVECTOR3 &boundsMin, const D3DXVECTOR3 &boundsMax)
+{
+	const D3DXVECTOR3 extent = boundsMax - boundsMin;
+
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+static inline float Component(const D3DXVECTOR3 &v, const UINT axis)
+{
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+TriangleBVH::TriangleBVH()
+: m_numTriangles(0)
+{
+
+}
+
+HRESULT TriangleBVH::Build(const float * const x, const float * const y, const float * const z, const DWORD * const indices,
+                           const UINT numTriangles, const UINT * const triangleMasks)
+{
+	m_nodes.clear();
+	m_packets.clear();
+	m_numTriangles = numTriangles;
+
+	if(numTriangles == 0)
+		return S_OK;
+
+	try
+	{
+		m_buildTriangles.resize(numTriangles);
+		m_order.resize(numTriangles);
+
+		for(UINT t=0; t<numTriangles; ++t)
+		{
+			BuildTriangle &triangle = m_buildTriangles[t];
+			triangle.boundsMin = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+			triangle.boundsMax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+			for(UINT k=0; k<3; ++k) {
+				const DWORD index = indices[t * 3 + k];
+				const D3DXVECTOR3 position(x[index], y[index], z[index]);
+
+				D3DXVec3Minimize(&triangle.boundsMin, &triangle.boundsMin, &position);
+				D3DXVec3Maximize(&triangle.boundsMax, &triangle.boundsMax, &position);
+			}
+
+			triangle.centroid = (triangle.boundsMin + triangle.boundsMax) * 0.5f;
+			m_order[t] = t;
+		}
+
+		const UINT leaves = (numTriangles + MAX_LEAF_TRIANGLES - 1) / MAX_LEAF_TRIANGLES;
+		m_nodes.reserve(2 * leaves);
+		m_packets.reserve(leaves);
+		m_nodes.resize(1);
+
+		vector<BuildTask> tasks;
+		vector<UINT> depths;
+
+		const BuildTask root = { 0, 0, numTriangles };
+		tasks.push_back(root);
+		depths.push_back(0);
+
+		while(!tasks.empty())
+		{
+			const BuildTask task = tasks.back();
+			const UINT depth = depths.back();
+			tasks.pop_back();
+			depths.pop_back();
+
+			D3DXVECTOR3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX);
+			D3DXVECTOR3 boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for(UINT i=task.begin; i<task.end; ++i) {
+				D3DXVec3Minimize(&boundsMin, &boundsMin, &m_buildTriangles[m_order[i]].boundsMin);
+				D3DXVec3Maximize(&boundsMax, &boundsMax, &m_buildTriangles[m_order[i]].boundsMax);
+			}
+
+			Node &node = m_nodes[task.node];
+			node.boundsMin[0] = boundsMin.x; node.boundsMin[1] = boundsMin.y; node.boundsMin[2] = boundsMin.z;
+			node.boundsMax[0] = boundsMax.x; node.boundsMax[1] = boundsMax.y; node.boundsMax[2] = boundsMax.z;
+
+			//con MAX_DEPTH niveles la pila de Intersect no se desborda; esas hojas tienen más de un paquete
+			if(task.end - task.begin <= MAX_LEAF_TRIANGLES || depth + 1 >= MAX_DEPTH) {
+				MakeLeaf(node, task.begin, task.end, x, y, z, indices, triangleMasks);
+				continue;
+			}
+
+			UINT axis;
+			UINT middle = PartitionSAH(task.begin, task.end, axis);
+
+			//centroides coincidentes o todos del mismo lado: partir por la mitad
+			if(middle == task.begin || middle == task.end) {
+				middle = task.begin + (task.end - task.begin) / 2;
+
+				const vector<BuildTriangle> &triangles = m_buildTriangles;
+				std::nth_element(m_order.begin() + task.begin, m_order.begin() + middle, m_order.begin() + task.end,
+				                 [&](const UINT a, const UINT b) {
+				                     return Component(triangles[a].centroid, axis) < Component(triangles[b].centroid, axis);
+				                 });
+			}
+
+			const UINT first = static_cast<UINT>(m_nodes.size());
+
+			//node deja de ser válida al agregar nodos
+			m_nodes[task.node].first = first;
+			m_nodes[task.node].flags = axis;
+			m_nodes.resize(first + 2);
+
+			const BuildTask right = { first + 1, middle, task.end };
+			const BuildTask left = { first, task.begin, middle };
+
+			tasks.push_back(right);
+			depths.push_back(depth + 1);
+			tasks.push_back(left);
+			depths.push_back(depth + 1);
+		}
+	}
+	catch (std::bad_alloc &)
+	{
+		MiscErrorWarning(BAD_ALLOC);
+		return E_FAIL;
+	}
+
+	//liberar los datos de construcción
+	vector<BuildTriangle>().swap(m_buildTriangles);
+	vector<UINT>().swap(m_order);
+
+	return S_OK;
+}
+
+void TriangleBVH::MakeLeaf(Node &node, const UINT begin, const UINT end, const float * const x, const float * const y, const float * const z,
+                           const DWORD * const indices, const UINT * const triangleMasks)
+{
+	const UINT numPackets = (end - begin + MAX_LEAF_TRIANGLES - 1) / MAX_LEAF_TRIANGLES;
+
+	node.first = static_cast<UINT>(m_packets.size());
+	node.flags = LEAF_FLAG | numPackets;
+
+	for(UINT p=0; p<numPackets; ++p)
+	{
+		TrianglePacket packet;
+		ZeroMemory(&packet, sizeof(packet));
+
+		for(UINT lane=0; lane<4; ++lane)
+		{
+			const UINT i = begin + p * 4 + lane;
+
+			if(i >= end) {
+				packet.triangle[lane] = NO_TRIANGLE;
+				packet.mask[lane] = 0xFFFFFFFF;
+				continue;
+			}
+
+			const UINT triangle = m_order[i];
+			const DWORD * const index = &indices[triangle * 3];
+
+			packet.v0x[lane] = x[index[0]];
+			packet.v0y[lane] = y[index[0]];
+			packet.v0z[lane] = z[index[0]];
+			packet.e1x[lane] = x[index[1]] - x[index[0]];
+			packet.e1y[lane] = y[index[1]] - y[index[0]];
+			packet.e1z[lane] = z[index[1]] - z[index[0]];
+			packet.e2x[lane] = x[index[2]] - x[index[0]];
+			packet.e2y[lane] = y[index[2]] - y[index[0]];
+			packet.e2z[lane] = z[index[2]] - z[index[0]];
+			packet.triangle[lane] = triangle;
+			packet.mask[lane] = triangleMasks ? triangleMasks[triangle] : 0;
+		}
+
+		m_packets.push_back(packet);
+	}
+}
+
+//------------------------------------------------------------------------------------------
+// SAH por bins: los centroides se reparten en SAH_BINS intervalos del eje más largo de su caja
+// y se elige, entre los SAH_BINS - 1 planos que separan intervalos, el de menor costo
+// área(izquierda) * triángulos(izquierda) + área(derecha) * triángulos(derecha).
+//------------------------------------------------------------------------------------------
+UINT TriangleBVH::PartitionSAH(const UINT begin, const UINT end, UINT &axis)
+{
+	D3DXVECTOR3 centroidMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	D3DXVECTOR3 centroidMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(UINT i=begin; i<end; ++i) {
+		D3DXVec3Minimize(&centroidMin, &centroidMin, &m_buildTriangles[m_order[i]].centroid);
+		D3DXVec3Maximize(&centroidMax, &centroidMax, &m_buildTriangles[m_order[i]].centroid);
+	}
+
+	const D3DXVECTOR3 extent = centroidMax - centroidMin;
+	axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+	const float axisMin = Component(centroidMin, axis);
+	const float axisExtent = Component(extent, axis);
+
+	if(axisExtent <= 0.0f)
+		return begin;
+
+	const float binScale = SAH_BINS / axisExtent;
+
+	UINT counts[SAH_BINS] = { 0 };
+	D3DXVECTOR3 binMin[SAH_BINS], binMax[SAH_BINS];
+	for(UINT b=0; b<SAH_BINS; ++b) {
+		binMin[b] = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+		binMax[b] = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	}
+
+	for(UINT i=begin; i<end; ++i)
+	{
+		const BuildTriangle &triangle = m_buildTriangles[m_order[i]];
+		const UINT b = min(SAH_BINS - 1, static_cast<UINT>((Component(triangle.centroid, axis) - axisMin) * binScale));
+
+		++counts[b];
+		D3DXVec3Minimize(&binMin[b], &binMin[b], &triangle.boundsMin);
+		D3DXVec3Maximize(&binMax[b], &binMax[b], &triangle.boundsMax);
+	}
+
+	//costo de la parte derecha de cada plano, recorriendo los bins desde el último
+	float rightCost[SAH_BINS];
+	{
+		D3DXVECTOR3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX), boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		UINT count = 0;
+		for(UINT b=SAH_BINS-1; b>0; --b) {
+			count += counts[b];
+			D3DXVec3Minimize(&boundsMin, &boundsMin, &binMin[b]);
+			D3DXVec3Maximize(&boundsMax, &boundsMax, &binMax[b]);
+			rightCost[b] = count > 0 ? SurfaceArea(boundsMin, boundsMax) * count : 0.0f;
+		}
+	}
+
+	UINT bestSplit = 0;
+	float bestCost = FLT_MAX;
+	{
+		D3DXVECTOR3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX), boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		UINT count = 0;
+		for(UINT b=1; b<SAH_BINS; ++b) {
+			count += counts[b - 1];
+			D3DXVec3Minimize(&boundsMin, &boundsMin, &binMin[b - 1]);
+			D3DXVec3Maximize(&boundsMax, &boundsMax, &binMax[b - 1]);
+
+			const float cost = (count > 0 ? SurfaceArea(boundsMin, boundsMax) * count : 0.0f) + rightCost[b];
+			if(cost < bestCost) {
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+	}
+
+	const vector<BuildTriangle> &triangles = m_buildTriangles;
+	const vector<UINT>::iterator middle = std::partition(m_order.begin() + begin, m_order.begin() + end, [&](const UINT t) {
+		return min(SAH_BINS - 1, static_cast<UINT>((Component(triangles[t].centroid, axis) - axisMin) * binScale)) < bestSplit;
+	});
+
+	return static_cast<UINT>(middle - m_order.begin());
+}
+
+static inline bool IntersectBox(const float * const boundsMin, const float * const boundsMax, const D3DXVECTOR3 &origin,
+                                const D3DXVECTOR3 &inverseDirection, const float tMin, const float tMax)
+{
+	const float o[3] = { origin.x, origin.y, origin.z };
+	const float inverse[3] = { inverseDirection.x, inverseDirection.y, inverseDirection.z };
+
+	float tNear = tMin, tFar = tMax;
+	for(UINT a=0; a<3; ++a) {
+		float t0 = (boundsMin[a] - o[a]) * inverse[a];
+		float t1 = (boundsMax[a] - o[a]) * inverse[a];
+		if(t0 > t1) std::swap(t0, t1);
+
+		tNear = max(tNear, t0);
+		tFar = min(tFar, t1);
+	}
+
+	return tNear <= tFar;
+}
+
+bool TriangleBVH::Intersect(const D3DXVECTOR3 &origin, const D3DXVECTOR3 &direction, const float tMin, const float tMax,
+                            const UINT ignoreMask, const bool cullBack, TriangleHit &hit) const
+{
+	if(m_nodes.empty())
+		return false;
+
+	const D3DXVECTOR3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	const bool negative[3] = { direction.x < 0.0f, direction.y < 0.0f, direction.z < 0.0f };
+
+	hit.triangle = NO_TRIANGLE;
+	hit.t = tMax;
+
+	UINT stack[MAX_DEPTH];
+	UINT stackSize = 0;
+	UINT current = 0;
+
+	for(;;)
+	{
+		const Node &node = m_nodes[current];
+
+		if(IntersectBox(node.boundsMin, node.boundsMax, origin, inverseDirection, tMin, hit.t))
+		{
+			if(!(node.flags & LEAF_FLAG))
+			{
+				//primero el hijo más cercano en el eje de la partición
+				const bool swapChildren = negative[node.flags];
+				stack[stackSize++] = swapChildren ? node.first : node.first + 1;
+				current = swapChildren ? node.first + 1 : node.first;
+				continue;
+			}
+
+			const UINT numPackets = node.flags & ~LEAF_FLAG;
+			for(UINT p=0; p<numPackets; ++p)
+				IntersectPacket(m_packets[node.first + p], origin, direction, tMin, ignoreMask, cullBack, hit);
+		}
+
+		if(stackSize == 0) break;
+		current = stack[--stackSize];
+	}
+
+	return hit.triangle != NO_TRIANGLE;
+}
+
+//------------------------------------------------------------------------------------------
+// Möller-Trumbore de a 4 triángulos. det > 0 cuando el triángulo está en sentido horario visto
+// desde el origen del rayo (la cara de adelante en Direct3D). Sólo actualiza hit si encuentra
+// una intersección más cercana que hit.t.
+//------------------------------------------------------------------------------------------
+bool TriangleBVH::IntersectPacket(const TrianglePacket &packet, const D3DXVECTOR3 &origin, const D3DXVECTOR3 &direction, const float tMin,
+                                  const UINT ignoreMask, const bool cullBack, TriangleHit &hit) const
+{
+	const __m128 dx = _mm_set1_ps(direction.x);
+	const __m128 dy = _mm_set1_ps(direction.y);
+	const __m128 dz = _mm_set1_ps(direction.z);
+
+	const __m128 e1x = _mm_loadu_ps(packet.e1x), e1y = _mm_loadu_ps(packet.e1y), e1z = _mm_loadu_ps(packet.e1z);
+	const __m128 e2x = _mm_loadu_ps(packet.e2x), e2y = _mm_loadu_ps(packet.e2y), e2z = _mm_loadu_ps(packet.e2z);
+
+	//p = direction x e2
+	const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+	const __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	const __m128 inverseDeterminant = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+	//s = origin - v0
+	const __m128 sx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(packet.v0x));
+	const __m128 sy = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(packet.v0y));
+	const __m128 sz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(packet.v0z));
+
+	const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDeterminant);
+
+	//q = s x e1
+	const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+	const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDeterminant);
+	const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDeterminant);
+
+	const __m128 zero = _mm_setzero_ps();
+
+	//los lugares libres del paquete tienen determinante 0
+	__m128 valid = cullBack ? _mm_cmpgt_ps(determinant, zero) : _mm_cmpneq_ps(determinant, zero);
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+	valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+	valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, _mm_set1_ps(tMin)));
+	valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(hit.t)));
+
+	const int lanes = _mm_movemask_ps(valid);
+	if(lanes == 0)
+		return false;
+
+	float ts[4], us[4], vs[4];
+	_mm_storeu_ps(ts, t);
+	_mm_storeu_ps(us, u);
+	_mm_storeu_ps(vs, v);
+
+	bool found = false;
+	for(UINT lane=0; lane<4; ++lane)
+	{
+		if(!(lanes & (1 << lane)) || (packet.mask[lane] & ignoreMask) || ts[lane] >= hit.t) continue;
+
+		hit.triangle = packet.triangle[lane];
+		hit.t = ts[lane];
+		hit.u = us[lane];
+		hit.v = vs[lane];
+		found = true;
+	}
+
+	return found;
+}
+
+}
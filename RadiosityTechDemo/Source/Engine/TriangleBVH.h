@@ -0,0 +1,124 @@
+﻿//------------------------------------------------------------------------------------------
+// File: TriangleBVH.h
+//
+// Bounding volume hierarchy binaria sobre los triángulos de una mesh para lanzar rayos desde
+// la CPU. Se construye con SAH por bins sobre los centroides. Las hojas tienen paquetes de 4
+// triángulos en formato SoA (vértice y dos aristas precalculados) que se intersecan con
+// Möller-Trumbore de a 4 triángulos con intrínsecas SSE2. Es de sólo lectura luego de
+// Build, así que varios hilos pueden intersecar rayos a la vez.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef TRIANGLE_BVH_H
+#define TRIANGLE_BVH_H
+
+#include <emmintrin.h>
+
+#include "Utility.h"
+
+using std::vector;
+
+namespace DTFramework
+{
+
+//intersección más cercana de un rayo
+struct TriangleHit
+{
+	UINT triangle;      //índice del triángulo en el arreglo de índices de Build
+	float t;            //distancia a lo largo de la dirección (normalizada) del rayo
+	float u, v;         //coordenadas baricéntricas de los vértices 1 y 2. La del vértice 0 es 1 - u - v
+};
+
+class TriangleBVH
+{
+public:
+	TriangleBVH();
+
+	//x, y, z: posiciones de los vértices en formato SoA. triangleMasks puede ser NULL (todos los triángulos con máscara 0)
+	HRESULT Build(const float * const x, const float * const y, const float * const z, const DWORD * const indices,
+	              const UINT numTriangles, const UINT * const triangleMasks);
+
+	//intersección más cercana con t en (tMin, tMax). Se ignoran los triángulos con (máscara & ignoreMask) != 0 y, con cullBack,
+	//los que se ven de atrás (sentido antihorario desde el origen, igual que D3D11_CULL_BACK). direction debe estar normalizada
+	bool Intersect(const D3DXVECTOR3 &origin, const D3DXVECTOR3 &direction, const float tMin, const float tMax,
+	               const UINT ignoreMask, const bool cullBack, TriangleHit &hit) const;
+
+	UINT GetNumNodes() const;
+	UINT GetNumTriangles() const;
+
+	static const UINT NO_TRIANGLE = 0xFFFFFFFF;
+
+private:
+	//32 bytes. Interior: los hijos son first y first + 1. Hoja: first es el índice del paquete de triángulos
+	struct Node
+	{
+		float boundsMin[3];
+		UINT first;
+		float boundsMax[3];
+		UINT flags;         //LEAF_FLAG o el eje de la partición (0, 1, 2)
+	};
+
+	//4 triángulos en formato SoA. Los lugares libres tienen aristas nulas (determinante 0: nunca se intersecan)
+	struct TrianglePacket
+	{
+		float v0x[4], v0y[4], v0z[4];
+		float e1x[4], e1y[4], e1z[4];
+		float e2x[4], e2y[4], e2z[4];
+		UINT triangle[4];
+		UINT mask[4];
+	};
+
+	//datos de cada triángulo durante la construcción
+	struct BuildTriangle
+	{
+		D3DXVECTOR3 boundsMin;
+		D3DXVECTOR3 boundsMax;
+		D3DXVECTOR3 centroid;
+	};
+
+	//rango [begin, end) de m_order que cubre el nodo node
+	struct BuildTask
+	{
+		UINT node;
+		UINT begin;
+		UINT end;
+	};
+
+	void MakeLeaf(Node &node, const UINT begin, const UINT end, const float * const x, const float * const y, const float * const z,
+	              const DWORD * const indices, const UINT * const triangleMasks);
+
+	//posición de m_order donde se parte el rango con SAH por bins, o begin si conviene no partir
+	UINT PartitionSAH(const UINT begin, const UINT end, UINT &axis);
+
+	bool IntersectPacket(const TrianglePacket &packet, const D3DXVECTOR3 &origin, const D3DXVECTOR3 &direction, const float tMin,
+	                     const UINT ignoreMask, const bool cullBack, TriangleHit &hit) const;
+
+private:
+	static const UINT LEAF_FLAG = 0x80000000;
+	static const UINT MAX_LEAF_TRIANGLES = 4;
+	static const UINT SAH_BINS = 16;
+	static const UINT MAX_DEPTH = 64;
+
+	vector<Node> m_nodes;
+	vector<TrianglePacket> m_packets;
+	UINT m_numTriangles;
+
+	//sólo durante Build
+	vector<BuildTriangle> m_buildTriangles;
+	vector<UINT> m_order;
+};
+
+inline UINT TriangleBVH::GetNumNodes() const
+{
+	return static_cast<UINT>(m_nodes.size());
+}
+
+inline UINT TriangleBVH::GetNumTriangles() const
+{
+	return m_numTriangles;
+}
+
+}
+
+#endif
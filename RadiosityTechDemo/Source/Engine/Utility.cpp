@@ -7,9 +7,28 @@
 
 #include "Utility.h"
 
+#include <cstdio>
+
 namespace DTFramework
 {
 
+static bool g_consoleErrorOutput = false;
+
+void SetConsoleErrorOutput(const bool enable)
+{
+	g_consoleErrorOutput = enable;
+}
+
+void ErrorMessage(LPCWSTR text, LPCWSTR title)
+{
+	if(g_consoleErrorOutput) {
+		fwprintf(stderr, L"%s: %s\n", title ? title : L"Error", text ? text : L"");
+		fflush(stderr);
+	} else {
+		MessageBox(NULL, text, title, MB_OK);
+	}
+}
+
 void MiscErrorWarning(UINT errorCode, LPCWSTR lpcwsFunction)
 {
 	LPCWSTR lpMsgBuf;
@@ -86,7 +105,7 @@ void MiscErrorWarning(UINT errorCode, LPCWSTR lpcwsFunction)
 			lpMsgBuf = L"Error desconocido";
 	}
 
-	MessageBox(NULL, lpMsgBuf, titulo, MB_OK);
+	ErrorMessage(lpMsgBuf, titulo);
 }
 
 void ErrorWarning(LPCWSTR lpcwsFunction)
@@ -100,10 +119,10 @@ void ErrorWarning(LPCWSTR lpcwsFunction)
 
 	//Imprimir mensaje de error y terminar el proceso
 	LPCWSTR lpDisplayBuf = new (std::nothrow) WCHAR[wcslen(lpcwsFunction)+ wcslen((LPCWSTR)lpMsgBuf) + 40];
-	if(lpDisplayBuf == NULL) { MessageBox(NULL, NULL, L"Error", MB_OK); return; }
+	if(lpDisplayBuf == NULL) { ErrorMessage(NULL, L"Error"); return; }
 	wsprintf((LPWSTR)lpDisplayBuf, L"%s ha fallado con error %d: %s\0", lpcwsFunction, dw, lpMsgBuf);
 	
-	MessageBox(NULL, (LPCTSTR)lpDisplayBuf, L"Error", MB_OK);
+	ErrorMessage((LPCTSTR)lpDisplayBuf, L"Error");
 
 	SAFE_DELETE_ARRAY(lpDisplayBuf);
 }
@@ -152,10 +171,10 @@ void COMErrorWarning(HRESULT hr, LPCWSTR lpcwsFunction)
 	}
 
 	LPCWSTR lpDisplayBuf = new (std::nothrow) WCHAR[wcslen(lpMsgBuf)+wcslen(lpcwsFunction)+50];
-	if(lpDisplayBuf == NULL) { MessageBox(NULL, NULL, L"Error COM", MB_OK); return; }
+	if(lpDisplayBuf == NULL) { ErrorMessage(NULL, L"Error COM"); return; }
 	wsprintf((LPWSTR)lpDisplayBuf, L"La función %s ha fallado. Mensaje de error: %s", lpcwsFunction, lpMsgBuf);
 
-	MessageBox(NULL, (LPCTSTR)lpDisplayBuf, L"Error COM", MB_OK);
+	ErrorMessage((LPCTSTR)lpDisplayBuf, L"Error COM");
 
 	SAFE_DELETE_ARRAY(lpDisplayBuf);
 }
@@ -239,10 +258,10 @@ void DXGI_D3D_ErrorWarning(HRESULT hr, LPCWSTR lpcwsFunction)
 	}
 
 	LPCWSTR lpDisplayBuf = new (std::nothrow) WCHAR[wcslen(lpMsgBuf)+wcslen(lpcwsFunction)+50];
-	if(lpDisplayBuf == NULL) { MessageBox(NULL, NULL, L"Error DXGI - D3D", MB_OK); return; } 
+	if(lpDisplayBuf == NULL) { ErrorMessage(NULL, L"Error DXGI - D3D"); return; } 
 	wsprintf((LPWSTR)lpDisplayBuf, L"La función %s ha fallado. Mensaje de error: %s", lpcwsFunction, lpMsgBuf);
 
-	MessageBox(NULL, (LPCTSTR)lpDisplayBuf, L"Error DXGI - D3D", MB_OK);
+	ErrorMessage((LPCTSTR)lpDisplayBuf, L"Error DXGI - D3D");
 
 	SAFE_DELETE_ARRAY(lpDisplayBuf);
 }
@@ -49,6 +49,8 @@
 #define MESHES_DIRECTORY        L"Assets/Meshes/"
 #define TEXTURES_DIRECTORY      L"Assets/Textures/"
 #define SHADERS_DIRECTORY       L"Assets/Shaders/"
+#define GI_CACHE_DIRECTORY      L"Assets/GICache/"
+#define MESH_CACHE_DIRECTORY    L"Assets/MeshCache/"
 
 namespace DTFramework
 {
@@ -95,6 +97,12 @@ namespace
 	const UINT INVALID_FUNCTION_CALL = 20;
 }
 
+//redirigir los mensajes de error a la consola (stderr) en lugar de MessageBox. Para procesos sin ventana
+void SetConsoleErrorOutput(const bool enable);
+
+//mostrar un mensaje de error con el título dado. MessageBox o consola según SetConsoleErrorOutput
+void ErrorMessage(LPCWSTR text, LPCWSTR title);
+
 //mostrar errores de funciones windows
 void ErrorWarning(LPCWSTR lpcwsFunction);
 
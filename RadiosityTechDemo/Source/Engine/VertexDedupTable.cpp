@@ -0,0 +1,64 @@
+﻿//------------------------------------------------------------------------------------------
+// File: VertexDedupTable.cpp
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#include "VertexDedupTable.h"
+
+namespace DTFramework
+{
+
+//generación 1 para que las ranuras en cero estén libres
+VertexDedupTable::VertexDedupTable()
+: m_mask(0), m_size(0), m_generation(1)
+{
+
+}
+
+void VertexDedupTable::Reserve(const UINT numVertices)
+{
+	UINT capacity = MIN_CAPACITY;
+	while(capacity < 0x80000000 && capacity / 2 < numVertices) capacity *= 2;
+
+	if(capacity > m_mask + 1)
+		Grow(capacity);
+}
+
+void VertexDedupTable::Clear()
+{
+	m_size = 0;
+
+	//al dar la vuelta el contador, una ranura vieja podría parecer de la generación actual
+	if(++m_generation == 0) {
+		for(UINT i=0; i<m_slots.size(); ++i)
+			m_slots[i].generation = 0;
+		m_generation = 1;
+	}
+}
+
+void VertexDedupTable::Grow(const UINT capacity)
+{
+	Slot emptySlot;
+	ZeroMemory(&emptySlot, sizeof(Slot));
+
+	vector<Slot> slots(capacity > MIN_CAPACITY ? capacity : MIN_CAPACITY, emptySlot);
+	const UINT mask = static_cast<UINT>(slots.size()) - 1;
+
+	//sólo las ranuras de la generación actual. Las nuevas quedan en la generación actual y las libres en 0
+	for(UINT i=0; i<m_slots.size(); ++i)
+	{
+		const Slot &slot = m_slots[i];
+		if(slot.generation != m_generation) continue;
+
+		UINT j = Hash(slot.position, slot.texCoord, slot.normal) & mask;
+		while(slots[j].generation == m_generation) j = (j + 1) & mask;
+
+		slots[j] = slot;
+	}
+
+	m_slots.swap(slots);
+	m_mask = mask;
+}
+
+}
@@ -0,0 +1,109 @@
+﻿//------------------------------------------------------------------------------------------
+// File: VertexDedupTable.h
+//
+// Tabla hash de direccionamiento abierto (sondeo lineal) de los vértices ya agregados a una
+// mesh, con clave la terna de índices (posición, coordenada de textura, normal) del .obj.
+// Las ranuras están en un único arreglo, sin vectores por bucket. Clear es O(1): cada ranura
+// guarda la generación en la que se escribió y sólo las de la generación actual están ocupadas.
+//
+// Author: Gabriel Clavero
+//------------------------------------------------------------------------------------------
+
+#ifndef VERTEX_DEDUP_TABLE_H
+#define VERTEX_DEDUP_TABLE_H
+
+#include "Utility.h"
+
+using std::vector;
+
+namespace DTFramework
+{
+
+class VertexDedupTable
+{
+public:
+	VertexDedupTable();
+
+	//reserva lugar para numVertices vértices por generación sin volver a crecer. Puede lanzar std::bad_alloc
+	void Reserve(const UINT numVertices);
+
+	//vacía la tabla en O(1)
+	void Clear();
+
+	//índice del vértice con esa terna. Si no estaba, lo agrega con newIndex y devuelve newIndex. Puede lanzar std::bad_alloc
+	DWORD FindOrInsert(const UINT position, const UINT texCoord, const UINT normal, const DWORD newIndex);
+
+	UINT GetSize() const;
+
+private:
+	struct Slot
+	{
+		UINT position;
+		UINT texCoord;
+		UINT normal;
+		DWORD index;
+		UINT generation;    //ocupada sólo si es m_generation
+	};
+
+	static UINT Hash(const UINT position, const UINT texCoord, const UINT normal);
+
+	//duplica la capacidad y vuelve a insertar las ranuras de la generación actual
+	void Grow(const UINT capacity);
+
+private:
+	static const UINT MIN_CAPACITY = 1024;
+
+	vector<Slot> m_slots;
+	UINT m_mask;            //capacidad - 1 (la capacidad es potencia de 2)
+	UINT m_size;            //ranuras ocupadas en la generación actual
+	UINT m_generation;
+};
+
+inline UINT VertexDedupTable::GetSize() const
+{
+	return m_size;
+}
+
+inline UINT VertexDedupTable::Hash(const UINT position, const UINT texCoord, const UINT normal)
+{
+	UINT h = position * 0x9E3779B1 ^ texCoord * 0x85EBCA77 ^ normal * 0xC2B2AE3D;
+
+	//función de finalización de MurmurHash3
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+inline DWORD VertexDedupTable::FindOrInsert(const UINT position, const UINT texCoord, const UINT normal, const DWORD newIndex)
+{
+	//factor de carga máximo 1/2: los sondeos son cortos
+	if((m_size + 1) * 2 > m_mask + 1)
+		Grow((m_mask + 1) * 2);
+
+	for(UINT i = Hash(position, texCoord, normal) & m_mask; ; i = (i + 1) & m_mask)
+	{
+		Slot &slot = m_slots[i];
+
+		if(slot.generation != m_generation) {
+			slot.position = position;
+			slot.texCoord = texCoord;
+			slot.normal = normal;
+			slot.index = newIndex;
+			slot.generation = m_generation;
+			++m_size;
+
+			return newIndex;
+		}
+
+		if(slot.position == position && slot.texCoord == texCoord && slot.normal == normal)
+			return slot.index;
+	}
+}
+
+}
+
+#endif
@@ -0,0 +1,617 @@
+﻿#include "Engine\GIBaker.h"
+#include "Engine\HemicubeIntegrator.h"
+#include "Engine\OBJParser.h"
+#include "Engine\VertexDedupTable.h"
+#include "Engine\MeshOptimizer.h"
+#include "Engine\CompactVertexCodec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cwchar>
+#include <cfloat>
+
+//lado en cuadrados de la grilla del .obj de -benchmeshload
+static const UINT MESH_BENCHMARK_GRID = 1024;
+
+//uso: RadiosityBaker <escena.txt> [-bounces N] [-batch N] [-out archivo] [-profile] [-software] [-rays N] [-threads N] [-facesize N] [-half] [-rerender] [-progressive] [-tolerance X] [-irradiancecache X] [-noweld] [-nocache] [-lod X] [-lodreport]
+//     RadiosityBaker -benchintegration
+//     RadiosityBaker -benchmeshload
+//debe ejecutarse desde el directorio que contiene Assets (Bin)
+static void PrintUsage()
+{
+	fwprintf(stderr, L"uso: RadiosityBaker <escena.txt> [-bounces N] [-batch N] [-out archivo] [-profile] [-software] [-rays N] [-threads N] [-facesize N] [-half] [-rerender] [-progressive] [-tolerance X] "
+	                 L"[-irradiancecache X] [-noweld] [-nocache] [-lod X] [-lodreport]\n");
+	fwprintf(stderr, L"  -bounces N   cantidad de pasadas del algoritmo (por defecto %u)\n", DTFramework::BakerConfig::DEFAULT_BOUNCES);
+	fwprintf(stderr, L"  -batch N     vertices procesados por cada renderizacion de hemicubos (por defecto %u)\n", DTFramework::BakerConfig::DEFAULT_VERTICES_BAKED_PER_DISPATCH);
+	fwprintf(stderr, L"  -out archivo archivo binario de salida con la irradiancia por vertice (por defecto gi.bin)\n");
+	fwprintf(stderr, L"  -profile     escribe profiling.txt\n");
+	fwprintf(stderr, L"  -software    renderiza los hemicubos con el rasterizador por software (sin GPU)\n");
+	fwprintf(stderr, L"  -rays N      lanza N rayos por vertice contra una BVH en la CPU en lugar de renderizar hemicubos, entre 1 y %u\n", 
+	        DTFramework::RayTracedRadiosity::MAX_RAYS_PER_VERTEX);
+	fwprintf(stderr, L"               (por ejemplo %u). Admite -rerender y -progressive como -software\n", DTFramework::RayTracedRadiosity::DEFAULT_RAYS_PER_VERTEX);
+	fwprintf(stderr, L"  -threads N   hilos para integrar (y renderizar con -software) los hemicubos (por defecto uno por nucleo)\n");
+	fwprintf(stderr, L"  -facesize N  lado en texels de las caras de los hemicubos: 32, 64, 128 o 256 (por defecto el de la escena o %u)\n", 
+	        DTFramework::Radiosity::DEFAULT_HEMICUBE_FACE_SIZE);
+	fwprintf(stderr, L"  -half        renderiza los hemicubos en half float: la mitad de lectura por hemicubo (se ignora con -software)\n");
+	fwprintf(stderr, L"  -rerender    con -software o -rays, renderiza los hemicubos en todos los rebotes en lugar de reutilizar los form factors del primero\n");
+	fwprintf(stderr, L"  -progressive con -software o -rays, refinamiento progresivo (shooting) hasta converger en lugar de una cantidad fija de rebotes\n");
+	fwprintf(stderr, L"  -tolerance X con -progressive, fraccion de la energia inicial sin distribuir a la que se detiene (por defecto %g)\n", 
+	        DTFramework::SoftwareRadiosity::DEFAULT_CONVERGENCE_TOLERANCE);
+	fwprintf(stderr, L"  -irradiancecache X  renderiza solo los hemicubos de las muestras de un cache de irradiancia con error maximo X en (0, 1),\n");
+	fwprintf(stderr, L"               por ejemplo %g, e interpola los demas vertices\n", DTFramework::IrradianceCache::DEFAULT_MAX_ERROR);
+	fwprintf(stderr, L"  -noweld      renderiza un hemicubo por vertice aunque otro tenga la misma posicion y normal\n");
+	fwprintf(stderr, L"  -nocache     calcula la GI aunque haya un resultado en el cache para la escena\n");
+	fwprintf(stderr, L"  -lod X       dibuja en los hemicubos los clusters de los objetos con lod N con el nivel de detalle mas simple cuyo error\n");
+	fwprintf(stderr, L"               proyectado es a lo sumo X texels, por ejemplo 0.5 (se ignora con -software y -rays)\n");
+	fwprintf(stderr, L"  -lodreport   con -lod, calcula tambien la GI con la geometria completa e informa la diferencia y los tiempos\n");
+	fwprintf(stderr, L"       RadiosityBaker -benchintegration\n");
+	fwprintf(stderr, L"  mide texels por segundo de cada kernel de integracion soportado por el procesador, por tamano de cara y formato (un hilo)\n");
+	fwprintf(stderr, L"       RadiosityBaker -benchmeshload\n");
+	fwprintf(stderr, L"  mide la lectura de un .obj sintetico de %u caras, la eliminacion de vertices duplicados, la optimizacion de la mesh\n"
+	                 L"  y el error y la velocidad de la codificacion de vertices compactos\n", 2 * MESH_BENCHMARK_GRID * MESH_BENCHMARK_GRID);
+}
+
+//------------------------------------------------------------------------------------------
+// Microbenchmark de los kernels de HemicubeIntegrator con hemicubos sintéticos, para cada
+// tamaño de cara soportado y para los dos formatos de la textura de hemicubos (float y half).
+// Se usan más hemicubos de los que entran en la caché para medir también la lectura de
+// memoria, como ocurre al integrar la textura de hemicubos real. Para half se informa también
+// el máximo error relativo de la irradiancia respecto de float.
+//------------------------------------------------------------------------------------------
+static int BenchmarkIntegrationKernels()
+{
+	using DTFramework::HemicubeIntegrator;
+	using DTFramework::IntegrationKernel;
+	using DTFramework::Radiosity;
+
+	//todos los tamaños leen la misma cantidad de texels: 64 hemicubos de 64x64
+	const UINT ATLAS_TEXELS = 64 * 64 * 64 * HemicubeIntegrator::NUM_FACES;
+	const UINT REPETITIONS = 32;
+
+	std::vector<float> atlas;
+	std::vector<UINT16> halfAtlas;
+	std::vector<float> reference;
+	try 
+	{
+		atlas.resize(ATLAS_TEXELS * 4);
+		halfAtlas.resize(ATLAS_TEXELS * 4);
+	}
+	catch (std::bad_alloc &) 
+	{
+		DTFramework::MiscErrorWarning(DTFramework::BAD_ALLOC);
+		return 2;
+	}
+
+	//valores HDR (hasta 16) como los de un cielo o una luz vista directamente
+	for(UINT i=0; i<atlas.size(); ++i) {
+		atlas[i] = static_cast<float>((i * 2654435761u) % 1000) / 1000.0f * 16.0f;
+		halfAtlas[i] = HemicubeIntegrator::FloatToHalf(atlas[i]);
+	}
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	for(UINT faceSize=Radiosity::MIN_HEMICUBE_FACE_SIZE; faceSize<=Radiosity::MAX_HEMICUBE_FACE_SIZE; faceSize *= 2) 
+	{
+		//un hemicubo por fila de caras, con el mismo formato (float4 o half4) de la textura de hemicubos
+		const UINT rowPitch = HemicubeIntegrator::NUM_FACES * faceSize * 4;
+		const UINT numHemicubes = ATLAS_TEXELS / (HemicubeIntegrator::NUM_FACES * faceSize * faceSize);
+
+		HemicubeIntegrator integrator;
+		if(FAILED(integrator.Init(faceSize))) return 2;
+
+		try 
+		{
+			reference.assign(numHemicubes * 4, 0.0f);
+		}
+		catch (std::bad_alloc &) 
+		{
+			DTFramework::MiscErrorWarning(DTFramework::BAD_ALLOC);
+			return 2;
+		}
+
+		for(UINT k=0; k<DTFramework::NUM_INTEGRATION_KERNELS; ++k) 
+		{
+			const IntegrationKernel kernel = static_cast<IntegrationKernel>(k);
+
+			if(!HemicubeIntegrator::IsKernelSupported(kernel)) {
+				wprintf(L"%3ux%-3u %-10S no soportado por el procesador\n", faceSize, faceSize, HemicubeIntegrator::GetKernelName(kernel));
+				continue;
+			}
+
+			integrator.SetKernel(kernel);
+
+			for(UINT halfPrecision=0; halfPrecision<2; ++halfPrecision) 
+			{
+				float irradiance[4];
+				float checksum = 0.0f;
+				float maxRelativeError = 0.0f;
+
+				LARGE_INTEGER start, end;
+				QueryPerformanceCounter(&start);
+
+				for(UINT r=0; r<REPETITIONS; ++r) 
+				{
+					for(UINT h=0; h<numHemicubes; ++h) 
+					{
+						if(halfPrecision) {
+							const UINT16 *faces[HemicubeIntegrator::NUM_FACES];
+							for(UINT f=0; f<HemicubeIntegrator::NUM_FACES; ++f)
+								faces[f] = &halfAtlas[h * faceSize * rowPitch + f * faceSize * 4];
+
+							integrator.IntegrateHalf(faces, rowPitch, irradiance);
+						} else {
+							const float *faces[HemicubeIntegrator::NUM_FACES];
+							for(UINT f=0; f<HemicubeIntegrator::NUM_FACES; ++f)
+								faces[f] = &atlas[h * faceSize * rowPitch + f * faceSize * 4];
+
+							integrator.Integrate(faces, rowPitch, irradiance);
+						}
+
+						checksum += irradiance[0];
+
+						//la primera repetición compara contra la irradiancia en float
+						if(r == 0) {
+							for(UINT c=0; c<3; ++c) {
+								if(!halfPrecision) {
+									reference[h * 4 + c] = irradiance[c];
+								} else if(reference[h * 4 + c] > 0.0f) {
+									const float error = fabsf(irradiance[c] - reference[h * 4 + c]) / reference[h * 4 + c];
+									if(error > maxRelativeError) maxRelativeError = error;
+								}
+							}
+						}
+					}
+				}
+
+				QueryPerformanceCounter(&end);
+
+				const double seconds = (end.QuadPart - start.QuadPart) / (double) frequency.QuadPart;
+				const double texels = (double) integrator.GetTexelsPerHemicube() * numHemicubes * REPETITIONS;
+				const UINT bytesPerHemicube = integrator.GetTexelsPerHemicube() * 4 * (halfPrecision ? sizeof(UINT16) : sizeof(float));
+
+				wprintf(L"%3ux%-3u %-10S %-7S %8.1f Mtexels/s  %8.1f hemicubos/ms  %7u bytes/hemicubo  error %.2e  (checksum %.3f)\n", 
+				        faceSize, faceSize, HemicubeIntegrator::GetKernelName(kernel), halfPrecision ? "float16" : "float32", 
+				        texels / seconds / 1.0e6, numHemicubes * REPETITIONS / seconds / 1000.0, bytesPerHemicube, maxRelativeError, checksum);
+			}
+		}
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------------------
+// Benchmark de la carga de meshes con un .obj sintético: una grilla de MESH_BENCHMARK_GRID^2
+// cuadrados (dos triángulos cada uno) con una coordenada de textura y una normal por
+// posición, como los que exportan los programas de modelado, y un "g" cada 64 filas. Mide
+// OBJParser con uno y con todos los hilos, y la eliminación de vértices duplicados con
+// VertexDedupTable y con la tabla anterior de Mesh::AddVertex (8192 buckets de vectores con
+// clave el índice de la posición y comparación de los floats) como referencia.
+//------------------------------------------------------------------------------------------
+struct BenchmarkVertex
+{
+	D3DXVECTOR3 position;
+	D3DXVECTOR2 texCoord;
+	D3DXVECTOR3 normal;
+};
+
+static double ElapsedSeconds(const LARGE_INTEGER &start, const LARGE_INTEGER &frequency)
+{
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+
+	return (end.QuadPart - start.QuadPart) / (double) frequency.QuadPart;
+}
+
+static BenchmarkVertex GetBenchmarkVertex(const DTFramework::OBJParser &parser, const DTFramework::OBJFaceVertex &faceVertex)
+{
+	BenchmarkVertex vertex;
+	ZeroMemory(&vertex, sizeof(BenchmarkVertex));
+
+	vertex.position = parser.GetPositions()[faceVertex.position - 1];
+	if(faceVertex.texCoord != 0)
+		vertex.texCoord = parser.GetTexCoords()[faceVertex.texCoord - 1];
+	vertex.normal = parser.GetNormals()[faceVertex.normal - 1];
+
+	return vertex;
+}
+
+static int BenchmarkMeshLoad()
+{
+	using DTFramework::OBJParser;
+	using DTFramework::OBJFace;
+	using DTFramework::OBJEvent;
+
+	const UINT side = MESH_BENCHMARK_GRID + 1;
+	const UINT GROUP_ROWS = 64;
+
+	WCHAR tempPath[MAX_PATH];
+	WCHAR file[MAX_PATH];
+	if(GetTempPath(MAX_PATH, tempPath) == 0 || GetTempFileName(tempPath, L"obj", 0, file) == 0) {
+		DTFramework::ErrorWarning(L"BenchmarkMeshLoad --> GetTempFileName");
+		return 2;
+	}
+
+	FILE *output = NULL;
+	if(_wfopen_s(&output, file, L"wb") != 0 || output == NULL) {
+		DTFramework::MiscErrorWarning(DTFramework::IFSTREAM_ERROR, L"BenchmarkMeshLoad");
+		DeleteFile(file);
+		return 2;
+	}
+
+	//una superficie ondulada para que las coordenadas tengan decimales y exponentes variados
+	for(UINT y=0; y<side; ++y) {
+		for(UINT x=0; x<side; ++x) {
+			const float height = 0.25f * sinf(x * 0.05f) * cosf(y * 0.07f);
+			fprintf(output, "v %.6f %.6f %.6f\n", x * 0.01f, height, y * 0.01f);
+		}
+	}
+	for(UINT y=0; y<side; ++y) {
+		for(UINT x=0; x<side; ++x)
+			fprintf(output, "vt %.6f %.6f\n", x / (float) MESH_BENCHMARK_GRID, y / (float) MESH_BENCHMARK_GRID);
+	}
+	for(UINT y=0; y<side; ++y) {
+		for(UINT x=0; x<side; ++x)
+			fprintf(output, "vn %.6f %.6f %.6f\n", -0.0125f * cosf(x * 0.05f) * cosf(y * 0.07f), 1.0f, 0.0175f * sinf(x * 0.05f) * sinf(y * 0.07f));
+	}
+	for(UINT y=0; y<MESH_BENCHMARK_GRID; ++y) {
+		if(y % GROUP_ROWS == 0) fprintf(output, "g grupo%u\n", y / GROUP_ROWS);
+
+		for(UINT x=0; x<MESH_BENCHMARK_GRID; ++x) {
+			const UINT a = y * side + x + 1, b = a + 1, c = a + side, d = c + 1;
+			fprintf(output, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, c, c, c, b, b, b);
+			fprintf(output, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", b, b, b, c, c, c, d, d, d);
+		}
+	}
+
+	const bool writeFailed = ferror(output) != 0;
+	const long fileSize = ftell(output);
+	fclose(output);
+
+	if(writeFailed) {
+		DTFramework::MiscErrorWarning(DTFramework::IFSTREAM_ERROR, L"BenchmarkMeshLoad");
+		DeleteFile(file);
+		return 2;
+	}
+
+	LARGE_INTEGER frequency, start;
+	QueryPerformanceFrequency(&frequency);
+
+	//la primera lectura deja el archivo en la caché del sistema operativo: se mide sólo el parseo
+	OBJParser parser;
+	double parseTime[2];
+
+	for(UINT run=0; run<2; ++run) {
+		QueryPerformanceCounter(&start);
+		if(FAILED(parser.Parse(file, run == 0 ? 1 : 0))) {
+			DeleteFile(file);
+			return 2;
+		}
+		parseTime[run] = ElapsedSeconds(start, frequency);
+	}
+
+	DeleteFile(file);
+
+	const std::vector<OBJFace> &faces = parser.GetFaces();
+	const std::vector<OBJEvent> &events = parser.GetEvents();
+
+	wprintf(L"%.1f MB, %u posiciones, %u caras, %u grupos\n", fileSize / (1024.0 * 1024.0), (UINT) parser.GetPositions().size(), 
+	        (UINT) faces.size(), (UINT) events.size());
+	wprintf(L"OBJParser 1 hilo          %8.3f s  %8.1f MB/s\n", parseTime[0], fileSize / (1024.0 * 1024.0) / parseTime[0]);
+	wprintf(L"OBJParser todos los hilos %8.3f s  %8.1f MB/s\n", parseTime[1], fileSize / (1024.0 * 1024.0) / parseTime[1]);
+
+	std::vector<BenchmarkVertex> vertices;
+	std::vector<DWORD> indices;
+	double dedupTime[2];
+	UINT numVertices[2];
+	UINT64 checksum[2];
+
+	for(UINT method=0; method<2; ++method)
+	{
+		static const UINT HASH_TABLE_SIZE = 8192;
+		std::vector<std::vector<UINT> > buckets;
+		DTFramework::VertexDedupTable table;
+
+		try
+		{
+			vertices.clear();
+			indices.clear();
+			vertices.reserve(parser.GetPositions().size());
+			indices.reserve(faces.size() * 3);
+
+			QueryPerformanceCounter(&start);
+
+			if(method == 0) buckets.resize(HASH_TABLE_SIZE);
+			else table.Reserve(static_cast<UINT>(parser.GetPositions().size()));
+
+			UINT nextEvent = 0;
+			for(UINT f=0; f<faces.size(); ++f)
+			{
+				for(; nextEvent < events.size() && events[nextEvent].face == f; ++nextEvent) {
+					if(events[nextEvent].type != DTFramework::OBJ_EVENT_GROUP) continue;
+
+					if(method == 0) {
+						for(UINT i=0; i<HASH_TABLE_SIZE; ++i) buckets[i].clear();
+					}
+					else table.Clear();
+				}
+
+				for(UINT v=0; v<3; ++v)
+				{
+					const DTFramework::OBJFaceVertex &faceVertex = faces[f].vertices[v];
+					const BenchmarkVertex vertex = GetBenchmarkVertex(parser, faceVertex);
+					const DWORD newIndex = static_cast<DWORD>(vertices.size());
+					DWORD index = newIndex;
+
+					if(method == 0) {
+						std::vector<UINT> &bucket = buckets[faceVertex.position % HASH_TABLE_SIZE];
+						for(UINT i=0; i<bucket.size(); ++i) {
+							const BenchmarkVertex &other = vertices[bucket[i]];
+							if(other.position == vertex.position && other.texCoord == vertex.texCoord && other.normal == vertex.normal) {
+								index = bucket[i];
+								break;
+							}
+						}
+						if(index == newIndex) bucket.push_back(newIndex);
+					}
+					else index = table.FindOrInsert(faceVertex.position, faceVertex.texCoord, faceVertex.normal, newIndex);
+
+					if(index == newIndex) vertices.push_back(vertex);
+					indices.push_back(index);
+				}
+			}
+
+			dedupTime[method] = ElapsedSeconds(start, frequency);
+		}
+		catch (std::bad_alloc &)
+		{
+			DTFramework::MiscErrorWarning(DTFramework::BAD_ALLOC);
+			return 2;
+		}
+
+		numVertices[method] = static_cast<UINT>(vertices.size());
+		checksum[method] = 0;
+		for(UINT i=0; i<indices.size(); ++i)
+			checksum[method] = checksum[method] * 31 + indices[i];
+	}
+
+	wprintf(L"AddVertex buckets         %8.3f s  %8.1f Mvertices/s  %u vertices (checksum %016I64x)\n", dedupTime[0], 
+	        faces.size() * 3 / dedupTime[0] / 1.0e6, numVertices[0], checksum[0]);
+	wprintf(L"VertexDedupTable          %8.3f s  %8.1f Mvertices/s  %u vertices (checksum %016I64x)\n", dedupTime[1], 
+	        faces.size() * 3 / dedupTime[1] / 1.0e6, numVertices[1], checksum[1]);
+
+	//MeshOptimizer con los triángulos en el orden del archivo y mezclados (un .obj exportado sin ningún orden)
+	using DTFramework::MeshOptimizer;
+	using DTFramework::VertexCacheStatistics;
+
+	const UINT numFaces = static_cast<UINT>(faces.size());
+
+	for(UINT order=0; order<2; ++order)
+	{
+		std::vector<UINT> optimizedIndices(indices.begin(), indices.end());
+		std::vector<UINT> attributes(numFaces, 0);
+		std::vector<UINT> remap;
+		std::vector<DTFramework::MeshSubset> subsets;
+
+		if(order == 1) {
+			UINT random = 12345;
+			for(UINT f=numFaces-1; f>0; --f) {
+				random = random * 1664525 + 1013904223;
+				const UINT other = random % (f + 1);
+				for(UINT k=0; k<3; ++k)
+					std::swap(optimizedIndices[f * 3 + k], optimizedIndices[other * 3 + k]);
+			}
+		}
+
+		VertexCacheStatistics before, after;
+		double optimizeTime;
+		UINT usedVertices;
+
+		try
+		{
+			before = MeshOptimizer::AnalyzeVertexCache(&optimizedIndices[0], numFaces, numVertices[1]);
+
+			QueryPerformanceCounter(&start);
+			usedVertices = MeshOptimizer::Optimize(&optimizedIndices[0], &attributes[0], numFaces, numVertices[1], &(vertices[0].position.x), 
+			                                       sizeof(BenchmarkVertex), 1.05f, remap, subsets);
+			optimizeTime = ElapsedSeconds(start, frequency);
+
+			after = MeshOptimizer::AnalyzeVertexCache(&optimizedIndices[0], numFaces, usedVertices);
+		}
+		catch (std::bad_alloc &)
+		{
+			DTFramework::MiscErrorWarning(DTFramework::BAD_ALLOC);
+			return 2;
+		}
+
+		wprintf(L"MeshOptimizer (%s) %8.3f s  %8.1f Mcaras/s  ACMR %.3f -> %.3f  ATVR %.3f -> %.3f\n", order == 0 ? L"archivo " : L"mezclado", 
+		        optimizeTime, numFaces / optimizeTime / 1.0e6, before.acmr, after.acmr, before.atvr, after.atvr);
+	}
+
+	//CompactVertexCodec: ida y vuelta de los vértices de la grilla con normales y tangentes en direcciones pseudoaleatorias
+	{
+		std::vector<DTFramework::Vertex> meshVertices;
+		std::vector<DTFramework::CompactVertex> compactVertices;
+
+		try
+		{
+			meshVertices.resize(vertices.size());
+			compactVertices.resize(vertices.size());
+		}
+		catch (std::bad_alloc &)
+		{
+			DTFramework::MiscErrorWarning(DTFramework::BAD_ALLOC);
+			return 2;
+		}
+
+		UINT random = 12345;
+		for(UINT i=0; i<meshVertices.size(); ++i) {
+			D3DXVECTOR3 direction[2];
+			for(UINT d=0; d<2; ++d) {
+				for(UINT k=0; k<3; ++k) {
+					random = random * 1664525 + 1013904223;
+					(&direction[d].x)[k] = (random >> 8) / 8388608.0f - 1.0f;
+				}
+			}
+
+			D3DXVECTOR3 normal, tangent;
+			D3DXVec3Normalize(&normal, &direction[0]);
+			tangent = direction[1] - normal * D3DXVec3Dot(&normal, &direction[1]);
+			D3DXVec3Normalize(&tangent, &tangent);
+
+			meshVertices[i].position = vertices[i].position;
+			meshVertices[i].normal = normal;
+			meshVertices[i].tangent = D3DXVECTOR4(tangent.x, tangent.y, tangent.z, (random & 1) ? 1.0f : -1.0f);
+			meshVertices[i].texcoord = vertices[i].texCoord;
+		}
+
+		QueryPerformanceCounter(&start);
+		DTFramework::CompactVertexCodec::Encode(&meshVertices[0], static_cast<UINT>(meshVertices.size()), &compactVertices[0]);
+		const double encodeTime = ElapsedSeconds(start, frequency);
+
+		const DTFramework::CompactVertexError error = DTFramework::CompactVertexCodec::MeasureError(&meshVertices[0], 
+		                                                                                            static_cast<UINT>(meshVertices.size()));
+
+		wprintf(L"CompactVertexCodec        %8.3f s  %8.1f Mvertices/s  %u -> %u bytes por vertice\n", encodeTime, 
+		        meshVertices.size() / encodeTime / 1.0e6, (UINT) sizeof(DTFramework::Vertex), (UINT) sizeof(DTFramework::CompactVertex));
+		wprintf(L"  error maximo: normal %.3f grados, tangente %.3f grados, coordenadas de textura %g, signo de bitangente %u\n", 
+		        error.normalAngle, error.tangentAngle, error.texCoord, error.handednessErrors);
+	}
+
+	return 0;
+}
+
+static bool ParseUInt(const wchar_t *text, UINT &value)
+{
+	wchar_t *end = NULL;
+	const unsigned long tmp = wcstoul(text, &end, 10);
+
+	if(end == text || *end != L'\0' || tmp == 0) return false;
+
+	value = static_cast<UINT>(tmp);
+
+	return true;
+}
+
+//número mayor que 0
+static bool ParsePositive(const wchar_t *text, float &value)
+{
+	wchar_t *end = NULL;
+	const double tmp = wcstod(text, &end);
+
+	if(end == text || *end != L'\0' || !(tmp > 0.0 && tmp < FLT_MAX)) return false;
+
+	value = static_cast<float>(tmp);
+
+	return true;
+}
+
+//número en (0, 1)
+static bool ParseFraction(const wchar_t *text, float &value)
+{
+	wchar_t *end = NULL;
+	const double tmp = wcstod(text, &end);
+
+	if(end == text || *end != L'\0' || !(tmp > 0.0 && tmp < 1.0)) return false;
+
+	value = static_cast<float>(tmp);
+
+	return true;
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+	//sin ventanas: los errores se escriben en stderr
+	DTFramework::SetConsoleErrorOutput(true);
+
+	DTFramework::BakerConfig config;
+
+	if(argc == 2 && std::wstring(argv[1]) == L"-benchintegration")
+		return BenchmarkIntegrationKernels();
+	if(argc == 2 && std::wstring(argv[1]) == L"-benchmeshload")
+		return BenchmarkMeshLoad();
+
+	for(int i=1; i<argc; ++i) 
+	{
+		const std::wstring arg(argv[i]);
+
+		if(arg == L"-bounces" && i+1 < argc) {
+			if(!ParseUInt(argv[++i], config.numBounces)) { PrintUsage(); return 1; }
+		} else if(arg == L"-batch" && i+1 < argc) {
+			if(!ParseUInt(argv[++i], config.verticesBakedPerDispatch)) { PrintUsage(); return 1; }
+		} else if(arg == L"-out" && i+1 < argc) {
+			config.outputFile = argv[++i];
+		} else if(arg == L"-profile") {
+			config.profiling = true;
+		} else if(arg == L"-half") {
+			config.halfPrecisionHemicubes = true;
+		} else if(arg == L"-rerender") {
+			config.reuseFormFactors = false;
+		} else if(arg == L"-progressive") {
+			config.solver = DTFramework::RADIOSITY_SOLVER_PROGRESSIVE;
+		} else if(arg == L"-tolerance" && i+1 < argc) {
+			if(!ParseFraction(argv[++i], config.convergenceTolerance)) { PrintUsage(); return 1; }
+		} else if(arg == L"-irradiancecache" && i+1 < argc) {
+			if(!ParseFraction(argv[++i], config.irradianceCacheError)) { PrintUsage(); return 1; }
+		} else if(arg == L"-noweld") {
+			config.weldVertices = false;
+		} else if(arg == L"-nocache") {
+			config.useGICache = false;
+		} else if(arg == L"-lod" && i+1 < argc) {
+			if(!ParsePositive(argv[++i], config.lodTexelError)) { PrintUsage(); return 1; }
+		} else if(arg == L"-lodreport") {
+			config.lodReport = true;
+		} else if(arg == L"-software") {
+			config.softwareRasterizer = true;
+		} else if(arg == L"-rays" && i+1 < argc) {
+			if(!ParseUInt(argv[++i], config.raysPerVertex) || config.raysPerVertex == 0 || 
+			   config.raysPerVertex > DTFramework::RayTracedRadiosity::MAX_RAYS_PER_VERTEX) { 
+				PrintUsage(); 
+				return 1; 
+			}
+		} else if(arg == L"-threads" && i+1 < argc) {
+			if(!ParseUInt(argv[++i], config.numThreads)) { PrintUsage(); return 1; }
+		} else if(arg == L"-facesize" && i+1 < argc) {
+			if(!ParseUInt(argv[++i], config.hemicubeFaceSize) || !DTFramework::Radiosity::IsValidHemicubeFaceSize(config.hemicubeFaceSize)) { 
+				PrintUsage(); 
+				return 1; 
+			}
+		} else if(arg[0] != L'-' && config.sceneFile.length() == 0) {
+			config.sceneFile = arg;
+		} else {
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if(config.sceneFile.length() == 0 || (config.solver == DTFramework::RADIOSITY_SOLVER_PROGRESSIVE && !config.softwareRasterizer && 
+	                                     config.raysPerVertex == 0) || 
+	   (config.lodReport && (config.lodTexelError == 0.0f || config.softwareRasterizer || config.raysPerVertex > 0))) {
+		PrintUsage();
+		return 1;
+	}
+
+	DTFramework::GIBaker baker;
+
+	if(FAILED(baker.Init(config))) return 2;
+	if(FAILED(baker.Bake())) return 2;
+
+	wprintf(L"%s: %u vertices, %u bounces, %.3f seconds -> %s\n", config.sceneFile.c_str(), baker.GetNumVertices(), 
+	        config.numBounces, baker.GetBakeTime(), config.outputFile.c_str());
+
+	if(config.lodReport) {
+		const DTFramework::LODReport &report = baker.GetLODReport();
+
+		wprintf(L"geometria completa: %.3f seconds (%.2fx con -lod %g)\n", report.fullDetailBakeTime, 
+		        baker.GetBakeTime() > 0.0 ? report.fullDetailBakeTime / baker.GetBakeTime() : 0.0, config.lodTexelError);
+		if(report.fullDetailTriangles > 0)
+			wprintf(L"triangulos en los hemicubos: %I64u de %I64u (%.1f%%)\n", report.trianglesDrawn, report.fullDetailTriangles, 
+			        100.0 * report.trianglesDrawn / report.fullDetailTriangles);
+		wprintf(L"error de la irradiancia: maximo %g, RMS %g (%.3f%% de la media), %u vertices con mas de %g%% de diferencia\n", 
+		        report.maxError, report.rmsError, 100.0f * report.relativeRMSError, report.verticesOverThreshold, 
+		        100.0f * DTFramework::GIBaker::LOD_REPORT_THRESHOLD);
+	}
+
+	return 0;
+}